@@ -168,19 +168,14 @@ void mainLoop() {
     // SDL_Event object to hold event data. We will use this to poll for events in the main loop.
     SDL_Event e;
 
-    // While the status of the application is running, poll for events. If we get a quit event, set running to false. 
-    while (running)
+    // While the status of the application is running, wait for events. If we get a quit event, set running to false.
+    // Nothing is rendered yet, so SDL_WaitEvent() sleeps until something happens instead of polling on a timer. Once
+    // frames are drawn, poll with SDL_PollEvent() and pace them with FramePacer (see vulkantest.cpp).
+    while (running && SDL_WaitEvent(&e))
     {   
-        // Poll for events. SDL_PollEvent() is a boolean function that returns 1 if there is an event in the queue, and
-        // 0 if there are no events. It also fills the SDL_Event structure with the event data. 
-        while (SDL_PollEvent(&e))
-        {   
-            // If we get a quit event, set running to false (Like if the user clicks the X button on the window)
-            if (e.type == SDL_EVENT_QUIT)
-                running = false;
-        }
-        // Wait 16ms (62.5 fps). Replace with proper frame timing later to reduce stutter.
-        SDL_Delay(16);
+        // If we get a quit event, set running to false (Like if the user clicks the X button on the window)
+        if (e.type == SDL_EVENT_QUIT)
+            running = false;
     }
 }
 
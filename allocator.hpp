@@ -0,0 +1,1073 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <array>
+#include <cstdint>
+#include <bit>
+
+#ifndef VK_CHECK
+#define VK_CHECK(x) do { VkResult err = x; if (err != VK_SUCCESS) throw std::runtime_error("Vulkan error at " #x); } while(0)
+#endif
+
+// Block based GPU memory sub-allocator.
+//
+// Instead of calling vkAllocateMemory once per buffer or image, memory is reserved from the driver in large blocks per
+// memory type and handed out in pieces. Each block uses one of three strategies:
+//
+//   Buddy     Power-of-two buddy allocator for small requests. Fast, no external fragmentation, some internal waste.
+//   FreeList  Offset sorted free list with best fit and coalescing for medium to large requests.
+//   Linear    Bump allocator that is reset when every allocation in it has been freed. Meant for transient data.
+//
+// Requests bigger than half a block get their own VkDeviceMemory (Dedicated). Host visible blocks are mapped once when
+// they are created and stay mapped, so allocations in them come with a ready to use host pointer.
+//
+// Callers either say what an allocation is for (MemoryUsage) and let the allocator pick the memory type, or ask for
+// property flags directly.
+
+inline VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+    return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+enum class AllocationStrategy { Default, Linear, Buddy, FreeList, Dedicated };
+
+inline const char* strategyName(AllocationStrategy strategy) {
+    switch (strategy) {
+        case AllocationStrategy::Default:   return "default";
+        case AllocationStrategy::Linear:    return "linear";
+        case AllocationStrategy::Buddy:     return "buddy";
+        case AllocationStrategy::FreeList:  return "free-list";
+        case AllocationStrategy::Dedicated: return "dedicated";
+    }
+    return "unknown";
+}
+
+// Vulkan requires linear resources (buffers, linear images) and optimal images that share a bufferImageGranularity
+// sized page to be kept apart. The free list checks its neighbours for this; buddy and linear blocks only ever hold
+// one kind of resource, so they never have to.
+enum class ResourceKind : uint8_t { Linear, Optimal };
+
+// What an allocation is for. For anything but Custom, the allocator ranks the memory types the resource allows by how
+// well they suit the use on this device, and falls back down the ranking when a type is out of memory:
+//
+//   GpuOnly   Only touched by the GPU. Device local, and preferably not host visible, so the BAR is left for Dynamic.
+//   Upload    Written once by the host and copied from on the GPU, like staging buffers. Host visible, preferably
+//             uncached system memory: write-combined memory is the fastest to stream writes into.
+//   Readback  Written by the GPU and read by the host. Host cached where possible, since reading uncached
+//             write-combined memory is many times slower. Cached memory is often not coherent, so the host has to
+//             call GpuAllocator::invalidate() before reading.
+//   Dynamic   Rewritten by the host often and read by the GPU in place. Device-local host-visible memory (the BAR, or
+//             all of VRAM with resizable BAR) when there is some, host visible system memory otherwise.
+//
+// Custom takes requiredFlags and preferredFlags as they are. Host writes to memory that isn't coherent need
+// GpuAllocator::flush() before the GPU reads them, whatever the usage.
+enum class MemoryUsage : uint8_t { Custom, GpuOnly, Upload, Readback, Dynamic };
+
+constexpr size_t MEMORY_USAGE_COUNT = 5;
+
+inline const char* usageName(MemoryUsage usage) {
+    switch (usage) {
+        case MemoryUsage::Custom:   return "custom";
+        case MemoryUsage::GpuOnly:  return "gpu-only";
+        case MemoryUsage::Upload:   return "upload";
+        case MemoryUsage::Readback: return "readback";
+        case MemoryUsage::Dynamic:  return "dynamic";
+    }
+    return "unknown";
+}
+
+// How well a memory type suits a usage, higher is better. -1 if it can't be used for it at all.
+inline int memoryTypeScore(MemoryUsage usage, VkMemoryPropertyFlags flags) {
+    if (usage == MemoryUsage::Custom) return 0;
+
+    // Lazily allocated memory is only for transient attachments, and protected memory needs protected queues
+    if (flags & (VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT | VK_MEMORY_PROPERTY_PROTECTED_BIT)) return -1;
+
+    const bool deviceLocal = flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    const bool hostVisible = flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    const bool coherent = flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    const bool cached = flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+
+    if (usage != MemoryUsage::GpuOnly && !hostVisible) return -1;
+
+    switch (usage) {
+        case MemoryUsage::GpuOnly:  return (deviceLocal ? 8 : 0) + (hostVisible ? 0 : 1);
+        case MemoryUsage::Upload:   return (coherent ? 4 : 0) + (deviceLocal ? 0 : 2) + (cached ? 0 : 1);
+        case MemoryUsage::Readback: return (cached ? 8 : 0) + (deviceLocal ? 0 : 2) + (coherent ? 1 : 0);
+        case MemoryUsage::Dynamic:  return (deviceLocal ? 8 : 0) + (coherent ? 2 : 0) + (cached ? 0 : 1);
+        default:                    return 0;
+    }
+}
+
+inline std::string memoryFlagsString(VkMemoryPropertyFlags flags) {
+    std::string result;
+    auto add = [&](VkMemoryPropertyFlags bit, const char* name) {
+        if (!(flags & bit)) return;
+        if (!result.empty()) result += ", ";
+        result += name;
+    };
+
+    add(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, "device local");
+    add(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, "host visible");
+    add(VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, "coherent");
+    add(VK_MEMORY_PROPERTY_HOST_CACHED_BIT, "cached");
+    add(VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, "lazy");
+    add(VK_MEMORY_PROPERTY_PROTECTED_BIT, "protected");
+    return result.empty() ? "none" : result;
+}
+
+// What the caller wants from the memory an allocation lands in
+struct AllocationCreateInfo {
+    MemoryUsage usage = MemoryUsage::Custom;                 // Picks the memory type unless Custom
+    VkMemoryPropertyFlags requiredFlags = 0;                 // Must have all of these
+    VkMemoryPropertyFlags preferredFlags = 0;                // Picked over other types when possible
+    AllocationStrategy strategy = AllocationStrategy::Default;
+};
+
+class MemoryBlock;
+
+// A piece of device memory handed out by the allocator
+struct GpuAllocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    uint32_t memoryType = UINT32_MAX;
+    void* mapped = nullptr;                                  // Host pointer to offset if the memory is host visible
+    MemoryUsage usage = MemoryUsage::Custom;
+    MemoryBlock* block = nullptr;
+};
+
+// ===================================================== Blocks =======================================================
+// One VkDeviceMemory and the bookkeeping of which parts of it are in use
+class MemoryBlock {
+public:
+    MemoryBlock(VkDevice device, VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryType, void* mapped,
+                AllocationStrategy strategy, ResourceKind kind)
+        : device(device), memory(memory), size(size), memoryType(memoryType),
+          mapped(static_cast<uint8_t*>(mapped)), strategy(strategy), kind(kind) {}
+
+    virtual ~MemoryBlock() {
+        if (mapped) vkUnmapMemory(device, memory);
+        vkFreeMemory(device, memory, nullptr);
+    }
+
+    MemoryBlock(const MemoryBlock&) = delete;
+    MemoryBlock& operator=(const MemoryBlock&) = delete;
+
+    // Tries to reserve size bytes at the given alignment. On success, writes the offset and returns true.
+    bool tryAllocate(VkDeviceSize bytes, VkDeviceSize alignment, ResourceKind resourceKind, VkDeviceSize granularity,
+                     VkDeviceSize& offset) {
+        if (bytes > size - usedBytes) return false;
+        if (!doAllocate(bytes, alignment, resourceKind, granularity, offset)) return false;
+        usedBytes += bytes;
+        ++allocationCount;
+        return true;
+    }
+
+    void release(VkDeviceSize offset, VkDeviceSize bytes) {
+        usedBytes -= bytes;
+        --allocationCount;
+        doFree(offset);
+    }
+
+    // Size of the biggest contiguous free range, used for the fragmentation metric
+    virtual VkDeviceSize largestFreeRange() const = 0;
+
+    bool empty() const { return allocationCount == 0; }
+
+    VkDevice device;
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    uint32_t memoryType;
+    uint8_t* mapped;
+    AllocationStrategy strategy;
+    ResourceKind kind;                                       // Only meaningful for buddy and linear blocks
+
+    VkDeviceSize usedBytes = 0;
+    uint32_t allocationCount = 0;
+
+protected:
+    virtual bool doAllocate(VkDeviceSize bytes, VkDeviceSize alignment, ResourceKind resourceKind,
+                            VkDeviceSize granularity, VkDeviceSize& offset) = 0;
+    virtual void doFree(VkDeviceSize offset) = 0;
+};
+
+// Offset sorted list of used and free ranges. Allocation picks the free range that leaves the least space over (best
+// fit), and freeing merges a range with free neighbours.
+class FreeListBlock : public MemoryBlock {
+public:
+    FreeListBlock(VkDevice device, VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryType, void* mapped)
+        : MemoryBlock(device, memory, size, memoryType, mapped, AllocationStrategy::FreeList, ResourceKind::Linear) {
+        ranges[0] = { size, true, ResourceKind::Linear };
+    }
+
+    VkDeviceSize largestFreeRange() const override {
+        VkDeviceSize largest = 0;
+        for (const auto& [offset, range] : ranges)
+            if (range.free) largest = std::max(largest, range.size);
+        return largest;
+    }
+
+protected:
+    struct Range {
+        VkDeviceSize size;
+        bool free;
+        ResourceKind kind;
+    };
+
+    // True if the last byte of one resource and the first byte of the next are on the same granularity page
+    static bool onSamePage(VkDeviceSize lastByte, VkDeviceSize firstByte, VkDeviceSize granularity) {
+        return lastByte / granularity == firstByte / granularity;
+    }
+
+    bool doAllocate(VkDeviceSize bytes, VkDeviceSize alignment, ResourceKind resourceKind,
+                    VkDeviceSize granularity, VkDeviceSize& offset) override {
+        auto best = ranges.end();
+        VkDeviceSize bestStart = 0;
+        VkDeviceSize bestWaste = UINT64_MAX;
+
+        for (auto it = ranges.begin(); it != ranges.end(); ++it) {
+            if (!it->second.free || it->second.size < bytes) continue;
+
+            VkDeviceSize rangeEnd = it->first + it->second.size;
+            VkDeviceSize start = alignUp(it->first, alignment);
+
+            // Free ranges are always merged, so the range before a free range is in use. If it holds the other kind
+            // of resource and ends on the page we would start on, move to the next page.
+            if (granularity > 1 && it != ranges.begin()) {
+                auto prev = std::prev(it);
+                if (prev->second.kind != resourceKind &&
+                    onSamePage(prev->first + prev->second.size - 1, start, granularity))
+                    start = alignUp(start, granularity);
+            }
+
+            if (start + bytes > rangeEnd) continue;
+            VkDeviceSize end = start + bytes;
+
+            // Same check against the resource after this range. We can't move it, so this range doesn't fit.
+            auto next = std::next(it);
+            if (granularity > 1 && next != ranges.end() && !next->second.free &&
+                next->second.kind != resourceKind && onSamePage(end - 1, next->first, granularity))
+                continue;
+
+            VkDeviceSize waste = it->second.size - bytes;
+            if (waste < bestWaste) {
+                best = it;
+                bestStart = start;
+                bestWaste = waste;
+            }
+        }
+
+        if (best == ranges.end()) return false;
+
+        // Split the free range into [padding][allocation][remainder]
+        VkDeviceSize rangeStart = best->first;
+        VkDeviceSize rangeEnd = best->first + best->second.size;
+        VkDeviceSize end = bestStart + bytes;
+        ranges.erase(best);
+
+        if (bestStart > rangeStart) ranges[rangeStart] = { bestStart - rangeStart, true, resourceKind };
+        ranges[bestStart] = { bytes, false, resourceKind };
+        if (end < rangeEnd) ranges[end] = { rangeEnd - end, true, resourceKind };
+
+        offset = bestStart;
+        return true;
+    }
+
+    void doFree(VkDeviceSize offset) override {
+        auto it = ranges.find(offset);
+        if (it == ranges.end() || it->second.free) throw std::runtime_error("Invalid free-list free");
+
+        it->second.free = true;
+
+        // Merge with the following range
+        auto next = std::next(it);
+        if (next != ranges.end() && next->second.free) {
+            it->second.size += next->second.size;
+            ranges.erase(next);
+        }
+
+        // Merge with the preceding range
+        if (it != ranges.begin()) {
+            auto prev = std::prev(it);
+            if (prev->second.free) {
+                prev->second.size += it->second.size;
+                ranges.erase(it);
+            }
+        }
+    }
+
+    std::map<VkDeviceSize, Range> ranges;
+};
+
+// Binary buddy allocator. The block is split into power-of-two pieces, and freed pieces are merged with their buddy.
+// Every piece starts at a multiple of its own size, so any alignment up to the piece size comes for free.
+class BuddyBlock : public MemoryBlock {
+public:
+    static constexpr VkDeviceSize MIN_SIZE = 256;
+
+    BuddyBlock(VkDevice device, VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryType, void* mapped,
+               ResourceKind kind)
+        : MemoryBlock(device, memory, size, memoryType, mapped, AllocationStrategy::Buddy, kind) {
+        while ((MIN_SIZE << maxOrder) < size) ++maxOrder;
+        if ((MIN_SIZE << maxOrder) != size) throw std::runtime_error("Buddy block size must be a power of two");
+
+        freeLists.resize(maxOrder + 1);
+        freeLists[maxOrder].insert(0);
+    }
+
+    VkDeviceSize largestFreeRange() const override {
+        for (uint32_t order = maxOrder + 1; order-- > 0;)
+            if (!freeLists[order].empty()) return MIN_SIZE << order;
+        return 0;
+    }
+
+protected:
+    bool doAllocate(VkDeviceSize bytes, VkDeviceSize alignment, ResourceKind, VkDeviceSize,
+                    VkDeviceSize& offset) override {
+        VkDeviceSize needed = std::max({ bytes, alignment, MIN_SIZE });
+
+        uint32_t order = 0;
+        while ((MIN_SIZE << order) < needed) ++order;
+        if (order > maxOrder) return false;
+
+        // Find the smallest free piece that is big enough
+        uint32_t found = order;
+        while (found <= maxOrder && freeLists[found].empty()) ++found;
+        if (found > maxOrder) return false;
+
+        offset = *freeLists[found].begin();
+        freeLists[found].erase(freeLists[found].begin());
+
+        // Split it down to the size we need, putting the upper halves on the free lists
+        while (found > order) {
+            --found;
+            freeLists[found].insert(offset + (MIN_SIZE << found));
+        }
+
+        allocatedOrders[offset] = order;
+        return true;
+    }
+
+    void doFree(VkDeviceSize offset) override {
+        auto it = allocatedOrders.find(offset);
+        if (it == allocatedOrders.end()) throw std::runtime_error("Invalid buddy free");
+
+        uint32_t order = it->second;
+        allocatedOrders.erase(it);
+
+        // Merge with the buddy for as long as the buddy is free too
+        while (order < maxOrder) {
+            VkDeviceSize buddy = offset ^ (MIN_SIZE << order);
+            auto buddyIt = freeLists[order].find(buddy);
+            if (buddyIt == freeLists[order].end()) break;
+
+            freeLists[order].erase(buddyIt);
+            offset = std::min(offset, buddy);
+            ++order;
+        }
+
+        freeLists[order].insert(offset);
+    }
+
+    uint32_t maxOrder = 0;
+    std::vector<std::set<VkDeviceSize>> freeLists;
+    std::unordered_map<VkDeviceSize, uint32_t> allocatedOrders;
+};
+
+// Bump allocator. Individual frees only count down, and the whole block is reused once everything has been freed.
+class LinearBlock : public MemoryBlock {
+public:
+    LinearBlock(VkDevice device, VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryType, void* mapped,
+                ResourceKind kind)
+        : MemoryBlock(device, memory, size, memoryType, mapped, AllocationStrategy::Linear, kind) {}
+
+    VkDeviceSize largestFreeRange() const override { return size - head; }
+
+protected:
+    bool doAllocate(VkDeviceSize bytes, VkDeviceSize alignment, ResourceKind, VkDeviceSize,
+                    VkDeviceSize& offset) override {
+        VkDeviceSize start = alignUp(head, alignment);
+        if (start + bytes > size) return false;
+
+        head = start + bytes;
+        offset = start;
+        return true;
+    }
+
+    void doFree(VkDeviceSize) override {
+        if (allocationCount == 0) head = 0;
+    }
+
+    VkDeviceSize head = 0;
+};
+
+// A block holding exactly one allocation
+class DedicatedBlock : public MemoryBlock {
+public:
+    DedicatedBlock(VkDevice device, VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryType, void* mapped,
+                   ResourceKind kind)
+        : MemoryBlock(device, memory, size, memoryType, mapped, AllocationStrategy::Dedicated, kind) {}
+
+    VkDeviceSize largestFreeRange() const override { return allocationCount ? 0 : size; }
+
+protected:
+    bool doAllocate(VkDeviceSize, VkDeviceSize, ResourceKind, VkDeviceSize, VkDeviceSize& offset) override {
+        if (allocationCount) return false;
+        offset = 0;
+        return true;
+    }
+
+    void doFree(VkDeviceSize) override {}
+};
+
+// ===================================================== Stats ========================================================
+struct MemoryStats {
+    VkDeviceSize bytesReserved = 0;                          // Device memory obtained from the driver
+    VkDeviceSize bytesUsed = 0;                              // Handed out to allocations
+    VkDeviceSize bytesFree = 0;
+    VkDeviceSize largestFree = 0;
+    uint32_t blockCount = 0;                                 // Live vkAllocateMemory allocations
+    uint32_t allocationCount = 0;
+
+    // 0 when all free space in each block is one contiguous range, approaching 1 as it gets chopped up
+    double fragmentation() const {
+        return bytesFree ? 1.0 - static_cast<double>(largestFree) / static_cast<double>(bytesFree) : 0.0;
+    }
+
+    void add(const MemoryStats& other) {
+        bytesReserved += other.bytesReserved;
+        bytesUsed += other.bytesUsed;
+        bytesFree += other.bytesFree;
+        largestFree = std::max(largestFree, other.largestFree);
+        blockCount += other.blockCount;
+        allocationCount += other.allocationCount;
+    }
+};
+
+// Where allocations of one MemoryUsage ended up
+struct UsageStats {
+    uint32_t allocationCount = 0;
+    VkDeviceSize bytes = 0;
+    std::vector<VkDeviceSize> bytesPerMemoryType;            // Indexed by memory type
+    uint32_t preferredType = UINT32_MAX;                     // The type the policy ranks first on this device
+    uint32_t fallbacks = 0;                                  // Allocations so far that didn't get their first choice
+};
+
+struct AllocatorStats {
+    MemoryStats total;
+    std::vector<MemoryStats> perMemoryType;                  // Indexed by memory type
+    std::vector<VkMemoryPropertyFlags> memoryTypeFlags;
+    std::array<UsageStats, MEMORY_USAGE_COUNT> perUsage;     // Indexed by MemoryUsage
+    bool resizableBar = false;                               // Most of VRAM is host visible
+
+    void print(std::ostream& out) const {
+        auto mib = [](VkDeviceSize bytes) { return static_cast<double>(bytes) / (1024.0 * 1024.0); };
+
+        out << "GPU memory: " << total.allocationCount << " allocations in " << total.blockCount << " blocks, "
+            << mib(total.bytesUsed) << " / " << mib(total.bytesReserved) << " MiB used, fragmentation "
+            << total.fragmentation() * 100.0 << "%" << (resizableBar ? ", resizable BAR" : "") << "\n";
+
+        for (size_t i = 0; i < perMemoryType.size(); ++i) {
+            const MemoryStats& s = perMemoryType[i];
+            if (s.blockCount == 0) continue;
+            out << "  type " << i << " (" << memoryFlagsString(memoryTypeFlags[i]) << "): " << s.allocationCount
+                << " allocations in " << s.blockCount << " blocks, " << mib(s.bytesUsed) << " / "
+                << mib(s.bytesReserved) << " MiB used, fragmentation " << s.fragmentation() * 100.0 << "%\n";
+        }
+
+        // Why allocations landed where they did: the type each usage prefers, and where it actually got memory
+        for (size_t u = 0; u < perUsage.size(); ++u) {
+            const UsageStats& s = perUsage[u];
+            if (s.allocationCount == 0 && s.fallbacks == 0) continue;
+
+            out << "  " << usageName(static_cast<MemoryUsage>(u)) << ": " << s.allocationCount << " allocations, "
+                << mib(s.bytes) << " MiB in type";
+            for (size_t type = 0; type < s.bytesPerMemoryType.size(); ++type)
+                if (s.bytesPerMemoryType[type] > 0) out << " " << type;
+            if (s.preferredType != UINT32_MAX) out << ", prefers type " << s.preferredType;
+            out << ", " << s.fallbacks << " fallbacks\n";
+        }
+    }
+};
+
+struct DefragmentationStats {
+    uint32_t buffersMoved = 0;
+    VkDeviceSize bytesMoved = 0;
+    uint32_t blocksFreed = 0;
+};
+
+// ============================================= Buffers and Images ===================================================
+// Buffers and images created through the allocator. The allocator owns these records so defragment() can rebind a
+// buffer to new memory and update the handle in place.
+struct GpuBuffer {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    VkBufferUsageFlags usage = 0;
+    GpuAllocation allocation;
+};
+
+struct GpuImage {
+    VkImage image = VK_NULL_HANDLE;
+    GpuAllocation allocation;
+};
+
+// =================================================== Allocator ======================================================
+class GpuAllocator {
+public:
+    struct Config {
+        VkDeviceSize blockSize = 64ull << 20;                // Free-list and linear blocks
+        VkDeviceSize buddyBlockSize = 8ull << 20;            // Buddy blocks, must be a power of two
+        VkDeviceSize smallThreshold = 64ull << 10;           // Requests up to this size go to buddy blocks
+    };
+
+    GpuAllocator(VkPhysicalDevice gpu, VkDevice device) : GpuAllocator(gpu, device, Config{}) {}
+
+    GpuAllocator(VkPhysicalDevice gpu, VkDevice device, const Config& config)
+        : device(device), config(config) {
+        vkGetPhysicalDeviceMemoryProperties(gpu, &memProps);
+
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(gpu, &props);
+        granularity = props.limits.bufferImageGranularity;
+        maxAllocationCount = props.limits.maxMemoryAllocationCount;
+        nonCoherentAtomSize = std::max<VkDeviceSize>(props.limits.nonCoherentAtomSize, 1);
+
+        pools.resize(memProps.memoryTypeCount);
+        for (auto& usage : usageStats) usage.bytesPerMemoryType.resize(memProps.memoryTypeCount);
+    }
+
+    ~GpuAllocator() {
+        for (auto& [ptr, buffer] : buffers) vkDestroyBuffer(device, buffer->buffer, nullptr);
+        for (auto& [ptr, image] : images) vkDestroyImage(device, image->image, nullptr);
+    }
+
+    GpuAllocator(const GpuAllocator&) = delete;
+    GpuAllocator& operator=(const GpuAllocator&) = delete;
+
+    // Allocates memory for the given requirements. Throws if no allowed memory type has room.
+    GpuAllocation allocate(const VkMemoryRequirements& req, const AllocationCreateInfo& info,
+                           ResourceKind kind = ResourceKind::Linear) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return allocateLocked(req, info, kind);
+    }
+
+    void free(GpuAllocation& allocation) {
+        if (!allocation.block) return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        freeLocked(allocation);
+    }
+
+    // Makes host writes to [offset, offset + size) of the allocation visible to the device. Only needed, and only
+    // does anything, for memory that isn't host coherent.
+    void flush(const GpuAllocation& allocation, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE) const {
+        VkMappedMemoryRange range;
+        if (mappedRange(allocation, offset, size, range)) VK_CHECK(vkFlushMappedMemoryRanges(device, 1, &range));
+    }
+
+    // Makes device writes to [offset, offset + size) of the allocation visible to the host. Call it after the GPU
+    // work has finished and before reading; it does nothing for host coherent memory.
+    void invalidate(const GpuAllocation& allocation, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE) const {
+        VkMappedMemoryRange range;
+        if (mappedRange(allocation, offset, size, range)) VK_CHECK(vkInvalidateMappedMemoryRanges(device, 1, &range));
+    }
+
+    // Creates a buffer and binds it to sub-allocated memory. Transfer usage is added so defragment() can move it.
+    GpuBuffer* createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, const AllocationCreateInfo& info) {
+        auto buffer = std::make_unique<GpuBuffer>();
+        buffer->size = size;
+        buffer->usage = usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+        VkBufferCreateInfo bufferCI{};
+        bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferCI.size = size;
+        bufferCI.usage = buffer->usage;
+        bufferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        VK_CHECK(vkCreateBuffer(device, &bufferCI, nullptr, &buffer->buffer));
+
+        VkMemoryRequirements memReq;
+        vkGetBufferMemoryRequirements(device, buffer->buffer, &memReq);
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        try {
+            buffer->allocation = allocateLocked(memReq, info, ResourceKind::Linear);
+        } catch (...) {
+            vkDestroyBuffer(device, buffer->buffer, nullptr);
+            throw;
+        }
+
+        VK_CHECK(vkBindBufferMemory(device, buffer->buffer, buffer->allocation.memory, buffer->allocation.offset));
+
+        GpuBuffer* ptr = buffer.get();
+        buffers[ptr] = std::move(buffer);
+        return ptr;
+    }
+
+    void destroyBuffer(GpuBuffer* buffer) {
+        if (!buffer) return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        vkDestroyBuffer(device, buffer->buffer, nullptr);
+        freeLocked(buffer->allocation);
+        buffers.erase(buffer);
+    }
+
+    // Creates an image and binds it to sub-allocated memory. Optimal tiling images are kept a granularity page away
+    // from buffers.
+    GpuImage* createImage(const VkImageCreateInfo& imageCI, const AllocationCreateInfo& info) {
+        auto image = std::make_unique<GpuImage>();
+        VK_CHECK(vkCreateImage(device, &imageCI, nullptr, &image->image));
+
+        VkMemoryRequirements memReq;
+        vkGetImageMemoryRequirements(device, image->image, &memReq);
+
+        ResourceKind kind = imageCI.tiling == VK_IMAGE_TILING_OPTIMAL ? ResourceKind::Optimal : ResourceKind::Linear;
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        try {
+            image->allocation = allocateLocked(memReq, info, kind);
+        } catch (...) {
+            vkDestroyImage(device, image->image, nullptr);
+            throw;
+        }
+
+        VK_CHECK(vkBindImageMemory(device, image->image, image->allocation.memory, image->allocation.offset));
+
+        GpuImage* ptr = image.get();
+        images[ptr] = std::move(image);
+        return ptr;
+    }
+
+    void destroyImage(GpuImage* image) {
+        if (!image) return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        vkDestroyImage(device, image->image, nullptr);
+        freeLocked(image->allocation);
+        images.erase(image);
+    }
+
+    AllocatorStats stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        AllocatorStats result;
+        result.perMemoryType.resize(pools.size());
+
+        for (size_t type = 0; type < pools.size(); ++type) {
+            MemoryStats& s = result.perMemoryType[type];
+            for (const auto& block : pools[type]) {
+                s.bytesReserved += block->size;
+                s.bytesUsed += block->usedBytes;
+                s.bytesFree += block->size - block->usedBytes;
+                s.largestFree = std::max(s.largestFree, block->largestFreeRange());
+                s.allocationCount += block->allocationCount;
+                ++s.blockCount;
+            }
+            result.total.add(s);
+        }
+
+        for (uint32_t type = 0; type < memProps.memoryTypeCount; ++type)
+            result.memoryTypeFlags.push_back(memProps.memoryTypes[type].propertyFlags);
+
+        for (size_t u = 0; u < MEMORY_USAGE_COUNT; ++u) {
+            result.perUsage[u] = usageStats[u];
+
+            AllocationCreateInfo info{};
+            info.usage = static_cast<MemoryUsage>(u);
+            std::vector<uint32_t> ranking = candidateTypes(~0u, info);
+            if (info.usage != MemoryUsage::Custom && !ranking.empty()) result.perUsage[u].preferredType = ranking[0];
+        }
+
+        result.resizableBar = resizableBar();
+        return result;
+    }
+
+    // True if a device-local host-visible heap is larger than the classic 256 MiB BAR window, which means Dynamic
+    // memory can be as big as the application needs
+    bool resizableBar() const {
+        const VkMemoryPropertyFlags bar = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        for (uint32_t type = 0; type < memProps.memoryTypeCount; ++type) {
+            const VkMemoryType& memoryType = memProps.memoryTypes[type];
+            bool large = memProps.memoryHeaps[memoryType.heapIndex].size > (256ull << 20);
+            if ((memoryType.propertyFlags & bar) == bar && large) return true;
+        }
+        return false;
+    }
+
+    // Moves buffers out of sparsely used free-list blocks into denser ones and releases blocks that end up empty.
+    // Copies are done on the given queue, which must support transfer. The moved buffers must not be in use by the
+    // GPU, and their VkBuffer handles change, so descriptor sets pointing at them have to be rewritten afterwards.
+    DefragmentationStats defragment(VkQueue queue, uint32_t queueFamily) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        struct Move {
+            GpuBuffer* buffer;
+            VkBuffer newBuffer;
+            GpuAllocation newAllocation;
+        };
+        std::vector<Move> moves;
+
+        for (auto& pool : pools) {
+            // Densest blocks first. Allocations in the emptiest blocks are moved towards the front.
+            std::vector<MemoryBlock*> order;
+            for (auto& block : pool)
+                if (block->strategy == AllocationStrategy::FreeList) order.push_back(block.get());
+
+            std::sort(order.begin(), order.end(),
+                      [](const MemoryBlock* a, const MemoryBlock* b) { return a->usedBytes > b->usedBytes; });
+
+            for (size_t src = order.size(); src-- > 1;) {
+                for (auto& [ptr, buffer] : buffers) {
+                    if (buffer->allocation.block != order[src]) continue;
+
+                    // A fresh buffer with the same parameters to bind at the new location
+                    VkBufferCreateInfo bufferCI{};
+                    bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+                    bufferCI.size = buffer->size;
+                    bufferCI.usage = buffer->usage;
+                    bufferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+                    VkBuffer newBuffer;
+                    VK_CHECK(vkCreateBuffer(device, &bufferCI, nullptr, &newBuffer));
+
+                    VkMemoryRequirements memReq;
+                    vkGetBufferMemoryRequirements(device, newBuffer, &memReq);
+
+                    bool moved = false;
+                    for (size_t dst = 0; dst < src && !moved; ++dst) {
+                        VkDeviceSize offset;
+                        if (!order[dst]->tryAllocate(memReq.size, memReq.alignment, ResourceKind::Linear,
+                                                     granularity, offset))
+                            continue;
+
+                        VK_CHECK(vkBindBufferMemory(device, newBuffer, order[dst]->memory, offset));
+                        moves.push_back({ buffer.get(), newBuffer,
+                                          makeAllocation(order[dst], offset, memReq.size, buffer->allocation.usage) });
+                        moved = true;
+                    }
+
+                    if (!moved) vkDestroyBuffer(device, newBuffer, nullptr);
+                }
+            }
+        }
+
+        DefragmentationStats result;
+        if (moves.empty()) return result;
+
+        // ============================================== Copy on the GPU =============================================
+        VkCommandPoolCreateInfo poolCI{};
+        poolCI.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolCI.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolCI.queueFamilyIndex = queueFamily;
+
+        VkCommandPool cmdPool;
+        VK_CHECK(vkCreateCommandPool(device, &poolCI, nullptr, &cmdPool));
+
+        VkCommandBufferAllocateInfo cmdBufAI{};
+        cmdBufAI.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        cmdBufAI.commandPool = cmdPool;
+        cmdBufAI.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        cmdBufAI.commandBufferCount = 1;
+
+        VkCommandBuffer cmdBuf;
+        VK_CHECK(vkAllocateCommandBuffers(device, &cmdBufAI, &cmdBuf));
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VK_CHECK(vkBeginCommandBuffer(cmdBuf, &beginInfo));
+
+        // Earlier writes to the buffers on this queue have to land before we copy them, and the copies have to land
+        // before anything that comes after
+        VkMemoryBarrier before{};
+        before.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        before.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+        before.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             1, &before, 0, nullptr, 0, nullptr);
+
+        for (const Move& move : moves) {
+            VkBufferCopy region{ 0, 0, move.buffer->size };
+            vkCmdCopyBuffer(cmdBuf, move.buffer->buffer, move.newBuffer, 1, &region);
+        }
+
+        VkMemoryBarrier after{};
+        after.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        after.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        after.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+        vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                             1, &after, 0, nullptr, 0, nullptr);
+
+        VK_CHECK(vkEndCommandBuffer(cmdBuf));
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &cmdBuf;
+
+        VkFenceCreateInfo fenceCI{};
+        fenceCI.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        VkFence fence;
+        VK_CHECK(vkCreateFence(device, &fenceCI, nullptr, &fence));
+
+        VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, fence));
+        VK_CHECK(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
+
+        vkDestroyFence(device, fence, nullptr);
+        vkDestroyCommandPool(device, cmdPool, nullptr);
+
+        // ============================================ Swap to the new copies ========================================
+        for (Move& move : moves) {
+            vkDestroyBuffer(device, move.buffer->buffer, nullptr);
+            move.buffer->allocation.block->release(move.buffer->allocation.offset, move.buffer->allocation.size);
+
+            move.buffer->buffer = move.newBuffer;
+            move.buffer->allocation = move.newAllocation;
+
+            ++result.buffersMoved;
+            result.bytesMoved += move.buffer->size;
+        }
+
+        // Give every block that is now empty back to the driver
+        for (auto& pool : pools) {
+            size_t blocksBefore = pool.size();
+            std::erase_if(pool, [](const std::unique_ptr<MemoryBlock>& block) { return block->empty(); });
+            result.blocksFreed += static_cast<uint32_t>(blocksBefore - pool.size());
+        }
+
+        return result;
+    }
+
+    const VkPhysicalDeviceMemoryProperties& memoryProperties() const { return memProps; }
+
+private:
+    GpuAllocation allocateLocked(const VkMemoryRequirements& req, const AllocationCreateInfo& info, ResourceKind kind) {
+        AllocationStrategy strategy = info.strategy;
+
+        // Pick a strategy by size unless the caller asked for one
+        if (strategy == AllocationStrategy::Default) {
+            if (req.size <= config.smallThreshold)      strategy = AllocationStrategy::Buddy;
+            else if (req.size > config.blockSize / 2)   strategy = AllocationStrategy::Dedicated;
+            else                                        strategy = AllocationStrategy::FreeList;
+        }
+
+        // Anything that can't share a block is given its own
+        if ((strategy == AllocationStrategy::FreeList || strategy == AllocationStrategy::Linear) &&
+            req.size > config.blockSize / 2)
+            strategy = AllocationStrategy::Dedicated;
+        if (strategy == AllocationStrategy::Buddy && std::max(req.size, req.alignment) > config.buddyBlockSize)
+            strategy = AllocationStrategy::Dedicated;
+
+        // Try the memory types in order of preference, falling back to the next one if a type is out of memory
+        std::vector<uint32_t> types = candidateTypes(req.memoryTypeBits, info);
+        UsageStats& usage = usageStats[static_cast<size_t>(info.usage)];
+
+        for (size_t i = 0; i < types.size(); ++i) {
+            GpuAllocation allocation;
+            if (!allocateFromType(types[i], req, strategy, kind, allocation)) continue;
+
+            allocation.usage = info.usage;
+            ++usage.allocationCount;
+            usage.bytes += allocation.size;
+            usage.bytesPerMemoryType[allocation.memoryType] += allocation.size;
+            if (i > 0) ++usage.fallbacks;
+            return allocation;
+        }
+
+        throw std::runtime_error("Out of device memory for a " + std::to_string(req.size) + " byte " +
+                                 usageName(info.usage) + " allocation");
+    }
+
+    void freeLocked(GpuAllocation& allocation) {
+        if (!allocation.block) return;
+
+        UsageStats& usage = usageStats[static_cast<size_t>(allocation.usage)];
+        --usage.allocationCount;
+        usage.bytes -= allocation.size;
+        usage.bytesPerMemoryType[allocation.memoryType] -= allocation.size;
+
+        MemoryBlock* block = allocation.block;
+        block->release(allocation.offset, allocation.size);
+        allocation = GpuAllocation{};
+
+        if (!block->empty()) return;
+
+        // Keep one empty block of each strategy around so a free/allocate cycle doesn't go to the driver every time.
+        // Dedicated blocks are always released.
+        auto& pool = pools[block->memoryType];
+        bool keep = false;
+        if (block->strategy != AllocationStrategy::Dedicated) {
+            keep = std::none_of(pool.begin(), pool.end(), [&](const std::unique_ptr<MemoryBlock>& other) {
+                return other.get() != block && other->strategy == block->strategy && other->empty();
+            });
+        }
+
+        if (!keep)
+            std::erase_if(pool, [&](const std::unique_ptr<MemoryBlock>& b) { return b.get() == block; });
+    }
+
+    // Memory types allowed by typeBits that have all required flags and suit the usage. Best suited first, then
+    // those with the most preferred flags.
+    std::vector<uint32_t> candidateTypes(uint32_t typeBits, const AllocationCreateInfo& info) const {
+        std::vector<uint32_t> types;
+        for (uint32_t i = 0; i < memProps.memoryTypeCount; ++i) {
+            VkMemoryPropertyFlags flags = memProps.memoryTypes[i].propertyFlags;
+            if ((typeBits & (1u << i)) && (flags & info.requiredFlags) == info.requiredFlags &&
+                memoryTypeScore(info.usage, flags) >= 0)
+                types.push_back(i);
+        }
+
+        auto score = [&](uint32_t type) {
+            VkMemoryPropertyFlags flags = memProps.memoryTypes[type].propertyFlags;
+            return memoryTypeScore(info.usage, flags) * 64 + std::popcount(flags & info.preferredFlags);
+        };
+        std::stable_sort(types.begin(), types.end(), [&](uint32_t a, uint32_t b) { return score(a) > score(b); });
+
+        return types;
+    }
+
+    // The range to flush or invalidate for part of an allocation, widened to nonCoherentAtomSize. False if the memory
+    // is coherent or not mapped, so there is nothing to do.
+    bool mappedRange(const GpuAllocation& allocation, VkDeviceSize offset, VkDeviceSize size,
+                     VkMappedMemoryRange& range) const {
+        if (!allocation.block || !allocation.block->mapped) return false;
+        if (memProps.memoryTypes[allocation.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+            return false;
+
+        VkDeviceSize begin = allocation.offset + offset;
+        VkDeviceSize end = size == VK_WHOLE_SIZE ? allocation.offset + allocation.size : begin + size;
+
+        // Blocks are mapped from offset 0, so offsets into the allocation are offsets into the mapping
+        range = {};
+        range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        range.memory = allocation.memory;
+        range.offset = begin / nonCoherentAtomSize * nonCoherentAtomSize;
+        range.size = std::min(alignUp(end, nonCoherentAtomSize), allocation.block->size) - range.offset;
+        return true;
+    }
+
+    bool allocateFromType(uint32_t type, const VkMemoryRequirements& req, AllocationStrategy strategy,
+                          ResourceKind kind, GpuAllocation& allocation) {
+        auto& pool = pools[type];
+
+        // Existing blocks first. Buddy and linear blocks only take the kind of resource they were created for.
+        if (strategy != AllocationStrategy::Dedicated) {
+            for (auto& block : pool) {
+                if (block->strategy != strategy) continue;
+                if (strategy != AllocationStrategy::FreeList && block->kind != kind) continue;
+
+                VkDeviceSize offset;
+                if (block->tryAllocate(req.size, req.alignment, kind, granularity, offset)) {
+                    allocation = makeAllocation(block.get(), offset, req.size);
+                    return true;
+                }
+            }
+        }
+
+        // Then a new block. Keep blocks to an eighth of the heap so small heaps aren't swallowed by one block.
+        VkDeviceSize heapSize = memProps.memoryHeaps[memProps.memoryTypes[type].heapIndex].size;
+        VkDeviceSize blockSize = req.size;
+
+        if (strategy == AllocationStrategy::Buddy) {
+            blockSize = config.buddyBlockSize;
+            while (blockSize / 2 >= std::max({ req.size, req.alignment, BuddyBlock::MIN_SIZE }) &&
+                   blockSize > heapSize / 8)
+                blockSize /= 2;
+        } else if (strategy != AllocationStrategy::Dedicated) {
+            blockSize = std::max(std::min(config.blockSize, heapSize / 8), req.size);
+        }
+
+        std::unique_ptr<MemoryBlock> block = createBlock(type, blockSize, strategy, kind);
+        if (!block) return false;
+
+        VkDeviceSize offset;
+        if (!block->tryAllocate(req.size, req.alignment, kind, granularity, offset)) return false;
+
+        allocation = makeAllocation(block.get(), offset, req.size);
+        pool.push_back(std::move(block));
+        return true;
+    }
+
+    // Gets a new VkDeviceMemory from the driver and wraps it in a block. Returns null if the driver is out of memory.
+    std::unique_ptr<MemoryBlock> createBlock(uint32_t type, VkDeviceSize size, AllocationStrategy strategy,
+                                             ResourceKind kind) {
+        if (liveDeviceAllocations() >= maxAllocationCount) return nullptr;
+
+        VkMemoryAllocateInfo memAI{};
+        memAI.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        memAI.allocationSize = size;
+        memAI.memoryTypeIndex = type;
+
+        VkDeviceMemory memory;
+        VkResult result = vkAllocateMemory(device, &memAI, nullptr, &memory);
+        if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY || result == VK_ERROR_OUT_OF_HOST_MEMORY) return nullptr;
+        VK_CHECK(result);
+
+        // Host visible memory is mapped once for the lifetime of the block
+        void* mapped = nullptr;
+        if (memProps.memoryTypes[type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+            result = vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+            if (result != VK_SUCCESS) {
+                vkFreeMemory(device, memory, nullptr);
+                VK_CHECK(result);
+            }
+        }
+
+        switch (strategy) {
+            case AllocationStrategy::Buddy:
+                return std::make_unique<BuddyBlock>(device, memory, size, type, mapped, kind);
+            case AllocationStrategy::Linear:
+                return std::make_unique<LinearBlock>(device, memory, size, type, mapped, kind);
+            case AllocationStrategy::Dedicated:
+                return std::make_unique<DedicatedBlock>(device, memory, size, type, mapped, kind);
+            default:
+                return std::make_unique<FreeListBlock>(device, memory, size, type, mapped);
+        }
+    }
+
+    GpuAllocation makeAllocation(MemoryBlock* block, VkDeviceSize offset, VkDeviceSize size,
+                                 MemoryUsage usage = MemoryUsage::Custom) const {
+        GpuAllocation allocation;
+        allocation.memory = block->memory;
+        allocation.offset = offset;
+        allocation.size = size;
+        allocation.memoryType = block->memoryType;
+        allocation.mapped = block->mapped ? block->mapped + offset : nullptr;
+        allocation.usage = usage;
+        allocation.block = block;
+        return allocation;
+    }
+
+    uint32_t liveDeviceAllocations() const {
+        size_t count = 0;
+        for (const auto& pool : pools) count += pool.size();
+        return static_cast<uint32_t>(count);
+    }
+
+    VkDevice device;
+    Config config;
+    VkPhysicalDeviceMemoryProperties memProps{};
+    VkDeviceSize granularity = 1;
+    uint32_t maxAllocationCount = 4096;
+    VkDeviceSize nonCoherentAtomSize = 1;
+
+    mutable std::mutex mutex;
+    std::vector<std::vector<std::unique_ptr<MemoryBlock>>> pools;   // Blocks per memory type
+    std::array<UsageStats, MEMORY_USAGE_COUNT> usageStats;
+    std::unordered_map<GpuBuffer*, std::unique_ptr<GpuBuffer>> buffers;
+    std::unordered_map<GpuImage*, std::unique_ptr<GpuImage>> images;
+};
@@ -0,0 +1,184 @@
+#include <vulkan/vulkan.h>
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+
+#include "compute_context.hpp"
+
+// Stress benchmark for the GPU memory sub-allocator. Allocates and frees a few thousand randomly sized pieces of
+// device-local memory, once straight through vkAllocateMemory and once through GpuAllocator, and compares throughput.
+
+constexpr uint32_t ROUNDS = 5;
+
+using Clock = std::chrono::steady_clock;
+
+// Log-uniform sizes between 256 bytes and 1 MiB, which is roughly what a mix of small uniform/storage buffers looks like
+std::vector<VkDeviceSize> makeSizes(uint32_t count, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> exponent(8.0, 20.0);
+
+    std::vector<VkDeviceSize> sizes(count);
+    for (auto& size : sizes) size = static_cast<VkDeviceSize>(std::pow(2.0, exponent(rng)));
+    return sizes;
+}
+
+// Frees half of the allocations in random order and replaces them, to mimic a long running workload
+std::vector<uint32_t> makeChurn(uint32_t count, uint32_t seed) {
+    std::vector<uint32_t> order(count);
+    for (uint32_t i = 0; i < count; ++i) order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(seed));
+    order.resize(count / 2);
+    return order;
+}
+
+double elapsedMs(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+void printResult(const char* name, uint32_t operations, double ms) {
+    std::cout << "  " << name << ": " << ms << " ms, " << operations / (ms / 1000.0) << " allocs+frees/s\n";
+}
+
+// Picks the first device-local memory type. Raw allocations and the allocator both use it so the comparison is fair.
+uint32_t deviceLocalType(const ComputeContext& ctx) {
+    const auto& memProps = ctx.allocator->memoryProperties();
+    for (uint32_t i = 0; i < memProps.memoryTypeCount; ++i)
+        if (memProps.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) return i;
+    return 0;
+}
+
+double benchRaw(const ComputeContext& ctx, const std::vector<VkDeviceSize>& sizes,
+                const std::vector<uint32_t>& churn, uint32_t type) {
+    std::vector<VkDeviceMemory> memory(sizes.size());
+
+    VkMemoryAllocateInfo memAI{};
+    memAI.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAI.memoryTypeIndex = type;
+
+    auto start = Clock::now();
+
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        memAI.allocationSize = sizes[i];
+        VK_CHECK(vkAllocateMemory(ctx.device, &memAI, nullptr, &memory[i]));
+    }
+
+    for (uint32_t i : churn) {
+        vkFreeMemory(ctx.device, memory[i], nullptr);
+        memAI.allocationSize = sizes[i];
+        VK_CHECK(vkAllocateMemory(ctx.device, &memAI, nullptr, &memory[i]));
+    }
+
+    for (VkDeviceMemory m : memory) vkFreeMemory(ctx.device, m, nullptr);
+
+    return elapsedMs(start);
+}
+
+double benchAllocator(const ComputeContext& ctx, const std::vector<VkDeviceSize>& sizes,
+                      const std::vector<uint32_t>& churn, uint32_t type, bool printStats) {
+    std::vector<GpuAllocation> allocations(sizes.size());
+
+    AllocationCreateInfo info{};
+    info.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+    VkMemoryRequirements req{};
+    req.alignment = 256;
+    req.memoryTypeBits = 1u << type;
+
+    auto start = Clock::now();
+
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        req.size = sizes[i];
+        allocations[i] = ctx.allocator->allocate(req, info);
+    }
+
+    for (uint32_t i : churn) {
+        ctx.allocator->free(allocations[i]);
+        req.size = sizes[i];
+        allocations[i] = ctx.allocator->allocate(req, info);
+    }
+
+    double ms = elapsedMs(start);
+
+    // Stats are taken outside the timed region, while everything is still allocated
+    if (printStats) ctx.allocator->stats().print(std::cout);
+
+    start = Clock::now();
+    for (auto& allocation : allocations) ctx.allocator->free(allocation);
+    return ms + elapsedMs(start);
+}
+
+// Fills a few free-list blocks with buffers, frees every other one and lets defragment() compact what is left
+void benchDefragment(const ComputeContext& ctx) {
+    AllocationCreateInfo info{};
+    info.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    info.strategy = AllocationStrategy::FreeList;
+
+    std::vector<GpuBuffer*> buffers;
+    for (uint32_t i = 0; i < 512; ++i)
+        buffers.push_back(ctx.allocator->createBuffer(512 << 10, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, info));
+
+    for (size_t i = 0; i < buffers.size(); i += 2) {
+        ctx.allocator->destroyBuffer(buffers[i]);
+        buffers[i] = nullptr;
+    }
+
+    std::cout << "Before defragmentation:\n";
+    ctx.allocator->stats().print(std::cout);
+
+    auto start = Clock::now();
+    DefragmentationStats defrag = ctx.allocator->defragment(ctx.queue, ctx.computeIndex);
+    double ms = elapsedMs(start);
+
+    std::cout << "Defragmentation moved " << defrag.buffersMoved << " buffers (" << defrag.bytesMoved / (1 << 20)
+              << " MiB) and freed " << defrag.blocksFreed << " blocks in " << ms << " ms\n";
+    ctx.allocator->stats().print(std::cout);
+
+    for (GpuBuffer* buffer : buffers) ctx.allocator->destroyBuffer(buffer);
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        ComputeContext ctx = createContext();
+
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(ctx.gpu, &props);
+
+        // Stay well under the driver's allocation limit so the raw path can actually run
+        uint32_t count = argc > 1 ? static_cast<uint32_t>(std::stoul(argv[1])) : 2000;
+        count = std::min(count, props.limits.maxMemoryAllocationCount - 64);
+
+        uint32_t type = deviceLocalType(ctx);
+        auto sizes = makeSizes(count, 1234);
+        auto churn = makeChurn(count, 5678);
+        uint32_t operations = count + static_cast<uint32_t>(churn.size());
+
+        std::cout << "Device: " << props.deviceName << "\n"
+                  << "Allocations: " << count << " (+" << churn.size() << " churned), memory type " << type << "\n";
+
+        double rawBest = 1e30, allocatorBest = 1e30;
+        for (uint32_t round = 0; round < ROUNDS; ++round) {
+            rawBest = std::min(rawBest, benchRaw(ctx, sizes, churn, type));
+            allocatorBest = std::min(allocatorBest, benchAllocator(ctx, sizes, churn, type, round == 0));
+        }
+
+        std::cout << "Best of " << ROUNDS << " rounds:\n";
+        printResult("vkAllocateMemory", operations, rawBest);
+        printResult("GpuAllocator    ", operations, allocatorBest);
+        std::cout << "Speedup: " << rawBest / allocatorBest << "x\n\n";
+
+        benchDefragment(ctx);
+
+        destroyContext(ctx);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
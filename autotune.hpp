@@ -0,0 +1,287 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <map>
+#include <string>
+#include <optional>
+#include <functional>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <stdexcept>
+#include <cstdint>
+
+#include "compute_context.hpp"
+#include "kernel.hpp"
+
+// Offline workgroup size autotuner.
+//
+// tune() builds the kernel once per candidate workgroup size, times a few dispatches of each with timestamp queries
+// and keeps the fastest. Results are stored in a small text file keyed by device UUID and kernel name, one
+// "<uuid> <kernel> <x> <y> <z>" line each, so later runs on the same GPU just look the size up. Entries for other
+// devices are left alone, which lets one file serve every machine that shares it.
+class WorkgroupTuner {
+public:
+    // Records one iteration of the kernel being tuned. The candidate pipeline is already bound; the callback binds
+    // descriptor sets and push constants and dispatches enough workgroups of the given size to cover the problem.
+    using RecordFn = std::function<void(VkCommandBuffer, const WorkgroupSize&)>;
+
+    // Each candidate is timed RUNS times, ITERATIONS dispatches per run, and its best run counts
+    static constexpr uint32_t RUNS = 3;
+    static constexpr uint32_t ITERATIONS = 8;
+
+    // Bigger workgroups rarely help and only make the sweep longer
+    static constexpr uint32_t MAX_CANDIDATE_INVOCATIONS = 1024;
+
+    WorkgroupTuner(const ComputeContext& ctx, std::string path) : ctx(ctx), path(std::move(path)) {
+        VkPhysicalDeviceSubgroupProperties subgroupProps{};
+        subgroupProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+
+        VkPhysicalDeviceIDProperties idProps{};
+        idProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+        idProps.pNext = &subgroupProps;
+
+        VkPhysicalDeviceProperties2 props{};
+        props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        props.pNext = &idProps;
+        vkGetPhysicalDeviceProperties2(ctx.gpu, &props);
+
+        limits = props.properties.limits;
+        subgroupSize = std::max(subgroupProps.subgroupSize, 1u);
+
+        deviceUUID = uuidString(idProps.deviceUUID);
+
+        uint32_t familyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(ctx.gpu, &familyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> families(familyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(ctx.gpu, &familyCount, families.data());
+
+        // Without timestamps on the compute queue, candidates are timed on the CPU around the submit instead
+        uint32_t validBits = families[ctx.computeIndex].timestampValidBits;
+        if (validBits > 0) {
+            timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+            VkQueryPoolCreateInfo queryPoolCI{};
+            queryPoolCI.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolCI.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolCI.queryCount = 2;
+            VK_CHECK(vkCreateQueryPool(ctx.device, &queryPoolCI, nullptr, &queryPool));
+        }
+
+        load(this->path, entries);
+    }
+
+    ~WorkgroupTuner() {
+        if (queryPool) vkDestroyQueryPool(ctx.device, queryPool, nullptr);
+    }
+
+    WorkgroupTuner(const WorkgroupTuner&) = delete;
+    WorkgroupTuner& operator=(const WorkgroupTuner&) = delete;
+
+    // Tuned size for a kernel on this device, if there is one and the device can still run it
+    std::optional<WorkgroupSize> find(const std::string& kernelName) const {
+        auto it = entries.find(key(kernelName));
+        if (it == entries.end() || !fits(limits, it->second)) return std::nullopt;
+        return it->second;
+    }
+
+    // Like find(), straight from the file at path, for programs that use tuned sizes without a ComputeContext to
+    // tune them with (the windowed demo)
+    static std::optional<WorkgroupSize> lookup(VkPhysicalDevice gpu, const std::string& path,
+                                               const std::string& kernelName) {
+        VkPhysicalDeviceIDProperties idProps{};
+        idProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+
+        VkPhysicalDeviceProperties2 props{};
+        props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        props.pNext = &idProps;
+        vkGetPhysicalDeviceProperties2(gpu, &props);
+
+        std::map<std::string, WorkgroupSize> stored;
+        load(path, stored);
+
+        auto it = stored.find(uuidString(idProps.deviceUUID) + " " + kernelName);
+        if (it == stored.end() || !fits(props.properties.limits, it->second)) return std::nullopt;
+        return it->second;
+    }
+
+    // Power of two sizes for a 1D or 2D kernel that cover at least one subgroup and fit the device limits. 2D
+    // candidates are kept at most 16 times wider than tall and never taller than wide, since image rows are
+    // contiguous in memory.
+    std::vector<WorkgroupSize> candidates(uint32_t dimensions) const {
+        uint32_t maxInvocations = std::min(limits.maxComputeWorkGroupInvocations, MAX_CANDIDATE_INVOCATIONS);
+        uint32_t minInvocations = std::min(subgroupSize, maxInvocations);
+
+        std::vector<WorkgroupSize> result;
+        for (uint32_t x = 1; x <= limits.maxComputeWorkGroupSize[0] && x <= maxInvocations; x *= 2) {
+            if (dimensions < 2) {
+                if (x >= minInvocations) result.push_back({ x, 1, 1 });
+                continue;
+            }
+
+            for (uint32_t y = 1; y <= x && y <= limits.maxComputeWorkGroupSize[1]; y *= 2) {
+                WorkgroupSize size{ x, y, 1 };
+                if (x > 16 * y || size.invocations() < minInvocations || size.invocations() > maxInvocations)
+                    continue;
+                result.push_back(size);
+            }
+        }
+
+        return result;
+    }
+
+    // Sweeps the candidates for a kernel with the given number of dimensions, rebuilds the kernel with the fastest
+    // one and remembers it under kernelName. Call save() to write the results out.
+    WorkgroupSize tune(const std::string& kernelName, ComputeKernel& kernel, uint32_t dimensions,
+                       const RecordFn& record) {
+        std::vector<WorkgroupSize> sizes = candidates(dimensions);
+        if (sizes.empty()) throw std::runtime_error("No workgroup sizes to try for " + kernelName);
+
+        std::cout << "Tuning " << kernelName << " (subgroup size " << subgroupSize << ", "
+                  << (queryPool ? "GPU" : "CPU") << " timing)\n";
+
+        WorkgroupSize best = sizes.front();
+        double bestMs = std::numeric_limits<double>::infinity();
+
+        for (const WorkgroupSize& size : sizes) {
+            VkPipeline pipeline = createComputePipeline(ctx, kernel.shader, kernel.layout, size);
+
+            double ms;
+            try {
+                ms = measure(pipeline, size, record);
+            } catch (...) {
+                vkDestroyPipeline(ctx.device, pipeline, nullptr);
+                throw;
+            }
+            vkDestroyPipeline(ctx.device, pipeline, nullptr);
+
+            std::cout << "  " << size.x << "x" << size.y << "x" << size.z << ": " << ms << " ms\n";
+
+            if (ms < bestMs) {
+                bestMs = ms;
+                best = size;
+            }
+        }
+
+        std::cout << "Best for " << kernelName << ": " << best.x << "x" << best.y << "x" << best.z << " (" << bestMs
+                  << " ms)\n";
+
+        setWorkgroupSize(ctx, kernel, best);
+        entries[key(kernelName)] = best;
+        tuned.push_back(kernelName);
+        return best;
+    }
+
+    // Writes the sizes tuned by this run into the file. Whatever is on disk at that moment is read first, so entries
+    // saved by other processes or for other devices survive, and the file is replaced with a rename.
+    void save() {
+        if (path.empty() || tuned.empty()) return;
+
+        std::map<std::string, WorkgroupSize> merged;
+        load(path, merged);
+        for (const auto& kernelName : tuned) merged[key(kernelName)] = entries[key(kernelName)];
+
+        std::string tmpPath = path + ".tmp";
+        {
+            std::ofstream file(tmpPath, std::ios::trunc);
+            if (!file.is_open()) throw std::runtime_error("Failed to open file: " + tmpPath);
+            for (const auto& [entryKey, size] : merged)
+                file << entryKey << " " << size.x << " " << size.y << " " << size.z << "\n";
+            if (!file) throw std::runtime_error("Failed to write file: " + tmpPath);
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(tmpPath, path, ec);
+        if (ec) {
+            std::filesystem::remove(tmpPath, ec);
+            throw std::runtime_error("Failed to replace tuning file " + path);
+        }
+    }
+
+private:
+    std::string key(const std::string& kernelName) const { return deviceUUID + " " + kernelName; }
+
+    static bool fits(const VkPhysicalDeviceLimits& limits, const WorkgroupSize& size) {
+        return size.x >= 1 && size.y >= 1 && size.z >= 1 &&
+               size.x <= limits.maxComputeWorkGroupSize[0] && size.y <= limits.maxComputeWorkGroupSize[1] &&
+               size.z <= limits.maxComputeWorkGroupSize[2] &&
+               static_cast<uint64_t>(size.x) * size.y * size.z <= limits.maxComputeWorkGroupInvocations;
+    }
+
+    // Reads every well formed line of the file into out. Kernel names can't contain spaces, so lines split cleanly.
+    static void load(const std::string& path, std::map<std::string, WorkgroupSize>& out) {
+        if (path.empty()) return;
+
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream in(line);
+            std::string uuid, kernelName;
+            WorkgroupSize size;
+            if (in >> uuid >> kernelName >> size.x >> size.y >> size.z) out[uuid + " " + kernelName] = size;
+        }
+    }
+
+    // Average time of one dispatch in milliseconds, best of RUNS submissions
+    double measure(VkPipeline pipeline, const WorkgroupSize& size, const RecordFn& record) {
+        double best = std::numeric_limits<double>::infinity();
+
+        for (uint32_t run = 0; run < RUNS; ++run) {
+            VkCommandBuffer cmd = beginCommands(ctx);
+            if (queryPool) {
+                vkCmdResetQueryPool(cmd, queryPool, 0, 2);
+                vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+            }
+
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+
+            for (uint32_t i = 0; i < ITERATIONS; ++i) {
+                // Iterations write the same memory, so each one waits for the one before like real work would
+                if (i > 0) {
+                    VkMemoryBarrier barrier{};
+                    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+                    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+                    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+                    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0,
+                                         nullptr);
+                }
+                record(cmd, size);
+            }
+
+            if (queryPool) vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+
+            auto start = std::chrono::steady_clock::now();
+            submitAndWait(ctx, cmd);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            if (queryPool) {
+                uint64_t timestamps[2];
+                VK_CHECK(vkGetQueryPoolResults(ctx.device, queryPool, 0, 2, sizeof(timestamps), timestamps,
+                                               sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+                uint64_t ticks = ((timestamps[1] & timestampMask) - (timestamps[0] & timestampMask)) & timestampMask;
+                ms = static_cast<double>(ticks) * limits.timestampPeriod / 1e6;
+            }
+
+            best = std::min(best, ms / ITERATIONS);
+        }
+
+        return best;
+    }
+
+    const ComputeContext& ctx;
+    std::string path;
+    std::string deviceUUID;
+    VkPhysicalDeviceLimits limits{};
+    uint32_t subgroupSize = 1;
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    uint64_t timestampMask = ~0ull;
+    std::map<std::string, WorkgroupSize> entries;   // Everything in the file, keyed by "<uuid> <kernel>"
+    std::vector<std::string> tuned;                 // Kernels tuned by this run
+};
@@ -0,0 +1,37 @@
+# Turns a SPIR-V binary into a C++ header with the code as an aligned constexpr uint32_t array.
+#
+# Run in script mode:
+#   cmake -DINPUT=gradient.comp.spv -DOUTPUT=gradient.comp.h -DSYMBOL=gradient_comp -DSOURCE=gradient.comp
+#         -P EmbedSpirv.cmake
+
+file(READ "${INPUT}" hex HEX)
+string(LENGTH "${hex}" length)
+math(EXPR remainder "${length} % 8")
+
+if(length EQUAL 0 OR NOT remainder EQUAL 0)
+    message(FATAL_ERROR "${INPUT} is not a valid SPIR-V binary (size is not a multiple of 4 bytes)")
+endif()
+
+# SPIR-V is a stream of little-endian 32-bit words. Swap the bytes of each word so the hex literal has the word's value.
+string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1," words "${hex}")
+
+# Eight words per line. CMake regexes have no {n} repetition, so spell the eight words out.
+string(REPEAT "0x[0-9a-f]+," 8 line)
+string(REGEX REPLACE "(${line})" "\\1\n    " words "${words}")
+string(REGEX REPLACE ",0x" ", 0x" words "${words}")
+string(STRIP "${words}" words)
+
+file(WRITE "${OUTPUT}"
+"// Generated from ${SOURCE} by cmake/EmbedSpirv.cmake. Do not edit.
+#pragma once
+
+#include <cstdint>
+
+namespace shaders {
+
+alignas(16) inline constexpr uint32_t ${SYMBOL}[] = {
+    ${words}
+};
+
+} // namespace shaders
+")
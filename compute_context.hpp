@@ -0,0 +1,261 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <span>
+#include <iostream>
+#include <cstdint>
+
+#include "allocator.hpp"
+#include "pipeline_cache.hpp"
+#include "pipeline_manager.hpp"
+#include "profiler.hpp"
+#include "queue_topology.hpp"
+#include "timeline.hpp"
+#include "device_select.hpp"
+#include "startup_trace.hpp"
+
+// Number of submissions that can have profiler scopes in flight at once (see GpuProfiler::beginFrame)
+constexpr uint32_t PROFILER_SLOTS = 4;
+
+#ifndef VK_CHECK
+#define VK_CHECK(x) do { VkResult err = x; if (err != VK_SUCCESS) throw std::runtime_error("Vulkan error at " #x); } while(0)
+#endif
+
+// Reduced precision shader features, enabled on the device wherever it has them. Kernels with fp16 arithmetic or
+// 8-bit values in storage buffers can only be built when these are set (see precision.hpp).
+struct PrecisionFeatures {
+    bool float16 = false;                           // shaderFloat16: float16_t arithmetic
+    bool int8 = false;                              // shaderInt8: int8_t and uint8_t arithmetic
+    bool storage8 = false;                          // storageBuffer8BitAccess: 8-bit values in storage buffers
+};
+
+// Everything the compute programs need: instance, device, a compute queue, an async compute queue and a transfer
+// queue, a command pool for the compute queue, a timeline for submitAndWait(), the memory allocator, the pipeline
+// cache, background pipeline compilation and the GPU profiler. No window or surface is involved, so this runs on
+// display-less machines and on software ICDs like lavapipe.
+struct ComputeContext {
+    VkInstance instance = VK_NULL_HANDLE;
+    VkPhysicalDevice gpu = VK_NULL_HANDLE;
+    VkDevice device = VK_NULL_HANDLE;
+    VkQueue queue = VK_NULL_HANDLE;
+    uint32_t computeIndex = 0;
+    VkQueue asyncQueue = VK_NULL_HANDLE;            // Same as queue if the device has no second compute queue
+    uint32_t asyncIndex = 0;
+    VkQueue transferQueue = VK_NULL_HANDLE;         // Same as queue if there is no dedicated transfer family
+    uint32_t transferIndex = 0;
+    VkQueue readbackQueue = VK_NULL_HANDLE;         // Second queue of the transfer family, or transferQueue
+    QueueTopology topology;
+    VkCommandPool cmdPool = VK_NULL_HANDLE;
+    VkPhysicalDeviceFeatures features{};            // Features enabled on the device
+    PrecisionFeatures precision;                    // Reduced precision features enabled on the device
+    bool hostQueryReset = false;                    // Query pools can be reset from the host (vkResetQueryPool)
+    std::unique_ptr<Timeline> timeline;             // Signalled by submitAndWait() on the compute queue
+    std::unique_ptr<GpuAllocator> allocator;
+    std::unique_ptr<PipelineCache> pipelineCache;
+    std::unique_ptr<PipelineManager> pipelines;     // Builds pipelines on worker threads, through pipelineCache
+    std::unique_ptr<GpuProfiler> profiler;
+    StartupTrace* startup = nullptr;                // If set, the first finished dispatch is marked (see below)
+};
+
+// Milestone in ComputeContext::startup for the first compute work to finish on the GPU
+constexpr const char* FIRST_DISPATCH_MILESTONE = "first dispatch";
+
+// Marks FIRST_DISPATCH_MILESTONE, if the context has a startup trace. Call it once compute work is known to have
+// finished (a wait on its timeline returned, or its job retired), not when it's submitted: the first result is what
+// startup is timed to. Only the first call counts.
+inline void markDispatchFinished(const ComputeContext& ctx) {
+    if (ctx.startup) ctx.startup->milestone(FIRST_DISPATCH_MILESTONE);
+}
+
+// Creates the context. The pipeline cache is loaded from pipelineCachePath and written back by destroyContext(); an
+// empty path keeps the cache in memory only. deviceOverride forces a device by index, UUID or name (see
+// selectPhysicalDevice); empty picks the best scoring one. Each step is recorded as a phase in trace if given, and
+// the context keeps the trace to mark its first dispatch.
+inline ComputeContext createContext(const std::string& pipelineCachePath = "", const std::string& deviceOverride = "",
+                                    StartupTrace* trace = nullptr) {
+    ComputeContext ctx;
+    ctx.startup = trace;
+
+    // 1️⃣ Instance
+    std::optional<StartupTrace::Scope> phase;
+    phase.emplace(trace, "instance");
+
+    VkApplicationInfo appInfo{};
+    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    appInfo.pApplicationName = "ComputeTest";
+    appInfo.apiVersion = VK_API_VERSION_1_3;
+
+    VkInstanceCreateInfo instanceCI{};
+    instanceCI.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    instanceCI.pApplicationInfo = &appInfo;
+
+    VK_CHECK(vkCreateInstance(&instanceCI, nullptr, &ctx.instance));
+
+    // 2️⃣ GPU. Scored on type, memory, compute limits and queue families, see device_select.hpp.
+    // Callers may carry on without Vulkan when there is no usable device (see the CPU backend), so don't leak the
+    // instance
+    phase.emplace(trace, "select device");
+    try {
+        ctx.gpu = selectPhysicalDevice(ctx.instance, DeviceRequirements{}, deviceOverride, std::cout);
+    } catch (...) {
+        vkDestroyInstance(ctx.instance, nullptr);
+        throw;
+    }
+
+    // 3️⃣ Queues. See QueueTopology for which family does what.
+    phase.emplace(trace, "device");
+    ctx.topology = discoverQueues(ctx.gpu);
+    ctx.computeIndex = ctx.topology.primary.family;
+    ctx.asyncIndex = ctx.topology.compute.family;
+    ctx.transferIndex = ctx.topology.transfer.family;
+
+    std::vector<float> priorities(ctx.topology.maxQueueCount(), 1.0f);
+    std::vector<VkDeviceQueueCreateInfo> queueCIs = ctx.topology.createInfos(priorities.data());
+
+    // Pipeline statistics give the profiler compute shader invocation counts. Not every driver has them.
+    VkPhysicalDeviceFeatures supported;
+    vkGetPhysicalDeviceFeatures(ctx.gpu, &supported);
+    ctx.features.pipelineStatisticsQuery = supported.pipelineStatisticsQuery;
+
+    // All CPU/GPU and cross-queue synchronisation goes through timeline semaphores (see timeline.hpp)
+    VkPhysicalDeviceVulkan12Features supported12{};
+    supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+    VkPhysicalDeviceFeatures2 supported2{};
+    supported2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    supported2.pNext = &supported12;
+    vkGetPhysicalDeviceFeatures2(ctx.gpu, &supported2);
+
+    if (!supported12.timelineSemaphore) throw std::runtime_error("Device doesn't support timeline semaphores");
+
+    // fp16 arithmetic and 8-bit storage are optional. Whatever the device has is turned on, and the fp16 kernel
+    // variants are only picked when the features they need are there.
+    ctx.precision.float16 = supported12.shaderFloat16;
+    ctx.precision.int8 = supported12.shaderInt8;
+    ctx.precision.storage8 = supported12.storageBuffer8BitAccess;
+
+    // Lets the transfer engine time batches on queues that can't reset query pools themselves
+    ctx.hostQueryReset = supported12.hostQueryReset;
+
+    VkPhysicalDeviceVulkan12Features features12{};
+    features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    features12.timelineSemaphore = VK_TRUE;
+    features12.shaderFloat16 = ctx.precision.float16;
+    features12.shaderInt8 = ctx.precision.int8;
+    features12.storageBuffer8BitAccess = ctx.precision.storage8;
+    features12.hostQueryReset = ctx.hostQueryReset;
+
+    // Barriers are Synchronization2's (see frame_graph.hpp). Every 1.3 device has it, and selection asks for 1.3.
+    VkPhysicalDeviceVulkan13Features features13{};
+    features13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+    features13.synchronization2 = VK_TRUE;
+    features12.pNext = &features13;
+
+    VkDeviceCreateInfo deviceCI{};
+    deviceCI.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceCI.pNext = &features12;
+    deviceCI.queueCreateInfoCount = static_cast<uint32_t>(queueCIs.size());
+    deviceCI.pQueueCreateInfos = queueCIs.data();
+    deviceCI.pEnabledFeatures = &ctx.features;
+
+    VK_CHECK(vkCreateDevice(ctx.gpu, &deviceCI, nullptr, &ctx.device));
+
+    vkGetDeviceQueue(ctx.device, ctx.computeIndex, ctx.topology.primary.index, &ctx.queue);
+    vkGetDeviceQueue(ctx.device, ctx.asyncIndex, ctx.topology.compute.index, &ctx.asyncQueue);
+    vkGetDeviceQueue(ctx.device, ctx.transferIndex, ctx.topology.transfer.index, &ctx.transferQueue);
+    vkGetDeviceQueue(ctx.device, ctx.transferIndex, ctx.topology.readback.index, &ctx.readbackQueue);
+
+    // 4️⃣ Command pool
+    phase.emplace(trace, "command pool");
+    VkCommandPoolCreateInfo cmdPoolCI{};
+    cmdPoolCI.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    cmdPoolCI.queueFamilyIndex = ctx.computeIndex;
+
+    VK_CHECK(vkCreateCommandPool(ctx.device, &cmdPoolCI, nullptr, &ctx.cmdPool));
+    ctx.timeline = std::make_unique<Timeline>(ctx.device);
+
+    // 5️⃣ Memory allocator
+    phase.emplace(trace, "allocator");
+    ctx.allocator = std::make_unique<GpuAllocator>(ctx.gpu, ctx.device);
+
+    // 6️⃣ Pipeline cache
+    phase.emplace(trace, "pipeline cache");
+    ctx.pipelineCache = std::make_unique<PipelineCache>(ctx.gpu, ctx.device, pipelineCachePath);
+
+    // 7️⃣ Pipeline compilation on worker threads
+    phase.emplace(trace, "pipeline workers");
+    ctx.pipelines = std::make_unique<PipelineManager>(ctx.device, ctx.pipelineCache->handle());
+
+    // 8️⃣ GPU profiler
+    phase.emplace(trace, "profiler");
+    ctx.profiler = std::make_unique<GpuProfiler>(ctx.gpu, ctx.device, ctx.computeIndex, PROFILER_SLOTS,
+                                                 ctx.features.pipelineStatisticsQuery);
+
+    return ctx;
+}
+
+inline void destroyContext(ComputeContext& ctx) {
+    // Failing to write the cache only costs startup time on the next run, so it isn't worth failing the job over
+    try {
+        ctx.pipelineCache->save();
+    } catch (const std::exception& e) {
+        std::cerr << "Warning: " << e.what() << std::endl;
+    }
+
+    ctx.profiler.reset();
+    ctx.pipelines.reset();
+    ctx.pipelineCache.reset();
+    ctx.allocator.reset();
+    ctx.timeline.reset();
+    vkDestroyCommandPool(ctx.device, ctx.cmdPool, nullptr);
+    vkDestroyDevice(ctx.device, nullptr);
+    vkDestroyInstance(ctx.instance, nullptr);
+}
+
+// Creates a shader module straight from SPIR-V words, embedded or mapped (see shader_loader.hpp)
+inline VkShaderModule createShaderModule(const ComputeContext& ctx, std::span<const uint32_t> code) {
+    VkShaderModuleCreateInfo shaderModuleCI{};
+    shaderModuleCI.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shaderModuleCI.codeSize = code.size_bytes();
+    shaderModuleCI.pCode = code.data();
+
+    VkShaderModule shader;
+    VK_CHECK(vkCreateShaderModule(ctx.device, &shaderModuleCI, nullptr, &shader));
+    return shader;
+}
+
+// Allocates a primary command buffer from the context's pool and begins recording it
+inline VkCommandBuffer beginCommands(const ComputeContext& ctx) {
+    VkCommandBufferAllocateInfo cmdBufAI{};
+    cmdBufAI.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    cmdBufAI.commandPool = ctx.cmdPool;
+    cmdBufAI.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    cmdBufAI.commandBufferCount = 1;
+
+    VkCommandBuffer cmdBuf;
+    VK_CHECK(vkAllocateCommandBuffers(ctx.device, &cmdBufAI, &cmdBuf));
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_CHECK(vkBeginCommandBuffer(cmdBuf, &beginInfo));
+    return cmdBuf;
+}
+
+// Ends the command buffer, submits it to the compute queue and blocks until it has finished executing
+inline void submitAndWait(const ComputeContext& ctx, VkCommandBuffer cmdBuf) {
+    VK_CHECK(vkEndCommandBuffer(cmdBuf));
+
+    SemaphoreSignal done{ ctx.timeline->handle(), ctx.timeline->next() };
+    queueSubmit(ctx.queue, { &cmdBuf, 1 }, {}, { &done, 1 });
+    ctx.timeline->wait(done.value);
+    markDispatchFinished(ctx);
+
+    vkFreeCommandBuffers(ctx.device, ctx.cmdPool, 1, &cmdBuf);
+}
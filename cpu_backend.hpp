@@ -0,0 +1,287 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <span>
+#include <optional>
+#include <filesystem>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#define CPU_BACKEND_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__aarch64__) || defined(_M_ARM64)
+#define CPU_BACKEND_NEON 1
+#include <arm_neon.h>
+#endif
+
+// AVX2 code is compiled for AVX2 function by function and only called after checking the CPU has it, so the rest of
+// the program keeps running on older x86 machines. MSVC allows the intrinsics without any flags.
+#if defined(CPU_BACKEND_X86) && (defined(__GNUC__) || defined(__clang__))
+#define CPU_BACKEND_AVX2 __attribute__((target("avx2")))
+#else
+#define CPU_BACKEND_AVX2
+#endif
+
+#include "job_system.hpp"
+
+// CPU versions of the kernels this repo ships: squares.comp, and the gradient.comp and shader.comp image kernels.
+// squares.comp is integer arithmetic, so its output matches the Vulkan path bit for bit. The image kernels do the
+// same float operations in the same order, but Vulkan only requires OpFDiv to be within 2.5 ULP and a store to a
+// UNORM8 image only should round to nearest, so their channels are compared within cpu_validation::UNORM8_TOLERANCE
+// (see --validate-cpu in main.cpp).
+//
+// Work is cut into tiles that fit in L2 and spread over a JobSystem. Within a tile the kernels run eight lanes at a
+// time with AVX2 or four with NEON, and fall back to plain C++ on anything else.
+
+namespace cpu_validation {
+    // Largest difference per 8-bit channel between an image kernel on the device and on the CPU backend. A division
+    // a few ULP off or a conversion that rounds the other way moves a channel by at most one step.
+    constexpr uint32_t UNORM8_TOLERANCE = 1;
+}
+
+enum class Backend { Auto, Vulkan, Cpu };
+
+inline const char* backendName(Backend backend) {
+    switch (backend) {
+        case Backend::Auto:   return "auto";
+        case Backend::Vulkan: return "vulkan";
+        case Backend::Cpu:    return "cpu";
+    }
+    return "unknown";
+}
+
+inline Backend parseBackend(const std::string& name) {
+    if (name == "auto") return Backend::Auto;
+    if (name == "vulkan") return Backend::Vulkan;
+    if (name == "cpu") return Backend::Cpu;
+    throw std::runtime_error("Unknown backend: " + name + " (expected auto, vulkan or cpu)");
+}
+
+// An image kernel the CPU backend can run. gradient.comp and shader.comp both write (x / width, y / height, blue, 1)
+// and only differ in blue.
+struct CpuImageKernel {
+    const char* name;
+    float blue;
+};
+
+inline constexpr CpuImageKernel CPU_IMAGE_KERNELS[] = {
+    { "gradient.comp", 0.5f },
+    { "shader.comp", 0.0f },
+};
+
+// Looks up the CPU version of an image kernel by the name given to --shader. Built-in kernels loaded from disk are
+// called "gradient.comp.spv" and so on, so a trailing .spv is ignored. Nothing is found for other .spv files.
+inline std::optional<CpuImageKernel> findCpuImageKernel(const std::string& shader) {
+    std::string name = std::filesystem::path(shader).filename().string();
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".spv") == 0) name.resize(name.size() - 4);
+
+    for (const auto& kernel : CPU_IMAGE_KERNELS)
+        if (name == kernel.name) return kernel;
+    return std::nullopt;
+}
+
+class CpuBackend {
+public:
+    // Tile sizes. A squares tile is 256 KiB of uints and an image tile 16 KiB of pixels, so a tile and whatever the
+    // other threads are doing stay in cache.
+    static constexpr uint32_t SQUARES_TILE = 1u << 16;
+    static constexpr uint32_t IMAGE_TILE_WIDTH = 256;
+    static constexpr uint32_t IMAGE_TILE_HEIGHT = 16;
+
+    // threadCount includes the calling thread, 0 means one per core (see JobSystem)
+    explicit CpuBackend(uint32_t threadCount = 0) : jobs(threadCount), avx2(detectAvx2()) {}
+
+    uint32_t threadCount() const { return jobs.threadCount(); }
+
+    // True if the kernels have a vector version for this CPU
+    static bool hasSimd() {
+#if defined(CPU_BACKEND_NEON)
+        return true;
+#else
+        return detectAvx2();
+#endif
+    }
+
+    // Instruction set the kernels run with
+    const char* isa() const {
+        if (avx2) return "AVX2";
+#if defined(CPU_BACKEND_NEON)
+        return "NEON";
+#else
+        return "scalar";
+#endif
+    }
+
+    // squares.comp: squares every value in place, wrapping at 2^32 like the GPU does. Squaring rounds times is the
+    // same as running the kernel rounds times, but each tile goes through every round while it is in cache.
+    void squares(std::span<uint32_t> values, uint32_t rounds = 1) {
+        const uint32_t count = static_cast<uint32_t>(values.size());
+        const uint32_t tiles = (count + SQUARES_TILE - 1) / SQUARES_TILE;
+
+        jobs.parallelFor(tiles, [&](uint32_t tile, uint32_t) {
+            uint32_t first = tile * SQUARES_TILE;
+            uint32_t* data = values.data() + first;
+            uint32_t n = std::min(SQUARES_TILE, count - first);
+
+            for (uint32_t round = 0; round < rounds; ++round) squareTile(data, n);
+        });
+    }
+
+    // Runs an image kernel over a tightly packed RGBA8 image of width x height pixels
+    void image(const CpuImageKernel& kernel, uint32_t width, uint32_t height, uint8_t* rgba) {
+        const uint32_t tilesX = (width + IMAGE_TILE_WIDTH - 1) / IMAGE_TILE_WIDTH;
+        const uint32_t tilesY = (height + IMAGE_TILE_HEIGHT - 1) / IMAGE_TILE_HEIGHT;
+
+        jobs.parallelFor(tilesX * tilesY, [&](uint32_t tile, uint32_t) {
+            uint32_t x0 = tile % tilesX * IMAGE_TILE_WIDTH;
+            uint32_t y0 = tile / tilesX * IMAGE_TILE_HEIGHT;
+            uint32_t x1 = std::min(x0 + IMAGE_TILE_WIDTH, width);
+            uint32_t y1 = std::min(y0 + IMAGE_TILE_HEIGHT, height);
+
+            for (uint32_t y = y0; y < y1; ++y) {
+                uint32_t* row = reinterpret_cast<uint32_t*>(rgba) + static_cast<size_t>(y) * width;
+                gradientRow(row, x0, x1, y, width, height, kernel.blue);
+            }
+        });
+    }
+
+private:
+    static bool detectAvx2() {
+#if defined(CPU_BACKEND_X86) && (defined(__GNUC__) || defined(__clang__))
+        return __builtin_cpu_supports("avx2");
+#elif defined(CPU_BACKEND_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        bool osSavesYmm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+        __cpuidex(info, 7, 0);
+        return osSavesYmm && (info[1] & (1 << 5));
+#else
+        return false;
+#endif
+    }
+
+    // Float to UNORM8 the way imageStore() to an rgba8 image does it: clamp, scale by 255, round to nearest even.
+    // std::nearbyint rounds to nearest even in the default rounding mode, like cvtps and vcvtn below.
+    static uint32_t toUnorm8(float value) {
+        return static_cast<uint32_t>(std::nearbyint(std::clamp(value, 0.0f, 1.0f) * 255.0f));
+    }
+
+    static uint32_t packPixel(uint32_t r, uint32_t g, uint32_t b, uint32_t a) {
+        return r | (g << 8) | (b << 16) | (a << 24);
+    }
+
+    // ===================================================== Squares ===================================================
+    void squareTile(uint32_t* data, uint32_t n) const {
+        uint32_t i = 0;
+#if defined(CPU_BACKEND_NEON)
+        for (; i + 4 <= n; i += 4) {
+            uint32x4_t v = vld1q_u32(data + i);
+            vst1q_u32(data + i, vmulq_u32(v, v));
+        }
+#elif defined(CPU_BACKEND_X86)
+        if (avx2) i = squareTileAvx2(data, n);
+#endif
+        for (; i < n; ++i) data[i] *= data[i];
+    }
+
+#if defined(CPU_BACKEND_X86)
+    // Returns how many values it did; the caller finishes the rest
+    CPU_BACKEND_AVX2 static uint32_t squareTileAvx2(uint32_t* data, uint32_t n) {
+        uint32_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), _mm256_mullo_epi32(v, v));
+        }
+        return i;
+    }
+#endif
+
+    // ================================================= Image Gradients ===============================================
+    // Pixels [x0, x1) of row y. Red is x / width and green y / height, both divided in float like the shaders do.
+    // The CPU divides correctly rounded; the device may be up to 2.5 ULP off, which can move a channel by one step.
+    void gradientRow(uint32_t* row, uint32_t x0, uint32_t x1, uint32_t y, uint32_t width, uint32_t height,
+                     float blue) const {
+        const float w = static_cast<float>(width);
+        const uint32_t g = toUnorm8(static_cast<float>(y) / static_cast<float>(height));
+        const uint32_t rest = packPixel(0, g, toUnorm8(blue), 255);
+
+        uint32_t x = x0;
+#if defined(CPU_BACKEND_NEON)
+        const float32x4_t scale = vdupq_n_f32(255.0f);
+        const float32x4_t one = vdupq_n_f32(1.0f);
+        const uint32x4_t restBits = vdupq_n_u32(rest);
+        const float lanes[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+        const float32x4_t laneOffsets = vld1q_f32(lanes);
+
+        for (; x + 4 <= x1; x += 4) {
+            float32x4_t xs = vaddq_f32(vdupq_n_f32(static_cast<float>(x)), laneOffsets);
+            float32x4_t r = vmulq_f32(vminq_f32(vdivq_f32(xs, vdupq_n_f32(w)), one), scale);
+            vst1q_u32(row + x, vorrq_u32(vcvtnq_u32_f32(r), restBits));
+        }
+#elif defined(CPU_BACKEND_X86)
+        if (avx2) x = gradientRowAvx2(row, x0, x1, w, rest);
+#endif
+        for (; x < x1; ++x) row[x] = toUnorm8(static_cast<float>(x) / w) | rest;
+    }
+
+#if defined(CPU_BACKEND_X86)
+    // Returns the first pixel it didn't do. x is below 2^24 in any image Vulkan allows, so it converts to float
+    // exactly.
+    CPU_BACKEND_AVX2 static uint32_t gradientRowAvx2(uint32_t* row, uint32_t x0, uint32_t x1, float w,
+                                                     uint32_t rest) {
+        const __m256 width = _mm256_set1_ps(w);
+        const __m256 scale = _mm256_set1_ps(255.0f);
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256i restBits = _mm256_set1_epi32(static_cast<int>(rest));
+        const __m256 laneOffsets = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+
+        uint32_t x = x0;
+        for (; x + 8 <= x1; x += 8) {
+            __m256 xs = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x)), laneOffsets);
+            __m256 r = _mm256_mul_ps(_mm256_min_ps(_mm256_div_ps(xs, width), one), scale);
+            __m256i bits = _mm256_or_si256(_mm256_cvtps_epi32(r), restBits);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(row + x), bits);
+        }
+        return x;
+    }
+#endif
+
+    JobSystem jobs;
+    bool avx2;
+};
+
+// =============================================== Backend Selection ==================================================
+// Rough cost model behind Backend::Auto. The kernels do next to nothing per element, so on the GPU a small job is all
+// fixed cost: submitting, waiting for the queue and copying the data in and out. The CPU has none of that and wins
+// until the job is big enough for the GPU's throughput to pay for it.
+struct WorkEstimate {
+    uint64_t items = 0;                             // Elements or pixels written, counting every round
+    uint32_t submissions = 0;                       // Queue submissions the Vulkan path waits on
+    uint64_t transferBytes = 0;                     // Copied between host and device memory
+};
+
+namespace backend_cost {
+    constexpr double CPU_SIMD_ITEMS_PER_US = 1000.0;       // Per thread
+    constexpr double CPU_SCALAR_ITEMS_PER_US = 150.0;
+    constexpr double GPU_ITEMS_PER_US = 100000.0;
+    constexpr double GPU_SUBMISSION_US = 50.0;             // Submit, execute and wake the waiting thread
+    constexpr double TRANSFER_BYTES_PER_US = 10000.0;      // About 10 GB/s over PCIe
+}
+
+inline double estimateCpuUs(const WorkEstimate& work, uint32_t threads, bool simd) {
+    double rate = simd ? backend_cost::CPU_SIMD_ITEMS_PER_US : backend_cost::CPU_SCALAR_ITEMS_PER_US;
+    return static_cast<double>(work.items) / (rate * std::max(threads, 1u));
+}
+
+inline double estimateGpuUs(const WorkEstimate& work) {
+    return static_cast<double>(work.items) / backend_cost::GPU_ITEMS_PER_US +
+           work.submissions * backend_cost::GPU_SUBMISSION_US +
+           static_cast<double>(work.transferBytes) / backend_cost::TRANSFER_BYTES_PER_US;
+}
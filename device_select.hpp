@@ -0,0 +1,300 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <ostream>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+#include <cstdint>
+
+#include "queue_topology.hpp"
+
+#ifndef VK_CHECK
+#define VK_CHECK(x) do { VkResult err = x; if (err != VK_SUCCESS) throw std::runtime_error("Vulkan error at " #x); } while(0)
+#endif
+
+// Environment variable that forces a device when no override is given on the command line
+constexpr const char* DEVICE_OVERRIDE_ENV = "VULKAN_DEVICE";
+
+// What a device needs to be usable at all. Devices missing any of it are skipped, whatever their score.
+struct DeviceRequirements {
+    VkSurfaceKHR surface = VK_NULL_HANDLE;          // If set, a graphics and compute family has to present to it
+    std::vector<const char*> extensions;            // Device extensions that have to be there
+    uint32_t apiVersion = VK_API_VERSION_1_3;       // Synchronization2 is core and always there from 1.3 on
+    bool timelineSemaphore = true;
+};
+
+// A device and how it fared. Rejected devices have a non-empty rejection and no score.
+struct DeviceCandidate {
+    VkPhysicalDevice gpu = VK_NULL_HANDLE;
+    uint32_t index = 0;                             // Position in vkEnumeratePhysicalDevices
+    std::string name;
+    std::string uuid;                               // Hex, as in the workgroup tuning file
+    std::string summary;                            // What the score is made of, for the log
+    std::string rejection;
+    int64_t score = 0;
+};
+
+// Device scores. The type dominates: a discrete GPU beats an integrated one, which beats a software rasterizer like
+// lavapipe or SwiftShader, whatever else they have. Within a type, more device-local memory, bigger compute limits,
+// wider subgroups and separate async compute and transfer families break the tie.
+namespace device_score {
+    constexpr int64_t DISCRETE = 40000;
+    constexpr int64_t INTEGRATED = 30000;
+    constexpr int64_t VIRTUAL = 20000;
+    constexpr int64_t OTHER = 10000;
+    constexpr int64_t CPU = 0;
+
+    // Everything below adds up to well under the gap between two types
+    constexpr int64_t PER_GIB_DEVICE_LOCAL = 100;   // Largest device-local heap, counted up to MAX_GIB
+    constexpr int64_t MAX_GIB = 64;
+    constexpr int64_t ASYNC_COMPUTE_FAMILY = 50;
+    constexpr int64_t TRANSFER_FAMILY = 25;
+}
+
+inline std::string uuidString(const uint8_t (&uuid)[VK_UUID_SIZE]) {
+    std::ostringstream out;
+    for (uint8_t byte : uuid) out << std::hex << std::setw(2) << std::setfill('0') << static_cast<unsigned>(byte);
+    return out.str();
+}
+
+// Checks one device against the requirements and scores it
+inline DeviceCandidate scoreDevice(VkPhysicalDevice gpu, uint32_t index, const DeviceRequirements& requirements) {
+    DeviceCandidate candidate;
+    candidate.gpu = gpu;
+    candidate.index = index;
+
+    VkPhysicalDeviceSubgroupProperties subgroupProps{};
+    subgroupProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+
+    VkPhysicalDeviceIDProperties idProps{};
+    idProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+    idProps.pNext = &subgroupProps;
+
+    VkPhysicalDeviceProperties2 props{};
+    props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    props.pNext = &idProps;
+    vkGetPhysicalDeviceProperties2(gpu, &props);
+
+    const VkPhysicalDeviceProperties& properties = props.properties;
+    candidate.name = properties.deviceName;
+    candidate.uuid = uuidString(idProps.deviceUUID);
+
+    // ================================================== Requirements =================================================
+    if (properties.apiVersion < requirements.apiVersion) {
+        candidate.rejection = "Vulkan " + std::to_string(VK_API_VERSION_MAJOR(properties.apiVersion)) + "." +
+                              std::to_string(VK_API_VERSION_MINOR(properties.apiVersion)) + " is too old";
+        return candidate;
+    }
+
+    uint32_t extensionCount = 0;
+    VK_CHECK(vkEnumerateDeviceExtensionProperties(gpu, nullptr, &extensionCount, nullptr));
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    VK_CHECK(vkEnumerateDeviceExtensionProperties(gpu, nullptr, &extensionCount, extensions.data()));
+
+    for (const char* required : requirements.extensions) {
+        bool found = std::any_of(extensions.begin(), extensions.end(), [&](const VkExtensionProperties& extension) {
+            return std::strcmp(extension.extensionName, required) == 0;
+        });
+        if (!found) {
+            candidate.rejection = std::string("no ") + required;
+            return candidate;
+        }
+    }
+
+    if (requirements.timelineSemaphore) {
+        VkPhysicalDeviceVulkan12Features features12{};
+        features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+        VkPhysicalDeviceFeatures2 features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &features12;
+        vkGetPhysicalDeviceFeatures2(gpu, &features);
+
+        if (!features12.timelineSemaphore) {
+            candidate.rejection = "no timeline semaphores";
+            return candidate;
+        }
+    }
+
+    QueueTopology topology;
+    try {
+        topology = discoverQueues(gpu, requirements.surface);
+    } catch (const std::exception& e) {
+        candidate.rejection = e.what();
+        return candidate;
+    }
+
+    // ===================================================== Score =====================================================
+    std::ostringstream summary;
+
+    switch (properties.deviceType) {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+            candidate.score = device_score::DISCRETE;
+            summary << "discrete GPU";
+            break;
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+            candidate.score = device_score::INTEGRATED;
+            summary << "integrated GPU";
+            break;
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+            candidate.score = device_score::VIRTUAL;
+            summary << "virtual GPU";
+            break;
+        case VK_PHYSICAL_DEVICE_TYPE_CPU:
+            candidate.score = device_score::CPU;
+            summary << "CPU";
+            break;
+        default:
+            candidate.score = device_score::OTHER;
+            summary << "other";
+            break;
+    }
+
+    VkPhysicalDeviceMemoryProperties memoryProps;
+    vkGetPhysicalDeviceMemoryProperties(gpu, &memoryProps);
+
+    VkDeviceSize deviceLocal = 0;
+    for (uint32_t i = 0; i < memoryProps.memoryHeapCount; ++i)
+        if (memoryProps.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+            deviceLocal = std::max(deviceLocal, memoryProps.memoryHeaps[i].size);
+
+    int64_t gib = static_cast<int64_t>(deviceLocal >> 30);
+    candidate.score += std::min(gib, device_score::MAX_GIB) * device_score::PER_GIB_DEVICE_LOCAL;
+    summary << ", " << gib << " GiB device local";
+
+    // Roughly 16 points for a 1024 invocation workgroup, 12 for 48 KiB of shared memory and 4 to 8 for the subgroup
+    candidate.score += properties.limits.maxComputeWorkGroupInvocations / 64;
+    candidate.score += properties.limits.maxComputeSharedMemorySize / 4096;
+    candidate.score += subgroupProps.subgroupSize / 8;
+    summary << ", " << properties.limits.maxComputeWorkGroupInvocations << " invocations, "
+            << properties.limits.maxComputeSharedMemorySize / 1024 << " KiB shared, subgroup "
+            << subgroupProps.subgroupSize;
+
+    if (topology.compute.family != topology.primary.family) {
+        candidate.score += device_score::ASYNC_COMPUTE_FAMILY;
+        summary << ", async compute family";
+    }
+    if (topology.dedicatedTransfer()) {
+        candidate.score += device_score::TRANSFER_FAMILY;
+        summary << ", transfer family";
+    }
+
+    candidate.summary = summary.str();
+    return candidate;
+}
+
+// Finds the device an override names, trying in turn:
+//   1. an index into all enumerated devices, if the override is all digits
+//   2. a prefix of the UUID, at least 8 hex digits, dashes ignored
+//   3. part of the name, case insensitive
+// The first kind that matches anything decides. Throws if nothing matches or if a UUID prefix or name matches more
+// than one device, rather than quietly taking the first of them.
+inline const DeviceCandidate& findOverride(const std::vector<DeviceCandidate>& candidates, const std::string& pattern,
+                                           const std::string& source) {
+    const std::string what = source + "=" + pattern;
+
+    auto isDigit = [](unsigned char c) { return std::isdigit(c) != 0; };
+    if (!pattern.empty() && std::all_of(pattern.begin(), pattern.end(), isDigit)) {
+        unsigned long index = pattern.size() <= 9 ? std::stoul(pattern) : ULONG_MAX;
+        if (index < candidates.size()) return candidates[index];
+    }
+
+    auto lower = [](std::string text) {
+        std::transform(text.begin(), text.end(), text.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return text;
+    };
+
+    auto unique = [&](const std::vector<const DeviceCandidate*>& matches, const char* kind) -> const DeviceCandidate* {
+        if (matches.size() <= 1) return matches.empty() ? nullptr : matches.front();
+
+        std::string names;
+        for (const DeviceCandidate* match : matches)
+            names += "\n  " + std::to_string(match->index) + " " + match->name + " [" + match->uuid.substr(0, 8) + "]";
+        throw std::runtime_error(what + " matches the " + kind + " of " + std::to_string(matches.size()) +
+                                 " devices, give an index or UUID instead:" + names);
+    };
+
+    std::string uuid = lower(pattern);
+    uuid.erase(std::remove(uuid.begin(), uuid.end(), '-'), uuid.end());     // UUIDs are often dashed
+    std::vector<const DeviceCandidate*> matches;
+    if (uuid.size() >= 8)
+        for (const auto& candidate : candidates)
+            if (candidate.uuid.compare(0, uuid.size(), uuid) == 0) matches.push_back(&candidate);
+    if (const DeviceCandidate* match = unique(matches, "UUID")) return *match;
+
+    for (const auto& candidate : candidates)
+        if (lower(candidate.name).find(lower(pattern)) != std::string::npos) matches.push_back(&candidate);
+    if (const DeviceCandidate* match = unique(matches, "name")) return *match;
+
+    throw std::runtime_error("No device matches " + what);
+}
+
+// Picks the physical device to use and logs the choice and why.
+//
+// With an override (from the command line, or else the VULKAN_DEVICE environment variable) the one device it
+// names is used (see findOverride()), provided it meets the requirements. Otherwise every device is scored and the
+// best usable one wins; ties go to the one enumerated first.
+inline VkPhysicalDevice selectPhysicalDevice(VkInstance instance, const DeviceRequirements& requirements,
+                                             std::string deviceOverride, std::ostream& log) {
+    uint32_t gpuCount = 0;
+    VK_CHECK(vkEnumeratePhysicalDevices(instance, &gpuCount, nullptr));
+    if (gpuCount == 0) throw std::runtime_error("No Vulkan devices found");
+    std::vector<VkPhysicalDevice> gpus(gpuCount);
+    VK_CHECK(vkEnumeratePhysicalDevices(instance, &gpuCount, gpus.data()));
+
+    std::vector<DeviceCandidate> candidates;
+    for (uint32_t i = 0; i < gpuCount; ++i) candidates.push_back(scoreDevice(gpus[i], i, requirements));
+
+    std::string source = "--device";
+    if (deviceOverride.empty()) {
+        const char* env = std::getenv(DEVICE_OVERRIDE_ENV);
+        if (env && *env) {
+            deviceOverride = env;
+            source = DEVICE_OVERRIDE_ENV;
+        }
+    }
+
+    const DeviceCandidate* chosen = nullptr;
+    std::string reason;
+
+    if (!deviceOverride.empty()) {
+        chosen = &findOverride(candidates, deviceOverride, source);
+        if (!chosen->rejection.empty())
+            throw std::runtime_error("Device " + chosen->name + " from " + source + " can't be used: " +
+                                     chosen->rejection);
+        reason = "forced by " + source + "=" + deviceOverride;
+    } else {
+        for (const auto& candidate : candidates)
+            if (candidate.rejection.empty() && (!chosen || candidate.score > chosen->score)) chosen = &candidate;
+
+        if (!chosen) {
+            std::string why;
+            for (const auto& candidate : candidates) why += "\n  " + candidate.name + ": " + candidate.rejection;
+            throw std::runtime_error("No usable Vulkan device:" + why);
+        }
+        reason = "highest score of " + std::to_string(candidates.size()) + " device" +
+                 (candidates.size() == 1 ? "" : "s");
+    }
+
+    log << "Using device " << chosen->index << ": " << chosen->name << " (" << reason << ")\n";
+    for (const auto& candidate : candidates) {
+        log << (&candidate == chosen ? "  * " : "    ") << candidate.index << " " << candidate.name << " ["
+            << candidate.uuid.substr(0, 8) << "] ";
+        if (candidate.rejection.empty())
+            log << "score " << candidate.score << ": " << candidate.summary << "\n";
+        else
+            log << "unusable: " << candidate.rejection << "\n";
+    }
+
+    return chosen->gpu;
+}
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include <stdexcept>
+#include <cstdint>
+
+#include "compute_context.hpp"
+#include "kernel.hpp"
+#include "timeline.hpp"
+
+// A dispatch recorded once into a secondary command buffer: pipeline, descriptor set, push constants and group
+// counts. It can be enqueued any number of times, including while earlier copies are still executing.
+struct RecordedDispatch {
+    VkCommandBuffer commands = VK_NULL_HANDLE;
+};
+
+// Packs many small dispatches into few submissions.
+//
+// Workloads made of thousands of tiny kernels spend most of their time in vkQueueSubmit and command recording, not
+// on the GPU. Here every dispatch is recorded once up front, and enqueue() only appends it to a pending batch. When
+// the batch is full (or flush() is called) all of it goes out as one primary command buffer that executes the
+// recorded dispatches, in one vkQueueSubmit. Each batch has a shared future that becomes ready when the GPU has
+// finished it. Batches signal consecutive values of one timeline semaphore, and a background thread waits on it so
+// nobody has to poll.
+//
+// Dispatches in a batch may run concurrently. Call barrier() between dispatches that depend on each other; it orders
+// everything enqueued before it against everything enqueued after it, across batch boundaries too.
+class Dispatcher {
+public:
+    static constexpr uint32_t DEFAULT_BATCH_SIZE = 1024;
+
+    Dispatcher(const ComputeContext& ctx, uint32_t batchSize = DEFAULT_BATCH_SIZE)
+        : ctx(ctx), batchSize(batchSize), timeline(ctx.device) {
+        if (batchSize == 0) throw std::runtime_error("Batch size must be at least 1");
+
+        // Recorded dispatches live as long as the dispatcher. Batch command buffers are reset and reused.
+        VkCommandPoolCreateInfo poolCI{};
+        poolCI.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolCI.queueFamilyIndex = ctx.computeIndex;
+
+        VK_CHECK(vkCreateCommandPool(ctx.device, &poolCI, nullptr, &recordedPool));
+
+        poolCI.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        VK_CHECK(vkCreateCommandPool(ctx.device, &poolCI, nullptr, &batchPool));
+
+        waiter = std::thread([this] { waitLoop(); });
+    }
+
+    ~Dispatcher() {
+        waitIdle();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        submittedCondition.notify_one();
+        waiter.join();
+
+        vkDestroyCommandPool(ctx.device, batchPool, nullptr);
+        vkDestroyCommandPool(ctx.device, recordedPool, nullptr);
+    }
+
+    Dispatcher(const Dispatcher&) = delete;
+    Dispatcher& operator=(const Dispatcher&) = delete;
+
+    // Records a dispatch of the kernel. pushConstants must hold kernel.pushConstantSize bytes, if the kernel has any.
+    RecordedDispatch record(const ComputeKernel& kernel, VkDescriptorSet descriptorSet, uint32_t groupsX,
+                            uint32_t groupsY = 1, uint32_t groupsZ = 1, const void* pushConstants = nullptr) {
+        VkCommandBufferAllocateInfo cmdBufAI{};
+        cmdBufAI.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        cmdBufAI.commandPool = recordedPool;
+        cmdBufAI.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        cmdBufAI.commandBufferCount = 1;
+
+        RecordedDispatch dispatch;
+        VK_CHECK(vkAllocateCommandBuffers(ctx.device, &cmdBufAI, &dispatch.commands));
+
+        // Compute work doesn't run inside a render pass, so there is nothing to inherit
+        VkCommandBufferInheritanceInfo inheritance{};
+        inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+
+        // Simultaneous use lets the same dispatch sit in several batches that are in flight at once
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+        beginInfo.pInheritanceInfo = &inheritance;
+        VK_CHECK(vkBeginCommandBuffer(dispatch.commands, &beginInfo));
+
+        vkCmdBindPipeline(dispatch.commands, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline);
+        vkCmdBindDescriptorSets(dispatch.commands, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.layout, 0, 1,
+                                &descriptorSet, 0, nullptr);
+        if (kernel.pushConstantSize > 0)
+            vkCmdPushConstants(dispatch.commands, kernel.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                               kernel.pushConstantSize, pushConstants);
+        vkCmdDispatch(dispatch.commands, groupsX, groupsY, groupsZ);
+
+        VK_CHECK(vkEndCommandBuffer(dispatch.commands));
+        return dispatch;
+    }
+
+    // Frees a recorded dispatch. It must not be in any batch that is pending or in flight.
+    void release(RecordedDispatch& dispatch) {
+        vkFreeCommandBuffers(ctx.device, recordedPool, 1, &dispatch.commands);
+        dispatch.commands = VK_NULL_HANDLE;
+    }
+
+    // Adds a dispatch to the pending batch and returns the future of that batch. Submits the batch if it is full.
+    std::shared_future<void> enqueue(const RecordedDispatch& dispatch) {
+        if (!pending) startBatch();
+
+        pending->entries.push_back(dispatch.commands);
+        std::shared_future<void> future = pending->future;
+        if (++pending->dispatchCount >= batchSize) flush();
+        return future;
+    }
+
+    // Makes the results of everything enqueued so far visible to everything enqueued afterwards
+    void barrier() {
+        if (!pending) startBatch();
+        pending->entries.push_back(VK_NULL_HANDLE);
+    }
+
+    // Submits the pending batch, if there is one
+    void flush() {
+        if (!pending) return;
+
+        Batch& batch = *pending;
+        VkCommandBuffer cmd = batch.commands;
+
+        // Runs of recorded dispatches go into one vkCmdExecuteCommands each, split by the barriers
+        size_t runStart = 0;
+        for (size_t i = 0; i <= batch.entries.size(); ++i) {
+            bool isBarrier = i < batch.entries.size() && batch.entries[i] == VK_NULL_HANDLE;
+            if (i < batch.entries.size() && !isBarrier) continue;
+
+            if (i > runStart)
+                vkCmdExecuteCommands(cmd, static_cast<uint32_t>(i - runStart), &batch.entries[runStart]);
+
+            if (isBarrier) {
+                VkMemoryBarrier memoryBarrier{};
+                memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+                memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+                memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+                vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                     0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+            }
+
+            runStart = i + 1;
+        }
+
+        VK_CHECK(vkEndCommandBuffer(cmd));
+
+        batch.value = timeline.next();
+        SemaphoreSignal done{ timeline.handle(), batch.value };
+        queueSubmit(ctx.queue, { &cmd, 1 }, {}, { &done, 1 });
+        ++submitCount;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            submitted.push_back(std::move(pending));
+        }
+        submittedCondition.notify_one();
+    }
+
+    // Submits the pending batch and blocks until every batch has finished
+    void waitIdle() {
+        flush();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        finishedCondition.wait(lock, [this] { return submitted.empty(); });
+    }
+
+    // Number of vkQueueSubmit calls made so far
+    uint64_t submissions() const { return submitCount; }
+
+private:
+    struct Batch {
+        VkCommandBuffer commands = VK_NULL_HANDLE;
+        uint64_t value = 0;                             // Timeline value the batch signals when it finishes
+        std::vector<VkCommandBuffer> entries;           // Recorded dispatches, VK_NULL_HANDLE marks a barrier
+        uint32_t dispatchCount = 0;
+        std::promise<void> promise;
+        std::shared_future<void> future;
+    };
+
+    // Takes a finished batch for reuse, or makes a new one. Only called from the submitting thread, which is the only
+    // one that touches the command pools.
+    void startBatch() {
+        std::unique_ptr<Batch> batch;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!finished.empty()) {
+                batch = std::move(finished.front());
+                finished.pop_front();
+            }
+        }
+
+        if (batch) {
+            VK_CHECK(vkResetCommandBuffer(batch->commands, 0));
+            batch->entries.clear();
+            batch->dispatchCount = 0;
+        } else {
+            batch = std::make_unique<Batch>();
+
+            VkCommandBufferAllocateInfo cmdBufAI{};
+            cmdBufAI.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            cmdBufAI.commandPool = batchPool;
+            cmdBufAI.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            cmdBufAI.commandBufferCount = 1;
+            VK_CHECK(vkAllocateCommandBuffers(ctx.device, &cmdBufAI, &batch->commands));
+        }
+
+        batch->promise = std::promise<void>();
+        batch->future = batch->promise.get_future().share();
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VK_CHECK(vkBeginCommandBuffer(batch->commands, &beginInfo));
+
+        pending = std::move(batch);
+    }
+
+    // Runs on the waiter thread. Batches finish in submission order since they all go to the same queue.
+    void waitLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (true) {
+            submittedCondition.wait(lock, [this] { return stopping || !submitted.empty(); });
+            if (submitted.empty()) return;
+
+            Batch* batch = submitted.front().get();
+            lock.unlock();
+
+            try {
+                timeline.wait(batch->value);
+                markDispatchFinished(ctx);
+                batch->promise.set_value();
+            } catch (...) {
+                batch->promise.set_exception(std::make_exception_ptr(
+                    std::runtime_error("Waiting for a dispatch batch failed")));
+            }
+
+            lock.lock();
+            finished.push_back(std::move(submitted.front()));
+            submitted.pop_front();
+            finishedCondition.notify_all();
+        }
+    }
+
+    const ComputeContext& ctx;
+    uint32_t batchSize;
+    VkCommandPool recordedPool = VK_NULL_HANDLE;
+    VkCommandPool batchPool = VK_NULL_HANDLE;
+    uint64_t submitCount = 0;
+    Timeline timeline;
+
+    std::unique_ptr<Batch> pending;                     // Being filled by enqueue(), not submitted yet
+
+    std::mutex mutex;                                   // Guards the two queues below and stopping
+    std::deque<std::unique_ptr<Batch>> submitted;       // In flight, oldest first
+    std::deque<std::unique_ptr<Batch>> finished;        // Done, ready to be reused
+    std::condition_variable submittedCondition;
+    std::condition_variable finishedCondition;
+    bool stopping = false;
+
+    std::thread waiter;
+};
@@ -0,0 +1,357 @@
+#pragma once
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <vector>
+#include <array>
+#include <memory>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+
+#include "swapchain.hpp"
+#include "shader_loader.hpp"
+#include "profiler.hpp"
+#include "pipeline_manager.hpp"
+#include "frame_graph.hpp"
+#include "tiling.hpp"
+
+// How a frame gets from the kernel onto the screen
+enum class DisplayPath {
+    Direct,                 // The kernel writes straight into the acquired swapchain image. Nothing is copied.
+    Blit,                   // The kernel writes an offscreen image, which is blitted into the swapchain image
+    Async,                  // Like Blit, but the kernel runs on the async compute queue with one image per frame slot
+};
+
+// Puts an image kernel on screen: gradient.comp, shader.comp or any .spv that writes an rgba8 storage image bound at
+// set 0, binding 0.
+//
+// If the swapchain images can be storage images (see Swapchain::storage), the kernel writes straight into them.
+// Otherwise it writes into an offscreen R8G8B8A8 image that is blitted into the swapchain image. The blit also
+// converts to whatever format the surface uses. With async compute, every frame slot has its own offscreen image and
+// the kernel runs on the compute queue, so the kernel of frame N+1 runs while frame N is blitted and presented. The
+// image is handed from the compute family to the graphics family with a release/acquire barrier pair, and the
+// graphics submission waits on the compute submission's semaphore. Each queue's part of a frame is described to a
+// FrameGraph, which works out the barriers.
+//
+// Descriptor sets and offscreen images depend on the swapchain, so resize() rebuilds them along with it. Like the
+// swapchain, the old ones are kept until every frame that could have used them has finished.
+//
+// The pipeline is compiled by a PipelineManager on a worker thread, so the first frames don't wait for it. Until it is
+// ready, frames clear the image to black instead of running the kernel. Given a GLSL source, the manager rebuilds the
+// pipeline whenever the file changes and the next frame picks it up.
+class DisplayKernel {
+public:
+    // Layout the kernel, or the clear standing in for it, leaves its image in
+    static constexpr VkImageLayout KERNEL_LAYOUT = VK_IMAGE_LAYOUT_GENERAL;
+
+    // The clear standing in for the kernel while its pipeline compiles
+    static constexpr ResourceUse CLEAR{ VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, KERNEL_LAYOUT };
+
+    // An Async offscreen image as the compute queue leaves it for the blit on the graphics queue
+    static constexpr ResourceUse HANDED_OVER{ VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+                                              VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL };
+
+    // graphicsFamily is where frames are blitted and presented, computeFamily where recordCompute()'s command
+    // buffers are submitted. asyncCompute picks the Async path over the other two. source is the GLSL file shaderName
+    // was compiled from, to rebuild the kernel from when it changes, or empty. The pipeline is specialized to
+    // workgroupSize, the device's tuned size or IMAGE_WORKGROUP_SIZE (see autotune.hpp).
+    DisplayKernel(const vk::raii::Device& device, PipelineManager& pipelines, const std::string& shaderName,
+                  const std::string& source, uint32_t framesInFlight, uint32_t graphicsFamily, uint32_t computeFamily,
+                  bool asyncCompute, WorkgroupSize workgroupSize = IMAGE_WORKGROUP_SIZE)
+        : pipelines(pipelines), framesInFlight(framesInFlight), graphicsFamily(graphicsFamily),
+          computeFamily(computeFamily), asyncCompute(asyncCompute), workgroupSize(workgroupSize) {
+        vk::DescriptorSetLayoutBinding binding(0, vk::DescriptorType::eStorageImage, 1,
+                                               vk::ShaderStageFlagBits::eCompute);
+
+        vk::DescriptorSetLayoutCreateInfo setLayoutInfo{};
+        setLayoutInfo.setBindings(binding);
+
+        setLayout = vk::raii::DescriptorSetLayout(device, setLayoutInfo);
+
+        // The kernels take a tile offset and the full image size as push constants (ImageTileConstants). The display
+        // always draws the whole image as one tile.
+        vk::PushConstantRange pushConstants(vk::ShaderStageFlagBits::eCompute, 0, sizeof(ImageTileConstants));
+
+        vk::PipelineLayoutCreateInfo layoutInfo{};
+        layoutInfo.setSetLayouts(*setLayout)
+                  .setPushConstantRanges(pushConstants);
+
+        layout = vk::raii::PipelineLayout(device, layoutInfo);
+
+        PipelineRequest request;
+        request.shader = shaderName;
+        request.layout = *layout;
+        request.specialization = { workgroupSize.x, workgroupSize.y, workgroupSize.z };
+        request.source = source;
+        pipeline = pipelines.request(std::move(request));
+    }
+
+    // False while the pipeline is still being compiled, or if it failed to
+    bool ready() const { return pipelines.ready(pipeline); }
+
+    DisplayPath path() const { return targets.path; }
+
+    // The first stage of the graphics submission that touches the acquired image. It waits on the image available
+    // semaphore (and on the Async path, on the compute submission) there.
+    vk::PipelineStageFlags waitStage() const {
+        return targets.path == DisplayPath::Direct ? vk::PipelineStageFlagBits::eComputeShader
+                                                   : vk::PipelineStageFlagBits::eTransfer;
+    }
+
+    // Rebuilds the descriptor sets and offscreen images for a new or rebuilt swapchain. frameNumber is the number of
+    // the next frame to be recorded; every frame before it may still use the old ones.
+    void resize(const vk::raii::PhysicalDevice& physicalDevice, const vk::raii::Device& device,
+                const Swapchain& swapchain, int64_t frameNumber) {
+        if (*targets.pool) {
+            targets.lastUsedFrame = frameNumber - 1;
+            retired.push_back(std::move(targets));
+        }
+
+        // The graphs hold no images of their own, so they outlive any number of swapchains
+        if (!graph) {
+            graph = std::make_unique<FrameGraph>(static_cast<VkPhysicalDevice>(*physicalDevice),
+                                                 static_cast<VkDevice>(*device));
+            computeGraph = std::make_unique<FrameGraph>(static_cast<VkPhysicalDevice>(*physicalDevice),
+                                                        static_cast<VkDevice>(*device));
+        }
+
+        targets = Targets{};
+        targets.extent = swapchain.extent;
+        targets.path = asyncCompute ? DisplayPath::Async
+                                    : swapchain.storage ? DisplayPath::Direct : DisplayPath::Blit;
+
+        if (targets.path != DisplayPath::Direct) {
+            vk::FormatProperties props = physicalDevice.getFormatProperties(swapchain.surfaceFormat.format);
+            if (!(props.optimalTilingFeatures & vk::FormatFeatureFlagBits::eBlitDst))
+                throw std::runtime_error("Swapchain format " + vk::to_string(swapchain.surfaceFormat.format) +
+                                         " can neither be written by a kernel nor blitted to");
+
+            uint32_t count = targets.path == DisplayPath::Async ? framesInFlight : 1;
+            for (uint32_t i = 0; i < count; ++i) targets.offscreen.push_back(createOffscreen(physicalDevice, device));
+        }
+
+        // One set per swapchain image when writing to them directly, otherwise one per offscreen image
+        uint32_t setCount = static_cast<uint32_t>(targets.path == DisplayPath::Direct ? swapchain.imageViews.size()
+                                                                                       : targets.offscreen.size());
+
+        vk::DescriptorPoolSize poolSize(vk::DescriptorType::eStorageImage, setCount);
+
+        vk::DescriptorPoolCreateInfo poolInfo{};
+        poolInfo.setFlags(vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet)        // Sets are freed by RAII
+                .setMaxSets(setCount)
+                .setPoolSizes(poolSize);
+
+        targets.pool = vk::raii::DescriptorPool(device, poolInfo);
+
+        std::vector<vk::DescriptorSetLayout> setLayouts(setCount, *setLayout);
+
+        vk::DescriptorSetAllocateInfo allocInfo{};
+        allocInfo.setDescriptorPool(*targets.pool)
+                 .setSetLayouts(setLayouts);
+
+        vk::raii::DescriptorSets sets(device, allocInfo);
+
+        for (uint32_t i = 0; i < setCount; ++i) {
+            vk::ImageView view = targets.path == DisplayPath::Direct ? *swapchain.imageViews[i]
+                                                                     : *targets.offscreen[i].view;
+            vk::DescriptorImageInfo imageInfo(nullptr, view, vk::ImageLayout::eGeneral);
+
+            vk::WriteDescriptorSet write{};
+            write.setDstSet(*sets[i])
+                 .setDstBinding(0)
+                 .setDescriptorType(vk::DescriptorType::eStorageImage)
+                 .setImageInfo(imageInfo);
+
+            device.updateDescriptorSets(write, nullptr);
+            targets.sets.push_back(std::move(sets[i]));
+        }
+    }
+
+    // Destroys retired sets and offscreen images once the GPU has finished every frame up to completedFrame
+    void collectGarbage(int64_t completedFrame) {
+        std::erase_if(retired, [&](const Targets& t) { return t.lastUsedFrame <= completedFrame; });
+    }
+
+    // Async path only. Records the kernel for a frame slot into a command buffer for the compute queue, ending with
+    // the release of the slot's offscreen image to the graphics family. The slot's previous frame must have finished.
+    void recordCompute(const vk::raii::CommandBuffer& cmd, GpuProfiler& profiler, uint32_t frameSlot) {
+        computeGraph->reset();
+
+        // The last frame that used this slot is done, so there is nothing to wait for and the old contents can go
+        FrameGraph::Resource target = computeGraph->importImage("offscreen", handle(targets.offscreen[frameSlot]));
+        addKernelPass(*computeGraph, profiler, *targets.sets[frameSlot], target);
+
+        // General -> blit source, and release to the graphics family. The acquire half is in record().
+        computeGraph->output(target, HANDED_OVER, handover());
+        computeGraph->compile();
+        computeGraph->execute(static_cast<VkCommandBuffer>(*cmd));
+    }
+
+    // Records the graphics queue's part of a frame and leaves the swapchain image ready to present. That is the
+    // whole kernel on the Direct and Blit paths, and just the acquire and the blit on the Async path.
+    void record(const vk::raii::CommandBuffer& cmd, GpuProfiler& profiler, uint32_t frameSlot, uint32_t imageIndex,
+                vk::Image image) {
+        graph->reset();
+
+        // The acquired image's old contents don't matter. Its first use waits for the semaphore wait stage.
+        VkPipelineStageFlags2 waitStage2 = targets.path == DisplayPath::Direct ? VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT
+                                                                               : VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+        FrameGraph::Resource swapchainImage =
+            graph->importImage("swapchain", static_cast<VkImage>(image), { waitStage2, VK_ACCESS_2_NONE });
+
+        if (targets.path == DisplayPath::Direct) {
+            addKernelPass(*graph, profiler, *targets.sets[imageIndex], swapchainImage);
+        } else {
+            FrameGraph::Resource source;
+
+            if (targets.path == DisplayPath::Blit) {
+                // The previous frame's blit may still be reading the offscreen image
+                source = graph->importImage("offscreen", handle(targets.offscreen[0]),
+                                            { VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_NONE });
+                addKernelPass(*graph, profiler, *targets.sets[0], source);
+            } else {
+                // Written on the compute queue and waited for with a semaphore in the Transfer stage. Across
+                // families this acquires it, repeating the release's transition; within one, recordCompute() already
+                // did the transition and the semaphore alone makes the writes visible.
+                OwnershipTransfer acquire = handover();
+                ResourceUse initial{ VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_NONE,
+                                     acquire.active() ? KERNEL_LAYOUT : HANDED_OVER.layout };
+                source = graph->importImage("offscreen", handle(targets.offscreen[frameSlot]), initial, acquire);
+            }
+
+            graph->addPass("blit", [this, &profiler, source, swapchainImage](VkCommandBuffer cmd) {
+                vk::ImageSubresourceLayers layers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+                std::array<vk::Offset3D, 2> bounds{ vk::Offset3D{ 0, 0, 0 },
+                                                    vk::Offset3D{ static_cast<int32_t>(targets.extent.width),
+                                                                  static_cast<int32_t>(targets.extent.height), 1 } };
+
+                vk::ImageBlit blit(layers, bounds, layers, bounds);
+
+                GpuProfiler::Scope scope(profiler, cmd, "blit");
+                vk::CommandBuffer(cmd).blitImage(vk::Image(graph->image(source)), vk::ImageLayout::eTransferSrcOptimal,
+                                                 vk::Image(graph->image(swapchainImage)),
+                                                 vk::ImageLayout::eTransferDstOptimal, blit, vk::Filter::eNearest);
+            }).read(source, resource_use::TRANSFER_READ).write(swapchainImage, resource_use::TRANSFER_WRITE);
+        }
+
+        graph->output(swapchainImage, resource_use::PRESENT);
+        graph->compile();
+        graph->execute(static_cast<VkCommandBuffer>(*cmd));
+    }
+
+private:
+    // An offscreen storage image. Members are destroyed bottom to top, so the view goes before its image and the
+    // image before its memory.
+    struct Offscreen {
+        vk::raii::DeviceMemory memory{nullptr};
+        vk::raii::Image image{nullptr};
+        vk::raii::ImageView view{nullptr};
+    };
+
+    // Everything that has to be rebuilt with the swapchain. The sets are destroyed before their pool.
+    struct Targets {
+        std::vector<Offscreen> offscreen;                               // None on the Direct path
+        vk::raii::DescriptorPool pool{nullptr};
+        std::vector<vk::raii::DescriptorSet> sets;
+        vk::Extent2D extent{};
+        DisplayPath path = DisplayPath::Direct;
+        int64_t lastUsedFrame = 0;
+    };
+
+    // The kernel writing target, or while the pipeline is still compiling, a clear to black. Both leave the image
+    // in KERNEL_LAYOUT, so what comes after doesn't have to know which it was.
+    void addKernelPass(FrameGraph& frame, GpuProfiler& profiler, vk::DescriptorSet set, FrameGraph::Resource target) {
+        vk::Pipeline kernel(pipelines.get(pipeline));
+        if (!kernel) {
+            frame.addPass("clear", [&frame, target](VkCommandBuffer cmd) {
+                vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+                vk::CommandBuffer(cmd).clearColorImage(vk::Image(frame.image(target)),
+                                                       static_cast<vk::ImageLayout>(KERNEL_LAYOUT),
+                                                       vk::ClearColorValue(0.0f, 0.0f, 0.0f, 1.0f), range);
+            }).write(target, CLEAR);
+            return;
+        }
+
+        frame.addPass("dispatch", [this, &profiler, kernel, set](VkCommandBuffer cmd) {
+            vk::CommandBuffer commands(cmd);
+            GpuProfiler::Scope scope(profiler, cmd, "dispatch");
+            commands.bindPipeline(vk::PipelineBindPoint::eCompute, kernel);
+            commands.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *layout, 0, set, nullptr);
+
+            ImageTileConstants tile{ 0, 0, static_cast<int32_t>(targets.extent.width),
+                                     static_cast<int32_t>(targets.extent.height) };
+            commands.pushConstants<ImageTileConstants>(*layout, vk::ShaderStageFlagBits::eCompute, 0, tile);
+            commands.dispatch(groupCount(targets.extent.width, workgroupSize.x),
+                              groupCount(targets.extent.height, workgroupSize.y), 1);
+        }).write(target, resource_use::COMPUTE_WRITE);
+    }
+
+    // From the compute family to the graphics family, or nothing if they are the same
+    OwnershipTransfer handover() const {
+        return computeFamily != graphicsFamily ? OwnershipTransfer{ computeFamily, graphicsFamily }
+                                               : OwnershipTransfer{};
+    }
+
+    static VkImage handle(const Offscreen& offscreen) { return static_cast<VkImage>(*offscreen.image); }
+
+    // R8G8B8A8 matches the rgba8 qualifier in the kernels, and every device can use it as a storage image and as a
+    // blit source
+    Offscreen createOffscreen(const vk::raii::PhysicalDevice& physicalDevice, const vk::raii::Device& device) const {
+        Offscreen offscreen;
+
+        vk::ImageCreateInfo imageInfo{};
+        imageInfo.setImageType(vk::ImageType::e2D)
+                 .setFormat(vk::Format::eR8G8B8A8Unorm)
+                 .setExtent({ targets.extent.width, targets.extent.height, 1 })
+                 .setMipLevels(1)
+                 .setArrayLayers(1)
+                 .setSamples(vk::SampleCountFlagBits::e1)
+                 .setTiling(vk::ImageTiling::eOptimal)
+                 .setUsage(vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eTransferSrc |
+                           vk::ImageUsageFlagBits::eTransferDst)
+                 .setInitialLayout(vk::ImageLayout::eUndefined);
+
+        offscreen.image = vk::raii::Image(device, imageInfo);
+
+        vk::MemoryRequirements requirements = offscreen.image.getMemoryRequirements();
+        vk::PhysicalDeviceMemoryProperties memoryProps = physicalDevice.getMemoryProperties();
+
+        uint32_t typeIndex = UINT32_MAX;
+        for (uint32_t i = 0; i < memoryProps.memoryTypeCount && typeIndex == UINT32_MAX; ++i) {
+            bool allowed = requirements.memoryTypeBits & (1u << i);
+            if (allowed && (memoryProps.memoryTypes[i].propertyFlags & vk::MemoryPropertyFlagBits::eDeviceLocal))
+                typeIndex = i;
+        }
+        if (typeIndex == UINT32_MAX) throw std::runtime_error("No device local memory for the offscreen image");
+
+        offscreen.memory = vk::raii::DeviceMemory(device, vk::MemoryAllocateInfo(requirements.size, typeIndex));
+        offscreen.image.bindMemory(*offscreen.memory, 0);
+
+        vk::ImageViewCreateInfo viewInfo{};
+        viewInfo.setImage(*offscreen.image)
+                .setViewType(vk::ImageViewType::e2D)
+                .setFormat(imageInfo.format)
+                .setSubresourceRange({ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 });
+
+        offscreen.view = vk::raii::ImageView(device, viewInfo);
+        return offscreen;
+    }
+
+    PipelineManager& pipelines;
+    PipelineHandle pipeline;
+    uint32_t framesInFlight;
+    uint32_t graphicsFamily;
+    uint32_t computeFamily;
+    bool asyncCompute;
+    WorkgroupSize workgroupSize;                                        // What the pipeline is specialized to
+
+    vk::raii::DescriptorSetLayout setLayout{nullptr};
+    vk::raii::PipelineLayout layout{nullptr};
+
+    Targets targets;
+    std::vector<Targets> retired;
+
+    std::unique_ptr<FrameGraph> graph;              // The graphics queue's part of a frame
+    std::unique_ptr<FrameGraph> computeGraph;       // The compute queue's, on the Async path
+};
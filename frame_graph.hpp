@@ -0,0 +1,717 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+
+#ifndef VK_CHECK
+#define VK_CHECK(x) do { VkResult err = x; if (err != VK_SUCCESS) throw std::runtime_error("Vulkan error at " #x); } while(0)
+#endif
+
+// How something touches a resource: the pipeline stages it does so in, the memory accesses it makes there and, for
+// images, the layout the image has to be in. Stages and accesses are Synchronization2's (Vulkan 1.3).
+struct ResourceUse {
+    VkPipelineStageFlags2 stage = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 access = VK_ACCESS_2_NONE;
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;           // Ignored for buffers
+};
+
+// Uses that come up again and again. Storage images are read and written in the General layout.
+namespace resource_use {
+    constexpr ResourceUse COMPUTE_READ{ VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT,
+                                        VK_IMAGE_LAYOUT_GENERAL };
+    constexpr ResourceUse COMPUTE_WRITE{ VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                                         VK_IMAGE_LAYOUT_GENERAL };
+    constexpr ResourceUse COMPUTE_READ_WRITE{ VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                                              VK_ACCESS_2_SHADER_STORAGE_READ_BIT |
+                                                  VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                                              VK_IMAGE_LAYOUT_GENERAL };
+    constexpr ResourceUse TRANSFER_READ{ VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT,
+                                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL };
+    constexpr ResourceUse TRANSFER_WRITE{ VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL };
+
+    // Read on the CPU once the submission has finished
+    constexpr ResourceUse HOST_READ{ VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT };
+
+    // Handed to vkQueuePresentKHR. The semaphore the present waits on takes care of the memory side.
+    constexpr ResourceUse PRESENT{ VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR };
+}
+
+// Accesses that write memory. Everything else only reads.
+constexpr VkAccessFlags2 WRITE_ACCESS_MASK = VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT |
+                                             VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |
+                                             VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+                                             VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_HOST_WRITE_BIT |
+                                             VK_ACCESS_2_MEMORY_WRITE_BIT;
+
+// A queue family ownership transfer of an image, for resources shared between queues of different families. The
+// src family's queue releases the image (FrameGraph::output) and the dst family's queue acquires it
+// (FrameGraph::importImage). Both sides have to describe the same layout change.
+struct OwnershipTransfer {
+    uint32_t srcFamily = VK_QUEUE_FAMILY_IGNORED;
+    uint32_t dstFamily = VK_QUEUE_FAMILY_IGNORED;
+
+    bool active() const { return srcFamily != dstFamily; }
+};
+
+// One image barrier between two uses, for the odd transition outside a graph (e.g. before handing an image to the
+// workgroup tuner). The old contents are discarded if from has the Undefined layout.
+inline void imageBarrier(VkCommandBuffer cmd, VkImage image, const ResourceUse& from, const ResourceUse& to,
+                         VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }) {
+    VkImageMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = from.stage;
+    barrier.srcAccessMask = from.access & WRITE_ACCESS_MASK;
+    barrier.dstStageMask = to.stage;
+    barrier.dstAccessMask = to.access;
+    barrier.oldLayout = from.layout;
+    barrier.newLayout = to.layout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = range;
+
+    VkDependencyInfo dependency{};
+    dependency.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependency.imageMemoryBarrierCount = 1;
+    dependency.pImageMemoryBarriers = &barrier;
+    vkCmdPipelineBarrier2(cmd, &dependency);
+}
+
+// A minimal frame graph: passes say which resources they read and write and how, and the graph works out the
+// barriers between them.
+//
+// Every frame (or job) is described afresh: reset(), import the images and buffers that live outside the graph, add
+// transient images, add the passes, mark what the frame produces with output(), then compile() and execute() into a
+// command buffer. compile()
+//
+//   - culls passes nothing needs: a pass is kept only if it writes an output, writes something a kept pass uses, or
+//     was marked with sideEffects().
+//   - walks the kept passes in order, tracking per resource the last write, the reads since, what has been made
+//     visible to which stages, and the image layout. Only real hazards (read after write, write after read or write,
+//     layout changes and ownership transfers) get a barrier, with exactly the stages and accesses involved; repeated
+//     reads of data already made visible get none.
+//   - merges barriers. A pass's barriers go into one vkCmdPipelineBarrier2, buffer and same-layout image hazards
+//     fold into a single global memory barrier, and a barrier moves up into an earlier batch when no pass in between
+//     touches the resource or runs in the stages it blocks, so merging never makes anything wait longer.
+//   - places transient images in memory. Transients whose kept passes don't overlap share one allocation, and the
+//     first use of each waits for the last use of whatever occupied the memory before it.
+//
+// Executions are assumed to follow each other on one queue, so each transient's first use also waits for its last use
+// in the previous execution. Transients keep their memory across compiles as long as their descriptions and the
+// aliasing stay the same; when they change, the old images are destroyed, which is only safe once the GPU has
+// finished every earlier execution. Cross-queue hand-offs of imported images go through OwnershipTransfer.
+class FrameGraph {
+public:
+    using Resource = uint32_t;
+
+    // Barriers compile() came up with, for logs and benchmarks
+    struct Stats {
+        uint32_t passes = 0;                        // Kept
+        uint32_t culled = 0;
+        uint32_t batches = 0;                       // vkCmdPipelineBarrier2 calls per execute()
+        uint32_t imageBarriers = 0;
+        uint32_t memoryBarriers = 0;
+        uint32_t transientImages = 0;
+        uint32_t transientAllocations = 0;          // Fewer than transientImages when images alias
+        VkDeviceSize transientBytes = 0;
+    };
+
+    // Declares how a pass uses resources. Returned by addPass().
+    class PassBuilder {
+    public:
+        PassBuilder& read(Resource resource, const ResourceUse& use) {
+            graph.addUse(pass, resource, use, false);
+            return *this;
+        }
+
+        PassBuilder& write(Resource resource, const ResourceUse& use) {
+            graph.addUse(pass, resource, use, true);
+            return *this;
+        }
+
+        // Keeps the pass even if nothing it writes is used, e.g. a pass that only writes timestamps
+        PassBuilder& sideEffects() { graph.passes[pass].sideEffects = true; return *this; }
+
+    private:
+        friend class FrameGraph;
+        PassBuilder(FrameGraph& graph, uint32_t pass) : graph(graph), pass(pass) {}
+
+        FrameGraph& graph;
+        uint32_t pass;
+    };
+
+    FrameGraph(VkPhysicalDevice gpu, VkDevice device) : device(device) {
+        vkGetPhysicalDeviceMemoryProperties(gpu, &memoryProps);
+    }
+
+    ~FrameGraph() { destroyTransients(); }
+
+    FrameGraph(const FrameGraph&) = delete;
+    FrameGraph& operator=(const FrameGraph&) = delete;
+
+    // Forgets the passes and resources of the last frame. Transient memory stays for the next compile() to reuse.
+    void reset() {
+        passes.clear();
+        resources.clear();
+        order.clear();
+        batches.clear();
+        statistics = Stats{};
+    }
+
+    // An image that lives outside the graph. initial is its last use before the graph, which the first use inside
+    // waits for: the stage a semaphore wait happens in, a previous submission's writes, or nothing with the Undefined
+    // layout if the old contents don't matter. acquire is the other half of a release recorded on another queue.
+    Resource importImage(const std::string& name, VkImage image, const ResourceUse& initial = {},
+                         OwnershipTransfer acquire = {},
+                         VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }) {
+        ResourceNode node;
+        node.name = name;
+        node.isImage = true;
+        node.image = image;
+        node.range = range;
+        node.initial = initial;
+        node.acquire = acquire;
+        return addResource(std::move(node));
+    }
+
+    // A buffer that lives outside the graph. initial is its last use before the graph, as for images.
+    Resource importBuffer(const std::string& name, VkBuffer buffer, const ResourceUse& initial = {}) {
+        ResourceNode node;
+        node.name = name;
+        node.buffer = buffer;
+        node.initial = initial;
+        return addResource(std::move(node));
+    }
+
+    // A colour image the graph allocates, for data that never leaves the frame. Its contents are undefined at its
+    // first use, and it only exists if a kept pass uses it. image() and view() are valid after compile().
+    Resource createImage(const std::string& name, const VkImageCreateInfo& info) {
+        ResourceNode node;
+        node.name = name;
+        node.isImage = true;
+        node.range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, info.mipLevels, 0, info.arrayLayers };
+        node.info = info;
+        node.info.pNext = nullptr;
+        node.info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        node.transient = true;
+        return addResource(std::move(node));
+    }
+
+    // Marks a resource as a result of the frame, to be left in the final use: e.g. resource_use::PRESENT for a
+    // swapchain image, or resource_use::HOST_READ for a readback buffer. release hands the image to another queue;
+    // an image imported with an acquire is still acquired at its first use.
+    void output(Resource resource, const ResourceUse& final, OwnershipTransfer release = {}) {
+        ResourceNode& node = resources.at(resource);
+        node.isOutput = true;
+        node.final = final;
+        node.release = release;
+    }
+
+    // Adds a pass, recorded by execute in the order passes are added
+    PassBuilder addPass(const std::string& name, std::function<void(VkCommandBuffer)> execute) {
+        Pass pass;
+        pass.name = name;
+        pass.execute = std::move(execute);
+        passes.push_back(std::move(pass));
+        return PassBuilder(*this, static_cast<uint32_t>(passes.size() - 1));
+    }
+
+    // Culls, places the transient images and plans the barriers
+    void compile() {
+        cull();
+        placeTransients();
+        planBarriers();
+    }
+
+    // Records the kept passes with their barriers
+    void execute(VkCommandBuffer cmd) const {
+        auto batch = batches.begin();
+        for (uint32_t position = 0; position <= order.size(); ++position) {
+            for (; batch != batches.end() && batch->position == position; ++batch) recordBatch(cmd, *batch);
+            if (position < order.size()) passes[order[position]].execute(cmd);
+        }
+    }
+
+    VkImage image(Resource resource) const {
+        const ResourceNode& node = resources.at(resource);
+        return node.transient ? transients.at(node.slot).image : node.image;
+    }
+
+    // Transient images only
+    VkImageView view(Resource resource) const { return transients.at(resources.at(resource).slot).view; }
+
+    const Stats& stats() const { return statistics; }
+
+private:
+    // Where a resource stands while the barriers are planned
+    struct State {
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags2 writeStages = VK_PIPELINE_STAGE_2_NONE;      // Last write
+        VkAccessFlags2 writeAccess = VK_ACCESS_2_NONE;
+        VkPipelineStageFlags2 readStages = VK_PIPELINE_STAGE_2_NONE;       // Reads since
+        VkPipelineStageFlags2 visibleStages = VK_PIPELINE_STAGE_2_NONE;    // Where the last write has been made visible
+        VkAccessFlags2 visibleAccess = VK_ACCESS_2_NONE;
+        int32_t lastPass = -1;                                              // Position of the last pass touching it
+        bool acquired = false;                                              // The acquire barrier has been planned
+    };
+
+    struct ResourceNode {
+        std::string name;
+        bool isImage = false;
+        VkImage image = VK_NULL_HANDLE;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkImageSubresourceRange range{};
+        ResourceUse initial;
+        bool isOutput = false;
+        ResourceUse final;
+        OwnershipTransfer acquire;                  // From another queue, at the first use
+        OwnershipTransfer release;                  // To another queue, after the last use
+
+        bool transient = false;
+        VkImageCreateInfo info{};
+        uint32_t slot = 0;                          // Index into transients
+        int32_t firstUse = -1, lastUse = -1;        // Positions of the first and last kept pass using it
+
+        State state;
+    };
+
+    struct Use {
+        Resource resource;
+        ResourceUse use;
+        bool write = false;
+    };
+
+    struct Pass {
+        std::string name;
+        std::function<void(VkCommandBuffer)> execute;
+        std::vector<Use> uses;
+        VkPipelineStageFlags2 stages = VK_PIPELINE_STAGE_2_NONE;
+        bool sideEffects = false;
+    };
+
+    // Barriers recorded together before the pass at position (or after the last pass)
+    struct Batch {
+        uint32_t position = 0;
+        VkMemoryBarrier2 memory{};
+        std::vector<VkImageMemoryBarrier2> images;
+    };
+
+    // A realized transient image. Images sharing memory point at the same allocation.
+    struct Transient {
+        std::string name;
+        VkImageCreateInfo info{};
+        uint32_t allocation = 0;
+        VkImage image = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE;
+        VkMemoryRequirements requirements{};
+    };
+
+    struct Allocation {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        State last;                                 // Last use of the last image in it, in the previous execution
+    };
+
+    Resource addResource(ResourceNode node) {
+        resources.push_back(std::move(node));
+        return static_cast<Resource>(resources.size() - 1);
+    }
+
+    // A pass using one resource twice uses it once with both accesses
+    void addUse(uint32_t pass, Resource resource, const ResourceUse& use, bool write) {
+        if (resource >= resources.size()) throw std::runtime_error("Frame graph resource out of range");
+
+        Pass& p = passes[pass];
+        p.stages |= use.stage;
+
+        for (Use& existing : p.uses) {
+            if (existing.resource != resource) continue;
+            if (resources[resource].isImage && existing.use.layout != use.layout)
+                throw std::runtime_error("Pass " + p.name + " uses " + resources[resource].name + " in two layouts");
+            existing.use.stage |= use.stage;
+            existing.use.access |= use.access;
+            existing.write = existing.write || write;
+            return;
+        }
+        p.uses.push_back({ resource, use, write });
+    }
+
+    // Walks back from the outputs, keeping every pass that writes something still needed
+    void cull() {
+        std::vector<bool> needed(resources.size());
+        for (size_t r = 0; r < resources.size(); ++r) needed[r] = resources[r].isOutput;
+
+        std::vector<bool> kept(passes.size());
+        for (size_t i = passes.size(); i-- > 0;) {
+            const Pass& pass = passes[i];
+            kept[i] = pass.sideEffects || std::any_of(pass.uses.begin(), pass.uses.end(), [&](const Use& use) {
+                return use.write && needed[use.resource];
+            });
+            if (kept[i])
+                for (const Use& use : pass.uses) needed[use.resource] = true;
+        }
+
+        order.clear();
+        for (uint32_t i = 0; i < passes.size(); ++i)
+            if (kept[i]) order.push_back(i);
+
+        statistics.passes = static_cast<uint32_t>(order.size());
+        statistics.culled = static_cast<uint32_t>(passes.size() - order.size());
+    }
+
+    // Gives every used transient an image, sharing memory between transients whose lifetimes don't overlap. The
+    // biggest go first, each into the first allocation it fits in time with.
+    void placeTransients() {
+        for (ResourceNode& node : resources) node.firstUse = node.lastUse = -1;
+
+        std::vector<Resource> used;
+        for (uint32_t position = 0; position < order.size(); ++position)
+            for (const Use& use : passes[order[position]].uses) {
+                ResourceNode& node = resources[use.resource];
+                if (!node.transient) continue;
+                if (node.firstUse < 0) {
+                    node.firstUse = static_cast<int32_t>(position);
+                    used.push_back(use.resource);
+                }
+                node.lastUse = static_cast<int32_t>(position);
+            }
+
+        std::vector<VkMemoryRequirements> requirements(resources.size());
+        for (Resource r : used) {
+            VkDeviceImageMemoryRequirements query{};
+            query.sType = VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS;
+            query.pCreateInfo = &resources[r].info;
+
+            VkMemoryRequirements2 result{};
+            result.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+            vkGetDeviceImageMemoryRequirements(device, &query, &result);
+            requirements[r] = result.memoryRequirements;
+        }
+
+        std::vector<Resource> bySize = used;
+        std::stable_sort(bySize.begin(), bySize.end(), [&](Resource a, Resource b) {
+            return requirements[a].size > requirements[b].size;
+        });
+
+        // Allocations as planned: their members and the memory types every member can live in
+        std::vector<std::vector<Resource>> members;
+        std::vector<uint32_t> typeBits;
+
+        for (Resource r : bySize) {
+            const ResourceNode& node = resources[r];
+            size_t chosen = members.size();
+
+            for (size_t a = 0; a < members.size() && chosen == members.size(); ++a) {
+                bool overlaps = std::any_of(members[a].begin(), members[a].end(), [&](Resource other) {
+                    const ResourceNode& o = resources[other];
+                    return node.firstUse <= o.lastUse && o.firstUse <= node.lastUse;
+                });
+                if (!overlaps && (typeBits[a] & requirements[r].memoryTypeBits)) chosen = a;
+            }
+
+            if (chosen == members.size()) {
+                members.emplace_back();
+                typeBits.push_back(requirements[r].memoryTypeBits);
+            }
+            members[chosen].push_back(r);
+            typeBits[chosen] &= requirements[r].memoryTypeBits;
+        }
+
+        // Transients are realized in the order they were declared, so an unchanged frame finds them where it left them
+        std::vector<Transient> planned;
+        for (Resource r : used) {
+            Transient transient;
+            transient.name = resources[r].name;
+            transient.info = resources[r].info;
+            transient.requirements = requirements[r];
+            for (uint32_t a = 0; a < members.size(); ++a)
+                if (std::find(members[a].begin(), members[a].end(), r) != members[a].end()) transient.allocation = a;
+
+            resources[r].slot = static_cast<uint32_t>(planned.size());
+            planned.push_back(transient);
+        }
+
+        if (!samePlacement(planned)) {
+            destroyTransients();
+            transients = std::move(planned);
+            allocations.assign(members.size(), Allocation{});
+            realizeTransients(typeBits);
+        }
+
+        statistics.transientImages = static_cast<uint32_t>(transients.size());
+        statistics.transientAllocations = static_cast<uint32_t>(allocations.size());
+        statistics.transientBytes = 0;
+        for (const Allocation& allocation : allocations) statistics.transientBytes += allocation.size;
+    }
+
+    bool samePlacement(const std::vector<Transient>& planned) const {
+        if (planned.size() != transients.size()) return false;
+        for (size_t i = 0; i < planned.size(); ++i) {
+            const VkImageCreateInfo& a = planned[i].info;
+            const VkImageCreateInfo& b = transients[i].info;
+            bool same = planned[i].name == transients[i].name && planned[i].allocation == transients[i].allocation &&
+                        a.flags == b.flags && a.imageType == b.imageType && a.format == b.format &&
+                        a.extent.width == b.extent.width && a.extent.height == b.extent.height &&
+                        a.extent.depth == b.extent.depth && a.mipLevels == b.mipLevels &&
+                        a.arrayLayers == b.arrayLayers && a.samples == b.samples && a.tiling == b.tiling &&
+                        a.usage == b.usage;
+            if (!same) return false;
+        }
+        return true;
+    }
+
+    void realizeTransients(const std::vector<uint32_t>& typeBits) {
+        for (Transient& transient : transients) {
+            Allocation& allocation = allocations[transient.allocation];
+            allocation.size = std::max(allocation.size, transient.requirements.size);
+        }
+
+        for (uint32_t a = 0; a < allocations.size(); ++a) {
+            VkMemoryAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            allocInfo.allocationSize = allocations[a].size;
+            allocInfo.memoryTypeIndex = findMemoryType(typeBits[a]);
+            VK_CHECK(vkAllocateMemory(device, &allocInfo, nullptr, &allocations[a].memory));
+        }
+
+        for (Transient& transient : transients) {
+            VK_CHECK(vkCreateImage(device, &transient.info, nullptr, &transient.image));
+            VK_CHECK(vkBindImageMemory(device, transient.image, allocations[transient.allocation].memory, 0));
+
+            VkImageViewCreateInfo viewCI{};
+            viewCI.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            viewCI.image = transient.image;
+            viewCI.viewType = transient.info.imageType == VK_IMAGE_TYPE_3D ? VK_IMAGE_VIEW_TYPE_3D
+                            : transient.info.imageType == VK_IMAGE_TYPE_1D ? VK_IMAGE_VIEW_TYPE_1D
+                            : transient.info.arrayLayers > 1              ? VK_IMAGE_VIEW_TYPE_2D_ARRAY
+                                                                          : VK_IMAGE_VIEW_TYPE_2D;
+            viewCI.format = transient.info.format;
+            viewCI.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, transient.info.mipLevels, 0,
+                                        transient.info.arrayLayers };
+            VK_CHECK(vkCreateImageView(device, &viewCI, nullptr, &transient.view));
+        }
+    }
+
+    // Device-local memory if any of the allowed types is, otherwise whatever is allowed
+    uint32_t findMemoryType(uint32_t typeBits) const {
+        for (uint32_t i = 0; i < memoryProps.memoryTypeCount; ++i)
+            if ((typeBits & (1u << i)) &&
+                (memoryProps.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+                return i;
+        for (uint32_t i = 0; i < memoryProps.memoryTypeCount; ++i)
+            if (typeBits & (1u << i)) return i;
+        throw std::runtime_error("No memory type for the frame graph's transient images");
+    }
+
+    void destroyTransients() {
+        for (Transient& transient : transients) {
+            vkDestroyImageView(device, transient.view, nullptr);
+            vkDestroyImage(device, transient.image, nullptr);
+        }
+        for (Allocation& allocation : allocations) vkFreeMemory(device, allocation.memory, nullptr);
+        transients.clear();
+        allocations.clear();
+    }
+
+    void planBarriers() {
+        batches.clear();
+
+        for (ResourceNode& node : resources) {
+            node.state = State{};
+            if (node.transient) continue;
+
+            node.state.layout = node.initial.layout;
+            if (node.initial.access & WRITE_ACCESS_MASK) {
+                node.state.writeStages = node.initial.stage;
+                node.state.writeAccess = node.initial.access & WRITE_ACCESS_MASK;
+            } else {
+                node.state.readStages = node.initial.stage;
+            }
+        }
+
+        // Which transient used each allocation last, so the next one in it waits for that
+        std::vector<int32_t> lastOccupant(allocations.size(), -1);
+
+        for (uint32_t position = 0; position < order.size(); ++position) {
+            for (const Use& use : passes[order[position]].uses) {
+                ResourceNode& node = resources[use.resource];
+
+                if (node.transient && node.firstUse == static_cast<int32_t>(position)) {
+                    uint32_t a = transients[node.slot].allocation;
+                    if (lastOccupant[a] < 0) {
+                        node.state = allocations[a].last;
+                        node.state.lastPass = -1;
+                    } else {
+                        node.state = resources[lastOccupant[a]].state;
+                    }
+                    node.state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+                    lastOccupant[a] = static_cast<int32_t>(use.resource);
+                }
+
+                transition(node, use.use, use.write, position);
+                node.state.lastPass = static_cast<int32_t>(position);
+            }
+        }
+
+        uint32_t end = static_cast<uint32_t>(order.size());
+        for (ResourceNode& node : resources) {
+            if (!node.isOutput) continue;
+
+            // An image no pass used is still taken over before it's handed on. The release goes in a batch of its
+            // own, since barriers in one vkCmdPipelineBarrier2 aren't ordered among themselves.
+            if (node.acquire.active() && !node.state.acquired && node.release.active()) {
+                transition(node, node.final, false, end);
+
+                Batch batch;
+                batch.position = end;
+                batch.memory.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+                batches.push_back(batch);
+            }
+            transition(node, node.final, false, end, true);
+        }
+
+        // The next execution starts where this one left off
+        for (uint32_t a = 0; a < allocations.size(); ++a)
+            if (lastOccupant[a] >= 0) allocations[a].last = resources[lastOccupant[a]].state;
+
+        statistics.batches = static_cast<uint32_t>(batches.size());
+        statistics.imageBarriers = 0;
+        statistics.memoryBarriers = 0;
+        for (const Batch& batch : batches) {
+            statistics.imageBarriers += static_cast<uint32_t>(batch.images.size());
+            if (batch.memory.srcStageMask || batch.memory.dstStageMask) ++statistics.memoryBarriers;
+        }
+    }
+
+    // Brings a resource from its current state into use before the pass at position, with a barrier if it takes one.
+    // The first transition of an imported image acquires it if it was imported with an acquire, and the final one
+    // (last, at the end of the graph) releases it if it was output with a release.
+    void transition(ResourceNode& node, const ResourceUse& use, bool write, uint32_t position, bool last = false) {
+        State& s = node.state;
+        bool acquire = node.acquire.active() && !s.acquired;
+        bool release = last && !acquire && node.release.active();
+        bool ownership = acquire || release;
+        const OwnershipTransfer& transfer = acquire ? node.acquire : node.release;
+        bool layoutChange = node.isImage && use.layout != s.layout;
+        bool image = layoutChange || ownership;
+
+        VkPipelineStageFlags2 srcStages;
+        bool needed;
+        if (write || image) {
+            // Write after read or write, or a layout change, which writes too
+            srcStages = s.writeStages | s.readStages;
+            needed = srcStages != VK_PIPELINE_STAGE_2_NONE || image;
+        } else {
+            // Read after write, unless an earlier barrier already made the write visible here
+            srcStages = s.writeStages;
+            needed = srcStages != VK_PIPELINE_STAGE_2_NONE &&
+                     ((use.stage & ~s.visibleStages) || (use.access & ~s.visibleAccess));
+        }
+
+        if (needed) {
+            // Released images need no destination scope; the acquire on the other queue has it
+            VkPipelineStageFlags2 dstStages = release ? VK_PIPELINE_STAGE_2_NONE : use.stage;
+            VkAccessFlags2 dstAccess = release ? VK_ACCESS_2_NONE : use.access;
+            Batch& batch = batchFor(s.lastPass, position, dstStages);
+
+            if (image) {
+                VkImageMemoryBarrier2 barrier{};
+                barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+                barrier.srcStageMask = srcStages;
+                barrier.srcAccessMask = acquire ? VK_ACCESS_2_NONE : s.writeAccess;
+                barrier.dstStageMask = dstStages;
+                barrier.dstAccessMask = dstAccess;
+                barrier.oldLayout = s.layout;
+                barrier.newLayout = use.layout;
+                barrier.srcQueueFamilyIndex = ownership ? transfer.srcFamily : VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstQueueFamilyIndex = ownership ? transfer.dstFamily : VK_QUEUE_FAMILY_IGNORED;
+                barrier.image = node.transient ? transients[node.slot].image : node.image;
+                barrier.subresourceRange = node.range;
+                batch.images.push_back(barrier);
+            } else {
+                batch.memory.srcStageMask |= srcStages;
+                batch.memory.srcAccessMask |= s.writeAccess;
+                batch.memory.dstStageMask |= dstStages;
+                batch.memory.dstAccessMask |= dstAccess;
+            }
+        }
+
+        if (acquire) s.acquired = true;
+
+        if (write) {
+            s.writeStages = use.stage;
+            s.writeAccess = use.access & WRITE_ACCESS_MASK;
+            s.readStages = VK_PIPELINE_STAGE_2_NONE;
+            s.visibleStages = VK_PIPELINE_STAGE_2_NONE;
+            s.visibleAccess = VK_ACCESS_2_NONE;
+        } else if (image) {
+            // Later reads elsewhere chain onto this barrier: it made everything before it visible here
+            s.writeStages = use.stage;
+            s.writeAccess = VK_ACCESS_2_NONE;
+            s.readStages |= use.stage;
+            s.visibleStages = use.stage;
+            s.visibleAccess = use.access;
+        } else {
+            s.readStages |= use.stage;
+            if (needed) {
+                s.visibleStages |= use.stage;
+                s.visibleAccess |= use.access;
+            }
+        }
+        s.layout = node.isImage ? use.layout : s.layout;
+    }
+
+    // The batch a barrier goes into: the one right before the pass at position, or an earlier one it can join
+    // without making anything wait longer. That is one after the last pass touching the resource (lastPass) with no
+    // pass between it and position running in the stages the barrier blocks.
+    Batch& batchFor(int32_t lastPass, uint32_t position, VkPipelineStageFlags2 dstStages) {
+        if (!batches.empty() && batches.back().position != position &&
+            static_cast<int32_t>(batches.back().position) > lastPass) {
+            Batch& earlier = batches.back();
+            bool blocks = false;
+            for (uint32_t p = earlier.position; p < position && !blocks; ++p)
+                blocks = (passes[order[p]].stages & dstStages) != 0;
+            if (!blocks) return earlier;
+        }
+
+        if (batches.empty() || batches.back().position != position) {
+            Batch batch;
+            batch.position = position;
+            batch.memory.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+            batches.push_back(batch);
+        }
+        return batches.back();
+    }
+
+    void recordBatch(VkCommandBuffer cmd, const Batch& batch) const {
+        bool memory = batch.memory.srcStageMask || batch.memory.dstStageMask;
+
+        VkDependencyInfo dependency{};
+        dependency.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+        dependency.memoryBarrierCount = memory ? 1 : 0;
+        dependency.pMemoryBarriers = &batch.memory;
+        dependency.imageMemoryBarrierCount = static_cast<uint32_t>(batch.images.size());
+        dependency.pImageMemoryBarriers = batch.images.data();
+        vkCmdPipelineBarrier2(cmd, &dependency);
+    }
+
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties memoryProps{};
+
+    std::vector<Pass> passes;
+    std::vector<ResourceNode> resources;
+    std::vector<uint32_t> order;                    // Kept passes, in recording order
+    std::vector<Batch> batches;                     // By position
+
+    std::vector<Transient> transients;
+    std::vector<Allocation> allocations;
+
+    Stats statistics;
+};
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <ostream>
+#include <cstdint>
+
+// CPU frame time statistics: frame count, average, min, max and jitter, the standard deviation of the frame time. With
+// a target frame rate, also how far frames landed from the target on average.
+struct FrameTimeStats {
+    uint64_t frameCount = 0;
+    double totalMs = 0.0;
+    double minMs = std::numeric_limits<double>::max();
+    double maxMs = 0.0;
+    double mean = 0.0;                              // Running mean and sum of squared deviations (Welford)
+    double m2 = 0.0;
+    double targetDeviationMs = 0.0;                 // Sum of |frame time - target|, for frames that had a target
+    uint64_t targetedFrames = 0;
+
+    void add(double ms, double targetMs = 0.0) {
+        ++frameCount;
+        totalMs += ms;
+        minMs = std::min(minMs, ms);
+        maxMs = std::max(maxMs, ms);
+
+        double delta = ms - mean;
+        mean += delta / static_cast<double>(frameCount);
+        m2 += delta * (ms - mean);
+
+        if (targetMs > 0.0) {
+            targetDeviationMs += std::abs(ms - targetMs);
+            ++targetedFrames;
+        }
+    }
+
+    double jitterMs() const { return frameCount > 1 ? std::sqrt(m2 / static_cast<double>(frameCount - 1)) : 0.0; }
+
+    void print(std::ostream& out) const {
+        if (frameCount == 0) return;
+        double avg = totalMs / static_cast<double>(frameCount);
+        out << "frames: " << frameCount
+            << " | avg: " << avg << " ms (" << 1000.0 / avg << " fps)"
+            << " | min: " << minMs << " ms"
+            << " | max: " << maxMs << " ms"
+            << " | jitter: " << jitterMs() << " ms";
+        if (targetedFrames > 0)
+            out << " | off target: " << targetDeviationMs / static_cast<double>(targetedFrames) << " ms";
+        out << std::endl;
+    }
+};
+
+// Paces a render loop to a target frame rate and measures how evenly frames start.
+//
+// beginFrame() blocks until the next frame is due. Sleeping alone wakes up late by up to a scheduler tick, and spinning
+// alone burns a core, so it sleeps until shortly before the deadline and yields in a loop for the rest. How early to
+// wake up is learned from how late the sleeps actually return, so the spin stays short on systems with precise timers.
+//
+// Deadlines advance by exactly one period, so an occasional late frame is made up by the next one instead of shifting
+// every frame after it. A loop that falls more than a period behind starts over from now rather than rushing out a
+// burst of frames. With no target, beginFrame() never waits and only measures.
+class FramePacer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Bounds for how long before a deadline the pacer stops sleeping and starts spinning
+    static constexpr std::chrono::microseconds MIN_SPIN{ 200 };
+    static constexpr std::chrono::microseconds MAX_SPIN{ 4000 };
+
+    explicit FramePacer(double targetFps = 0.0) { setTargetFps(targetFps); }
+
+    // 0 turns the limiter off
+    void setTargetFps(double fps) {
+        period = fps > 0.0 ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps))
+                           : Clock::duration::zero();
+        nextFrame = Clock::now();
+    }
+
+    double targetFps() const {
+        return period > Clock::duration::zero() ? 1.0 / std::chrono::duration<double>(period).count() : 0.0;
+    }
+
+    // Waits until the next frame is due, then starts it and records the time since the previous frame started
+    void beginFrame() {
+        if (period > Clock::duration::zero()) {
+            Clock::time_point now = Clock::now();
+            if (now - nextFrame > period) nextFrame = now;
+            waitUntil(nextFrame);
+            nextFrame += period;
+        }
+
+        Clock::time_point start = Clock::now();
+        if (hasLastFrame) {
+            double targetMs = std::chrono::duration<double, std::milli>(period).count();
+            frameStats.add(std::chrono::duration<double, std::milli>(start - lastFrameStart).count(), targetMs);
+        }
+
+        lastFrameStart = start;
+        hasLastFrame = true;
+    }
+
+    // Call after the loop blocked for something other than rendering (waiting for events while idle or minimized), so
+    // the gap isn't counted as a frame and the next frame doesn't try to catch up
+    void resume() {
+        hasLastFrame = false;
+        nextFrame = Clock::now();
+    }
+
+    const FrameTimeStats& stats() const { return frameStats; }
+
+private:
+    void waitUntil(Clock::time_point deadline) {
+        while (true) {
+            Clock::time_point now = Clock::now();
+            if (now >= deadline) return;
+
+            Clock::duration remaining = deadline - now;
+            if (remaining <= spin) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            // Sleep up to the spin window and learn from how late that actually returns. The window shrinks slowly
+            // and grows at once, so a single late wakeup is enough to widen it.
+            Clock::duration requested = remaining - spin;
+            std::this_thread::sleep_for(requested);
+            Clock::duration oversleep = Clock::now() - now - requested;
+
+            Clock::duration learned = std::max(oversleep * 2, spin - spin / 16);
+            spin = std::clamp<Clock::duration>(learned, MIN_SPIN, MAX_SPIN);
+        }
+    }
+
+    Clock::duration period = Clock::duration::zero();
+    Clock::duration spin = std::chrono::milliseconds(1);
+    Clock::time_point nextFrame = Clock::now();
+    Clock::time_point lastFrameStart;
+    bool hasLastFrame = false;
+    FrameTimeStats frameStats;
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <algorithm>
+#include <cstdint>
+
+// A small work-stealing thread pool.
+//
+// parallelFor() deals the indices out to one queue per thread in contiguous blocks. Each thread works through its own
+// queue from the front, and once it runs dry steals from the back of the others, so uneven jobs still finish close
+// together. The calling thread takes part as thread 0, which means a pool of one thread runs everything inline.
+//
+// Every job is told which thread runs it. Jobs on the same thread never overlap, so per-thread resources (command
+// pools, scratch memory) indexed by it need no locking.
+class JobSystem {
+public:
+    using JobFn = std::function<void(uint32_t index, uint32_t thread)>;
+
+    // threadCount includes the calling thread. 0 means one thread per core.
+    explicit JobSystem(uint32_t threadCount = 0) {
+        if (threadCount == 0) threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+        for (uint32_t i = 0; i < threadCount; ++i) queues.push_back(std::make_unique<Queue>());
+        for (uint32_t i = 1; i < threadCount; ++i) workers.emplace_back([this, i] { workerLoop(i); });
+    }
+
+    ~JobSystem() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeCondition.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    uint32_t threadCount() const { return static_cast<uint32_t>(queues.size()); }
+
+    // Runs fn for every index in [0, count) and returns once all of them have finished. If jobs throw, the first
+    // exception is rethrown here after the rest have run. Not reentrant: jobs must not call parallelFor themselves.
+    void parallelFor(uint32_t count, const JobFn& fn) {
+        if (count == 0) return;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &fn;
+            remaining = count;
+            error = nullptr;
+            ++generation;
+        }
+
+        // Contiguous blocks keep neighbouring indices on one thread until stealing kicks in
+        const uint32_t threads = threadCount();
+        for (uint32_t t = 0; t < threads; ++t) {
+            uint32_t first = static_cast<uint32_t>(static_cast<uint64_t>(count) * t / threads);
+            uint32_t last = static_cast<uint32_t>(static_cast<uint64_t>(count) * (t + 1) / threads);
+
+            std::lock_guard<std::mutex> lock(queues[t]->mutex);
+            for (uint32_t i = first; i < last; ++i) queues[t]->indices.push_back(i);
+        }
+        wakeCondition.notify_all();
+
+        while (runOne(0)) {}
+
+        std::unique_lock<std::mutex> lock(mutex);
+        doneCondition.wait(lock, [&] { return remaining == 0; });
+        job = nullptr;
+        if (error) std::rethrow_exception(error);
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<uint32_t> indices;
+    };
+
+    void workerLoop(uint32_t thread) {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeCondition.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+
+            while (runOne(thread)) {}
+        }
+    }
+
+    // Runs one job, from this thread's queue if it has any and stolen otherwise. False once every queue is empty.
+    bool runOne(uint32_t thread) {
+        uint32_t index;
+        if (!pop(thread, index)) {
+            bool stolen = false;
+            for (uint32_t i = 1; i < threadCount() && !stolen; ++i) stolen = steal((thread + i) % threadCount(), index);
+            if (!stolen) return false;
+        }
+
+        // The index was queued after job was set, and the queue mutex orders the two
+        const JobFn* fn;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            fn = job;
+        }
+
+        std::exception_ptr failure;
+        try {
+            (*fn)(index, thread);
+        } catch (...) {
+            failure = std::current_exception();
+        }
+
+        bool last;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (failure && !error) error = failure;
+            last = --remaining == 0;
+        }
+        if (last) doneCondition.notify_all();
+        return true;
+    }
+
+    bool pop(uint32_t thread, uint32_t& index) {
+        Queue& queue = *queues[thread];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.indices.empty()) return false;
+        index = queue.indices.front();
+        queue.indices.pop_front();
+        return true;
+    }
+
+    bool steal(uint32_t victim, uint32_t& index) {
+        Queue& queue = *queues[victim];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.indices.empty()) return false;
+        index = queue.indices.back();
+        queue.indices.pop_back();
+        return true;
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues;     // One per thread, the caller's first
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;                               // Guards everything below
+    std::condition_variable wakeCondition;
+    std::condition_variable doneCondition;
+    const JobFn* job = nullptr;
+    uint32_t remaining = 0;
+    uint64_t generation = 0;
+    std::exception_ptr error;
+    bool stopping = false;
+};
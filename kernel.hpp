@@ -0,0 +1,152 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <span>
+#include <initializer_list>
+#include <cstdint>
+
+#include "compute_context.hpp"
+
+// Workgroup dimensions. Kernels declare them with local_size_x_id = 0, local_size_y_id = 1 and local_size_z_id = 2,
+// so the same SPIR-V can be specialized to any size the device allows when the pipeline is built.
+struct WorkgroupSize {
+    uint32_t x = 1;
+    uint32_t y = 1;
+    uint32_t z = 1;
+
+    uint32_t invocations() const { return x * y * z; }
+    bool operator==(const WorkgroupSize&) const = default;
+};
+
+// Number of workgroups of size groupSize needed to cover count items
+inline uint32_t groupCount(uint32_t count, uint32_t groupSize) {
+    return (count + groupSize - 1) / groupSize;
+}
+
+// A compute pipeline with everything it was built from: shader module, descriptor set layout and pipeline layout.
+// Created once and used for as many dispatches as needed.
+struct ComputeKernel {
+    VkShaderModule shader = VK_NULL_HANDLE;
+    VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    uint32_t pushConstantSize = 0;
+    WorkgroupSize workgroupSize;                    // What the pipeline's workgroup size constants are set to
+};
+
+// Builds a compute pipeline from a shader module with its workgroup size specialized to workgroupSize. Spec
+// constants the shader doesn't declare are ignored, so 1D kernels can be given a full WorkgroupSize too.
+inline VkPipeline createComputePipeline(const ComputeContext& ctx, VkShaderModule shader, VkPipelineLayout layout,
+                                        WorkgroupSize workgroupSize) {
+    VkSpecializationMapEntry entries[3]{};
+    for (uint32_t i = 0; i < 3; ++i) {
+        entries[i].constantID = i;
+        entries[i].offset = i * sizeof(uint32_t);
+        entries[i].size = sizeof(uint32_t);
+    }
+
+    const uint32_t values[3] = { workgroupSize.x, workgroupSize.y, workgroupSize.z };
+
+    VkSpecializationInfo specInfo{};
+    specInfo.mapEntryCount = 3;
+    specInfo.pMapEntries = entries;
+    specInfo.dataSize = sizeof(values);
+    specInfo.pData = values;
+
+    VkComputePipelineCreateInfo computePipelineCI{};
+    computePipelineCI.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    computePipelineCI.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    computePipelineCI.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    computePipelineCI.stage.module = shader;
+    computePipelineCI.stage.pName = "main";
+    computePipelineCI.stage.pSpecializationInfo = &specInfo;
+    computePipelineCI.layout = layout;
+
+    VkPipeline pipeline;
+    VK_CHECK(vkCreateComputePipelines(ctx.device, ctx.pipelineCache->handle(), 1, &computePipelineCI, nullptr,
+                                      &pipeline));
+    return pipeline;
+}
+
+// Everything createKernel() builds except the pipeline: the shader module and the layouts. Cheap, so the pipeline can
+// be compiled on ctx.pipelines' workers while the caller carries on (see requestPipeline()).
+inline ComputeKernel createKernelLayout(const ComputeContext& ctx, std::span<const uint32_t> code,
+                                        std::initializer_list<VkDescriptorType> bindings, uint32_t pushConstantSize,
+                                        WorkgroupSize workgroupSize) {
+    ComputeKernel kernel;
+    kernel.shader = createShaderModule(ctx, code);
+    kernel.pushConstantSize = pushConstantSize;
+    kernel.workgroupSize = workgroupSize;
+
+    std::vector<VkDescriptorSetLayoutBinding> layoutBindings;
+    for (VkDescriptorType type : bindings) {
+        VkDescriptorSetLayoutBinding layoutBinding{};
+        layoutBinding.binding = static_cast<uint32_t>(layoutBindings.size());
+        layoutBinding.descriptorType = type;
+        layoutBinding.descriptorCount = 1;
+        layoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        layoutBindings.push_back(layoutBinding);
+    }
+
+    VkDescriptorSetLayoutCreateInfo dslCI{};
+    dslCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    dslCI.bindingCount = static_cast<uint32_t>(layoutBindings.size());
+    dslCI.pBindings = layoutBindings.data();
+
+    VK_CHECK(vkCreateDescriptorSetLayout(ctx.device, &dslCI, nullptr, &kernel.setLayout));
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = pushConstantSize;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCI{};
+    pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCI.setLayoutCount = 1;
+    pipelineLayoutCI.pSetLayouts = &kernel.setLayout;
+    pipelineLayoutCI.pushConstantRangeCount = pushConstantSize > 0 ? 1 : 0;
+    pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
+
+    VK_CHECK(vkCreatePipelineLayout(ctx.device, &pipelineLayoutCI, nullptr, &kernel.layout));
+    return kernel;
+}
+
+// Queues the kernel's pipeline on ctx.pipelines. Hand the result to PipelineManager::take() to fill in
+// kernel.pipeline; the kernel's shader module has to live until then.
+inline PipelineHandle requestPipeline(const ComputeContext& ctx, const ComputeKernel& kernel) {
+    PipelineRequest request;
+    request.module = kernel.shader;
+    request.layout = kernel.layout;
+    request.specialization = { kernel.workgroupSize.x, kernel.workgroupSize.y, kernel.workgroupSize.z };
+    return ctx.pipelines->request(std::move(request));
+}
+
+// Builds a kernel from SPIR-V. Set 0 gets one descriptor per entry of bindings, at bindings 0, 1, 2 and so on.
+// pushConstantSize bytes of push constants are available to the shader, starting at offset 0.
+inline ComputeKernel createKernel(const ComputeContext& ctx, std::span<const uint32_t> code,
+                                  std::initializer_list<VkDescriptorType> bindings, uint32_t pushConstantSize,
+                                  WorkgroupSize workgroupSize) {
+    ComputeKernel kernel = createKernelLayout(ctx, code, bindings, pushConstantSize, workgroupSize);
+    kernel.pipeline = createComputePipeline(ctx, kernel.shader, kernel.layout, workgroupSize);
+    return kernel;
+}
+
+// Rebuilds the kernel's pipeline for another workgroup size. Descriptor sets and the pipeline layout stay valid.
+inline void setWorkgroupSize(const ComputeContext& ctx, ComputeKernel& kernel, WorkgroupSize workgroupSize) {
+    if (workgroupSize == kernel.workgroupSize) return;
+
+    VkPipeline pipeline = createComputePipeline(ctx, kernel.shader, kernel.layout, workgroupSize);
+    vkDestroyPipeline(ctx.device, kernel.pipeline, nullptr);
+    kernel.pipeline = pipeline;
+    kernel.workgroupSize = workgroupSize;
+}
+
+inline void destroyKernel(const ComputeContext& ctx, ComputeKernel& kernel) {
+    vkDestroyPipeline(ctx.device, kernel.pipeline, nullptr);
+    vkDestroyPipelineLayout(ctx.device, kernel.layout, nullptr);
+    vkDestroyDescriptorSetLayout(ctx.device, kernel.setLayout, nullptr);
+    vkDestroyShaderModule(ctx.device, kernel.shader, nullptr);
+    kernel = {};
+}
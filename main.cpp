@@ -1,156 +1,101 @@
 #include <vulkan/vulkan.h>
 #include <iostream>
 #include <vector>
+#include <deque>
 #include <fstream>
 #include <stdexcept>
 #include <cstring>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <future>
+#include <thread>
+#include <filesystem>
+#include <span>
+#include <random>
+#include <numeric>
+#include <functional>
+#include <iterator>
 
-#define VK_CHECK(x) do { VkResult err = x; if (err != VK_SUCCESS) throw std::runtime_error("Vulkan error at " #x); } while(0)
-
-// Load SPIR-V binary
-std::vector<char> readFile(const std::string& filename) {
-    std::ifstream file(filename, std::ios::ate | std::ios::binary);
-    if (!file.is_open()) throw std::runtime_error("Failed to open file: " + filename);
-    size_t size = file.tellg();
-    std::vector<char> buffer(size);
-    file.seekg(0);
-    file.read(buffer.data(), size);
-    return buffer;
-}
-
-int main() {
-    const int N = 16;
-
-    // 1️⃣ Instance
-    VkApplicationInfo appInfo{};
-    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-    appInfo.pApplicationName = "ComputeTest";
-    appInfo.apiVersion = VK_API_VERSION_1_3;
-
-    VkInstanceCreateInfo instanceCI{};
-    instanceCI.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-    instanceCI.pApplicationInfo = &appInfo;
-
-    VkInstance instance;
-    VK_CHECK(vkCreateInstance(&instanceCI, nullptr, &instance));
-
-    // 2️⃣ GPU
-    uint32_t gpuCount = 0;
-    VK_CHECK(vkEnumeratePhysicalDevices(instance, &gpuCount, nullptr));
-    std::vector<VkPhysicalDevice> gpus(gpuCount);
-    VK_CHECK(vkEnumeratePhysicalDevices(instance, &gpuCount, gpus.data()));
-    VkPhysicalDevice gpu = gpus[0];
-
-    // 3️⃣ Queue
-    uint32_t qCount = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(gpu, &qCount, nullptr);
-    std::vector<VkQueueFamilyProperties> qProps(qCount);
-    vkGetPhysicalDeviceQueueFamilyProperties(gpu, &qCount, qProps.data());
-
-    int computeIndex = -1;
-    for (uint32_t i = 0; i < qProps.size(); ++i)
-        if (qProps[i].queueFlags & VK_QUEUE_COMPUTE_BIT) { computeIndex = i; break; }
-
-    float qp = 1.0f;
-    VkDeviceQueueCreateInfo queueCI{};
-    queueCI.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queueCI.queueFamilyIndex = computeIndex;
-    queueCI.queueCount = 1;
-    queueCI.pQueuePriorities = &qp;
-
-    VkDeviceCreateInfo deviceCI{};
-    deviceCI.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    deviceCI.queueCreateInfoCount = 1;
-    deviceCI.pQueueCreateInfos = &queueCI;
-
-    VkDevice device;
-    VK_CHECK(vkCreateDevice(gpu, &deviceCI, nullptr, &device));
-
-    VkQueue queue;
-    vkGetDeviceQueue(device, computeIndex, 0, &queue);
-
-    // 4️⃣ Buffer
-    VkBufferCreateInfo bufferCI{};
-    bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferCI.size = sizeof(uint32_t) * N;
-    bufferCI.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-    bufferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-    VkBuffer buffer;
-    VK_CHECK(vkCreateBuffer(device, &bufferCI, nullptr, &buffer));
-
-    VkMemoryRequirements memReq;
-    vkGetBufferMemoryRequirements(device, buffer, &memReq);
-
-    VkPhysicalDeviceMemoryProperties memProps;
-    vkGetPhysicalDeviceMemoryProperties(gpu, &memProps);
-
-    uint32_t memType = 0;
-    for (uint32_t i = 0; i < memProps.memoryTypeCount; ++i)
-        if ((memReq.memoryTypeBits & (1 << i)) &&
-            (memProps.memoryTypes[i].propertyFlags &
-             (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) ==
-             (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
-            memType = i;
-            break;
-        }
-
-    VkMemoryAllocateInfo memAI{};
-    memAI.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    memAI.allocationSize = memReq.size;
-    memAI.memoryTypeIndex = memType;
-
-    VkDeviceMemory bufferMem;
-    VK_CHECK(vkAllocateMemory(device, &memAI, nullptr, &bufferMem));
-    VK_CHECK(vkBindBufferMemory(device, buffer, bufferMem, 0));
-
-    // 5️⃣ Shader
-    auto shaderCode = readFile("shader.spv");
-    VkShaderModuleCreateInfo shaderModuleCI{};
-    shaderModuleCI.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    shaderModuleCI.codeSize = shaderCode.size();
-    shaderModuleCI.pCode = reinterpret_cast<const uint32_t*>(shaderCode.data());
-
-    VkShaderModule shader;
-    VK_CHECK(vkCreateShaderModule(device, &shaderModuleCI, nullptr, &shader));
-
-    // 6️⃣ Descriptor
-    VkDescriptorSetLayoutBinding layoutBinding{};
-    layoutBinding.binding = 0;
-    layoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    layoutBinding.descriptorCount = 1;
-    layoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-
-    VkDescriptorSetLayoutCreateInfo dslCI{};
-    dslCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    dslCI.bindingCount = 1;
-    dslCI.pBindings = &layoutBinding;
-
-    VkDescriptorSetLayout dsl;
-    VK_CHECK(vkCreateDescriptorSetLayout(device, &dslCI, nullptr, &dsl));
-
-    VkPipelineLayoutCreateInfo pipelineLayoutCI{};
-    pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutCI.setLayoutCount = 1;
-    pipelineLayoutCI.pSetLayouts = &dsl;
-
-    VkPipelineLayout pipelineLayout;
-    VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutCI, nullptr, &pipelineLayout));
-
-    VkComputePipelineCreateInfo computePipelineCI{};
-    computePipelineCI.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-    computePipelineCI.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    computePipelineCI.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-    computePipelineCI.stage.module = shader;
-    computePipelineCI.stage.pName = "main";
-    computePipelineCI.layout = pipelineLayout;
-
-    VkPipeline pipeline;
-    VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineCI, nullptr, &pipeline));
-
-    // 7️⃣ Descriptor pool & set
+#include "compute_context.hpp"
+#include "shader_loader.hpp"
+#include "transfer.hpp"
+#include "kernel.hpp"
+#include "dispatcher.hpp"
+#include "autotune.hpp"
+#include "job_system.hpp"
+#include "parallel_recorder.hpp"
+#include "timeline.hpp"
+#include "cpu_backend.hpp"
+#include "tiling.hpp"
+#include "primitives.hpp"
+#include "frame_graph.hpp"
+#include "startup_trace.hpp"
+#include "precision.hpp"
+
+// Options that can be passed on the command line
+struct Options {
+    bool headless = false;                          // Run an image kernel offscreen instead of the buffer kernel
+    std::string shader = "gradient.comp";           // Image kernel to dispatch in headless mode
+    uint32_t width = 1920;
+    uint32_t height = 1080;
+    std::string output = "output.ppm";
+    std::string pipelineCache = "pipeline_cache.bin";
+    std::string device;                             // Device index, UUID or name to use instead of the best scoring one
+    std::vector<std::string> mergeCaches;           // Extra cache files (e.g. from worker processes) to merge in
+    bool profile = false;                           // Print GPU timings per profiler scope at exit
+    bool memoryStats = false;                       // Print where the allocator put what before cleaning up
+    uint32_t jobs = 4;                              // Number of buffer kernel jobs to pipeline
+    bool batched = false;                           // Run many small buffer kernel dispatches through the dispatcher
+    uint32_t dispatches = 4096;                     // Dispatches per round in batched mode
+    uint32_t repeat = 4;                            // Rounds in batched mode
+    uint32_t batchSize = Dispatcher::DEFAULT_BATCH_SIZE;
+    uint32_t recordThreads = 0;                     // Re-record every round on this many threads (0 = replay)
+    bool tune = false;                              // Sweep workgroup sizes for the kernel being run and save the best
+    std::string tuningFile = "workgroups.txt";      // Tuned workgroup sizes per device and kernel
+    Backend backend = Backend::Auto;                // Where the kernels run
+    bool validateCpu = false;                       // Compare the Vulkan results with the CPU backend's
+    uint64_t stream = 0;                            // Square this many values tile by tile into streamOutput
+    std::string streamOutput = "squares.bin";
+    uint32_t maxTileMiB = 0;                        // Cap on the size of a tile, 0 = as big as the device allows
+    bool testPrimitives = false;                    // Check the parallel primitives against std:: and exit
+    bool fp32 = false;                              // Never use the fp16 image kernel variants (see precision.hpp)
+    bool testPrecision = false;                     // Check the fp16 variants against the fp32 kernels and exit
+    std::string startupTrace;                       // Chrome trace of the startup phases, written at exit if set
+};
+
+// Workgroup size used until squares.comp has been tuned for the device (see autotune.hpp). The image kernels' is
+// IMAGE_WORKGROUP_SIZE in tiling.hpp.
+constexpr WorkgroupSize SQUARES_WORKGROUP_SIZE{ 64, 1, 1 };
+
+// Elements in the scratch buffer squares.comp is tuned on. The real jobs are far too small to time.
+constexpr uint32_t SQUARES_TUNING_ELEMENTS = 1u << 22;
+
+// Elements squared by one squares.comp dispatch
+constexpr uint32_t BUFFER_KERNEL_ELEMENTS = 16;
+
+// Push constants of squares.comp
+struct SquaresRange {
+    uint32_t offset;                                // First element of the dispatch
+    uint32_t count;                                 // Number of elements
+};
+
+// Dispatches per secondary command buffer when rounds are recorded in parallel. Big enough that a job outweighs
+// the cost of handing it to a thread, small enough that hundreds of dispatches still spread over every core.
+constexpr uint32_t DISPATCHES_PER_SECONDARY = 32;
+
+// Buffer kernel jobs in flight at once. Each one gets its own buffer and descriptor set, so the upload of one job,
+// the dispatch of the one before it and the readback of the one before that can overlap.
+constexpr uint32_t PIPELINE_DEPTH = 3;
+static_assert(PIPELINE_DEPTH <= PROFILER_SLOTS);
+
+// Creates a descriptor pool with room for one set of one descriptor, and allocates that set
+VkDescriptorSet allocateSingleDescriptorSet(const ComputeContext& ctx, VkDescriptorType type,
+                                            VkDescriptorSetLayout dsl, VkDescriptorPool& descriptorPool) {
     VkDescriptorPoolSize poolSize{};
-    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSize.type = type;
     poolSize.descriptorCount = 1;
 
     VkDescriptorPoolCreateInfo poolCI{};
@@ -159,8 +104,7 @@ int main() {
     poolCI.pPoolSizes = &poolSize;
     poolCI.maxSets = 1;
 
-    VkDescriptorPool descriptorPool;
-    VK_CHECK(vkCreateDescriptorPool(device, &poolCI, nullptr, &descriptorPool));
+    VK_CHECK(vkCreateDescriptorPool(ctx.device, &poolCI, nullptr, &descriptorPool));
 
     VkDescriptorSetAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
@@ -169,12 +113,41 @@ int main() {
     allocInfo.pSetLayouts = &dsl;
 
     VkDescriptorSet descriptorSet;
-    VK_CHECK(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet));
+    VK_CHECK(vkAllocateDescriptorSets(ctx.device, &allocInfo, &descriptorSet));
+    return descriptorSet;
+}
+
+// Starts building squares.comp with the device's tuned workgroup size. The pipeline compiles on a worker thread while
+// the caller sets up its buffers and descriptors; finishSquaresKernel() waits for it.
+ComputeKernel requestSquaresKernel(const ComputeContext& ctx, WorkgroupTuner& tuner, PipelineHandle& pending) {
+    ComputeKernel kernel = createKernelLayout(ctx, loadShader("squares.comp").span(),
+                                              { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }, sizeof(SquaresRange),
+                                              tuner.find("squares.comp").value_or(SQUARES_WORKGROUP_SIZE));
+    pending = requestPipeline(ctx, kernel);
+    return kernel;
+}
+
+// Takes the pipeline requestSquaresKernel() started. With --tune the sizes are swept next, on a scratch buffer of
+// SQUARES_TUNING_ELEMENTS uints, which may change kernel.workgroupSize.
+void finishSquaresKernel(const ComputeContext& ctx, const Options& opts, WorkgroupTuner& tuner, ComputeKernel& kernel,
+                         PipelineHandle pending) {
+    kernel.pipeline = ctx.pipelines->take(pending);
+    if (!opts.tune) return;
+
+    const VkDeviceSize bufferSize = sizeof(uint32_t) * SQUARES_TUNING_ELEMENTS;
+
+    AllocationCreateInfo bufferAI{};
+    bufferAI.usage = MemoryUsage::GpuOnly;
+    GpuBuffer* scratch = ctx.allocator->createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, bufferAI);
+
+    VkDescriptorPool descriptorPool;
+    VkDescriptorSet descriptorSet =
+        allocateSingleDescriptorSet(ctx, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, kernel.setLayout, descriptorPool);
 
     VkDescriptorBufferInfo bufInfo{};
-    bufInfo.buffer = buffer;
+    bufInfo.buffer = scratch->buffer;
     bufInfo.offset = 0;
-    bufInfo.range = bufferCI.size;
+    bufInfo.range = bufferSize;
 
     VkWriteDescriptorSet writeDS{};
     writeDS.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
@@ -184,72 +157,1383 @@ int main() {
     writeDS.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
     writeDS.pBufferInfo = &bufInfo;
 
-    vkUpdateDescriptorSets(device, 1, &writeDS, 0, nullptr);
+    vkUpdateDescriptorSets(ctx.device, 1, &writeDS, 0, nullptr);
+
+    // The scratch contents are garbage, which squaring doesn't care about
+    SquaresRange range{ 0, SQUARES_TUNING_ELEMENTS };
+    tuner.tune("squares.comp", kernel, 1, [&](VkCommandBuffer cmd, const WorkgroupSize& size) {
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.layout, 0, 1, &descriptorSet, 0, nullptr);
+        vkCmdPushConstants(cmd, kernel.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(range), &range);
+        vkCmdDispatch(cmd, groupCount(SQUARES_TUNING_ELEMENTS, size.x), 1, 1);
+    });
+
+    vkDestroyDescriptorPool(ctx.device, descriptorPool, nullptr);
+    ctx.allocator->destroyBuffer(scratch);
+}
+
+// Compares a Vulkan result with the CPU backend's, bit for bit unless a tolerance is given. Throws if any value is
+// further off than that.
+template <typename T>
+void validateAgainstCpu(const std::string& what, std::span<const T> gpu, std::span<const T> cpu, T tolerance = 0) {
+    if (gpu.size() != cpu.size()) throw std::runtime_error(what + ": GPU and CPU results differ in size");
+
+    size_t differing = 0;
+    size_t first = 0;
+    for (size_t i = 0; i < gpu.size(); ++i) {
+        T difference = gpu[i] > cpu[i] ? gpu[i] - cpu[i] : cpu[i] - gpu[i];
+        if (difference <= tolerance) continue;
+        if (differing++ == 0) first = i;
+    }
+
+    if (differing > 0)
+        throw std::runtime_error(what + ": " + std::to_string(differing) + " of " + std::to_string(gpu.size()) +
+                                 " values differ from the CPU backend, the first at index " + std::to_string(first));
+
+    std::cout << "Validated " << what << " against the CPU backend: all " << gpu.size() << " values "
+              << (tolerance == 0 ? std::string("match") : "within " + std::to_string(tolerance)) << "\n";
+}
+
+// Prints how long the transfer engine's batches ran on the GPU and how much of that time they overlapped
+void printTransferTimings(const TransferEngine& transfers) {
+    if (!transfers.timed()) {
+        std::cout << "Transfers: not timed, the device can't reset query pools from the host or has no timestamps\n";
+        return;
+    }
+
+    TransferTimings timings = transfers.timings();
+    std::cout << "Transfers: " << timings.jobs << " jobs timed, upload " << timings.uploadMs << " ms, compute "
+              << timings.computeMs << " ms, readback " << timings.readbackMs << " ms, busy " << timings.busyMs
+              << " ms, " << timings.overlap() * 100.0 << "% overlapped\n";
+}
+
+// Runs opts.jobs jobs of squares.comp over N uints each. The buffers live in device-local memory, and the input and
+// results move through the transfer engine's staging rings, with up to PIPELINE_DEPTH jobs in flight.
+void runBufferKernel(const ComputeContext& ctx, const Options& opts, WorkgroupTuner& tuner) {
+    const uint32_t N = BUFFER_KERNEL_ELEMENTS;
+    const VkDeviceSize bufferSize = sizeof(uint32_t) * N;
+
+    TransferEngine transfers(ctx);
+    std::cout << "Transfers run on "
+              << (transfers.hasDedicatedQueue() ? "a dedicated transfer queue" : "the compute queue")
+              << (transfers.hasReadbackQueue() ? ", readbacks on a queue of their own" : "") << "\n";
+
+    // 1️⃣ Kernel, which compiles while the buffers and descriptor sets are set up
+    PipelineHandle pendingPipeline;
+    ComputeKernel kernel = requestSquaresKernel(ctx, tuner, pendingPipeline);
+    SquaresRange range{ 0, N };
+
+    // 2️⃣ One device-local buffer and descriptor set per job in flight
+    AllocationCreateInfo bufferAI{};
+    bufferAI.usage = MemoryUsage::GpuOnly;
+
+    GpuBuffer* buffers[PIPELINE_DEPTH];
+    VkDescriptorPool descriptorPools[PIPELINE_DEPTH];
+    VkDescriptorSet descriptorSets[PIPELINE_DEPTH];
+
+    for (uint32_t slot = 0; slot < PIPELINE_DEPTH; ++slot) {
+        buffers[slot] = ctx.allocator->createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, bufferAI);
+        descriptorSets[slot] = allocateSingleDescriptorSet(ctx, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, kernel.setLayout,
+                                                           descriptorPools[slot]);
+
+        VkDescriptorBufferInfo bufInfo{};
+        bufInfo.buffer = buffers[slot]->buffer;
+        bufInfo.offset = 0;
+        bufInfo.range = bufferSize;
+
+        VkWriteDescriptorSet writeDS{};
+        writeDS.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeDS.dstSet = descriptorSets[slot];
+        writeDS.dstBinding = 0;
+        writeDS.descriptorCount = 1;
+        writeDS.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writeDS.pBufferInfo = &bufInfo;
+
+        vkUpdateDescriptorSets(ctx.device, 1, &writeDS, 0, nullptr);
+    }
+    finishSquaresKernel(ctx, opts, tuner, kernel, pendingPipeline);
+
+    // 3️⃣ Upload, dispatch & read back each job without waiting for the previous one
+    std::vector<std::vector<uint32_t>> results(opts.jobs, std::vector<uint32_t>(N));
+    std::vector<uint64_t> jobIds(opts.jobs);
+    std::vector<uint32_t> input(N);
+
+    for (uint32_t j = 0; j < opts.jobs; ++j) {
+        uint32_t slot = j % PIPELINE_DEPTH;
+
+        // The slot's buffer, descriptor set and profiler queries are free once the job that used them last retired
+        if (j >= PIPELINE_DEPTH) transfers.waitFor(jobIds[j - PIPELINE_DEPTH]);
+
+        for (uint32_t i = 0; i < N; ++i) input[i] = j * N + i;
+
+        TransferEngine::Job* job = transfers.beginJob();
+        transfers.upload(job, buffers[slot], input.data(), bufferSize);
+
+        VkCommandBuffer cmdBuf = transfers.computeCommands(job);
+        ctx.profiler->beginFrame(cmdBuf, slot);
+
+        {
+            GpuProfiler::Scope scope(*ctx.profiler, cmdBuf, "squares");
+            vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline);
+            vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.layout, 0, 1,
+                                    &descriptorSets[slot], 0, nullptr);
+            vkCmdPushConstants(cmdBuf, kernel.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(range), &range);
+            vkCmdDispatch(cmdBuf, groupCount(N, kernel.workgroupSize.x), 1, 1);
+        }
+
+        transfers.readback(job, buffers[slot], results[j].data(), bufferSize);
+        jobIds[j] = transfers.submit(job);
+    }
+
+    transfers.waitFor(jobIds.back());
+    ctx.profiler->collectAll();
+    if (opts.profile) printTransferTimings(transfers);
+
+    // 4️⃣ Print the first job and check the rest
+    std::cout << "GPU Output: ";
+    for (uint32_t i = 0; i < N; ++i) std::cout << results[0][i] << " ";
+    std::cout << "\n";
+
+    uint32_t mismatches = 0;
+    for (uint32_t j = 0; j < opts.jobs; ++j)
+        for (uint32_t i = 0; i < N; ++i) {
+            uint32_t value = j * N + i;
+            if (results[j][i] != value * value) ++mismatches;
+        }
+
+    std::cout << opts.jobs << " jobs, " << mismatches << " wrong values\n";
+
+    if (opts.validateCpu) {
+        std::vector<uint32_t> gpu, cpu(static_cast<size_t>(opts.jobs) * N);
+        for (const auto& result : results) gpu.insert(gpu.end(), result.begin(), result.end());
+        for (uint32_t i = 0; i < cpu.size(); ++i) cpu[i] = i;
+
+        CpuBackend().squares(cpu);
+        validateAgainstCpu<uint32_t>("squares.comp", gpu, cpu);
+    }
+
+    if (opts.memoryStats) ctx.allocator->stats().print(std::cout);
+
+    // Cleanup
+    for (uint32_t slot = 0; slot < PIPELINE_DEPTH; ++slot) {
+        vkDestroyDescriptorPool(ctx.device, descriptorPools[slot], nullptr);
+        ctx.allocator->destroyBuffer(buffers[slot]);
+    }
+    destroyKernel(ctx, kernel);
+}
+
+// Batched mode, default: records every dispatch once and replays the recordings round after round through the
+// dispatcher, opts.batchSize dispatches per vkQueueSubmit
+void replayRecordedRounds(const ComputeContext& ctx, const Options& opts, const ComputeKernel& kernel,
+                          VkDescriptorSet descriptorSet) {
+    const uint32_t N = BUFFER_KERNEL_ELEMENTS;
+    Dispatcher dispatcher(ctx, opts.batchSize);
+
+    std::vector<RecordedDispatch> dispatches(opts.dispatches);
+    for (uint32_t d = 0; d < opts.dispatches; ++d) {
+        SquaresRange range{ d * N, N };
+        dispatches[d] = dispatcher.record(kernel, descriptorSet, groupCount(N, kernel.workgroupSize.x), 1, 1, &range);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::shared_future<void> done;
+    for (uint32_t round = 0; round < opts.repeat; ++round) {
+        for (const auto& dispatch : dispatches) done = dispatcher.enqueue(dispatch);
+        dispatcher.barrier();
+    }
+    dispatcher.flush();
+    done.wait();
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    uint64_t total = static_cast<uint64_t>(opts.dispatches) * opts.repeat;
+
+    std::cout << total << " dispatches in " << dispatcher.submissions() << " submissions, " << ms << " ms ("
+              << total / (ms / 1000.0) << " dispatches/s)\n";
+
+    for (auto& dispatch : dispatches) dispatcher.release(dispatch);
+}
+
+// Batched mode with --record-threads: records each round afresh, the way a renderer records each frame. The
+// dispatches are split into secondaries recorded on every thread, and one primary per round executes them in order.
+// Up to PIPELINE_DEPTH rounds are in flight, so recording the next round overlaps the GPU running the last one.
+void recordRoundsInParallel(const ComputeContext& ctx, const Options& opts, const ComputeKernel& kernel,
+                            VkDescriptorSet descriptorSet) {
+    const uint32_t N = BUFFER_KERNEL_ELEMENTS;
+    JobSystem jobs(opts.recordThreads);
+    ParallelRecorder recorder(ctx, jobs, PIPELINE_DEPTH);
+
+    // Round r signals value r + 1. A slot can be recorded into again once the round that last used it has finished.
+    Timeline timeline(ctx.device);
+    uint64_t slotValues[PIPELINE_DEPTH]{};
+
+    auto record = [&](VkCommandBuffer cmd, uint32_t first, uint32_t count) {
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.layout, 0, 1, &descriptorSet, 0, nullptr);
+        for (uint32_t d = first; d < first + count; ++d) {
+            SquaresRange range{ d * N, N };
+            vkCmdPushConstants(cmd, kernel.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(range), &range);
+            vkCmdDispatch(cmd, groupCount(N, kernel.workgroupSize.x), 1, 1);
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    double recordMs = 0.0;
+
+    for (uint32_t round = 0; round < opts.repeat; ++round) {
+        uint32_t slot = round % PIPELINE_DEPTH;
+        timeline.wait(slotValues[slot]);
+
+        auto recordStart = std::chrono::steady_clock::now();
+        recorder.beginFrame(slot);
+
+        std::vector<VkCommandBuffer> secondaries =
+            recorder.record(slot, opts.dispatches, DISPATCHES_PER_SECONDARY, record);
+
+        // The previous round, submitted earlier on the same queue, has to finish writing first
+        VkCommandBuffer cmd = recorder.primary(slot);
+
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                             &barrier, 0, nullptr, 0, nullptr);
 
-    // 8️⃣ Command pool & buffer
-    VkCommandPoolCreateInfo cmdPoolCI{};
-    cmdPoolCI.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    cmdPoolCI.queueFamilyIndex = computeIndex;
+        vkCmdExecuteCommands(cmd, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+        VK_CHECK(vkEndCommandBuffer(cmd));
+        recordMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordStart).count();
 
-    VkCommandPool cmdPool;
-    VK_CHECK(vkCreateCommandPool(device, &cmdPoolCI, nullptr, &cmdPool));
+        slotValues[slot] = timeline.next();
+        SemaphoreSignal done{ timeline.handle(), slotValues[slot] };
+        queueSubmit(ctx.queue, { &cmd, 1 }, {}, { &done, 1 });
+    }
 
-    VkCommandBufferAllocateInfo cmdBufAI{};
-    cmdBufAI.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    cmdBufAI.commandPool = cmdPool;
-    cmdBufAI.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    cmdBufAI.commandBufferCount = 1;
+    timeline.wait(timeline.lastValue());
 
-    VkCommandBuffer cmdBuf;
-    VK_CHECK(vkAllocateCommandBuffers(device, &cmdBufAI, &cmdBuf));
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    uint64_t total = static_cast<uint64_t>(opts.dispatches) * opts.repeat;
 
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    VK_CHECK(vkBeginCommandBuffer(cmdBuf, &beginInfo));
+    std::cout << total << " dispatches in " << opts.repeat << " submissions, " << ms << " ms ("
+              << total / (ms / 1000.0) << " dispatches/s)\n";
+    if (opts.repeat > 0)
+        std::cout << "Recording took " << recordMs / opts.repeat << " ms per round on " << jobs.threadCount()
+                  << " threads\n";
+}
+
+// Elements the batched mode squares, opts.dispatches dispatches of BUFFER_KERNEL_ELEMENTS each. The product is taken
+// in 64 bits and rejected above maxElements, before anything is allocated, instead of wrapping around in 32.
+uint32_t batchedElementCount(const Options& opts, uint64_t maxElements) {
+    const uint64_t count = static_cast<uint64_t>(opts.dispatches) * BUFFER_KERNEL_ELEMENTS;
+    if (count > std::min<uint64_t>(maxElements, UINT32_MAX))
+        throw std::runtime_error("--dispatches " + std::to_string(opts.dispatches) + " needs " +
+                                 std::to_string(count) + " elements, more than the " +
+                                 std::to_string(std::min<uint64_t>(maxElements, UINT32_MAX)) + " one buffer can hold");
+    return static_cast<uint32_t>(count);
+}
+
+// Squares one device-local buffer in opts.dispatches tiny dispatches of BUFFER_KERNEL_ELEMENTS elements each, which
+// is where per-submit and per-command overhead dominates. Every round squares the whole buffer again, either by
+// replaying dispatches recorded once or, with --record-threads, by recording the round anew on several threads.
+void runBatchedKernel(const ComputeContext& ctx, const Options& opts, WorkgroupTuner& tuner) {
+    const uint32_t N = BUFFER_KERNEL_ELEMENTS;
+
+    // The whole buffer is bound as one storage buffer, so it can't be larger than one binding's range
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(ctx.gpu, &props);
+    const uint32_t count = batchedElementCount(opts, props.limits.maxStorageBufferRange / sizeof(uint32_t));
+    const VkDeviceSize bufferSize = sizeof(uint32_t) * static_cast<VkDeviceSize>(count);
+
+    // 1️⃣ Kernel, buffer & descriptor set. The pipeline compiles until the rounds need it, through the upload.
+    PipelineHandle pendingPipeline;
+    ComputeKernel kernel = requestSquaresKernel(ctx, tuner, pendingPipeline);
+
+    AllocationCreateInfo bufferAI{};
+    bufferAI.usage = MemoryUsage::GpuOnly;
+    GpuBuffer* buffer = ctx.allocator->createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, bufferAI);
+
+    VkDescriptorPool descriptorPool;
+    VkDescriptorSet descriptorSet =
+        allocateSingleDescriptorSet(ctx, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, kernel.setLayout, descriptorPool);
+
+    VkDescriptorBufferInfo bufInfo{};
+    bufInfo.buffer = buffer->buffer;
+    bufInfo.offset = 0;
+    bufInfo.range = bufferSize;
+
+    VkWriteDescriptorSet writeDS{};
+    writeDS.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeDS.dstSet = descriptorSet;
+    writeDS.dstBinding = 0;
+    writeDS.descriptorCount = 1;
+    writeDS.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDS.pBufferInfo = &bufInfo;
 
-    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
-    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
-    vkCmdDispatch(cmdBuf, N, 1, 1);
+    vkUpdateDescriptorSets(ctx.device, 1, &writeDS, 0, nullptr);
 
-    VK_CHECK(vkEndCommandBuffer(cmdBuf));
+    // 2️⃣ Upload the input. The job's compute commands take the buffer over from the transfer queue.
+    TransferEngine transfers(ctx, std::max(TransferEngine::DEFAULT_STAGING_SIZE, bufferSize));
 
-    // 9️⃣ Submit & wait
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &cmdBuf;
+    std::vector<uint32_t> values(count);
+    for (uint32_t i = 0; i < count; ++i) values[i] = i;
 
-    VkFenceCreateInfo fenceCI{};
-    fenceCI.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    VkFence fence;
-    VK_CHECK(vkCreateFence(device, &fenceCI, nullptr, &fence));
+    TransferEngine::Job* job = transfers.beginJob();
+    transfers.upload(job, buffer, values.data(), bufferSize);
+    transfers.computeCommands(job);
+    transfers.waitFor(transfers.submit(job));
 
-    VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, fence));
-    VK_CHECK(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
+    // 3️⃣ Square every element once per round. Rounds depend on each other, so they are ordered by barriers.
+    finishSquaresKernel(ctx, opts, tuner, kernel, pendingPipeline);
+    if (opts.recordThreads > 0)
+        recordRoundsInParallel(ctx, opts, kernel, descriptorSet);
+    else
+        replayRecordedRounds(ctx, opts, kernel, descriptorSet);
 
-    // 10️⃣ Read back
-    void* data;
-    VK_CHECK(vkMapMemory(device, bufferMem, 0, bufferCI.size, 0, &data));
-    uint32_t* out = static_cast<uint32_t*>(data);
+    // 4️⃣ Read back & check. Squaring wraps around at 2^32 on the GPU and here alike.
+    job = transfers.beginJob();
+    transfers.readback(job, buffer, values.data(), bufferSize);
+    transfers.waitFor(transfers.submit(job));
 
     std::cout << "GPU Output: ";
-    for (int i = 0; i < N; ++i) std::cout << out[i] << " ";
+    for (uint32_t i = 0; i < N; ++i) std::cout << values[i] << " ";
     std::cout << "\n";
 
-    vkUnmapMemory(device, bufferMem);
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t expected = i;
+        for (uint32_t round = 0; round < opts.repeat; ++round) expected *= expected;
+        if (values[i] != expected) ++mismatches;
+    }
+
+    std::cout << count << " values, " << mismatches << " wrong\n";
+
+    if (opts.validateCpu) {
+        std::vector<uint32_t> cpu(count);
+        for (uint32_t i = 0; i < count; ++i) cpu[i] = i;
+
+        CpuBackend().squares(cpu, opts.repeat);
+        validateAgainstCpu<uint32_t>("squares.comp", values, cpu);
+    }
+
+    if (opts.memoryStats) ctx.allocator->stats().print(std::cout);
+
+    // Cleanup
+    vkDestroyDescriptorPool(ctx.device, descriptorPool, nullptr);
+    ctx.allocator->destroyBuffer(buffer);
+    destroyKernel(ctx, kernel);
+}
+
+// Writes tightly packed RGBA8 pixels to a binary PPM file. PPM has no alpha channel, so alpha is dropped.
+void writePPM(const std::string& path, const uint8_t* rgba, uint32_t width, uint32_t height) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) throw std::runtime_error("Failed to open file: " + path);
+
+    file << "P6\n" << width << " " << height << "\n255\n";
+
+    std::vector<uint8_t> row(static_cast<size_t>(width) * 3);
+    for (uint32_t y = 0; y < height; ++y) {
+        const uint8_t* src = rgba + static_cast<size_t>(y) * width * 4;
+        for (uint32_t x = 0; x < width; ++x) {
+            row[x * 3 + 0] = src[x * 4 + 0];
+            row[x * 3 + 1] = src[x * 4 + 1];
+            row[x * 3 + 2] = src[x * 4 + 2];
+        }
+        file.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size()));
+    }
+
+    if (!file) throw std::runtime_error("Failed to write file: " + path);
+}
+
+// Headless image path: dispatches an image kernel (gradient.comp, shader.comp) into an offscreen RGBA8 storage image
+// and copies the result into a host-visible buffer. A reduced precision variant (see precision.hpp) writes its pixels
+// into a device-local storage buffer instead, which is copied the same way. No window or surface is created.
+// Returns the buffer, tightly packed and ready to be read on the host; the caller destroys it.
+GpuBuffer* renderImage(const ComputeContext& ctx, const Options& opts, WorkgroupTuner& tuner,
+                       const PrecisionVariant* variant) {
+    // 1️⃣ Kernel, with the device's tuned workgroup size. Tuning results are keyed by file name, so variants are
+    // tuned on their own. The pipeline compiles on a worker thread while the image, buffer and descriptors are set up.
+    const std::string shader = variant ? variant->variant : opts.shader;
+    const std::string kernelName = std::filesystem::path(shader).filename().string();
+    const VkDescriptorType descriptorType =
+        variant ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    ComputeKernel kernel = createKernelLayout(ctx, loadShader(shader).span(), { descriptorType },
+                                              sizeof(ImageTileConstants),
+                                              tuner.find(kernelName).value_or(IMAGE_WORKGROUP_SIZE));
+    PipelineHandle pendingPipeline = requestPipeline(ctx, kernel);
+    ImageTileConstants wholeImage{ 0, 0, static_cast<int32_t>(opts.width), static_cast<int32_t>(opts.height) };
+
+    // 2️⃣ Storage image, for the fp32 kernels. Nothing outside the frame needs it, so it is a transient the frame
+    // graph allocates in device-local memory. The variants write a device-local buffer of the same pixels instead.
+    const VkDeviceSize imageBytes = static_cast<VkDeviceSize>(opts.width) * opts.height * 4;
+    FrameGraph graph(ctx.gpu, ctx.device);
+    FrameGraph::Resource target = 0;                          // The image, or the variant's pixel buffer
+    GpuBuffer* pixels = nullptr;
+
+    if (!variant) {
+        VkImageCreateInfo imageCI{};
+        imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageCI.imageType = VK_IMAGE_TYPE_2D;
+        imageCI.format = VK_FORMAT_R8G8B8A8_UNORM;                   // Matches the rgba8 qualifier in the kernels
+        imageCI.extent = { opts.width, opts.height, 1 };
+        imageCI.mipLevels = 1;
+        imageCI.arrayLayers = 1;
+        imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageCI.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        imageCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageCI.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        target = graph.createImage("image", imageCI);
+    } else {
+        AllocationCreateInfo pixelsAI{};
+        pixelsAI.usage = MemoryUsage::GpuOnly;
+        pixels = ctx.allocator->createBuffer(imageBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                                         VK_BUFFER_USAGE_TRANSFER_SRC_BIT, pixelsAI);
+        target = graph.importBuffer("pixels", pixels->buffer);
+    }
+
+    // 3️⃣ Readback buffer the pixels get copied into. Readback memory is host cached where the device has it, which
+    // makes reading it on the CPU many times faster but means it may have to be invalidated first.
+    AllocationCreateInfo bufferAI{};
+    bufferAI.usage = MemoryUsage::Readback;
+
+    GpuBuffer* readback = ctx.allocator->createBuffer(imageBytes, VK_BUFFER_USAGE_TRANSFER_DST_BIT, bufferAI);
+    FrameGraph::Resource buffer = graph.importBuffer("readback", readback->buffer);
+
+    // 4️⃣ Passes: dispatch into the image or pixel buffer, copy it into the readback buffer, which the host reads.
+    // The graph puts the layout transitions and the transfer -> host barrier in between.
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+    graph.addPass("dispatch", [&](VkCommandBuffer cmd) {
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.layout, 0, 1, &descriptorSet, 0, nullptr);
+        vkCmdPushConstants(cmd, kernel.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(wholeImage), &wholeImage);
+
+        // One invocation per pixel, rounded up to whole workgroups. The kernels skip pixels outside the image.
+        GpuProfiler::Scope scope(*ctx.profiler, cmd, "dispatch");
+        vkCmdDispatch(cmd, groupCount(opts.width, kernel.workgroupSize.x),
+                      groupCount(opts.height, kernel.workgroupSize.y), 1);
+    }).write(target, resource_use::COMPUTE_WRITE);
+
+    graph.addPass("readback", [&](VkCommandBuffer cmd) {
+        GpuProfiler::Scope scope(*ctx.profiler, cmd, "readback");
+        if (variant) {
+            VkBufferCopy region{ 0, 0, imageBytes };
+            vkCmdCopyBuffer(cmd, pixels->buffer, readback->buffer, 1, &region);
+            return;
+        }
+
+        VkBufferImageCopy region{};
+        region.bufferOffset = 0;
+        region.bufferRowLength = 0;                                  // Tightly packed
+        region.bufferImageHeight = 0;
+        region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        region.imageOffset = { 0, 0, 0 };
+        region.imageExtent = { opts.width, opts.height, 1 };
+
+        vkCmdCopyImageToBuffer(cmd, graph.image(target), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback->buffer, 1,
+                               &region);
+    }).read(target, resource_use::TRANSFER_READ).write(buffer, resource_use::TRANSFER_WRITE);
+
+    graph.output(buffer, resource_use::HOST_READ);
+    graph.compile();
+
+    // 5️⃣ Descriptor pool & set, for the image compile() created or for the pixel buffer
+    VkDescriptorPool descriptorPool;
+    descriptorSet = allocateSingleDescriptorSet(ctx, descriptorType, kernel.setLayout, descriptorPool);
+
+    VkDescriptorImageInfo imgInfo{};
+    imgInfo.imageView = variant ? VK_NULL_HANDLE : graph.view(target);
+    imgInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkDescriptorBufferInfo bufInfo{};
+    bufInfo.buffer = variant ? pixels->buffer : VK_NULL_HANDLE;
+    bufInfo.offset = 0;
+    bufInfo.range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet writeDS{};
+    writeDS.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeDS.dstSet = descriptorSet;
+    writeDS.dstBinding = 0;
+    writeDS.descriptorCount = 1;
+    writeDS.descriptorType = descriptorType;
+    writeDS.pImageInfo = variant ? nullptr : &imgInfo;
+    writeDS.pBufferInfo = variant ? &bufInfo : nullptr;
+
+    vkUpdateDescriptorSets(ctx.device, 1, &writeDS, 0, nullptr);
+
+    // Nothing else to set up, so from here on the pipeline is needed
+    kernel.pipeline = ctx.pipelines->take(pendingPipeline);
+
+    // With --tune, sweep workgroup sizes on the real image first. It has to be in the General layout for that.
+    if (opts.tune) {
+        if (!variant) {
+            VkCommandBuffer cmd = beginCommands(ctx);
+            imageBarrier(cmd, graph.image(target), {}, resource_use::COMPUTE_WRITE);
+            submitAndWait(ctx, cmd);
+        }
+
+        tuner.tune(kernelName, kernel, 2, [&](VkCommandBuffer cmd, const WorkgroupSize& size) {
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.layout, 0, 1, &descriptorSet, 0,
+                                    nullptr);
+            vkCmdPushConstants(cmd, kernel.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(wholeImage), &wholeImage);
+            vkCmdDispatch(cmd, groupCount(opts.width, size.x), groupCount(opts.height, size.y), 1);
+        });
+    }
+
+    // 6️⃣ Record the graph
+    VkCommandBuffer cmdBuf = beginCommands(ctx);
+    ctx.profiler->beginFrame(cmdBuf, 0);
+    ctx.profiler->begin(cmdBuf, shader);
+    graph.execute(cmdBuf);
+    ctx.profiler->end(cmdBuf);
+
+    // 7️⃣ Submit & wait
+    submitAndWait(ctx, cmdBuf);
+    ctx.profiler->collectAll();
+    ctx.allocator->invalidate(readback->allocation);
+
+    if (opts.memoryStats) {
+        ctx.allocator->stats().print(std::cout);
+
+        const FrameGraph::Stats& stats = graph.stats();
+        std::cout << "Frame graph: " << stats.transientImages << " transient images in "
+                  << stats.transientAllocations << " allocations, " << stats.transientBytes / 1024 << " KiB; "
+                  << stats.batches << " barriers for " << stats.passes << " passes\n";
+    }
+
+    // Cleanup. The graph frees the image when it goes out of scope.
+    vkDestroyDescriptorPool(ctx.device, descriptorPool, nullptr);
+    if (pixels) ctx.allocator->destroyBuffer(pixels);
+    destroyKernel(ctx, kernel);
+    return readback;
+}
+
+// Renders opts.shader headless and writes it out as a PPM. Built-in kernels run as their fp16 variant wherever the
+// device and the image size allow it, unless --fp32 is given.
+void runImageKernel(const ComputeContext& ctx, const Options& opts, WorkgroupTuner& tuner) {
+    const PrecisionVariant* variant =
+        opts.fp32 ? nullptr : findPrecisionVariant(ctx.precision, opts.shader, opts.width, opts.height);
+    const std::string shader = variant ? variant->variant : opts.shader;
+    if (variant) std::cout << "Running " << shader << ", the fp16 variant of " << opts.shader << "\n";
+
+    // 8️⃣ Read back and write out
+    GpuBuffer* readback = renderImage(ctx, opts, tuner, variant);
+    const uint8_t* pixels = static_cast<const uint8_t*>(readback->allocation.mapped);
+    writePPM(opts.output, pixels, opts.width, opts.height);
+
+    std::cout << "Wrote " << opts.width << "x" << opts.height << " image from " << shader
+              << " to " << opts.output << "\n";
+
+    // The fp32 kernels match the CPU backend within one step per channel (see cpu_backend.hpp). The variants are
+    // allowed their fp16 rounding on top of that.
+    if (opts.validateCpu) {
+        if (auto cpuKernel = findCpuImageKernel(opts.shader)) {
+            const size_t bytes = static_cast<size_t>(opts.width) * opts.height * 4;
+            std::vector<uint8_t> cpu(bytes);
+            CpuBackend().image(*cpuKernel, opts.width, opts.height, cpu.data());
+
+            std::span<const uint8_t> gpu(pixels, bytes);
+            uint32_t tolerance = cpu_validation::UNORM8_TOLERANCE + (variant ? precision::UNORM8_TOLERANCE : 0);
+            validateAgainstCpu<uint8_t>(shader, gpu, cpu, static_cast<uint8_t>(tolerance));
+        } else {
+            std::cout << "Not validated: the CPU backend has no version of " << opts.shader << "\n";
+        }
+    }
+
+    ctx.allocator->destroyBuffer(readback);
+}
+
+// ===================================================== Tiled Jobs ====================================================
+// Jobs too big for one dispatch, one buffer binding or device memory, run tile by tile with up to PIPELINE_DEPTH tiles
+// in flight through the transfer engine. Results go straight into a memory-mapped output file as tiles retire.
+
+// How the headless image splits into tiles on this device. A single tile means runImageKernel can do it in one go.
+std::vector<Tile> planImageTiles(const ComputeContext& ctx, const Options& opts, WorkgroupTuner& tuner) {
+    const std::string kernelName = std::filesystem::path(opts.shader).filename().string();
+    TileLimits limits = queryTileLimits(ctx, tuner.find(kernelName).value_or(IMAGE_WORKGROUP_SIZE), true,
+                                        TransferEngine::DEFAULT_STAGING_SIZE, PIPELINE_DEPTH,
+                                        static_cast<VkDeviceSize>(opts.maxTileMiB) << 20);
+    return planTiles(opts.width, opts.height, 4, limits);
+}
+
+// Headless image path for big images. Each tile is rendered into a tile-sized storage image, with its offset in the
+// full image passed as push constants, copied into a device-local buffer and read back through the staging rings. The
+// PPM is written into a mapped file row by row as tiles come back, so neither the device nor the host ever holds the
+// whole image.
+void runTiledImageKernel(const ComputeContext& ctx, const Options& opts, WorkgroupTuner& tuner) {
+    const std::vector<Tile> tiles = planImageTiles(ctx, opts, tuner);
+    const uint32_t tileWidth = tiles.front().width;                // The first tile is as big as any
+    const uint32_t tileHeight = tiles.front().height;
+    const VkDeviceSize tileBytes = static_cast<VkDeviceSize>(tileWidth) * tileHeight * 4;
+
+    if (opts.tune) std::cout << "Not tuning: tuning needs an image that fits in a single tile\n";
+
+    TransferEngine transfers(ctx);
+    std::cout << "Rendering " << opts.width << "x" << opts.height << " in " << tiles.size() << " tiles of up to "
+              << tileWidth << "x" << tileHeight << "\n";
+
+    // 1️⃣ Kernel, which compiles on a worker thread while the tile slots are set up
+    const std::string kernelName = std::filesystem::path(opts.shader).filename().string();
+    ComputeKernel kernel = createKernelLayout(ctx, loadShader(opts.shader).span(),
+                                              { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE }, sizeof(ImageTileConstants),
+                                              tuner.find(kernelName).value_or(IMAGE_WORKGROUP_SIZE));
+    PipelineHandle pendingPipeline = requestPipeline(ctx, kernel);
+
+    // 2️⃣ One tile-sized image, buffer and descriptor set per tile in flight, and host memory for its pixels
+    struct TileSlot {
+        GpuImage* image = nullptr;
+        VkImageView view = VK_NULL_HANDLE;
+        GpuBuffer* buffer = nullptr;
+        VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+        VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+        std::vector<uint8_t> rgba;
+        const Tile* tile = nullptr;                                // Tile in flight, if any
+        uint64_t jobId = 0;
+    };
+    TileSlot slots[PIPELINE_DEPTH];
+
+    VkImageCreateInfo imageCI{};
+    imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageCI.imageType = VK_IMAGE_TYPE_2D;
+    imageCI.format = VK_FORMAT_R8G8B8A8_UNORM;
+    imageCI.extent = { tileWidth, tileHeight, 1 };
+    imageCI.mipLevels = 1;
+    imageCI.arrayLayers = 1;
+    imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageCI.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    imageCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageCI.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    AllocationCreateInfo deviceAI{};
+    deviceAI.usage = MemoryUsage::GpuOnly;
+
+    for (auto& slot : slots) {
+        slot.image = ctx.allocator->createImage(imageCI, deviceAI);
+        slot.buffer = ctx.allocator->createBuffer(tileBytes, VK_BUFFER_USAGE_TRANSFER_DST_BIT, deviceAI);
+        slot.rgba.resize(tileBytes);
+
+        VkImageViewCreateInfo viewCI{};
+        viewCI.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewCI.image = slot.image->image;
+        viewCI.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewCI.format = imageCI.format;
+        viewCI.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        VK_CHECK(vkCreateImageView(ctx.device, &viewCI, nullptr, &slot.view));
+
+        slot.descriptorSet = allocateSingleDescriptorSet(ctx, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, kernel.setLayout,
+                                                         slot.descriptorPool);
+
+        VkDescriptorImageInfo imgInfo{};
+        imgInfo.imageView = slot.view;
+        imgInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        VkWriteDescriptorSet writeDS{};
+        writeDS.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeDS.dstSet = slot.descriptorSet;
+        writeDS.dstBinding = 0;
+        writeDS.descriptorCount = 1;
+        writeDS.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        writeDS.pImageInfo = &imgInfo;
+
+        vkUpdateDescriptorSets(ctx.device, 1, &writeDS, 0, nullptr);
+    }
+    kernel.pipeline = ctx.pipelines->take(pendingPipeline);
+
+    // 3️⃣ Output file: the PPM header, then the pixels as RGB
+    const std::string header = "P6\n" + std::to_string(opts.width) + " " + std::to_string(opts.height) + "\n255\n";
+    MappedOutputFile output(opts.output, header.size() + static_cast<uint64_t>(opts.width) * opts.height * 3);
+    std::memcpy(output.data(), header.data(), header.size());
+
+    // Waits for the slot's tile and copies its rows into the file, dropping alpha
+    auto writeTile = [&](TileSlot& slot) {
+        transfers.waitFor(slot.jobId);
+        const Tile& tile = *slot.tile;
+
+        for (uint32_t y = 0; y < tile.height; ++y) {
+            const uint8_t* src = slot.rgba.data() + static_cast<size_t>(y) * tile.width * 4;
+            uint8_t* dst = output.data() + header.size() + ((tile.y + y) * opts.width + tile.x) * 3;
+            for (uint32_t x = 0; x < tile.width; ++x) {
+                dst[x * 3 + 0] = src[x * 4 + 0];
+                dst[x * 3 + 1] = src[x * 4 + 1];
+                dst[x * 3 + 2] = src[x * 4 + 2];
+            }
+        }
+
+        // Full-width tiles are done with their rows for good
+        if (tile.width == opts.width)
+            output.release(header.size() + tile.y * opts.width * 3, tile.items() * 3);
+        slot.tile = nullptr;
+    };
+
+    // 4️⃣ Render, copy out & read back each tile without waiting for the one before it
+    for (size_t t = 0; t < tiles.size(); ++t) {
+        TileSlot& slot = slots[t % PIPELINE_DEPTH];
+        if (slot.tile) writeTile(slot);
+
+        const Tile& tile = tiles[t];
+        TransferEngine::Job* job = transfers.beginJob();
+        VkCommandBuffer cmdBuf = transfers.computeCommands(job);
+
+        // Undefined -> General: whatever the last tile left in the image doesn't matter, and its job has retired
+        imageBarrier(cmdBuf, slot.image->image, {}, resource_use::COMPUTE_WRITE);
+
+        ImageTileConstants constants{ static_cast<int32_t>(tile.x), static_cast<int32_t>(tile.y),
+                                      static_cast<int32_t>(opts.width), static_cast<int32_t>(opts.height) };
+
+        vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline);
+        vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.layout, 0, 1, &slot.descriptorSet, 0,
+                                nullptr);
+        vkCmdPushConstants(cmdBuf, kernel.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+        vkCmdDispatch(cmdBuf, groupCount(tile.width, kernel.workgroupSize.x),
+                      groupCount(tile.height, kernel.workgroupSize.y), 1);
+
+        imageBarrier(cmdBuf, slot.image->image, resource_use::COMPUTE_WRITE, resource_use::TRANSFER_READ);
+
+        // The tile is tightly packed in the buffer, so its rows are tile.width pixels apart
+        VkBufferImageCopy region{};
+        region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        region.imageExtent = { tile.width, tile.height, 1 };
+        vkCmdCopyImageToBuffer(cmdBuf, slot.image->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.buffer->buffer,
+                               1, &region);
+
+        transfers.readback(job, slot.buffer, slot.rgba.data(), tile.items() * 4, 0, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_ACCESS_TRANSFER_WRITE_BIT);
+        slot.tile = &tile;
+        slot.jobId = transfers.submit(job);
+    }
+
+    for (auto& slot : slots)
+        if (slot.tile) writeTile(slot);
+    output.close();
+
+    std::cout << "Wrote " << opts.width << "x" << opts.height << " image from " << opts.shader
+              << " to " << opts.output << "\n";
+
+    if (opts.validateCpu) std::cout << "Not validated: tiled images aren't compared with the CPU backend\n";
+    if (opts.memoryStats) ctx.allocator->stats().print(std::cout);
 
     // Cleanup
-    vkDestroyFence(device, fence, nullptr);
-    vkDestroyCommandPool(device, cmdPool, nullptr);
-    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
-    vkDestroyPipeline(device, pipeline, nullptr);
-    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-    vkDestroyDescriptorSetLayout(device, dsl, nullptr);
-    vkDestroyShaderModule(device, shader, nullptr);
-    vkFreeMemory(device, bufferMem, nullptr);
-    vkDestroyBuffer(device, buffer, nullptr);
-    vkDestroyDevice(device, nullptr);
-    vkDestroyInstance(instance, nullptr);
+    for (auto& slot : slots) {
+        vkDestroyDescriptorPool(ctx.device, slot.descriptorPool, nullptr);
+        vkDestroyImageView(ctx.device, slot.view, nullptr);
+        ctx.allocator->destroyImage(slot.image);
+        ctx.allocator->destroyBuffer(slot.buffer);
+    }
+    destroyKernel(ctx, kernel);
+}
+
+// Squares opts.stream values, 0, 1, 2, ..., tile by tile, and writes the results into opts.streamOutput as raw
+// uint32s. Each tile is uploaded, squared and read back straight into the mapped file while the tiles before and
+// after it are in flight, so jobs far bigger than device memory run in a fixed amount of it. Tiles are checked as
+// their jobs retire and then released to the OS, so they don't pile up in host memory either.
+void runStreamedKernel(const ComputeContext& ctx, const Options& opts, WorkgroupTuner& tuner) {
+    // The pipeline compiles while the transfer engine is set up. Tiles are planned after tuning, which may change the
+    // workgroup size and with it how many values one dispatch can cover.
+    PipelineHandle pendingPipeline;
+    ComputeKernel kernel = requestSquaresKernel(ctx, tuner, pendingPipeline);
+    TransferEngine transfers(ctx);
+    finishSquaresKernel(ctx, opts, tuner, kernel, pendingPipeline);
+
+    TileLimits limits = queryTileLimits(ctx, kernel.workgroupSize, false, TransferEngine::DEFAULT_STAGING_SIZE,
+                                        PIPELINE_DEPTH, static_cast<VkDeviceSize>(opts.maxTileMiB) << 20);
+    const std::vector<Tile> tiles = planTiles(opts.stream, 1, sizeof(uint32_t), limits);
+    const VkDeviceSize tileBytes = static_cast<VkDeviceSize>(tiles.front().width) * sizeof(uint32_t);
+
+    std::cout << "Streaming " << opts.stream << " values in " << tiles.size() << " tiles of up to "
+              << tiles.front().width << "\n";
+
+    // 1️⃣ One device-local buffer and descriptor set per tile in flight
+    AllocationCreateInfo bufferAI{};
+    bufferAI.usage = MemoryUsage::GpuOnly;
+
+    GpuBuffer* buffers[PIPELINE_DEPTH];
+    VkDescriptorPool descriptorPools[PIPELINE_DEPTH];
+    VkDescriptorSet descriptorSets[PIPELINE_DEPTH];
+
+    for (uint32_t slot = 0; slot < PIPELINE_DEPTH; ++slot) {
+        buffers[slot] = ctx.allocator->createBuffer(tileBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, bufferAI);
+        descriptorSets[slot] = allocateSingleDescriptorSet(ctx, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, kernel.setLayout,
+                                                           descriptorPools[slot]);
+
+        VkDescriptorBufferInfo bufInfo{};
+        bufInfo.buffer = buffers[slot]->buffer;
+        bufInfo.offset = 0;
+        bufInfo.range = tileBytes;
+
+        VkWriteDescriptorSet writeDS{};
+        writeDS.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeDS.dstSet = descriptorSets[slot];
+        writeDS.dstBinding = 0;
+        writeDS.descriptorCount = 1;
+        writeDS.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writeDS.pBufferInfo = &bufInfo;
+
+        vkUpdateDescriptorSets(ctx.device, 1, &writeDS, 0, nullptr);
+    }
+
+    // 2️⃣ Upload, dispatch & read back each tile into the file
+    MappedOutputFile output(opts.streamOutput, opts.stream * sizeof(uint32_t));
+    uint32_t* results = reinterpret_cast<uint32_t*>(output.data());
+
+    std::vector<uint64_t> jobIds(PIPELINE_DEPTH, 0);
+    std::vector<uint32_t> input(tiles.front().width);
+    std::deque<std::pair<uint64_t, size_t>> inFlight;              // Job id and tile, oldest first
+    uint64_t mismatches = 0;
+
+    // Checks every tile whose job has retired while it's still in memory, then lets the OS write it out and drop it,
+    // so nothing reads the file back afterwards. Values wrap at 2^32 like the squares do.
+    auto checkRetired = [&]() {
+        while (!inFlight.empty() && inFlight.front().first <= transfers.completedId()) {
+            const Tile& tile = tiles[inFlight.front().second];
+            for (uint64_t i = tile.x; i < tile.x + tile.width; ++i) {
+                uint32_t value = static_cast<uint32_t>(i);
+                if (results[i] != value * value) ++mismatches;
+            }
+            output.release(tile.x * sizeof(uint32_t), tile.width * sizeof(uint32_t));
+            inFlight.pop_front();
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t t = 0; t < tiles.size(); ++t) {
+        uint32_t slot = t % PIPELINE_DEPTH;
+        const Tile& tile = tiles[t];
+
+        // The slot's buffer and descriptor set are free once the tile that used them last retired
+        transfers.waitFor(jobIds[slot]);
+        transfers.poll();
+        checkRetired();
+
+        for (uint32_t i = 0; i < tile.width; ++i) input[i] = static_cast<uint32_t>(tile.x + i);
+
+        TransferEngine::Job* job = transfers.beginJob();
+        transfers.upload(job, buffers[slot], input.data(), tile.width * sizeof(uint32_t));
+
+        SquaresRange range{ 0, tile.width };
+        VkCommandBuffer cmdBuf = transfers.computeCommands(job);
+        vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline);
+        vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.layout, 0, 1, &descriptorSets[slot],
+                                0, nullptr);
+        vkCmdPushConstants(cmdBuf, kernel.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(range), &range);
+        vkCmdDispatch(cmdBuf, groupCount(tile.width, kernel.workgroupSize.x), 1, 1);
+
+        transfers.readback(job, buffers[slot], results + tile.x, tile.width * sizeof(uint32_t));
+        jobIds[slot] = transfers.submit(job);
+        inFlight.push_back({ jobIds[slot], t });
+    }
+
+    for (uint64_t id : jobIds) transfers.waitFor(id);
+    checkRetired();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    // 3️⃣ Write out what's left
+    output.close();
+
+    std::cout << opts.stream << " values in " << ms << " ms, " << mismatches << " wrong, written to "
+              << opts.streamOutput << "\n";
+    if (opts.profile) printTransferTimings(transfers);
+
+    if (opts.validateCpu) std::cout << "Not validated: streamed jobs aren't compared with the CPU backend\n";
+    if (opts.memoryStats) ctx.allocator->stats().print(std::cout);
+
+    // Cleanup
+    for (uint32_t slot = 0; slot < PIPELINE_DEPTH; ++slot) {
+        vkDestroyDescriptorPool(ctx.device, descriptorPools[slot], nullptr);
+        ctx.allocator->destroyBuffer(buffers[slot]);
+    }
+    destroyKernel(ctx, kernel);
+}
+
+// ===================================================== Primitives ====================================================
+// Checks every primitive in primitives.hpp against the std:: algorithm it stands in for, on random values and on
+// counts around tile boundaries
+
+// A buffer the host can write the input into and read the result back from
+GpuBuffer* createHostBuffer(const ComputeContext& ctx, uint32_t count) {
+    AllocationCreateInfo bufferAI{};
+    bufferAI.usage = MemoryUsage::Dynamic;
+    return ctx.allocator->createBuffer(sizeof(uint32_t) * std::max<VkDeviceSize>(count, 1),
+                                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                       bufferAI);
+}
+
+// Records the primitive, runs it and returns the first count values of output
+std::vector<uint32_t> runPrimitive(const ComputeContext& ctx, GpuPrimitives& primitives, const GpuBuffer* output,
+                                   uint32_t count, const std::function<void(VkCommandBuffer)>& record) {
+    VkCommandBuffer cmdBuf = beginCommands(ctx);
+    record(cmdBuf);
+
+    VkMemoryBarrier toHost{};
+    toHost.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    toHost.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &toHost, 0, nullptr, 0, nullptr);
+    submitAndWait(ctx, cmdBuf);
+    primitives.recycle();
+
+    ctx.allocator->invalidate(output->allocation);
+    const uint32_t* mapped = static_cast<const uint32_t*>(output->allocation.mapped);
+    return std::vector<uint32_t>(mapped, mapped + count);
+}
+
+void expectEqual(const std::string& what, uint32_t count, const std::vector<uint32_t>& gpu,
+                 const std::vector<uint32_t>& expected) {
+    auto [g, e] = std::mismatch(gpu.begin(), gpu.end(), expected.begin(), expected.end());
+    if (g == gpu.end() && e == expected.end()) return;
+
+    throw std::runtime_error(what + " of " + std::to_string(count) + " values differs from the std:: result at index " +
+                             std::to_string(g - gpu.begin()));
+}
+
+void testPrimitives(const ComputeContext& ctx) {
+    GpuPrimitives primitives(ctx);
+
+    const uint32_t tile = GpuPrimitives::TILE_SIZE;
+    const uint32_t counts[] = { 1, 2, 255, tile - 1, tile, tile + 1, 3 * tile + 17, 100003, (1u << 20) + 5 };
+    const uint32_t maxCount = *std::max_element(std::begin(counts), std::end(counts));
+
+    GpuBuffer* input = createHostBuffer(ctx, maxCount);
+    GpuBuffer* output = createHostBuffer(ctx, maxCount);
+    GpuBuffer* small = createHostBuffer(ctx, GpuPrimitives::MAX_HISTOGRAM_BINS);
+
+    std::mt19937 rng(1234);
+    uint32_t checks = 0;
+
+    for (uint32_t count : counts) {
+        // Every other run keeps the values small, so the histograms and compaction see runs of equal values
+        std::vector<uint32_t> values(count);
+        for (uint32_t& value : values) value = (checks & 1) ? rng() % 16 : rng();
+
+        auto upload = [&] {
+            std::memcpy(input->allocation.mapped, values.data(), sizeof(uint32_t) * count);
+            ctx.allocator->flush(input->allocation);
+        };
+        upload();
+
+        std::vector<uint32_t> sum{ std::accumulate(values.begin(), values.end(), 0u) };
+        expectEqual("reduce", count, runPrimitive(ctx, primitives, small, 1, [&](VkCommandBuffer cmd) {
+            primitives.reduce(cmd, input, count, small);
+        }), sum);
+
+        std::vector<uint32_t> scanned(count);
+        std::exclusive_scan(values.begin(), values.end(), scanned.begin(), 0u);
+        expectEqual("exclusive scan", count, runPrimitive(ctx, primitives, output, count, [&](VkCommandBuffer cmd) {
+            primitives.scan(cmd, input, output, count, ScanKind::Exclusive);
+        }), scanned);
+
+        std::inclusive_scan(values.begin(), values.end(), scanned.begin());
+        expectEqual("inclusive scan", count, runPrimitive(ctx, primitives, output, count, [&](VkCommandBuffer cmd) {
+            primitives.scan(cmd, input, output, count, ScanKind::Inclusive);
+        }), scanned);
+
+        for (auto [binCount, shift] : { std::pair{ 256u, 0u }, std::pair{ 1024u, 22u }, std::pair{ 4u, 1u } }) {
+            std::vector<uint32_t> bins(binCount);
+            for (uint32_t value : values) ++bins[(value >> shift) & (binCount - 1)];
+            expectEqual("histogram", count, runPrimitive(ctx, primitives, small, binCount, [&](VkCommandBuffer cmd) {
+                primitives.histogram(cmd, input, count, small, binCount, shift);
+            }), bins);
+        }
+
+        const CompactPredicate predicate{ CompactOp::Less, (checks & 1) ? 5u : 1u << 31 };
+        std::vector<uint32_t> kept;
+        std::copy_if(values.begin(), values.end(), std::back_inserter(kept),
+                     [&](uint32_t value) { return value < predicate.operand; });
+        std::vector<uint32_t> compacted = runPrimitive(ctx, primitives, output, count, [&](VkCommandBuffer cmd) {
+            primitives.compact(cmd, input, count, output, small, predicate);
+        });
+        const uint32_t selected = static_cast<const uint32_t*>(small->allocation.mapped)[0];
+        expectEqual("compaction count", count, { selected }, { static_cast<uint32_t>(kept.size()) });
+        compacted.resize(kept.size());
+        expectEqual("compact", count, compacted, kept);
+
+        std::vector<uint32_t> sorted = values;
+        std::sort(sorted.begin(), sorted.end());
+        expectEqual("sort", count, runPrimitive(ctx, primitives, input, count, [&](VkCommandBuffer cmd) {
+            primitives.sort(cmd, input, count);
+        }), sorted);
+
+        std::cout << "Primitives match std:: on " << count << " values\n";
+        ++checks;
+    }
+
+    for (GpuBuffer* buffer : { input, output, small }) ctx.allocator->destroyBuffer(buffer);
+    std::cout << "All primitives passed on " << checks << " sizes\n";
+}
+
+// ===================================================== Precision =====================================================
+// Checks the fp16 variant of every built-in image kernel (precision.hpp) against the fp32 kernel on the same device,
+// at sizes around workgroup edges and up to the largest image the variants are used for
+
+void testPrecision(const ComputeContext& ctx, const Options& opts, WorkgroupTuner& tuner) {
+    if (!supportsPrecisionVariants(ctx.precision)) {
+        std::cout << "The device has no fp16 arithmetic or 8-bit storage, so only the fp32 kernels ever run\n";
+        return;
+    }
+
+    const uint32_t maxSize = precision::FP16_MAX_IMAGE_SIZE;
+    const std::pair<uint32_t, uint32_t> sizes[] = { { 1, 1 }, { 17, 9 }, { 640, 480 }, { 1920, 1080 },
+                                                    { maxSize - 1, 3 }, { maxSize, maxSize } };
+    uint32_t checks = 0;
+
+    for (const PrecisionVariant& variant : PRECISION_VARIANTS) {
+        for (auto [width, height] : sizes) {
+            Options run = opts;
+            run.shader = variant.kernel;
+            run.width = width;
+            run.height = height;
+            run.tune = false;
+            run.memoryStats = false;
+
+            GpuBuffer* full = renderImage(ctx, run, tuner, nullptr);
+            GpuBuffer* reduced = renderImage(ctx, run, tuner, &variant);
+            const uint8_t* expected = static_cast<const uint8_t*>(full->allocation.mapped);
+            const uint8_t* actual = static_cast<const uint8_t*>(reduced->allocation.mapped);
+
+            const size_t bytes = static_cast<size_t>(width) * height * 4;
+            size_t differing = 0;
+            uint32_t maxDifference = 0;
+            for (size_t i = 0; i < bytes; ++i) {
+                uint32_t difference = actual[i] > expected[i] ? actual[i] - expected[i] : expected[i] - actual[i];
+                if (difference > 0) ++differing;
+                maxDifference = std::max(maxDifference, difference);
+            }
+
+            ctx.allocator->destroyBuffer(full);
+            ctx.allocator->destroyBuffer(reduced);
+
+            const std::string size = std::to_string(width) + "x" + std::to_string(height);
+            if (maxDifference > precision::UNORM8_TOLERANCE)
+                throw std::runtime_error(std::string(variant.variant) + " differs from " + variant.kernel +
+                                         " by up to " + std::to_string(maxDifference) + " at " + size);
+
+            std::cout << variant.variant << " matches " << variant.kernel << " at " << size << " (" << differing
+                      << " of " << bytes << " channels off by one)\n";
+            ++checks;
+        }
+    }
+
+    std::cout << "All precision variants passed on " << checks << " images\n";
+}
+
+// ==================================================== CPU Backend ====================================================
+// The same three jobs on the CPU backend, with the same output and checks, for hosts without a usable Vulkan device
+// and for jobs too small to be worth a trip to the GPU
+
+void runBufferKernelCpu(CpuBackend& cpu, const Options& opts) {
+    const uint32_t N = BUFFER_KERNEL_ELEMENTS;
+
+    std::vector<uint32_t> values(static_cast<size_t>(opts.jobs) * N);
+    for (uint32_t i = 0; i < values.size(); ++i) values[i] = i;
+
+    cpu.squares(values);
+
+    std::cout << "CPU Output: ";
+    for (uint32_t i = 0; i < N; ++i) std::cout << values[i] << " ";
+    std::cout << "\n";
+
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < values.size(); ++i)
+        if (values[i] != i * i) ++mismatches;
+
+    std::cout << opts.jobs << " jobs, " << mismatches << " wrong values\n";
+}
+
+void runBatchedKernelCpu(CpuBackend& cpu, const Options& opts) {
+    const uint32_t N = BUFFER_KERNEL_ELEMENTS;
+    const uint32_t count = batchedElementCount(opts, UINT32_MAX);
+
+    std::vector<uint32_t> values(count);
+    for (uint32_t i = 0; i < count; ++i) values[i] = i;
+
+    auto start = std::chrono::steady_clock::now();
+    cpu.squares(values, opts.repeat);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << opts.repeat << " rounds of " << count << " values in " << ms << " ms on " << cpu.threadCount()
+              << " threads\n";
+
+    std::cout << "CPU Output: ";
+    for (uint32_t i = 0; i < N; ++i) std::cout << values[i] << " ";
+    std::cout << "\n";
+
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t expected = i;
+        for (uint32_t round = 0; round < opts.repeat; ++round) expected *= expected;
+        if (values[i] != expected) ++mismatches;
+    }
+
+    std::cout << count << " values, " << mismatches << " wrong\n";
+}
+
+void runImageKernelCpu(CpuBackend& cpu, const Options& opts) {
+    auto kernel = findCpuImageKernel(opts.shader);
+    if (!kernel) throw std::runtime_error("The CPU backend has no version of " + opts.shader);
+
+    std::vector<uint8_t> pixels(static_cast<size_t>(opts.width) * opts.height * 4);
+    cpu.image(*kernel, opts.width, opts.height, pixels.data());
+    writePPM(opts.output, pixels.data(), opts.width, opts.height);
+
+    std::cout << "Wrote " << opts.width << "x" << opts.height << " image from " << opts.shader
+              << " to " << opts.output << "\n";
+}
+
+// What the job asked for on the command line costs, for the Backend::Auto cost model
+WorkEstimate estimateWork(const Options& opts) {
+    const uint64_t N = BUFFER_KERNEL_ELEMENTS;
+    WorkEstimate work;
+
+    if (opts.headless) {
+        work.items = static_cast<uint64_t>(opts.width) * opts.height;
+        work.submissions = 1;
+        work.transferBytes = work.items * 4;
+    } else if (opts.batched) {
+        uint64_t dispatches = static_cast<uint64_t>(opts.dispatches) * opts.repeat;
+        work.items = N * opts.dispatches * opts.repeat;
+        work.submissions = static_cast<uint32_t>((dispatches + opts.batchSize - 1) / opts.batchSize) + 2;
+        work.transferBytes = 2 * N * opts.dispatches * sizeof(uint32_t);
+    } else {
+        work.items = N * opts.jobs;
+        work.submissions = opts.jobs;
+        work.transferBytes = 2 * N * opts.jobs * sizeof(uint32_t);
+    }
+
+    return work;
+}
+
+// Resolves Backend::Auto once the device is known. Software devices like lavapipe run the shaders on the same cores
+// the CPU backend would, with Vulkan's overhead on top, so they always lose. On a real GPU the cost model decides.
+// Options that are about the Vulkan path itself keep the job there.
+Backend chooseBackend(const ComputeContext& ctx, const Options& opts) {
+    if (opts.headless && !findCpuImageKernel(opts.shader)) return Backend::Vulkan;
+    if (opts.stream > 0 || opts.maxTileMiB > 0 || opts.testPrimitives || opts.testPrecision) return Backend::Vulkan;
+    if (opts.tune || opts.profile || opts.memoryStats || opts.validateCpu || opts.recordThreads > 0)
+        return Backend::Vulkan;
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(ctx.gpu, &props);
+
+    if (props.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU) {
+        std::cout << props.deviceName << " is a software device, running on the CPU backend instead\n";
+        return Backend::Cpu;
+    }
+
+    WorkEstimate work = estimateWork(opts);
+    double cpuUs = estimateCpuUs(work, std::max(std::thread::hardware_concurrency(), 1u), CpuBackend::hasSimd());
+    double gpuUs = estimateGpuUs(work);
+
+    Backend backend = cpuUs < gpuUs ? Backend::Cpu : Backend::Vulkan;
+    std::cout << "Estimated " << cpuUs << " us on the CPU and " << gpuUs << " us on " << props.deviceName
+              << ", running on " << (backend == Backend::Cpu ? "the CPU backend" : "Vulkan") << "\n";
+    return backend;
+}
+
+// Parses the command line. Supported options:
+//   --headless          Dispatch an image kernel offscreen and write the result to a file
+//   --shader NAME       Image kernel for --headless: a built-in kernel like gradient.comp or shader.comp, or a path to
+//                       a .spv file (default gradient.comp)
+//   --size WxH          Output image size for --headless (default 1920x1080)
+//   --output PATH       Output PPM file for --headless (default output.ppm)
+//   --device ID         Use the device with this index, UUID (prefix) or name (substring) instead of the best scoring
+//                       one. Defaults to $VULKAN_DEVICE if set.
+//   --pipeline-cache P  Pipeline cache file to load and save (default pipeline_cache.bin, "none" to disable)
+//   --merge-cache PATH  Merge another pipeline cache file into ours before saving. Can be given more than once.
+//   --profile           Print GPU time (min/avg/p99) and shader invocations per profiler scope before exiting, and
+//                       how long each pipeline took to build
+//   --memory-stats      Print the allocator's blocks per memory type, and which type each kind of memory got and why
+//   --jobs N            Number of buffer kernel jobs to run back to back (default 4)
+//   --batched           Run thousands of tiny buffer kernel dispatches, recorded once and submitted in batches
+//   --dispatches N      Dispatches per round for --batched (default 4096)
+//   --repeat N          Rounds for --batched (default 4)
+//   --batch-size N      Dispatches per submission for --batched (default 1024)
+//   --record-threads N  Record every --batched round afresh on N threads (0 = one per core) instead of replaying
+//   --tune              Time every workgroup size the device allows for the kernel being run and keep the fastest
+//   --tuning-file PATH  Tuned workgroup sizes to load and save (default workgroups.txt, "none" to disable)
+//   --backend NAME      auto (default), vulkan or cpu. Auto runs on the CPU backend when there is no usable Vulkan
+//                       device, when the device is a software rasterizer, or when the job is too small for the GPU.
+//   --validate-cpu      Run on Vulkan and check the results match the CPU backend's: bit for bit for squares.comp,
+//                       within one step per channel for the image kernels
+//   --stream N          Square N values (more than fit on the device if need be) tile by tile into --stream-output
+//   --stream-output P   Raw uint32 output file for --stream (default squares.bin)
+//   --max-tile-mib N    Cut --headless images and --stream jobs into tiles of at most N MiB, even if they'd fit in
+//                       one. Images too big for the device are always tiled.
+//   --test-primitives   Check reduce, scan, histogram, compact and sort (primitives.hpp) against std:: and exit
+//   --fp32              Always run the fp32 image kernels, even where the device could run their fp16 variants
+//   --test-precision    Check the fp16 image kernel variants (precision.hpp) against the fp32 kernels and exit
+//   --startup-trace P   Write the CPU time of each startup phase up to the first dispatch to P as a Chrome trace
+//                       (chrome://tracing, ui.perfetto.dev). --profile prints it as well.
+Options parseArgs(int argc, char* argv[]) {
+    Options opts;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        if (arg == "--headless") {
+            opts.headless = true;
+        } else if (arg == "--shader" && i + 1 < argc) {
+            opts.shader = argv[++i];
+        } else if (arg == "--size" && i + 1 < argc) {
+            std::string size = argv[++i];
+            size_t x = size.find('x');
+            if (x == std::string::npos) throw std::runtime_error("--size expects WxH, got " + size);
+            opts.width = static_cast<uint32_t>(std::stoul(size.substr(0, x)));
+            opts.height = static_cast<uint32_t>(std::stoul(size.substr(x + 1)));
+            if (opts.width == 0 || opts.height == 0) throw std::runtime_error("--size must be non-zero");
+        } else if (arg == "--output" && i + 1 < argc) {
+            opts.output = argv[++i];
+        } else if (arg == "--device" && i + 1 < argc) {
+            opts.device = argv[++i];
+        } else if (arg == "--pipeline-cache" && i + 1 < argc) {
+            opts.pipelineCache = argv[++i];
+            if (opts.pipelineCache == "none") opts.pipelineCache.clear();
+        } else if (arg == "--merge-cache" && i + 1 < argc) {
+            opts.mergeCaches.push_back(argv[++i]);
+        } else if (arg == "--profile") {
+            opts.profile = true;
+        } else if (arg == "--memory-stats") {
+            opts.memoryStats = true;
+        } else if (arg == "--jobs" && i + 1 < argc) {
+            opts.jobs = static_cast<uint32_t>(std::stoul(argv[++i]));
+            if (opts.jobs == 0) throw std::runtime_error("--jobs must be at least 1");
+        } else if (arg == "--batched") {
+            opts.batched = true;
+        } else if (arg == "--dispatches" && i + 1 < argc) {
+            opts.dispatches = static_cast<uint32_t>(std::stoul(argv[++i]));
+            if (opts.dispatches == 0) throw std::runtime_error("--dispatches must be at least 1");
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            opts.repeat = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (arg == "--batch-size" && i + 1 < argc) {
+            opts.batchSize = static_cast<uint32_t>(std::stoul(argv[++i]));
+            if (opts.batchSize == 0) throw std::runtime_error("--batch-size must be at least 1");
+        } else if (arg == "--record-threads" && i + 1 < argc) {
+            uint32_t threads = static_cast<uint32_t>(std::stoul(argv[++i]));
+            opts.recordThreads = threads > 0 ? threads : std::max(std::thread::hardware_concurrency(), 1u);
+        } else if (arg == "--tune") {
+            opts.tune = true;
+        } else if (arg == "--tuning-file" && i + 1 < argc) {
+            opts.tuningFile = argv[++i];
+            if (opts.tuningFile == "none") opts.tuningFile.clear();
+        } else if (arg == "--backend" && i + 1 < argc) {
+            opts.backend = parseBackend(argv[++i]);
+        } else if (arg == "--validate-cpu") {
+            opts.validateCpu = true;
+        } else if (arg == "--stream" && i + 1 < argc) {
+            opts.stream = std::stoull(argv[++i]);
+            if (opts.stream == 0) throw std::runtime_error("--stream must be at least 1");
+        } else if (arg == "--stream-output" && i + 1 < argc) {
+            opts.streamOutput = argv[++i];
+        } else if (arg == "--max-tile-mib" && i + 1 < argc) {
+            opts.maxTileMiB = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (arg == "--test-primitives") {
+            opts.testPrimitives = true;
+        } else if (arg == "--fp32") {
+            opts.fp32 = true;
+        } else if (arg == "--test-precision") {
+            opts.testPrecision = true;
+        } else if (arg == "--startup-trace" && i + 1 < argc) {
+            opts.startupTrace = argv[++i];
+        } else {
+            throw std::runtime_error("Unknown argument: " + arg);
+        }
+    }
+
+    return opts;
+}
+
+int main(int argc, char* argv[]) {
+    // Startup is timed from here to the first dispatch (see StartupTrace)
+    StartupTrace trace;
+
+    try {
+        Options opts = parseArgs(argc, argv);
+        if (opts.validateCpu && opts.backend == Backend::Cpu)
+            throw std::runtime_error("--validate-cpu compares Vulkan with the CPU backend, it needs --backend vulkan");
+        if (opts.stream > 0 && opts.backend == Backend::Cpu)
+            throw std::runtime_error("--stream only runs on Vulkan");
+        if (opts.testPrimitives && opts.backend == Backend::Cpu)
+            throw std::runtime_error("--test-primitives only runs on Vulkan");
+        if (opts.testPrecision && opts.backend == Backend::Cpu)
+            throw std::runtime_error("--test-precision only runs on Vulkan");
+
+        // Without a usable device, Auto carries on on the CPU if it can run the job there
+        Backend backend = opts.backend;
+        ComputeContext ctx;
+        if (backend != Backend::Cpu) {
+            try {
+                ctx = createContext(opts.pipelineCache, opts.device, &trace);
+            } catch (const std::exception& e) {
+                bool cpuCanRun = opts.stream == 0 && !opts.testPrimitives && !opts.testPrecision &&
+                                 (!opts.headless || findCpuImageKernel(opts.shader));
+                if (backend == Backend::Vulkan || opts.validateCpu || !cpuCanRun) throw;
+                std::cout << "No usable Vulkan device (" << e.what() << "), running on the CPU backend\n";
+                backend = Backend::Cpu;
+            }
+        }
+        if (backend == Backend::Auto) backend = chooseBackend(ctx, opts);
+
+        if (backend == Backend::Cpu) {
+            if (ctx.device) destroyContext(ctx);
+
+            CpuBackend cpu;
+            std::cout << "CPU backend: " << cpu.threadCount() << " threads, " << cpu.isa() << "\n";
+
+            if (opts.headless)
+                runImageKernelCpu(cpu, opts);
+            else if (opts.batched)
+                runBatchedKernelCpu(cpu, opts);
+            else
+                runBufferKernelCpu(cpu, opts);
+            return 0;
+        }
+
+        for (const auto& path : opts.mergeCaches)
+            if (!ctx.pipelineCache->merge(path)) std::cout << "Could not merge pipeline cache " << path << "\n";
+
+        // Whether the cache had this device's pipelines is reported once; the time each pipeline took to build only
+        // with --profile
+        if (!opts.pipelineCache.empty())
+            std::cout << "Pipeline cache " << opts.pipelineCache << " is "
+                      << (ctx.pipelineCache->isWarm() ? "warm" : "cold") << "\n";
+        ctx.pipelines->reportBuildTimes(opts.profile);
+
+        {
+            auto tunerStart = StartupTrace::Clock::now();
+            WorkgroupTuner tuner(ctx, opts.tuningFile);
+            trace.add("workgroup sizes", tunerStart, StartupTrace::Clock::now());
+
+            if (opts.testPrimitives)
+                testPrimitives(ctx);
+            else if (opts.testPrecision)
+                testPrecision(ctx, opts, tuner);
+            else if (opts.stream > 0)
+                runStreamedKernel(ctx, opts, tuner);
+            else if (opts.headless && (opts.maxTileMiB > 0 || planImageTiles(ctx, opts, tuner).size() > 1))
+                runTiledImageKernel(ctx, opts, tuner);
+            else if (opts.headless)
+                runImageKernel(ctx, opts, tuner);
+            else if (opts.batched)
+                runBatchedKernel(ctx, opts, tuner);
+            else
+                runBufferKernel(ctx, opts, tuner);
+
+            tuner.save();
+        }
+
+        if (opts.profile) {
+            ctx.profiler->report(std::cout);
+            trace.print(std::cout);
+            std::cout << "Time to first dispatch: " << trace.milestoneMs(FIRST_DISPATCH_MILESTONE) << " ms\n";
+        }
+        if (!opts.startupTrace.empty()) trace.write(opts.startupTrace);
+
+        destroyContext(ctx);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
 
     return 0;
 }
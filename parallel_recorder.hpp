@@ -0,0 +1,151 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+
+#include "compute_context.hpp"
+#include "job_system.hpp"
+
+// Records secondary command buffers on every thread of a job system.
+//
+// Each thread has its own command pool per frame slot, since a pool may only be used by one thread at a time. When a
+// slot comes round again, beginFrame() resets its pools with one vkResetCommandPool each instead of resetting buffers
+// one by one, and the buffers they hold are handed out again rather than reallocated.
+//
+// Whichever thread recorded a chunk, record() returns the secondaries in chunk order, so the primary that executes
+// them replays the same command stream every time.
+class ParallelRecorder {
+public:
+    // Records items [first, first + count) into cmd. The kernel pipeline and descriptor sets are not inherited from
+    // the primary, so every chunk binds its own.
+    using RecordFn = std::function<void(VkCommandBuffer cmd, uint32_t first, uint32_t count)>;
+
+    ParallelRecorder(const ComputeContext& ctx, JobSystem& jobs, uint32_t frameSlots)
+        : ctx(ctx), jobs(jobs), slots(frameSlots) {
+        if (frameSlots == 0) throw std::runtime_error("Need at least one frame slot");
+
+        // Transient: everything recorded here lives for one frame
+        VkCommandPoolCreateInfo poolCI{};
+        poolCI.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolCI.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolCI.queueFamilyIndex = ctx.computeIndex;
+
+        for (auto& slot : slots) {
+            slot.pools.resize(jobs.threadCount());
+            for (auto& pool : slot.pools) VK_CHECK(vkCreateCommandPool(ctx.device, &poolCI, nullptr, &pool.pool));
+            VK_CHECK(vkCreateCommandPool(ctx.device, &poolCI, nullptr, &slot.primaryPool.pool));
+        }
+    }
+
+    ~ParallelRecorder() {
+        for (auto& slot : slots) {
+            for (auto& pool : slot.pools) vkDestroyCommandPool(ctx.device, pool.pool, nullptr);
+            vkDestroyCommandPool(ctx.device, slot.primaryPool.pool, nullptr);
+        }
+    }
+
+    ParallelRecorder(const ParallelRecorder&) = delete;
+    ParallelRecorder& operator=(const ParallelRecorder&) = delete;
+
+    uint32_t frameSlots() const { return static_cast<uint32_t>(slots.size()); }
+
+    // Resets every pool of the slot. Whatever was last recorded in it must have finished executing.
+    void beginFrame(uint32_t slot) {
+        Slot& s = slots.at(slot);
+        for (auto& pool : s.pools) reset(pool);
+        reset(s.primaryPool);
+    }
+
+    // A primary command buffer from the slot, begun for one submission
+    VkCommandBuffer primary(uint32_t slot) {
+        VkCommandBuffer cmd = acquire(slots.at(slot).primaryPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VK_CHECK(vkBeginCommandBuffer(cmd, &beginInfo));
+        return cmd;
+    }
+
+    // Splits count items into chunks of at most chunkSize and records every chunk into its own secondary command
+    // buffer, spread over the job system's threads. Returns the secondaries in chunk order, ready for
+    // vkCmdExecuteCommands.
+    std::vector<VkCommandBuffer> record(uint32_t slot, uint32_t count, uint32_t chunkSize, const RecordFn& fn) {
+        if (chunkSize == 0) throw std::runtime_error("Chunk size must be at least 1");
+
+        Slot& s = slots.at(slot);
+        std::vector<VkCommandBuffer> secondaries((count + chunkSize - 1) / chunkSize);
+
+        jobs.parallelFor(static_cast<uint32_t>(secondaries.size()), [&](uint32_t chunk, uint32_t thread) {
+            VkCommandBuffer cmd = acquire(s.pools[thread], VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+
+            // Compute work doesn't run inside a render pass, so there is nothing to inherit
+            VkCommandBufferInheritanceInfo inheritance{};
+            inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            beginInfo.pInheritanceInfo = &inheritance;
+            VK_CHECK(vkBeginCommandBuffer(cmd, &beginInfo));
+
+            uint32_t first = chunk * chunkSize;
+            fn(cmd, first, std::min(chunkSize, count - first));
+
+            VK_CHECK(vkEndCommandBuffer(cmd));
+            secondaries[chunk] = cmd;
+        });
+
+        return secondaries;
+    }
+
+private:
+    // A command pool and every buffer ever allocated from it. Buffers before next were handed out this frame.
+    struct Pool {
+        VkCommandPool pool = VK_NULL_HANDLE;
+        std::vector<VkCommandBuffer> primaries;
+        std::vector<VkCommandBuffer> secondaries;
+        size_t nextPrimary = 0;
+        size_t nextSecondary = 0;
+    };
+
+    struct Slot {
+        std::vector<Pool> pools;                    // One per job system thread
+        Pool primaryPool;                           // Only used by the thread that owns the recorder
+    };
+
+    void reset(Pool& pool) {
+        VK_CHECK(vkResetCommandPool(ctx.device, pool.pool, 0));
+        pool.nextPrimary = 0;
+        pool.nextSecondary = 0;
+    }
+
+    VkCommandBuffer acquire(Pool& pool, VkCommandBufferLevel level) {
+        bool isPrimary = level == VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        auto& buffers = isPrimary ? pool.primaries : pool.secondaries;
+        size_t& next = isPrimary ? pool.nextPrimary : pool.nextSecondary;
+
+        if (next == buffers.size()) {
+            VkCommandBufferAllocateInfo cmdBufAI{};
+            cmdBufAI.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            cmdBufAI.commandPool = pool.pool;
+            cmdBufAI.level = level;
+            cmdBufAI.commandBufferCount = 1;
+
+            VkCommandBuffer cmd;
+            VK_CHECK(vkAllocateCommandBuffers(ctx.device, &cmdBufAI, &cmd));
+            buffers.push_back(cmd);
+        }
+
+        return buffers[next++];
+    }
+
+    const ComputeContext& ctx;
+    JobSystem& jobs;
+    std::vector<Slot> slots;
+};
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifndef VK_CHECK
+#define VK_CHECK(x) do { VkResult err = x; if (err != VK_SUCCESS) throw std::runtime_error("Vulkan error at " #x); } while(0)
+#endif
+
+// On-disk VkPipelineCache.
+//
+// The cache blob is loaded at startup so pipelines compiled by an earlier run don't have to be compiled from SPIR-V
+// again. A blob is only used if its header matches this device (vendorID, deviceID and pipelineCacheUUID), since a
+// driver update or a different GPU makes it useless at best. On save, whatever is on disk at that moment is merged in
+// first, so several worker processes sharing one cache file add to it instead of overwriting each other, and the new
+// file is written next to the old one and renamed over it so readers never see a half written cache.
+class PipelineCache {
+public:
+    PipelineCache(VkPhysicalDevice gpu, VkDevice device, std::string path)
+        : device(device), path(std::move(path)) {
+        vkGetPhysicalDeviceProperties(gpu, &props);
+
+        std::vector<char> data;
+        std::string reason;
+        if (!this->path.empty() && readBlob(this->path, data)) {
+            if (isCompatible(data, reason)) {
+                warm = true;
+            } else {
+                std::cout << "Ignoring pipeline cache " << this->path << ": " << reason << "\n";
+                data.clear();
+            }
+        }
+
+        cache = createCache(data);
+    }
+
+    ~PipelineCache() {
+        vkDestroyPipelineCache(device, cache, nullptr);
+    }
+
+    PipelineCache(const PipelineCache&) = delete;
+    PipelineCache& operator=(const PipelineCache&) = delete;
+
+    VkPipelineCache handle() const { return cache; }
+
+    // True if a valid cache blob for this device was loaded at startup
+    bool isWarm() const { return warm; }
+
+    // Merges another cache file (for example one written by a worker process under a different name) into this one.
+    // Returns false if the file doesn't exist or was built for a different device or driver.
+    bool merge(const std::string& otherPath) {
+        std::vector<char> data;
+        std::string reason;
+        if (!readBlob(otherPath, data)) return false;
+
+        if (!isCompatible(data, reason)) {
+            std::cout << "Not merging pipeline cache " << otherPath << ": " << reason << "\n";
+            return false;
+        }
+
+        VkPipelineCache other = createCache(data);
+        VkResult result = vkMergePipelineCaches(device, cache, 1, &other);
+        vkDestroyPipelineCache(device, other, nullptr);
+        VK_CHECK(result);
+        return true;
+    }
+
+    // Writes the cache back to disk. Anything other processes saved since we started is merged in first, then the
+    // blob is written to a temporary file and renamed over the old one.
+    void save() {
+        if (path.empty()) return;
+
+        merge(path);
+
+        size_t size = 0;
+        VK_CHECK(vkGetPipelineCacheData(device, cache, &size, nullptr));
+        std::vector<char> data(size);
+        VK_CHECK(vkGetPipelineCacheData(device, cache, &size, data.data()));
+        data.resize(size);
+
+        // Unique per process, so parallel savers never write to the same temporary file
+        std::string tmpPath = path + ".tmp." + std::to_string(processId());
+
+        {
+            std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+            if (!file.is_open()) throw std::runtime_error("Failed to open file: " + tmpPath);
+            file.write(data.data(), static_cast<std::streamsize>(data.size()));
+            if (!file) throw std::runtime_error("Failed to write file: " + tmpPath);
+        }
+
+        // rename() replaces the destination atomically on POSIX, and std::filesystem does the same on Windows
+        std::error_code ec;
+        std::filesystem::rename(tmpPath, path, ec);
+        if (ec) {
+            std::filesystem::remove(tmpPath, ec);
+            throw std::runtime_error("Failed to replace pipeline cache " + path);
+        }
+    }
+
+private:
+    static bool readBlob(const std::string& file, std::vector<char>& data) {
+        std::ifstream in(file, std::ios::ate | std::ios::binary);
+        if (!in.is_open()) return false;
+
+        size_t size = in.tellg();
+        data.resize(size);
+        in.seekg(0);
+        in.read(data.data(), static_cast<std::streamsize>(size));
+        return static_cast<bool>(in);
+    }
+
+    // Checks the version one header every pipeline cache blob starts with against this device
+    bool isCompatible(const std::vector<char>& data, std::string& reason) const {
+        VkPipelineCacheHeaderVersionOne header{};
+        if (data.size() < sizeof(header)) { reason = "too small"; return false; }
+
+        std::memcpy(&header, data.data(), sizeof(header));
+
+        if (header.headerSize < sizeof(header) || header.headerSize > data.size()) {
+            reason = "bad header size";
+            return false;
+        }
+        if (header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) {
+            reason = "unknown header version";
+            return false;
+        }
+        if (header.vendorID != props.vendorID || header.deviceID != props.deviceID) {
+            reason = "built for a different device";
+            return false;
+        }
+        if (std::memcmp(header.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+            reason = "built by a different driver version";
+            return false;
+        }
+
+        return true;
+    }
+
+    VkPipelineCache createCache(const std::vector<char>& data) const {
+        VkPipelineCacheCreateInfo cacheCI{};
+        cacheCI.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        cacheCI.initialDataSize = data.size();
+        cacheCI.pInitialData = data.empty() ? nullptr : data.data();
+
+        VkPipelineCache result;
+        VK_CHECK(vkCreatePipelineCache(device, &cacheCI, nullptr, &result));
+        return result;
+    }
+
+    static long processId() {
+#ifdef _WIN32
+        return static_cast<long>(_getpid());
+#else
+        return static_cast<long>(getpid());
+#endif
+    }
+
+    VkDevice device;
+    std::string path;
+    VkPhysicalDeviceProperties props{};
+    VkPipelineCache cache = VK_NULL_HANDLE;
+    bool warm = false;
+};
@@ -0,0 +1,352 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+
+#include "shader_loader.hpp"
+
+#ifndef VK_CHECK
+#define VK_CHECK(x) do { VkResult err = x; if (err != VK_SUCCESS) throw std::runtime_error("Vulkan error at " #x); } while(0)
+#endif
+
+// glslc or glslangValidator with its output flag, as found by CMakeLists.txt. Followed by the output and source paths.
+#ifndef SHADER_COMPILE_COMMAND
+#define SHADER_COMPILE_COMMAND "glslc --target-env=vulkan1.3 -o"
+#endif
+
+using PipelineHandle = uint32_t;
+
+// What to build a compute pipeline from. The shader is either a module the caller keeps alive until the pipeline is
+// built, or a name for loadShader() ("gradient.comp" or a .spv path), loaded on the worker.
+struct PipelineRequest {
+    std::string shader;
+    VkShaderModule module = VK_NULL_HANDLE;         // Used instead of shader if set
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    std::vector<uint32_t> specialization;           // Constants 0, 1, 2... e.g. the workgroup size (see kernel.hpp)
+    std::string source;                             // GLSL file to rebuild from when it changes, see watch()
+};
+
+// Compiles compute pipelines on worker threads so creating one never blocks the thread that records and submits.
+//
+// request() queues a build and returns a handle straight away. get() is VK_NULL_HANDLE until the pipeline is ready,
+// so a render loop can skip the work or draw something else meanwhile; wait() and take() block for callers that
+// can't go on without it. Builds go through the pipeline cache, which Vulkan synchronises internally.
+//
+// With watch(), a background thread polls the source file of every request that has one. When a file changes it is
+// compiled to SPIR-V with SHADER_COMPILE_COMMAND and built on a worker, and update() swaps the new pipeline in between
+// two frames. The old one keeps going for the frames already recorded with it and is destroyed once they have
+// finished, so nothing in flight is waited on. If the source doesn't compile, the old pipeline stays and the error is
+// printed.
+//
+// request(), get(), wait(), take() and update() belong to one thread, the one that records commands.
+class PipelineManager {
+public:
+    // threadCount worker threads, 0 = one per core but one, leaving a core for the caller
+    PipelineManager(VkDevice device, VkPipelineCache cache, uint32_t threadCount = 0,
+                    std::string compileCommand = SHADER_COMPILE_COMMAND)
+        : device(device), cache(cache), compileCommand(std::move(compileCommand)) {
+        if (threadCount == 0) threadCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+        for (uint32_t i = 0; i < threadCount; ++i) workers.emplace_back([this] { workerLoop(); });
+    }
+
+    // The GPU must be done with every pipeline handed out by get()
+    ~PipelineManager() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeCondition.notify_all();
+        watchCondition.notify_all();
+        if (watcher.joinable()) watcher.join();
+        for (auto& worker : workers) worker.join();
+
+        for (auto& slot : slots) {
+            vkDestroyPipeline(device, slot->current.load(), nullptr);
+            vkDestroyPipeline(device, slot->replacement, nullptr);
+        }
+        for (const Retired& old : retired) vkDestroyPipeline(device, old.pipeline, nullptr);
+    }
+
+    PipelineManager(const PipelineManager&) = delete;
+    PipelineManager& operator=(const PipelineManager&) = delete;
+
+    // Queues the pipeline for building and returns at once
+    PipelineHandle request(PipelineRequest request) {
+        auto slot = std::make_unique<Slot>();
+        slot->request = std::move(request);
+
+        std::error_code ec;
+        if (!slot->request.source.empty())
+            slot->sourceTime = std::filesystem::last_write_time(slot->request.source, ec);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back({ slot.get(), false, ++slot->generation });
+        slots.push_back(std::move(slot));
+        wakeCondition.notify_one();
+        return static_cast<PipelineHandle>(slots.size() - 1);
+    }
+
+    // The current pipeline, or VK_NULL_HANDLE while the first build is pending or if it failed. Never blocks.
+    VkPipeline get(PipelineHandle handle) const { return slots.at(handle)->current.load(); }
+
+    bool ready(PipelineHandle handle) const { return get(handle) != VK_NULL_HANDLE; }
+
+    // Why the first build failed, empty if it didn't (or hasn't yet)
+    std::string error(PipelineHandle handle) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return slots.at(handle)->error;
+    }
+
+    // Blocks until the first build has finished. Throws if it failed.
+    VkPipeline wait(PipelineHandle handle) {
+        Slot& slot = *slots.at(handle);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        doneCondition.wait(lock, [&] { return slot.current.load() != VK_NULL_HANDLE || slot.failed; });
+        if (slot.failed) throw std::runtime_error("Failed to build pipeline " + name(slot) + ": " + slot.error);
+        return slot.current.load();
+    }
+
+    // Waits for the pipeline and hands it over: the caller destroys it, and it is no longer rebuilt or swapped
+    VkPipeline take(PipelineHandle handle) {
+        VkPipeline pipeline = wait(handle);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        Slot& slot = *slots[handle];
+        slot.current = VK_NULL_HANDLE;
+        vkDestroyPipeline(device, slot.replacement, nullptr);
+        slot.replacement = VK_NULL_HANDLE;
+        slot.request.source.clear();
+        slot.taken = true;
+        return pipeline;
+    }
+
+    // Whether to print how long each successful build took. Off by default, so a program that builds many pipelines
+    // doesn't log a line per pipeline unless asked to (main does with --profile).
+    void reportBuildTimes(bool enabled) { reportingBuilds = enabled; }
+
+    // Starts polling the source files every interval for changes
+    void watch(std::chrono::milliseconds interval = std::chrono::milliseconds(250)) {
+        if (watcher.joinable()) return;
+        watcher = std::thread([this, interval] { watchLoop(interval); });
+    }
+
+    // Call once per frame before recording. Swaps in pipelines rebuilt since the last call, and destroys replaced ones
+    // the GPU has finished with. frameNumber is the number of the next frame to be recorded; every frame before it
+    // may still use the old pipelines. Frames up to completedFrame have finished.
+    void update(int64_t frameNumber, int64_t completedFrame) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto& slot : slots) {
+                if (slot->replacement == VK_NULL_HANDLE) continue;
+
+                retired.push_back({ slot->current.exchange(slot->replacement), frameNumber - 1 });
+                slot->replacement = VK_NULL_HANDLE;
+                std::cout << "Swapped in rebuilt pipeline " << name(*slot) << "\n";
+            }
+        }
+
+        std::erase_if(retired, [&](const Retired& old) {
+            if (old.lastUsedFrame > completedFrame) return false;
+            vkDestroyPipeline(device, old.pipeline, nullptr);
+            return true;
+        });
+    }
+
+private:
+    struct Slot {
+        PipelineRequest request;
+        std::atomic<VkPipeline> current{ VK_NULL_HANDLE };
+        VkPipeline replacement = VK_NULL_HANDLE;    // Rebuilt, waiting for update(). Guarded by mutex.
+        uint64_t generation = 0;                    // Latest build queued, guarded by mutex
+        uint64_t builtGeneration = 0;               // Latest build published, so a slow old build can't win
+        std::filesystem::file_time_type sourceTime; // Only touched by request() and the watcher
+        std::string error;
+        bool failed = false;
+        bool taken = false;
+    };
+
+    struct Task {
+        Slot* slot;
+        bool fromSource;                            // Compile request.source first instead of using request.shader
+        uint64_t generation;
+    };
+
+    struct Retired {
+        VkPipeline pipeline;
+        int64_t lastUsedFrame;
+    };
+
+    static std::string name(const Slot& slot) {
+        return slot.request.source.empty() ? slot.request.shader : slot.request.source;
+    }
+
+    void workerLoop() {
+        while (true) {
+            Task task;
+            PipelineRequest request;                // A copy, since take() may change the slot's meanwhile
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeCondition.wait(lock, [&] { return stopping || !tasks.empty(); });
+                if (stopping) return;
+                task = tasks.front();
+                tasks.pop_front();
+                request = task.slot->request;
+            }
+
+            VkPipeline pipeline = VK_NULL_HANDLE;
+            std::string failure;
+            auto start = std::chrono::steady_clock::now();
+            try {
+                pipeline = build(request, task.fromSource);
+            } catch (const std::exception& e) {
+                failure = e.what();
+            }
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            publish(task, pipeline, failure, ms);
+        }
+    }
+
+    VkPipeline build(const PipelineRequest& request, bool fromSource) {
+        VkShaderModule module = request.module;
+        bool ownModule = false;
+        if (fromSource || module == VK_NULL_HANDLE) {
+            ShaderCode code = fromSource ? compileSource(request.source) : loadShader(request.shader);
+
+            VkShaderModuleCreateInfo shaderModuleCI{};
+            shaderModuleCI.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+            shaderModuleCI.codeSize = code.sizeBytes();
+            shaderModuleCI.pCode = code.data();
+            VK_CHECK(vkCreateShaderModule(device, &shaderModuleCI, nullptr, &module));
+            ownModule = true;
+        }
+
+        std::vector<VkSpecializationMapEntry> entries(request.specialization.size());
+        for (uint32_t i = 0; i < entries.size(); ++i)
+            entries[i] = { i, static_cast<uint32_t>(i * sizeof(uint32_t)), sizeof(uint32_t) };
+
+        VkSpecializationInfo specInfo{};
+        specInfo.mapEntryCount = static_cast<uint32_t>(entries.size());
+        specInfo.pMapEntries = entries.data();
+        specInfo.dataSize = request.specialization.size() * sizeof(uint32_t);
+        specInfo.pData = request.specialization.data();
+
+        VkComputePipelineCreateInfo computePipelineCI{};
+        computePipelineCI.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        computePipelineCI.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        computePipelineCI.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        computePipelineCI.stage.module = module;
+        computePipelineCI.stage.pName = "main";
+        computePipelineCI.stage.pSpecializationInfo = entries.empty() ? nullptr : &specInfo;
+        computePipelineCI.layout = request.layout;
+
+        VkPipeline pipeline;
+        VkResult result = vkCreateComputePipelines(device, cache, 1, &computePipelineCI, nullptr, &pipeline);
+
+        // The pipeline doesn't need the module once it exists
+        if (ownModule) vkDestroyShaderModule(device, module, nullptr);
+        VK_CHECK(result);
+        return pipeline;
+    }
+
+    // Runs the shader compiler on a GLSL file and maps the SPIR-V it writes
+    ShaderCode compileSource(const std::string& source) {
+        namespace fs = std::filesystem;
+        fs::path output = fs::temp_directory_path() /
+                          (fs::path(source).filename().string() + "." + std::to_string(compileCounter++) + ".spv");
+
+        std::string command = compileCommand + " \"" + output.string() + "\" \"" + source + "\"";
+        if (std::system(command.c_str()) != 0) throw std::runtime_error("Failed to compile " + source);
+
+        // The mapping keeps the contents alive after the file is gone
+        ShaderCode code = ShaderCode::mapFile(output.string());
+        std::error_code ec;
+        fs::remove(output, ec);
+        return code;
+    }
+
+    void publish(const Task& task, VkPipeline pipeline, const std::string& failure, double ms) {
+        Slot& slot = *task.slot;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            // Outdated by a newer build, or the caller took the slot's pipeline over meanwhile
+            if (task.generation < slot.builtGeneration || (slot.taken && task.fromSource)) {
+                vkDestroyPipeline(device, pipeline, nullptr);
+                return;
+            }
+            slot.builtGeneration = task.generation;
+
+            if (!failure.empty()) {
+                std::cerr << "Pipeline " << name(slot) << ": " << failure << "\n";
+                if (!task.fromSource) {
+                    slot.error = failure;
+                    slot.failed = true;
+                }
+            } else if (task.fromSource && slot.current.load() != VK_NULL_HANDLE) {
+                vkDestroyPipeline(device, slot.replacement, nullptr);
+                slot.replacement = pipeline;
+            } else {
+                slot.current = pipeline;                // Also recovers a first build that failed
+                slot.error.clear();
+                slot.failed = false;
+            }
+
+            if (failure.empty() && reportingBuilds)
+                std::cout << "Pipeline " << name(slot) << " built in " << ms << " ms on a worker\n";
+        }
+        doneCondition.notify_all();
+    }
+
+    void watchLoop(std::chrono::milliseconds interval) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!watchCondition.wait_for(lock, interval, [&] { return stopping; })) {
+            for (auto& slot : slots) {
+                if (slot->request.source.empty()) continue;
+
+                std::error_code ec;
+                auto time = std::filesystem::last_write_time(slot->request.source, ec);
+                if (ec || time == slot->sourceTime) continue;
+
+                slot->sourceTime = time;
+                tasks.push_back({ slot.get(), true, ++slot->generation });
+                wakeCondition.notify_all();
+            }
+        }
+    }
+
+    VkDevice device;
+    VkPipelineCache cache;
+    std::string compileCommand;
+    std::atomic<uint64_t> compileCounter{ 0 };      // Keeps the workers' temporary .spv files apart
+    std::atomic<bool> reportingBuilds{ false };     // See reportBuildTimes()
+
+    std::vector<std::thread> workers;
+    std::thread watcher;
+
+    mutable std::mutex mutex;                       // Guards tasks, stopping and the slots' build state
+    std::condition_variable wakeCondition;
+    std::condition_variable doneCondition;
+    std::condition_variable watchCondition;         // Only wakes the watcher, to stop it
+    std::deque<Task> tasks;
+    bool stopping = false;
+
+    std::vector<std::unique_ptr<Slot>> slots;       // Grown by request() only, under mutex
+    std::vector<Retired> retired;                   // Swapped out by update(), destroyed once their frames finish
+};
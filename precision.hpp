@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+#include <filesystem>
+#include <cstdint>
+
+#include "compute_context.hpp"
+
+// Reduced precision variants of the built-in image kernels, picked automatically when the device has the features
+// they need (see PrecisionFeatures). They compute in fp16 and write 8-bit pixels into a device-local storage buffer,
+// which the headless path copies to the host like it copies the image of the fp32 kernels; a plain buffer copy needs
+// no layout transitions and no detiling.
+//
+// fp16 holds every integer up to 2048 exactly, so the variants only run on images no bigger than that on either side.
+// There the only error is fp16 rounding the division and the scale by 255, which keeps every channel within one
+// step of what the fp32 kernel writes. --test-precision in main.cpp checks exactly that.
+//
+// The output is already 8 bits a channel either way, so 16-bit storage would only widen it; none of the kernels
+// keeps fp32 data in a buffer that fp16 could halve, and storageBuffer16BitAccess isn't enabled.
+
+namespace precision {
+    // Largest image side the fp16 variants are used for
+    constexpr uint32_t FP16_MAX_IMAGE_SIZE = 2048;
+
+    // Largest difference per 8-bit channel between a variant and its fp32 kernel
+    constexpr uint32_t UNORM8_TOLERANCE = 1;
+}
+
+struct PrecisionVariant {
+    const char* kernel;                             // fp32 kernel, as given to --shader
+    const char* variant;                            // Built-in kernel with fp16 arithmetic and 8-bit storage
+};
+
+inline constexpr PrecisionVariant PRECISION_VARIANTS[] = {
+    { "gradient.comp", "gradient_fp16.comp" },
+    { "shader.comp", "shader_fp16.comp" },
+};
+
+// True if the device can build the variants
+inline bool supportsPrecisionVariants(const PrecisionFeatures& features) {
+    return features.float16 && features.int8 && features.storage8;
+}
+
+// Looks up the variant of an image kernel by the name given to --shader, like findCpuImageKernel(). Returns null if
+// there is none, if the device can't build it or if the image is too big for fp16.
+inline const PrecisionVariant* findPrecisionVariant(const PrecisionFeatures& features, const std::string& shader,
+                                                    uint32_t width, uint32_t height) {
+    if (!supportsPrecisionVariants(features)) return nullptr;
+    if (width > precision::FP16_MAX_IMAGE_SIZE || height > precision::FP16_MAX_IMAGE_SIZE) return nullptr;
+
+    std::string name = std::filesystem::path(shader).filename().string();
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".spv") == 0) name.resize(name.size() - 4);
+
+    for (const auto& variant : PRECISION_VARIANTS)
+        if (name == variant.kernel) return &variant;
+    return nullptr;
+}
@@ -0,0 +1,339 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <string>
+#include <initializer_list>
+#include <stdexcept>
+#include <utility>
+#include <iterator>
+#include <cstdint>
+
+#include "compute_context.hpp"
+#include "shader_loader.hpp"
+#include "kernel.hpp"
+
+// Parallel primitives over uint32 values in device buffers: reduction, prefix scan, histogram, stream compaction and
+// radix sort, built from reduce.comp, scan.comp, histogram.comp, compact.comp, radix_count.comp and
+// radix_scatter.comp.
+//
+// Every kernel works on tiles of TILE_SIZE values per workgroup and does the work within a tile with subgroup
+// operations and shared memory, so a primitive touches device memory about as little as it can: the reduction and the
+// scan read every value once, the scan writes it once, and each radix sort pass reads the keys twice and writes them
+// once. The scan is a single pass with decoupled look-back; compaction and the sort are built on it.
+//
+// The functions record into a command buffer the caller submits, and end with a barrier that makes their results
+// visible to later compute shaders and transfers. Descriptor sets and scratch buffers stay in use until the GPU has
+// finished, so call recycle() only after that. Recording for two queues at once isn't supported, since the recordings
+// share scratch buffers. Buffers the primitives clear before adding to (the reduction result, histogram bins and the
+// compaction count) need VK_BUFFER_USAGE_TRANSFER_DST_BIT as well as storage buffer usage.
+enum class ScanKind { Exclusive, Inclusive };
+
+// Which values stream compaction keeps
+enum class CompactOp : uint32_t { NotEqual = 1, Less = 2, GreaterEqual = 3 };
+
+struct CompactPredicate {
+    CompactOp op = CompactOp::NotEqual;
+    uint32_t operand = 0;
+};
+
+class GpuPrimitives {
+public:
+    static constexpr uint32_t WORKGROUP_SIZE = 256;
+    static constexpr uint32_t TILE_SIZE = WORKGROUP_SIZE * 4;
+    static constexpr uint32_t RADIX_BITS = 8;
+    static constexpr uint32_t RADIX = 1u << RADIX_BITS;
+    static constexpr uint32_t MAX_HISTOGRAM_BINS = 1024;
+
+    // Builds the kernels. Throws if the device can't run them: they need basic, arithmetic and ballot subgroup
+    // operations in compute shaders and workgroups of WORKGROUP_SIZE invocations.
+    explicit GpuPrimitives(const ComputeContext& ctx) : ctx(ctx) {
+        VkPhysicalDeviceSubgroupProperties subgroupProps{};
+        subgroupProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+
+        VkPhysicalDeviceProperties2 props{};
+        props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        props.pNext = &subgroupProps;
+        vkGetPhysicalDeviceProperties2(ctx.gpu, &props);
+
+        const VkSubgroupFeatureFlags needed = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT |
+                                              VK_SUBGROUP_FEATURE_BALLOT_BIT;
+        if (!(subgroupProps.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) ||
+            (subgroupProps.supportedOperations & needed) != needed)
+            throw std::runtime_error("The device lacks the subgroup operations the primitives need");
+        if (props.properties.limits.maxComputeWorkGroupInvocations < WORKGROUP_SIZE)
+            throw std::runtime_error("The device can't run workgroups of " + std::to_string(WORKGROUP_SIZE) +
+                                     " invocations");
+
+        maxGroups = props.properties.limits.maxComputeWorkGroupCount[0];
+
+        // The kernels have fixed workgroup sizes, since the tile layout depends on them
+        const WorkgroupSize size{ WORKGROUP_SIZE, 1, 1 };
+        const VkDescriptorType buffer = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
+        reduceKernel = createKernelLayout(ctx, loadShader("reduce.comp").span(), { buffer, buffer }, 4, size);
+        scanKernel = createKernelLayout(ctx, loadShader("scan.comp").span(), { buffer, buffer, buffer }, 16, size);
+        histogramKernel = createKernelLayout(ctx, loadShader("histogram.comp").span(), { buffer, buffer }, 12, size);
+        compactKernel = createKernelLayout(ctx, loadShader("compact.comp").span(), { buffer, buffer, buffer, buffer },
+                                           12, size);
+        radixCountKernel = createKernelLayout(ctx, loadShader("radix_count.comp").span(), { buffer, buffer }, 12,
+                                              size);
+        radixScatterKernel = createKernelLayout(ctx, loadShader("radix_scatter.comp").span(),
+                                                { buffer, buffer, buffer }, 12, size);
+
+        // All six pipelines compile at once on ctx.pipelines' workers rather than one after another
+        ComputeKernel* kernels[] = { &reduceKernel, &scanKernel, &histogramKernel, &compactKernel, &radixCountKernel,
+                                     &radixScatterKernel };
+        PipelineHandle pending[std::size(kernels)];
+        for (size_t i = 0; i < std::size(kernels); ++i) pending[i] = requestPipeline(ctx, *kernels[i]);
+        for (size_t i = 0; i < std::size(kernels); ++i) kernels[i]->pipeline = ctx.pipelines->take(pending[i]);
+    }
+
+    ~GpuPrimitives() {
+        recycle();
+        for (VkDescriptorPool pool : descriptorPools) vkDestroyDescriptorPool(ctx.device, pool, nullptr);
+        for (GpuBuffer* buffer : { lookback, positions, sortKeys, sortCounts, sortOffsets })
+            if (buffer) ctx.allocator->destroyBuffer(buffer);
+
+        for (ComputeKernel* kernel : { &reduceKernel, &scanKernel, &histogramKernel, &compactKernel,
+                                       &radixCountKernel, &radixScatterKernel })
+            destroyKernel(ctx, *kernel);
+    }
+
+    GpuPrimitives(const GpuPrimitives&) = delete;
+    GpuPrimitives& operator=(const GpuPrimitives&) = delete;
+
+    // Largest count the primitives accept, given how many workgroups one dispatch may have. Bigger jobs have to be
+    // cut up first (see tiling.hpp).
+    uint64_t maxCount() const { return static_cast<uint64_t>(maxGroups) * TILE_SIZE; }
+
+    // result[0] = sum of the first count values of input, wrapping at 2^32
+    void reduce(VkCommandBuffer cmd, const GpuBuffer* input, uint32_t count, const GpuBuffer* result) {
+        vkCmdFillBuffer(cmd, result->buffer, 0, sizeof(uint32_t), 0);
+        fillBarrier(cmd);
+
+        uint32_t params[] = { count };
+        dispatch(cmd, reduceKernel, { input, result }, params, tiles(count));
+        computeBarrier(cmd);
+    }
+
+    // output[i] = input[0] + ... + input[i - 1] (exclusive) or + input[i] (inclusive). output may be input.
+    void scan(VkCommandBuffer cmd, const GpuBuffer* input, const GpuBuffer* output, uint32_t count,
+              ScanKind kind = ScanKind::Exclusive) {
+        scanWith(cmd, input, output, count, kind == ScanKind::Inclusive ? 1 : 0, 0, 0);
+        computeBarrier(cmd);
+    }
+
+    // bins[b] = how many of the first count values have b in bits [shift, shift + log2(binCount)). binCount has to be
+    // a power of two up to MAX_HISTOGRAM_BINS.
+    void histogram(VkCommandBuffer cmd, const GpuBuffer* input, uint32_t count, const GpuBuffer* bins,
+                   uint32_t binCount, uint32_t shift = 0) {
+        if (binCount == 0 || binCount > MAX_HISTOGRAM_BINS || (binCount & (binCount - 1)) != 0)
+            throw std::runtime_error("Histograms need a power of two number of bins up to " +
+                                     std::to_string(MAX_HISTOGRAM_BINS));
+
+        vkCmdFillBuffer(cmd, bins->buffer, 0, sizeof(uint32_t) * binCount, 0);
+        fillBarrier(cmd);
+
+        uint32_t params[] = { count, shift, binCount };
+        dispatch(cmd, histogramKernel, { input, bins }, params, tiles(count));
+        computeBarrier(cmd);
+    }
+
+    // Copies the values that pass the predicate to the front of output, in order, and their number to selected[0].
+    // output must not be input.
+    void compact(VkCommandBuffer cmd, const GpuBuffer* input, uint32_t count, const GpuBuffer* output,
+                 const GpuBuffer* selected, CompactPredicate predicate) {
+        vkCmdFillBuffer(cmd, selected->buffer, 0, sizeof(uint32_t), 0);       // In case count is 0
+        if (count == 0) {
+            fillBarrier(cmd);
+            return;
+        }
+
+        GpuBuffer* places = scratch(positions, sizeof(uint32_t) * static_cast<VkDeviceSize>(count));
+        scanWith(cmd, input, places, count, 0, static_cast<uint32_t>(predicate.op), predicate.operand);
+        computeBarrier(cmd);
+
+        uint32_t params[] = { count, static_cast<uint32_t>(predicate.op), predicate.operand };
+        dispatch(cmd, compactKernel, { input, places, output, selected }, params, tiles(count));
+        computeBarrier(cmd);
+    }
+
+    // Sorts the first count keys in place, ascending, with a stable LSD radix sort of RADIX_BITS bits per pass
+    void sort(VkCommandBuffer cmd, const GpuBuffer* keys, uint32_t count) {
+        if (count < 2) return;
+
+        const uint32_t groups = tiles(count);
+        const VkDeviceSize countsSize = sizeof(uint32_t) * static_cast<VkDeviceSize>(groups) * RADIX;
+        GpuBuffer* other = scratch(sortKeys, sizeof(uint32_t) * static_cast<VkDeviceSize>(count));
+        GpuBuffer* counts = scratch(sortCounts, countsSize);
+        GpuBuffer* offsets = scratch(sortOffsets, countsSize);
+
+        // An even number of passes, so the keys end up back where they started
+        const GpuBuffer* from = keys;
+        const GpuBuffer* to = other;
+        for (uint32_t shift = 0; shift < 32; shift += RADIX_BITS) {
+            uint32_t params[] = { count, shift, groups };
+
+            dispatch(cmd, radixCountKernel, { from, counts }, params, groups);
+            computeBarrier(cmd);
+            scanWith(cmd, counts, offsets, groups * RADIX, 0, 0, 0);
+            computeBarrier(cmd);
+            dispatch(cmd, radixScatterKernel, { from, to, offsets }, params, groups);
+            computeBarrier(cmd);
+
+            std::swap(from, to);
+        }
+    }
+
+    // Makes the descriptor sets and scratch buffers of everything recorded so far available again. Only call it once
+    // the GPU has finished with those commands.
+    void recycle() {
+        for (VkDescriptorPool pool : descriptorPools) VK_CHECK(vkResetDescriptorPool(ctx.device, pool, 0));
+        currentPool = 0;
+
+        for (GpuBuffer* buffer : retired) ctx.allocator->destroyBuffer(buffer);
+        retired.clear();
+    }
+
+private:
+    // Descriptor sets per pool. Each set has at most four storage buffers.
+    static constexpr uint32_t SETS_PER_POOL = 64;
+
+    uint32_t tiles(uint32_t count) const {
+        uint32_t groups = (count + TILE_SIZE - 1) / TILE_SIZE;
+        if (groups > maxGroups)
+            throw std::runtime_error(std::to_string(count) + " values are more than one dispatch can cover");
+        return groups;
+    }
+
+    // Scan with an optional predicate, see scan.comp. Clears the look-back state first.
+    void scanWith(VkCommandBuffer cmd, const GpuBuffer* input, const GpuBuffer* output, uint32_t count,
+                  uint32_t inclusive, uint32_t predicate, uint32_t operand) {
+        if (count == 0) return;
+
+        const uint32_t groups = tiles(count);
+        GpuBuffer* state = scratch(lookback, 16 + 16 * static_cast<VkDeviceSize>(groups));
+        vkCmdFillBuffer(cmd, state->buffer, 0, VK_WHOLE_SIZE, 0);
+        fillBarrier(cmd);
+
+        uint32_t params[] = { count, inclusive, predicate, operand };
+        dispatch(cmd, scanKernel, { input, output, state }, params, groups);
+    }
+
+    template <size_t N>
+    void dispatch(VkCommandBuffer cmd, const ComputeKernel& kernel, std::initializer_list<const GpuBuffer*> buffers,
+                  const uint32_t (&params)[N], uint32_t groups) {
+        if (groups == 0) return;
+
+        VkDescriptorSet set = bind(kernel, buffers);
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.layout, 0, 1, &set, 0, nullptr);
+        vkCmdPushConstants(cmd, kernel.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), params);
+        vkCmdDispatch(cmd, groups, 1, 1);
+    }
+
+    // Allocates a descriptor set pointing at the buffers, in binding order, adding a pool when the others are full
+    VkDescriptorSet bind(const ComputeKernel& kernel, std::initializer_list<const GpuBuffer*> buffers) {
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &kernel.setLayout;
+
+        VkDescriptorSet set = VK_NULL_HANDLE;
+        while (true) {
+            if (currentPool == descriptorPools.size()) descriptorPools.push_back(createPool());
+
+            allocInfo.descriptorPool = descriptorPools[currentPool];
+            VkResult result = vkAllocateDescriptorSets(ctx.device, &allocInfo, &set);
+            if (result == VK_SUCCESS) break;
+            if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL) VK_CHECK(result);
+            ++currentPool;
+        }
+
+        std::vector<VkDescriptorBufferInfo> infos;
+        for (const GpuBuffer* buffer : buffers) infos.push_back({ buffer->buffer, 0, VK_WHOLE_SIZE });
+
+        std::vector<VkWriteDescriptorSet> writes(infos.size());
+        for (uint32_t i = 0; i < writes.size(); ++i) {
+            writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i].dstSet = set;
+            writes[i].dstBinding = i;
+            writes[i].descriptorCount = 1;
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[i].pBufferInfo = &infos[i];
+        }
+        vkUpdateDescriptorSets(ctx.device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+        return set;
+    }
+
+    VkDescriptorPool createPool() {
+        VkDescriptorPoolSize poolSize{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, SETS_PER_POOL * 4 };
+
+        VkDescriptorPoolCreateInfo poolCI{};
+        poolCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolCI.maxSets = SETS_PER_POOL;
+        poolCI.poolSizeCount = 1;
+        poolCI.pPoolSizes = &poolSize;
+
+        VkDescriptorPool pool;
+        VK_CHECK(vkCreateDescriptorPool(ctx.device, &poolCI, nullptr, &pool));
+        return pool;
+    }
+
+    // Returns buffer, replaced by a bigger one first if it is too small. Commands recorded earlier may still use the
+    // old one, so it is only destroyed by recycle().
+    GpuBuffer* scratch(GpuBuffer*& buffer, VkDeviceSize size) {
+        if (buffer && buffer->size >= size) return buffer;
+        if (buffer) retired.push_back(buffer);
+
+        AllocationCreateInfo info{};
+        info.usage = MemoryUsage::GpuOnly;
+        const VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        buffer = ctx.allocator->createBuffer(size, usage, info);
+        return buffer;
+    }
+
+    // Fills and clears -> the compute shaders after them
+    static void fillBarrier(VkCommandBuffer cmd) {
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                             1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    // Compute shader writes -> later compute shaders and transfers
+    static void computeBarrier(VkCommandBuffer cmd) {
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT |
+                                VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    const ComputeContext& ctx;
+    uint32_t maxGroups = 0;
+
+    ComputeKernel reduceKernel;
+    ComputeKernel scanKernel;
+    ComputeKernel histogramKernel;
+    ComputeKernel compactKernel;
+    ComputeKernel radixCountKernel;
+    ComputeKernel radixScatterKernel;
+
+    std::vector<VkDescriptorPool> descriptorPools;
+    size_t currentPool = 0;
+
+    GpuBuffer* lookback = nullptr;                  // Scratch buffers, grown on demand
+    GpuBuffer* positions = nullptr;
+    GpuBuffer* sortKeys = nullptr;
+    GpuBuffer* sortCounts = nullptr;
+    GpuBuffer* sortOffsets = nullptr;
+    std::vector<GpuBuffer*> retired;                // Outgrown scratch buffers, destroyed by recycle()
+};
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <string>
+#include <map>
+#include <ostream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+
+#ifndef VK_CHECK
+#define VK_CHECK(x) do { VkResult err = x; if (err != VK_SUCCESS) throw std::runtime_error("Vulkan error at " #x); } while(0)
+#endif
+
+// GPU profiler built on timestamp and pipeline statistics queries.
+//
+// Scopes are named regions of a command buffer and can be nested; a scope's full name is its parent's name, a slash
+// and its own name ("frame/clear"). Every frame slot (one per frame in flight) has its own range of queries. Results
+// for a slot are read back the next time the slot is used, when the caller has already waited for its previous
+// submission (on a fence or a timeline value), and with VK_QUERY_RESULT_WITH_AVAILABILITY_BIT rather than
+// VK_QUERY_RESULT_WAIT_BIT, so the profiler never waits for the GPU by itself.
+//
+// Pipeline statistics queries of the same type can't be active at the same time in a command buffer, so only the
+// outermost scope that is open gets a compute shader invocation count.
+class GpuProfiler {
+public:
+    // Maximum number of scopes per frame slot
+    static constexpr uint32_t MAX_SCOPES = 256;
+
+    // Number of samples kept per scope for the percentiles. Older samples are overwritten.
+    static constexpr size_t MAX_SAMPLES = 4096;
+
+    // pipelineStatistics must only be true if the pipelineStatisticsQuery feature was enabled on the device
+    GpuProfiler(VkPhysicalDevice gpu, VkDevice device, uint32_t queueFamily, uint32_t frameSlots,
+                bool pipelineStatistics)
+        : device(device), slots(frameSlots) {
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(gpu, &props);
+        timestampPeriod = props.limits.timestampPeriod;
+
+        uint32_t familyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(gpu, &familyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> families(familyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(gpu, &familyCount, families.data());
+
+        // Zero valid bits means the queue doesn't support timestamps at all, and the profiler does nothing
+        uint32_t validBits = queueFamily < familyCount ? families[queueFamily].timestampValidBits : 0;
+        if (validBits == 0) return;
+        timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+        VkQueryPoolCreateInfo timestampCI{};
+        timestampCI.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        timestampCI.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        timestampCI.queryCount = frameSlots * MAX_SCOPES * 2;                     // Begin and end per scope
+        VK_CHECK(vkCreateQueryPool(device, &timestampCI, nullptr, &timestampPool));
+
+        if (pipelineStatistics) {
+            VkQueryPoolCreateInfo statisticsCI{};
+            statisticsCI.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            statisticsCI.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+            statisticsCI.queryCount = frameSlots * MAX_SCOPES;
+            statisticsCI.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+            VK_CHECK(vkCreateQueryPool(device, &statisticsCI, nullptr, &statisticsPool));
+        }
+    }
+
+    ~GpuProfiler() {
+        if (timestampPool) vkDestroyQueryPool(device, timestampPool, nullptr);
+        if (statisticsPool) vkDestroyQueryPool(device, statisticsPool, nullptr);
+    }
+
+    GpuProfiler(const GpuProfiler&) = delete;
+    GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+    bool enabled() const { return timestampPool != VK_NULL_HANDLE; }
+
+    // Starts recording a frame into the given slot. Must be called after the slot's previous submission was waited
+    // on, and before any scope is recorded into cmd. Collects that submission's results and resets the slot's queries.
+    void beginFrame(VkCommandBuffer cmd, uint32_t slot) {
+        if (!enabled()) return;
+
+        collect(slot);
+        current = slot;
+        openScopes.clear();
+        statisticsOwner = -1;
+
+        uint32_t first = slot * MAX_SCOPES;
+        vkCmdResetQueryPool(cmd, timestampPool, first * 2, MAX_SCOPES * 2);
+        if (statisticsPool) vkCmdResetQueryPool(cmd, statisticsPool, first, MAX_SCOPES);
+    }
+
+    // Opens a named scope. Scopes past MAX_SCOPES in one frame are silently dropped.
+    void begin(VkCommandBuffer cmd, const std::string& name) {
+        if (!enabled()) return;
+
+        FrameSlot& frame = slots[current];
+        if (frame.scopes.size() >= MAX_SCOPES) {
+            openScopes.push_back(-1);
+            return;
+        }
+
+        std::string fullName = openScopes.empty() ? name : frame.scopes[openScopes.back()].name + "/" + name;
+
+        int index = static_cast<int>(frame.scopes.size());
+        bool statistics = statisticsPool && statisticsOwner < 0;
+
+        frame.scopes.push_back({ std::move(fullName), static_cast<uint32_t>(openScopes.size()), statistics });
+        openScopes.push_back(index);
+
+        uint32_t query = current * MAX_SCOPES + index;
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, query * 2);
+
+        if (statistics) {
+            vkCmdBeginQuery(cmd, statisticsPool, query, 0);
+            statisticsOwner = index;
+        }
+    }
+
+    // Closes the innermost open scope
+    void end(VkCommandBuffer cmd) {
+        if (!enabled() || openScopes.empty()) return;
+
+        int index = openScopes.back();
+        openScopes.pop_back();
+        if (index < 0) return;
+
+        uint32_t query = current * MAX_SCOPES + index;
+
+        if (statisticsOwner == index) {
+            vkCmdEndQuery(cmd, statisticsPool, query);
+            statisticsOwner = -1;
+        }
+
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool, query * 2 + 1);
+    }
+
+    // Collects the results of every slot that still has some. Only call this once the GPU is idle (or at least done
+    // with every submission that recorded scopes), e.g. before printing the report at exit.
+    void collectAll() {
+        for (uint32_t slot = 0; slot < static_cast<uint32_t>(slots.size()); ++slot) collect(slot);
+    }
+
+    // Prints min/avg/p99 GPU time and the average compute shader invocations for every scope seen so far
+    void report(std::ostream& out) const {
+        if (!enabled()) {
+            out << "GPU profiler: timestamps are not supported on this queue\n";
+            return;
+        }
+
+        std::ios::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+
+        out << "GPU profile (" << results.size() << " scopes)\n";
+        for (const auto& [name, result] : order()) {
+            std::vector<double> sorted = result->samples;
+            std::sort(sorted.begin(), sorted.end());
+
+            double total = 0.0;
+            for (double ms : sorted) total += ms;
+
+            size_t p99 = std::min(sorted.size() - 1, static_cast<size_t>(static_cast<double>(sorted.size()) * 0.99));
+
+            out << "  " << std::left << std::setw(32) << name << std::right << std::fixed << std::setprecision(3)
+                << " n=" << std::setw(6) << result->count
+                << "  min " << std::setw(8) << sorted.front() << " ms"
+                << "  avg " << std::setw(8) << total / static_cast<double>(sorted.size()) << " ms"
+                << "  p99 " << std::setw(8) << sorted[p99] << " ms";
+
+            if (result->statisticsCount > 0)
+                out << "  " << result->invocations / result->statisticsCount << " invocations";
+
+            out << "\n";
+        }
+
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+    // RAII helper that opens a scope on construction and closes it on destruction
+    class Scope {
+    public:
+        Scope(GpuProfiler& profiler, VkCommandBuffer cmd, const std::string& name) : profiler(profiler), cmd(cmd) {
+            profiler.begin(cmd, name);
+        }
+        ~Scope() { profiler.end(cmd); }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        GpuProfiler& profiler;
+        VkCommandBuffer cmd;
+    };
+
+private:
+    struct ScopeInfo {
+        std::string name;
+        uint32_t depth;
+        bool statistics;
+    };
+
+    struct FrameSlot {
+        std::vector<ScopeInfo> scopes;
+    };
+
+    struct ScopeResult {
+        std::vector<double> samples;                    // GPU time in ms, ring of the last MAX_SAMPLES
+        uint64_t count = 0;
+        uint64_t invocations = 0;
+        uint64_t statisticsCount = 0;
+    };
+
+    // Reads back whatever the slot's last submission recorded, without waiting. Scopes whose results aren't available
+    // (the command buffer was never submitted, say) are dropped.
+    void collect(uint32_t slot) {
+        FrameSlot& frame = slots[slot];
+        if (frame.scopes.empty()) return;
+
+        uint32_t count = static_cast<uint32_t>(frame.scopes.size());
+        uint32_t first = slot * MAX_SCOPES;
+
+        // Each timestamp is followed by its availability value
+        std::vector<uint64_t> timestamps(count * 2 * 2);
+        VkResult result = vkGetQueryPoolResults(device, timestampPool, first * 2, count * 2,
+                                                timestamps.size() * sizeof(uint64_t), timestamps.data(),
+                                                2 * sizeof(uint64_t),
+                                                VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+        if (result != VK_SUCCESS && result != VK_NOT_READY) VK_CHECK(result);
+
+        std::vector<uint64_t> statistics;
+        if (statisticsPool) {
+            statistics.resize(count * 2);
+            result = vkGetQueryPoolResults(device, statisticsPool, first, count,
+                                           statistics.size() * sizeof(uint64_t), statistics.data(),
+                                           2 * sizeof(uint64_t),
+                                           VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+            if (result != VK_SUCCESS && result != VK_NOT_READY) VK_CHECK(result);
+        }
+
+        for (uint32_t i = 0; i < count; ++i) {
+            const ScopeInfo& scope = frame.scopes[i];
+            uint64_t begin = timestamps[i * 4 + 0], beginAvailable = timestamps[i * 4 + 1];
+            uint64_t end = timestamps[i * 4 + 2], endAvailable = timestamps[i * 4 + 3];
+            if (!beginAvailable || !endAvailable) continue;
+
+            ScopeResult& r = results[scope.name];
+            if (r.count == 0) firstSeen.push_back({ scope.name, scope.depth });
+
+            // Only the valid bits of a timestamp count, so the difference is taken modulo 2^validBits
+            double ms = static_cast<double>((end - begin) & timestampMask) * timestampPeriod / 1e6;
+            if (r.samples.size() < MAX_SAMPLES) r.samples.push_back(ms);
+            else r.samples[r.count % MAX_SAMPLES] = ms;
+            ++r.count;
+
+            if (scope.statistics && statistics[i * 2 + 1]) {
+                r.invocations += statistics[i * 2];
+                ++r.statisticsCount;
+            }
+        }
+
+        frame.scopes.clear();
+    }
+
+    // Scopes in the order they were first seen, indented by depth, so nested scopes are listed under their parent
+    std::vector<std::pair<std::string, const ScopeResult*>> order() const {
+        std::vector<std::pair<std::string, const ScopeResult*>> list;
+        for (const auto& [name, depth] : firstSeen) {
+            std::string label = std::string(depth * 2, ' ') + name.substr(name.find_last_of('/') + 1);
+            list.push_back({ label, &results.at(name) });
+        }
+        return list;
+    }
+
+    VkDevice device;
+    VkQueryPool timestampPool = VK_NULL_HANDLE;
+    VkQueryPool statisticsPool = VK_NULL_HANDLE;
+    float timestampPeriod = 1.0f;                       // Nanoseconds per timestamp tick
+    uint64_t timestampMask = ~0ull;
+
+    std::vector<FrameSlot> slots;
+    uint32_t current = 0;
+    std::vector<int> openScopes;                        // Indices into the current slot's scopes, -1 for dropped ones
+    int statisticsOwner = -1;                           // Scope that has the pipeline statistics query open
+
+    std::map<std::string, ScopeResult> results;
+    std::vector<std::pair<std::string, uint32_t>> firstSeen;
+};
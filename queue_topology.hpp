@@ -0,0 +1,139 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <stdexcept>
+#include <cstdint>
+
+// One queue of one family
+struct QueueSlot {
+    uint32_t family = UINT32_MAX;
+    uint32_t index = 0;
+
+    bool operator==(const QueueSlot&) const = default;
+};
+
+// Which queue does what, worked out from the device's queue families.
+//
+//   primary   Graphics and compute (and present, if a surface was given). On compute-only devices without a surface,
+//             the first compute family.
+//   compute   Async compute. A family with compute but no graphics is usually backed by separate hardware queues, so
+//             it is used if there is one. Otherwise a second queue of the primary family, if it has more than one, and
+//             as a last resort the primary queue itself.
+//   transfer  A family with transfer but neither graphics nor compute, usually a separate copy engine. Otherwise the
+//             primary queue.
+//   readback  A second queue of the dedicated transfer family, if it has one, so copies back to the host don't queue
+//             up behind uploads. Otherwise the transfer queue.
+//
+// queueCounts says how many queues to create per family so every slot exists. Roles that share a family but not a
+// queue index are separate queues, and their work can overlap.
+struct QueueTopology {
+    QueueSlot primary;
+    QueueSlot compute;
+    QueueSlot transfer;
+    QueueSlot readback;
+    std::vector<VkQueueFamilyProperties> families;
+    std::vector<uint32_t> queueCounts;              // Queues to create, indexed by family
+
+    // True if async compute work lands on a queue other than the primary one
+    bool asyncCompute() const { return compute != primary; }
+
+    // True if transfers land on a queue other than the primary one
+    bool dedicatedTransfer() const { return transfer != primary; }
+
+    // Create infos for every family that needs queues. priorities has to outlive the returned infos and hold at least
+    // as many entries as the largest queue count.
+    std::vector<VkDeviceQueueCreateInfo> createInfos(const float* priorities) const {
+        std::vector<VkDeviceQueueCreateInfo> infos;
+        for (uint32_t family = 0; family < queueCounts.size(); ++family) {
+            if (queueCounts[family] == 0) continue;
+
+            VkDeviceQueueCreateInfo queueCI{};
+            queueCI.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+            queueCI.queueFamilyIndex = family;
+            queueCI.queueCount = queueCounts[family];
+            queueCI.pQueuePriorities = priorities;
+            infos.push_back(queueCI);
+        }
+        return infos;
+    }
+
+    // Largest number of queues created from one family
+    uint32_t maxQueueCount() const {
+        uint32_t count = 0;
+        for (uint32_t c : queueCounts) count = c > count ? c : count;
+        return count;
+    }
+};
+
+// Works out the queue topology of a device. If surface is given, the primary family also has to be able to present
+// to it.
+inline QueueTopology discoverQueues(VkPhysicalDevice gpu, VkSurfaceKHR surface = VK_NULL_HANDLE) {
+    QueueTopology topology;
+
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(gpu, &familyCount, nullptr);
+    topology.families.resize(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(gpu, &familyCount, topology.families.data());
+
+    auto has = [&](uint32_t family, VkQueueFlags flags) {
+        return (topology.families[family].queueFlags & flags) == flags;
+    };
+    auto lacks = [&](uint32_t family, VkQueueFlags flags) {
+        return (topology.families[family].queueFlags & flags) == 0;
+    };
+    auto canPresent = [&](uint32_t family) {
+        if (!surface) return true;
+        VkBool32 supported = VK_FALSE;
+        vkGetPhysicalDeviceSurfaceSupportKHR(gpu, family, surface, &supported);
+        return supported == VK_TRUE;
+    };
+
+    // ==================================================== Primary ====================================================
+    for (uint32_t i = 0; i < familyCount && topology.primary.family == UINT32_MAX; ++i)
+        if (has(i, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT) && canPresent(i)) topology.primary.family = i;
+
+    if (topology.primary.family == UINT32_MAX && !surface)
+        for (uint32_t i = 0; i < familyCount && topology.primary.family == UINT32_MAX; ++i)
+            if (has(i, VK_QUEUE_COMPUTE_BIT)) topology.primary.family = i;
+
+    if (topology.primary.family == UINT32_MAX)
+        throw std::runtime_error(surface ? "No queue family can do graphics, compute and present"
+                                         : "No compute queue found");
+
+    // ================================================= Async Compute =================================================
+    topology.compute = topology.primary;
+    for (uint32_t i = 0; i < familyCount; ++i) {
+        if (has(i, VK_QUEUE_COMPUTE_BIT) && lacks(i, VK_QUEUE_GRAPHICS_BIT)) {
+            topology.compute = { i, 0 };
+            break;
+        }
+    }
+
+    if (topology.compute == topology.primary && topology.families[topology.primary.family].queueCount > 1)
+        topology.compute = { topology.primary.family, 1 };
+
+    // =================================================== Transfer ====================================================
+    topology.transfer = topology.primary;
+    for (uint32_t i = 0; i < familyCount; ++i) {
+        if (has(i, VK_QUEUE_TRANSFER_BIT) && lacks(i, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) {
+            topology.transfer = { i, 0 };
+            break;
+        }
+    }
+
+    topology.readback = topology.transfer;
+    if (topology.transfer != topology.primary &&
+        topology.families[topology.transfer.family].queueCount > topology.transfer.index + 1)
+        topology.readback = { topology.transfer.family, topology.transfer.index + 1 };
+
+    // =============================================== Queues to Create ================================================
+    topology.queueCounts.assign(familyCount, 0);
+    for (const QueueSlot& slot : { topology.primary, topology.compute, topology.transfer, topology.readback }) {
+        uint32_t& count = topology.queueCounts[slot.family];
+        if (slot.index + 1 > count) count = slot.index + 1;
+    }
+
+    return topology;
+}
@@ -28,15 +28,12 @@ int main(int argc, char* argv[])
     bool running = true;
     SDL_Event event;
 
-    // Main loop: Poll for events and handle them. If we receive a quit event, set running to false to exit the loop.
-    while (running) {
-        while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_EVENT_QUIT) {
-                running = false;
-            }
+    // Main loop: Nothing is drawn, so block until the next event instead of waking up every few milliseconds. If we
+    // receive a quit event, set running to false to exit the loop.
+    while (running && SDL_WaitEvent(&event)) {
+        if (event.type == SDL_EVENT_QUIT) {
+            running = false;
         }
-
-        SDL_Delay(16); // Draws frames with a delay of 16ms, or 62.5 fps equivalent
     }
 
     // Clean up and quit SDL
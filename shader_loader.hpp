@@ -0,0 +1,134 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+#include <cstdint>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Built-in kernels are compiled and embedded by the CMake build (see CMakeLists.txt). Programs built some other way,
+// like vulkantest.cpp through the single file VS Code task, just don't have any and load .spv files instead.
+#if __has_include("embedded_shaders.hpp")
+#include "embedded_shaders.hpp"
+#define HAS_EMBEDDED_SHADERS 1
+#else
+#define HAS_EMBEDDED_SHADERS 0
+#endif
+
+constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+
+// SPIR-V code for a shader module. Either points straight at an array embedded in the executable, or at a .spv file
+// mapped into memory. Neither case copies the code.
+class ShaderCode {
+public:
+    ShaderCode() = default;
+    explicit ShaderCode(std::span<const uint32_t> embedded) : words(embedded) {}
+
+    // Maps a .spv file read-only. Falls back to reading it into memory on platforms without mmap.
+    static ShaderCode mapFile(const std::string& path) {
+        ShaderCode shader;
+
+#ifdef _WIN32
+        std::ifstream file(path, std::ios::ate | std::ios::binary);
+        if (!file.is_open()) throw std::runtime_error("Failed to open file: " + path);
+        size_t size = file.tellg();
+        shader.fallback.resize((size + 3) / 4);
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(shader.fallback.data()), static_cast<std::streamsize>(size));
+        shader.words = std::span<const uint32_t>(shader.fallback.data(), size / 4);
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Failed to open file: " + path);
+
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            throw std::runtime_error("Failed to stat file: " + path);
+        }
+
+        void* mapping = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);                                                // The mapping keeps the file alive
+        if (mapping == MAP_FAILED) throw std::runtime_error("Failed to map file: " + path);
+
+        shader.mapping = mapping;
+        shader.mappingSize = static_cast<size_t>(st.st_size);
+        shader.words = std::span<const uint32_t>(static_cast<const uint32_t*>(mapping), shader.mappingSize / 4);
+#endif
+
+        if (shader.words.empty() || shader.words[0] != SPIRV_MAGIC || shader.sizeBytes() % 4 != 0)
+            throw std::runtime_error(path + " is not a SPIR-V binary");
+
+        return shader;
+    }
+
+    ~ShaderCode() { unmap(); }
+
+    ShaderCode(ShaderCode&& other) noexcept { *this = std::move(other); }
+
+    ShaderCode& operator=(ShaderCode&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            words = other.words;
+            fallback = std::move(other.fallback);
+            mapping = other.mapping;
+            mappingSize = other.mappingSize;
+            other.words = {};
+            other.mapping = nullptr;
+            other.mappingSize = 0;
+        }
+        return *this;
+    }
+
+    ShaderCode(const ShaderCode&) = delete;
+    ShaderCode& operator=(const ShaderCode&) = delete;
+
+    const uint32_t* data() const { return words.data(); }
+    size_t sizeBytes() const { return mapping ? mappingSize : words.size_bytes(); }
+    std::span<const uint32_t> span() const { return words; }
+
+private:
+    void unmap() {
+#ifndef _WIN32
+        if (mapping) munmap(mapping, mappingSize);
+#endif
+        mapping = nullptr;
+        mappingSize = 0;
+    }
+
+    std::span<const uint32_t> words;
+    std::vector<uint32_t> fallback;
+    void* mapping = nullptr;
+    size_t mappingSize = 0;
+};
+
+// Looks up a kernel embedded at build time by its source file name, e.g. "gradient.comp". Returns an empty span if
+// there is no such kernel.
+inline std::span<const uint32_t> findEmbeddedShader(std::string_view name) {
+#if HAS_EMBEDDED_SHADERS
+    for (const auto& shader : EMBEDDED_SHADERS)
+        if (shader.name == name) return shader.code;
+#endif
+    (void)name;
+    return {};
+}
+
+// Loads a shader by name. Built-in kernels ("gradient.comp") come from the embedded table. Anything else, and
+// built-in names in builds without embedded shaders, is treated as a .spv file and mapped from disk ("gradient.comp"
+// becomes "gradient.comp.spv").
+inline ShaderCode loadShader(const std::string& name) {
+    auto embedded = findEmbeddedShader(name);
+    if (!embedded.empty()) return ShaderCode(embedded);
+
+    bool isSpirvFile = name.size() > 4 && name.compare(name.size() - 4, 4, ".spv") == 0;
+    return ShaderCode::mapFile(isSpirvFile ? name : name + ".spv");
+}
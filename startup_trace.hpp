@@ -0,0 +1,168 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <fstream>
+#include <ostream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+
+// CPU timeline of startup: when each phase ran, for how long and on which thread, and when milestones like the first
+// frame or the first dispatch were reached. Times are relative to the trace's creation, which should be as early in
+// main() as possible, so milestones read as "time to first frame".
+//
+// write() saves the trace in the Chrome trace event format, which chrome://tracing, Perfetto (ui.perfetto.dev) and
+// speedscope open. Phases that overlap because they ran on different threads show up side by side.
+//
+// Phases and milestones can be recorded from any thread.
+class StartupTrace {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Times a phase from construction to destruction. Does nothing if trace is null, so functions can take an
+    // optional trace.
+    class Scope {
+    public:
+        Scope(StartupTrace* trace, std::string name) : trace(trace), name(std::move(name)), begin(Clock::now()) {}
+        ~Scope() { if (trace) trace->add(name, begin, Clock::now()); }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        StartupTrace* trace;
+        std::string name;
+        Clock::time_point begin;
+    };
+
+    StartupTrace() : start(Clock::now()) { threadIndex("main"); }
+
+    // Records a phase that ran on the calling thread
+    void add(const std::string& name, Clock::time_point begin, Clock::time_point end) {
+        std::lock_guard<std::mutex> lock(mutex);
+        phases.push_back({ name, microseconds(begin), microseconds(end) - microseconds(begin), threadIndex() });
+    }
+
+    // Records when a milestone was first reached. Later calls for the same milestone are ignored, so it can be called
+    // on every frame or every submission.
+    void milestone(const std::string& name) {
+        Clock::time_point now = Clock::now();
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const Milestone& m : milestones)
+            if (m.name == name) return;
+        milestones.push_back({ name, microseconds(now), threadIndex() });
+    }
+
+    // Milliseconds from the start of the trace to a milestone, or a negative number if it hasn't been reached
+    double milestoneMs(const std::string& name) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const Milestone& m : milestones)
+            if (m.name == name) return m.us / 1000.0;
+        return -1.0;
+    }
+
+    // Names the calling thread in the trace. The thread that created the trace is "main".
+    void nameThread(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        threadIndex(name);
+    }
+
+    // Phases in the order they started, then the milestones
+    void print(std::ostream& out) const {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        std::vector<Phase> sorted = phases;
+        std::stable_sort(sorted.begin(), sorted.end(), [](const Phase& a, const Phase& b) { return a.us < b.us; });
+
+        out << "Startup phases (ms since start):\n" << std::fixed << std::setprecision(2);
+        for (const Phase& phase : sorted)
+            out << "  " << std::setw(9) << phase.us / 1000.0 << " +" << std::setw(8) << phase.durationUs / 1000.0
+                << "  " << phase.name << " [" << threads[phase.thread].name << "]\n";
+        for (const Milestone& m : milestones)
+            out << "  " << std::setw(9) << m.us / 1000.0 << "            " << m.name << "\n";
+        out << std::defaultfloat;
+    }
+
+    // Writes the trace as Chrome trace event JSON
+    void write(const std::string& path) const {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        std::ofstream file(path);
+        if (!file.is_open()) throw std::runtime_error("Failed to open file: " + path);
+
+        file << "{\n  \"displayTimeUnit\": \"ms\",\n  \"traceEvents\": [";
+        const char* separator = "\n    ";
+
+        for (uint32_t t = 0; t < threads.size(); ++t) {
+            file << separator << "{ \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << t
+                 << ", \"args\": { \"name\": " << quoted(threads[t].name) << " } }";
+            separator = ",\n    ";
+        }
+        for (const Phase& phase : phases)
+            file << separator << "{ \"name\": " << quoted(phase.name) << ", \"cat\": \"startup\", \"ph\": \"X\", "
+                 << "\"ts\": " << phase.us << ", \"dur\": " << phase.durationUs << ", \"pid\": 1, \"tid\": "
+                 << phase.thread << " }";
+        for (const Milestone& m : milestones)
+            file << separator << "{ \"name\": " << quoted(m.name) << ", \"cat\": \"milestone\", \"ph\": \"i\", "
+                 << "\"s\": \"g\", \"ts\": " << m.us << ", \"pid\": 1, \"tid\": " << m.thread << " }";
+
+        file << "\n  ]\n}\n";
+        if (!file) throw std::runtime_error("Failed to write file: " + path);
+    }
+
+private:
+    struct Phase {
+        std::string name;
+        int64_t us;                                 // Start, since the trace was created
+        int64_t durationUs;
+        uint32_t thread;
+    };
+
+    struct Milestone {
+        std::string name;
+        int64_t us;
+        uint32_t thread;
+    };
+
+    struct Thread {
+        std::thread::id id;
+        std::string name;
+    };
+
+    int64_t microseconds(Clock::time_point time) const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(time - start).count();
+    }
+
+    // Small, stable thread numbers for the trace, in order of first appearance. Called with the mutex held (or
+    // from the constructor).
+    uint32_t threadIndex(const std::string& name = "") {
+        std::thread::id id = std::this_thread::get_id();
+        for (uint32_t t = 0; t < threads.size(); ++t) {
+            if (threads[t].id != id) continue;
+            if (!name.empty()) threads[t].name = name;
+            return t;
+        }
+        threads.push_back({ id, name.empty() ? "worker " + std::to_string(threads.size()) : name });
+        return static_cast<uint32_t>(threads.size() - 1);
+    }
+
+    static std::string quoted(const std::string& text) {
+        std::string out = "\"";
+        for (char c : text) {
+            if (c == '"' || c == '\\') out += '\\';
+            if (static_cast<unsigned char>(c) >= 0x20) out += c;
+        }
+        return out + "\"";
+    }
+
+    Clock::time_point start;
+    mutable std::mutex mutex;
+    std::vector<Phase> phases;
+    std::vector<Milestone> milestones;
+    std::vector<Thread> threads;
+};
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include <vector>
+#include <array>
+#include <string>
+#include <stdexcept>
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+
+// Converts a present mode name from the command line ("fifo", "mailbox", "immediate", "relaxed") to the Vulkan enum
+inline vk::PresentModeKHR parsePresentMode(const std::string& name) {
+    if (name == "fifo")      return vk::PresentModeKHR::eFifo;
+    if (name == "mailbox")   return vk::PresentModeKHR::eMailbox;
+    if (name == "immediate") return vk::PresentModeKHR::eImmediate;
+    if (name == "relaxed")   return vk::PresentModeKHR::eFifoRelaxed;
+
+    throw std::runtime_error("Unknown present mode: " + name);
+}
+
+// Settings the application would like the swapchain to have. Anything the surface doesn't support is replaced with the
+// closest thing it does support when the swapchain is (re)built.
+struct SwapchainConfig {
+    vk::PresentModeKHR presentMode = vk::PresentModeKHR::eFifo;
+    vk::ImageUsageFlags imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferDst;
+    uint32_t desiredImageCount = 3;                                    // Triple buffering if the surface allows it
+
+    // Add storage usage when the surface and format allow it, so compute kernels can write to the images directly.
+    // Kernels write rgba8, so an R8G8B8A8 format is preferred over B8G8R8A8 in that case.
+    bool preferStorage = false;
+};
+
+// Owns the swapchain, its image views and the per-image render finished semaphores, and knows how to rebuild them
+// when the window is resized or the surface reports that the swapchain is out of date.
+//
+// Rebuilding does not wait for the device to go idle. The old swapchain is passed as oldSwapchain to the new one and
+// kept alive, along with its views and semaphores, until every frame that could have used it has finished on the GPU.
+// The caller reports finished frames through collectGarbage().
+struct Swapchain {
+    vk::raii::SwapchainKHR swapchain{nullptr};
+    std::vector<vk::Image> images;                                      // Owned by the swapchain
+    std::vector<vk::raii::ImageView> imageViews;
+
+    // One render finished semaphore per image. Present waits on it per image, so it can only be reused once that
+    // image has been acquired again.
+    std::vector<vk::raii::Semaphore> renderFinishedSemaphores;
+
+    vk::SurfaceFormatKHR surfaceFormat{};
+    vk::Extent2D extent{};
+    vk::PresentModeKHR presentMode = vk::PresentModeKHR::eFifo;
+
+    // True if the images were created with storage usage (see SwapchainConfig::preferStorage)
+    bool storage = false;
+
+    SwapchainConfig config{};
+
+    // Set when the swapchain has to be rebuilt before the next acquire (resize, out of date, present mode change)
+    bool dirty = true;
+
+    // Swapchains that have been replaced but may still be referenced by frames executing on the GPU
+    struct Retired {
+        vk::raii::SwapchainKHR swapchain{nullptr};
+        std::vector<vk::raii::ImageView> imageViews;
+        std::vector<vk::raii::Semaphore> renderFinishedSemaphores;
+        int64_t lastUsedFrame = 0;
+    };
+    std::vector<Retired> retired;
+
+    // Requests a different present mode. Takes effect the next time the swapchain is rebuilt.
+    void setPresentMode(vk::PresentModeKHR mode) {
+        if (mode == config.presentMode) return;
+        config.presentMode = mode;
+        dirty = true;
+    }
+
+    // Rebuilds the swapchain for the given window size in pixels. frameNumber is the number of the next frame to be
+    // recorded; every frame before it may still be using the current swapchain. Returns false if the window has no
+    // area (minimized), in which case nothing is rebuilt and the swapchain stays dirty.
+    bool recreate(const vk::raii::PhysicalDevice& physicalDevice,
+                  const vk::raii::Device& device,
+                  const vk::raii::SurfaceKHR& surface,
+                  vk::Extent2D windowExtent,
+                  int64_t frameNumber)
+    {
+        // ============================================ Surface Capabilities ==========================================
+        auto capabilities = physicalDevice.getSurfaceCapabilitiesKHR(*surface);
+
+        // If the surface dictates the size, use it. Otherwise use the window size, clamped to what is allowed.
+        vk::Extent2D newExtent = capabilities.currentExtent;
+        if (newExtent.width == UINT32_MAX) {
+            newExtent.width  = std::clamp(windowExtent.width,
+                                          capabilities.minImageExtent.width,
+                                          capabilities.maxImageExtent.width);
+            newExtent.height = std::clamp(windowExtent.height,
+                                          capabilities.minImageExtent.height,
+                                          capabilities.maxImageExtent.height);
+        }
+
+        // A minimized window has a zero sized surface, and a swapchain can't be created for it
+        if (newExtent.width == 0 || newExtent.height == 0) return false;
+
+        // Ask for the desired number of images, within the limits of the surface (a max of 0 means no limit)
+        uint32_t imageCount = std::max(config.desiredImageCount, capabilities.minImageCount);
+        if (capabilities.maxImageCount > 0)
+            imageCount = std::min(imageCount, capabilities.maxImageCount);
+
+        // Every usage we rely on has to be supported by the surface
+        if ((capabilities.supportedUsageFlags & config.imageUsage) != config.imageUsage)
+            throw std::runtime_error("Surface does not support the requested swapchain image usage");
+
+        // Prefer opaque composition, but take whatever the surface offers
+        vk::CompositeAlphaFlagBitsKHR compositeAlpha = vk::CompositeAlphaFlagBitsKHR::eOpaque;
+        if (!(capabilities.supportedCompositeAlpha & compositeAlpha)) {
+            for (auto bit : { vk::CompositeAlphaFlagBitsKHR::ePreMultiplied,
+                              vk::CompositeAlphaFlagBitsKHR::ePostMultiplied,
+                              vk::CompositeAlphaFlagBitsKHR::eInherit }) {
+                if (capabilities.supportedCompositeAlpha & bit) { compositeAlpha = bit; break; }
+            }
+        }
+
+        // ============================================= Format and Mode ==============================================
+        surfaceFormat = chooseSurfaceFormat(physicalDevice.getSurfaceFormatsKHR(*surface));
+        vk::PresentModeKHR newPresentMode = choosePresentMode(physicalDevice.getSurfacePresentModesKHR(*surface));
+
+        // Storage needs support from the surface and from the format itself, and the format has to match the rgba8
+        // the kernels write
+        bool newStorage = config.preferStorage &&
+                          (capabilities.supportedUsageFlags & vk::ImageUsageFlagBits::eStorage) &&
+                          surfaceFormat.format == vk::Format::eR8G8B8A8Unorm &&
+                          (physicalDevice.getFormatProperties(surfaceFormat.format).optimalTilingFeatures &
+                           vk::FormatFeatureFlagBits::eStorageImage);
+
+        if (newStorage != storage || !*swapchain)
+            std::cout << "Swapchain images " << (newStorage ? "are" : "are not") << " storage images" << std::endl;
+        storage = newStorage;
+
+        vk::ImageUsageFlags usage = config.imageUsage;
+        if (storage) usage |= vk::ImageUsageFlagBits::eStorage;
+
+        // Only mention the present mode when it changes, resizing would otherwise spam the console
+        if (newPresentMode != presentMode || !*swapchain) {
+            std::cout << "Present mode: " << vk::to_string(newPresentMode);
+            if (newPresentMode != config.presentMode)
+                std::cout << " (" << vk::to_string(config.presentMode) << " not supported)";
+            std::cout << std::endl;
+        }
+        presentMode = newPresentMode;
+
+        // ================================================= Swapchain ================================================
+        // Handing over the old swapchain lets the driver reuse its resources and lets already queued presents finish
+        vk::SwapchainCreateInfoKHR swapchainInfo{};
+        swapchainInfo.setSurface(*surface)
+                     .setMinImageCount(imageCount)
+                     .setImageFormat(surfaceFormat.format)
+                     .setImageColorSpace(surfaceFormat.colorSpace)
+                     .setImageExtent(newExtent)
+                     .setImageArrayLayers(1)
+                     .setImageUsage(usage)
+                     .setPreTransform(capabilities.currentTransform)
+                     .setCompositeAlpha(compositeAlpha)
+                     .setPresentMode(presentMode)
+                     .setClipped(true)
+                     .setOldSwapchain(*swapchain ? *swapchain : vk::SwapchainKHR{});
+
+        vk::raii::SwapchainKHR newSwapchain(device, swapchainInfo);
+
+        // Frames up to frameNumber - 1 may still reference the old resources, so park them instead of destroying them
+        if (*swapchain) {
+            Retired old;
+            old.swapchain = std::move(swapchain);
+            old.imageViews = std::move(imageViews);
+            old.renderFinishedSemaphores = std::move(renderFinishedSemaphores);
+            old.lastUsedFrame = frameNumber - 1;
+            retired.push_back(std::move(old));
+        }
+
+        swapchain = std::move(newSwapchain);
+        extent = newExtent;
+        imageViews.clear();
+        renderFinishedSemaphores.clear();
+
+        // ============================================ Views and Semaphores ==========================================
+        images = swapchain.getImages();
+
+        for (const auto& image : images) {
+            vk::ImageViewCreateInfo viewInfo{};
+            viewInfo.setImage(image)
+                    .setViewType(vk::ImageViewType::e2D)
+                    .setFormat(surfaceFormat.format) // Must match swapchain format
+                    .setSubresourceRange({ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 });
+
+            imageViews.push_back(vk::raii::ImageView(device, viewInfo));
+            renderFinishedSemaphores.push_back(vk::raii::Semaphore(device, vk::SemaphoreCreateInfo{}));
+        }
+
+        dirty = false;
+        return true;
+    }
+
+    // Destroys retired swapchains once the GPU has finished every frame up to and including completedFrame
+    void collectGarbage(int64_t completedFrame) {
+        std::erase_if(retired, [&](const Retired& r) { return r.lastUsedFrame <= completedFrame; });
+    }
+
+    // Acquires the next image. Returns false, and marks the swapchain dirty, if it has to be rebuilt first.
+    bool acquire(const vk::raii::Semaphore& imageAvailable, uint32_t& imageIndex) {
+        try {
+            auto [result, index] = swapchain.acquireNextImage(UINT64_MAX, *imageAvailable);
+
+            // Suboptimal still gives us a usable image. Render this frame and rebuild afterwards.
+            if (result == vk::Result::eSuboptimalKHR) dirty = true;
+
+            imageIndex = index;
+            return true;
+        } catch (const vk::OutOfDateKHRError&) {
+            dirty = true;
+            return false;
+        }
+    }
+
+    // Presents an image on the given queue. Out of date and suboptimal results mark the swapchain for rebuilding.
+    void present(const vk::raii::Queue& queue, uint32_t imageIndex) {
+        vk::PresentInfoKHR presentInfo(*renderFinishedSemaphores[imageIndex], *swapchain, imageIndex);
+
+        try {
+            if (queue.presentKHR(presentInfo) == vk::Result::eSuboptimalKHR) dirty = true;
+        } catch (const vk::OutOfDateKHRError&) {
+            dirty = true;
+        }
+    }
+
+private:
+    // Prefers 8 bit BGRA/RGBA UNORM in the sRGB color space (RGBA first if storage is wanted), and otherwise takes the
+    // first format the surface offers
+    vk::SurfaceFormatKHR chooseSurfaceFormat(const std::vector<vk::SurfaceFormatKHR>& formats) const {
+        if (formats.empty()) throw std::runtime_error("Surface reports no formats");
+
+        std::array<vk::Format, 2> preferred{ vk::Format::eB8G8R8A8Unorm, vk::Format::eR8G8B8A8Unorm };
+        if (config.preferStorage) std::swap(preferred[0], preferred[1]);
+
+        for (auto wanted : preferred) {
+            for (const auto& f : formats) {
+                if (f.format == wanted && f.colorSpace == vk::ColorSpaceKHR::eSrgbNonlinear) return f;
+            }
+        }
+
+        return formats.front();
+    }
+
+    // Uses the requested present mode if the surface supports it. FIFO is always supported, so it is the fallback.
+    vk::PresentModeKHR choosePresentMode(const std::vector<vk::PresentModeKHR>& modes) const {
+        if (std::find(modes.begin(), modes.end(), config.presentMode) != modes.end()) return config.presentMode;
+
+        // Mailbox and immediate both avoid waiting for vsync. If one isn't there, the other is the next best thing.
+        if (config.presentMode == vk::PresentModeKHR::eMailbox &&
+            std::find(modes.begin(), modes.end(), vk::PresentModeKHR::eImmediate) != modes.end())
+            return vk::PresentModeKHR::eImmediate;
+
+        return vk::PresentModeKHR::eFifo;
+    }
+};
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include <cstdint>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "compute_context.hpp"
+#include "kernel.hpp"
+
+// Splits jobs that don't fit on the device in one go into tiles that do.
+//
+// A single dispatch covers at most maxComputeWorkGroupCount workgroups per dimension, a storage buffer binding at most
+// maxStorageBufferRange bytes and an image at most maxImageDimension2D pixels per side, and the whole output may not
+// fit in device memory at all. planTiles() cuts a 1D or 2D job into tiles that stay within all of these, row by row,
+// so each tile can be uploaded, dispatched and read back on its own and several can be in flight through the transfer
+// engine at once. Kernels learn where their tile is from push constants (ImageTileConstants for the image kernels).
+//
+// Results go into a MappedOutputFile as tiles retire, so the host never holds more than the tiles in flight.
+
+// Push constants of gradient.comp and shader.comp: where the bound image sits in the full image, and the full size
+struct ImageTileConstants {
+    int32_t offsetX = 0;
+    int32_t offsetY = 0;
+    int32_t width = 0;
+    int32_t height = 0;
+};
+
+// Workgroup size of gradient.comp and shader.comp until they have been tuned for the device (see autotune.hpp)
+constexpr WorkgroupSize IMAGE_WORKGROUP_SIZE{ 16, 16, 1 };
+
+// A rectangle of a width x height job. One-dimensional jobs have height 1 and only use x and width.
+struct Tile {
+    uint64_t x = 0;
+    uint64_t y = 0;
+    uint32_t width = 0;
+    uint32_t height = 1;
+
+    uint64_t items() const { return static_cast<uint64_t>(width) * height; }
+};
+
+// How big a tile may get on this device
+struct TileLimits {
+    uint64_t maxWidth = 0;                          // Items one dispatch covers in x
+    uint64_t maxHeight = 0;                         // And in y
+    VkDeviceSize maxBytes = 0;                      // Device memory and staging space one tile may take
+};
+
+// Limits for a kernel with the given workgroup size. image adds the image dimension limit; otherwise the tile has to
+// fit in one storage buffer binding. stagingBytes is the size of the transfer engine's staging rings, and every one of
+// the tilesInFlight tiles needs room in them and in device-local memory. maxTileBytes, if not 0, caps tiles further.
+inline TileLimits queryTileLimits(const ComputeContext& ctx, const WorkgroupSize& workgroupSize, bool image,
+                                  VkDeviceSize stagingBytes, uint32_t tilesInFlight, VkDeviceSize maxTileBytes = 0) {
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(ctx.gpu, &props);
+    const VkPhysicalDeviceLimits& limits = props.limits;
+
+    TileLimits result;
+    result.maxWidth = static_cast<uint64_t>(limits.maxComputeWorkGroupCount[0]) * workgroupSize.x;
+    result.maxHeight = static_cast<uint64_t>(limits.maxComputeWorkGroupCount[1]) * workgroupSize.y;
+
+    if (image) {
+        result.maxWidth = std::min<uint64_t>(result.maxWidth, limits.maxImageDimension2D);
+        result.maxHeight = std::min<uint64_t>(result.maxHeight, limits.maxImageDimension2D);
+    }
+
+    // A quarter of the largest device-local heap is shared by the tiles in flight, which leaves room for everything
+    // else on the device. Each tile is read back (and uploaded) through the staging rings as a whole.
+    const VkPhysicalDeviceMemoryProperties& memProps = ctx.allocator->memoryProperties();
+    VkDeviceSize deviceLocal = 0;
+    for (uint32_t i = 0; i < memProps.memoryHeapCount; ++i)
+        if (memProps.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+            deviceLocal = std::max(deviceLocal, memProps.memoryHeaps[i].size);
+
+    tilesInFlight = std::max(tilesInFlight, 1u);
+    result.maxBytes = std::min(deviceLocal / 4, stagingBytes) / tilesInFlight;
+    if (!image) result.maxBytes = std::min<VkDeviceSize>(result.maxBytes, limits.maxStorageBufferRange);
+    if (maxTileBytes > 0) result.maxBytes = std::min(result.maxBytes, maxTileBytes);
+
+    return result;
+}
+
+// Cuts a width x height job of bytesPerItem items into tiles, left to right and then top to bottom. Tiles are as wide
+// as the limits allow, so as long as a whole row fits, every tile is a band of full rows and lands in one contiguous
+// range of a row-major output.
+inline std::vector<Tile> planTiles(uint64_t width, uint64_t height, uint32_t bytesPerItem, const TileLimits& limits) {
+    if (width == 0 || height == 0) return {};
+    if (limits.maxBytes < bytesPerItem) throw std::runtime_error("Not even one item fits in a tile");
+
+    uint64_t tileWidth = std::min({ width, limits.maxWidth, limits.maxBytes / bytesPerItem,
+                                    static_cast<uint64_t>(UINT32_MAX) });
+    uint64_t tileHeight = std::min({ height, limits.maxHeight, limits.maxBytes / (tileWidth * bytesPerItem),
+                                     static_cast<uint64_t>(UINT32_MAX) });
+
+    std::vector<Tile> tiles;
+    for (uint64_t y = 0; y < height; y += tileHeight) {
+        for (uint64_t x = 0; x < width; x += tileWidth) {
+            Tile tile;
+            tile.x = x;
+            tile.y = y;
+            tile.width = static_cast<uint32_t>(std::min(tileWidth, width - x));
+            tile.height = static_cast<uint32_t>(std::min(tileHeight, height - y));
+            tiles.push_back(tile);
+        }
+    }
+
+    return tiles;
+}
+
+// An output file of a fixed size, mapped into memory so results can be written straight into it and the OS pages
+// them out as it goes. Falls back to a buffer in memory that is written out on close on platforms without mmap.
+class MappedOutputFile {
+public:
+    MappedOutputFile(const std::string& path, uint64_t size) : path(path), fileSize(size) {
+#ifdef _WIN32
+        fallback.resize(size);
+        bytes = fallback.data();
+#else
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) throw std::runtime_error("Failed to create file: " + path);
+
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Failed to size file: " + path);
+        }
+
+        void* mapping = size > 0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : nullptr;
+        if (mapping == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Failed to map file: " + path);
+        }
+
+        bytes = static_cast<uint8_t*>(mapping);
+        if (bytes)
+            file = fd;                                            // Kept open for posix_fadvise() in release()
+        else
+            ::close(fd);
+#endif
+    }
+
+    ~MappedOutputFile() {
+        try {
+            close();
+        } catch (...) {
+        }
+    }
+
+    MappedOutputFile(const MappedOutputFile&) = delete;
+    MappedOutputFile& operator=(const MappedOutputFile&) = delete;
+
+    uint8_t* data() { return bytes; }
+    uint64_t size() const { return fileSize; }
+
+    // Tells the OS [offset, offset + size) won't be touched again: it starts writing the range out, drops it from
+    // this mapping and drops it from the page cache once it's clean, so output far bigger than RAM doesn't crowd
+    // everything else out. Pages shared with a neighbouring range are only unmapped; the next write to them faults
+    // them back in from the page cache with their contents intact.
+    void release(uint64_t offset, uint64_t size) {
+#ifndef _WIN32
+        if (!bytes || size == 0) return;
+
+        const uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        uint64_t begin = offset / page * page;
+        msync(bytes + begin, offset + size - begin, MS_ASYNC);
+        madvise(bytes + begin, offset + size - begin, MADV_DONTNEED);
+        posix_fadvise(file, static_cast<off_t>(begin), static_cast<off_t>(offset + size - begin),
+                      POSIX_FADV_DONTNEED);
+#else
+        (void)offset;
+        (void)size;
+#endif
+    }
+
+    // Writes everything out and unmaps the file. Called by the destructor, but only here do errors get reported.
+    void close() {
+        if (!bytes) return;
+
+#ifdef _WIN32
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(fallback.data()), static_cast<std::streamsize>(fallback.size()));
+        fallback.clear();
+        bytes = nullptr;
+        if (!file) throw std::runtime_error("Failed to write file: " + path);
+#else
+        bool synced = msync(bytes, fileSize, MS_SYNC) == 0;
+        munmap(bytes, fileSize);
+        ::close(file);
+        bytes = nullptr;
+        file = -1;
+        if (!synced) throw std::runtime_error("Failed to write file: " + path);
+#endif
+    }
+
+private:
+    std::string path;
+    uint64_t fileSize;
+    uint8_t* bytes = nullptr;
+    int file = -1;
+    std::vector<uint8_t> fallback;
+};
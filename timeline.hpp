@@ -0,0 +1,129 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <span>
+#include <stdexcept>
+#include <cstdint>
+
+#ifndef VK_CHECK
+#define VK_CHECK(x) do { VkResult err = x; if (err != VK_SUCCESS) throw std::runtime_error("Vulkan error at " #x); } while(0)
+#endif
+
+// A Vulkan 1.2 timeline semaphore used as a submission counter.
+//
+// Every submission that should be tracked signals the value returned by next(), so values grow with submission order
+// and "value >= X" means everything up to submission X has finished. The CPU polls with reached() or blocks with
+// wait(), and other queues wait on a value in their own submissions. Unlike fences, nothing is created per submission
+// and nothing has to be reset, and one counter covers any number of submissions in flight.
+//
+// Values have to be signalled in increasing order, so a timeline should be signalled from one queue only. Waiting is
+// fine from anywhere, including other threads.
+class Timeline {
+public:
+    explicit Timeline(VkDevice device, uint64_t initialValue = 0) : device(device), last(initialValue) {
+        VkSemaphoreTypeCreateInfo typeCI{};
+        typeCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        typeCI.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        typeCI.initialValue = initialValue;
+
+        VkSemaphoreCreateInfo semaphoreCI{};
+        semaphoreCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphoreCI.pNext = &typeCI;
+
+        VK_CHECK(vkCreateSemaphore(device, &semaphoreCI, nullptr, &semaphore));
+    }
+
+    ~Timeline() { vkDestroySemaphore(device, semaphore, nullptr); }
+
+    Timeline(const Timeline&) = delete;
+    Timeline& operator=(const Timeline&) = delete;
+
+    VkSemaphore handle() const { return semaphore; }
+
+    // Hands out the value for the next submission to signal
+    uint64_t next() { return ++last; }
+
+    // Newest value handed out by next(). Waiting for it waits for every submission made so far.
+    uint64_t lastValue() const { return last; }
+
+    // Value the GPU has signalled so far
+    uint64_t completed() const {
+        uint64_t value;
+        VK_CHECK(vkGetSemaphoreCounterValue(device, semaphore, &value));
+        return value;
+    }
+
+    bool reached(uint64_t value) const { return completed() >= value; }
+
+    // Blocks until the timeline reaches value. Returns false if timeoutNs ran out first.
+    bool wait(uint64_t value, uint64_t timeoutNs = UINT64_MAX) const {
+        VkSemaphoreWaitInfo waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &semaphore;
+        waitInfo.pValues = &value;
+
+        VkResult result = vkWaitSemaphores(device, &waitInfo, timeoutNs);
+        if (result == VK_TIMEOUT) return false;
+        VK_CHECK(result);
+        return true;
+    }
+
+private:
+    VkDevice device;
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    uint64_t last;
+};
+
+// A semaphore a submission waits on. value is ignored for binary semaphores, like the swapchain's.
+struct SemaphoreWait {
+    VkSemaphore semaphore;
+    uint64_t value;
+    VkPipelineStageFlags stage;
+};
+
+// A semaphore a submission signals. value is ignored for binary semaphores.
+struct SemaphoreSignal {
+    VkSemaphore semaphore;
+    uint64_t value;
+};
+
+// Submits command buffers that wait on and signal any mix of timeline and binary semaphores
+inline void queueSubmit(VkQueue queue, std::span<const VkCommandBuffer> commandBuffers,
+                        std::span<const SemaphoreWait> waits, std::span<const SemaphoreSignal> signals) {
+    std::vector<VkSemaphore> waitSemaphores, signalSemaphores;
+    std::vector<VkPipelineStageFlags> waitStages;
+    std::vector<uint64_t> waitValues, signalValues;
+
+    for (const auto& wait : waits) {
+        waitSemaphores.push_back(wait.semaphore);
+        waitValues.push_back(wait.value);
+        waitStages.push_back(wait.stage);
+    }
+    for (const auto& signal : signals) {
+        signalSemaphores.push_back(signal.semaphore);
+        signalValues.push_back(signal.value);
+    }
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+    timelineInfo.pWaitSemaphoreValues = waitValues.data();
+    timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+    timelineInfo.pSignalSemaphoreValues = signalValues.data();
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+    submitInfo.pWaitSemaphores = waitSemaphores.data();
+    submitInfo.pWaitDstStageMask = waitStages.data();
+    submitInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+    submitInfo.pCommandBuffers = commandBuffers.data();
+    submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+    submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+    VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+}
@@ -0,0 +1,576 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <utility>
+#include <iterator>
+
+#include "compute_context.hpp"
+#include "timeline.hpp"
+
+// ================================================== Staging Ring ====================================================
+// Host visible buffer that is mapped once and handed out front to back. Positions only ever grow; the offset into
+// the buffer is the position modulo the capacity, and an allocation that would straddle the end starts over at the
+// beginning instead. Space is given back in the order it was taken, by moving the tail up to a position returned by
+// position() earlier.
+//
+// The memory type comes from the usage (Upload or Readback), so it may not be host coherent: flush() what the host
+// wrote and invalidate() what the GPU wrote before the other side looks at it.
+class StagingRing {
+public:
+    StagingRing(GpuAllocator& allocator, VkDeviceSize capacity, VkBufferUsageFlags usage, MemoryUsage memoryUsage)
+        : allocator(allocator), capacity(capacity) {
+        AllocationCreateInfo info{};
+        info.usage = memoryUsage;
+        info.strategy = AllocationStrategy::Dedicated;
+
+        buffer = allocator.createBuffer(capacity, usage, info);
+        mapped = static_cast<uint8_t*>(buffer->allocation.mapped);
+    }
+
+    ~StagingRing() { allocator.destroyBuffer(buffer); }
+
+    StagingRing(const StagingRing&) = delete;
+    StagingRing& operator=(const StagingRing&) = delete;
+
+    // Reserves size bytes and returns the offset into the buffer, or false if the ring doesn't have room right now
+    bool allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset) {
+        if (size > capacity) throw std::runtime_error("Transfer of " + std::to_string(size) +
+                                                      " bytes is larger than the staging ring");
+
+        uint64_t start = alignUp(head, alignment);
+        if (start % capacity + size > capacity) start = alignUp(start, capacity);     // Wrap around
+        if (start + size - tail > capacity) return false;
+
+        head = start + size;
+        offset = start % capacity;
+        return true;
+    }
+
+    // Gives back everything allocated before the given position()
+    void release(uint64_t position) { tail = position; }
+
+    uint64_t position() const { return head; }
+
+    VkBuffer handle() const { return buffer->buffer; }
+    uint8_t* data(VkDeviceSize offset) const { return mapped + offset; }
+
+    void flush(VkDeviceSize offset, VkDeviceSize size) const { allocator.flush(buffer->allocation, offset, size); }
+    void invalidate(VkDeviceSize offset, VkDeviceSize size) const {
+        allocator.invalidate(buffer->allocation, offset, size);
+    }
+
+private:
+    GpuAllocator& allocator;
+    GpuBuffer* buffer = nullptr;
+    uint8_t* mapped = nullptr;
+    VkDeviceSize capacity;
+    uint64_t head = 0;
+    uint64_t tail = 0;
+};
+
+// ================================================= Transfer Engine ==================================================
+// GPU time of the transfer engine's batches, measured with timestamps. Busy time is the union of every timed batch,
+// so the part of the upload, compute and readback time that doesn't show up in it ran at the same time as something
+// else. Timestamps from different queues are compared directly, which assumes the device has one timestamp clock.
+struct TransferTimings {
+    uint32_t jobs = 0;                              // Jobs that were timed
+    double uploadMs = 0.0;
+    double computeMs = 0.0;
+    double readbackMs = 0.0;
+    double busyMs = 0.0;                            // Time at least one timed batch was running
+
+    // Fraction of the batches' time saved by running them at the same time, 0 if they ran one after another
+    double overlap() const {
+        double serial = uploadMs + computeMs + readbackMs;
+        return serial > 0.0 ? 1.0 - busyMs / serial : 0.0;
+    }
+};
+
+// Moves data between the host and device-local buffers through two staging rings, one for uploads and one for
+// readbacks, on the dedicated transfer queue when the device has one.
+//
+// Work is organised in jobs. A job is some uploads, a compute command buffer that uses them and some readbacks of its
+// results, submitted as up to three batches chained through timeline semaphores:
+//
+//   transfer queue:  [upload N+1]  [readback N-1]
+//   compute queue:   [compute N                 ]
+//
+// Queues may start their batches strictly in submission order, so what can overlap depends on the order they are
+// submitted in. A readback waits for its job's compute, and an upload queued behind it would wait for that compute
+// too. So a job's readback is held back until the next job's upload has been submitted, and the transfer queue sees
+// upload N, readback N-1, upload N+1, readback N: while compute N runs, readback N-1 and upload N+1 can. If the
+// transfer family has a second queue (see QueueTopology::readback), readbacks go there and are submitted right away.
+// poll() and waitFor() submit a held readback themselves when no next job comes along.
+//
+// When the transfer queue belongs to another family than the compute queue, the engine records the queue family
+// ownership transfers for the buffers it copies. Buffers used by one job must not be used by another job that is
+// still in flight.
+//
+// Uploads, compute batches and readbacks each signal a timeline of their own, in the order they are submitted, and
+// the job remembers the value on each. A job is done once all three have reached them, so no fences or binary
+// semaphores are created, reset or recycled. Jobs retire in submission order. Retiring copies readback data to its
+// host destination and gives the staging space back; it happens in poll() and waitFor(), or when a ring runs out of
+// room and has to wait for the oldest job.
+//
+// Where both queue families write timestamps and query pools can be reset from the host, the batches of up to
+// TIMED_JOBS jobs in flight are timed, and timings() says how much they actually overlapped.
+class TransferEngine {
+public:
+    static constexpr VkDeviceSize DEFAULT_STAGING_SIZE = 32ull << 20;
+
+    // Jobs in flight that can be timed at once. Jobs beyond that run untimed.
+    static constexpr uint32_t TIMED_JOBS = 16;
+
+    class Job;
+
+    explicit TransferEngine(const ComputeContext& ctx, VkDeviceSize stagingSize = DEFAULT_STAGING_SIZE)
+        : ctx(ctx),
+          uploadRing(*ctx.allocator, stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryUsage::Upload),
+          readbackRing(*ctx.allocator, stagingSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, MemoryUsage::Readback),
+          uploadTimeline(ctx.device),
+          computeTimeline(ctx.device),
+          readbackTimeline(ctx.device) {
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(ctx.gpu, &props);
+        copyAlignment = std::max<VkDeviceSize>(props.limits.optimalBufferCopyOffsetAlignment, 16);
+
+        // Command buffers are allocated per job and freed when it retires
+        VkCommandPoolCreateInfo poolCI{};
+        poolCI.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolCI.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+        poolCI.queueFamilyIndex = ctx.transferIndex;
+        VK_CHECK(vkCreateCommandPool(ctx.device, &poolCI, nullptr, &transferPool));
+
+        poolCI.queueFamilyIndex = ctx.computeIndex;
+        VK_CHECK(vkCreateCommandPool(ctx.device, &poolCI, nullptr, &computePool));
+
+        // Transfer queues can't reset query pools in a command buffer, so the host does it
+        uint32_t validBits = std::min(ctx.topology.families[ctx.transferIndex].timestampValidBits,
+                                      ctx.topology.families[ctx.computeIndex].timestampValidBits);
+        if (ctx.hostQueryReset && validBits > 0) {
+            timestampPeriod = props.limits.timestampPeriod;
+            timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+            VkQueryPoolCreateInfo queryCI{};
+            queryCI.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryCI.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryCI.queryCount = TIMED_JOBS * QUERIES_PER_JOB;
+            VK_CHECK(vkCreateQueryPool(ctx.device, &queryCI, nullptr, &timestampPool));
+            vkResetQueryPool(ctx.device, timestampPool, 0, queryCI.queryCount);
+
+            for (uint32_t slot = 0; slot < TIMED_JOBS; ++slot) freeTimingSlots.push_back(slot);
+        }
+    }
+
+    ~TransferEngine() {
+        waitFor(nextId - 1);
+
+        if (timestampPool) vkDestroyQueryPool(ctx.device, timestampPool, nullptr);
+        vkDestroyCommandPool(ctx.device, transferPool, nullptr);
+        vkDestroyCommandPool(ctx.device, computePool, nullptr);
+    }
+
+    TransferEngine(const TransferEngine&) = delete;
+    TransferEngine& operator=(const TransferEngine&) = delete;
+
+    // True if transfers run on their own queue family, in parallel with compute
+    bool hasDedicatedQueue() const { return ctx.transferIndex != ctx.computeIndex; }
+
+    // True if readbacks have a queue of their own instead of queueing up behind uploads
+    bool hasReadbackQueue() const { return ctx.readbackQueue != ctx.transferQueue; }
+
+    // Starts a new job. The pointer stays valid until the job is submitted.
+    Job* beginJob() {
+        recording = std::make_unique<Job>();
+        recording->id = nextId++;
+
+        if (!freeTimingSlots.empty()) {
+            recording->timingSlot = freeTimingSlots.back();
+            freeTimingSlots.pop_back();
+        }
+        return recording.get();
+    }
+
+    // Copies size bytes of host data into a device buffer. The data is copied into the staging ring right away, so
+    // it can be reused as soon as this returns. All uploads must come before computeCommands().
+    void upload(Job* job, const GpuBuffer* dst, const void* data, VkDeviceSize size, VkDeviceSize dstOffset = 0) {
+        if (job->compute) throw std::runtime_error("Uploads must be recorded before the compute commands");
+
+        VkDeviceSize offset = stage(uploadRing, size);
+        std::memcpy(uploadRing.data(offset), data, size);
+        uploadRing.flush(offset, size);
+
+        if (!job->upload) {
+            job->upload = begin(transferPool);
+            timestamp(*job, job->upload, UPLOAD_BATCH, false);
+        }
+
+        VkBufferCopy region{ offset, dstOffset, size };
+        vkCmdCopyBuffer(job->upload, uploadRing.handle(), dst->buffer, 1, &region);
+
+        if (hasDedicatedQueue()) {
+            // Release to the compute queue; the matching acquire is recorded by computeCommands()
+            VkBufferMemoryBarrier release = ownershipBarrier(dst->buffer, dstOffset, size, ctx.transferIndex,
+                                                             ctx.computeIndex);
+            release.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            vkCmdPipelineBarrier(job->upload, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                 0, 0, nullptr, 1, &release, 0, nullptr);
+            job->acquires.push_back(release);
+        }
+    }
+
+    // Returns the job's compute command buffer, recording the acquire side of the upload ownership transfers the
+    // first time. Record dispatches into it, but don't end or submit it.
+    VkCommandBuffer computeCommands(Job* job) {
+        if (job->compute) return job->compute;
+
+        job->compute = begin(computePool);
+        timestamp(*job, job->compute, COMPUTE_BATCH, false);
+
+        if (!job->acquires.empty()) {
+            for (auto& acquire : job->acquires) {
+                acquire.srcAccessMask = 0;
+                acquire.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            }
+            vkCmdPipelineBarrier(job->compute, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr,
+                                 static_cast<uint32_t>(job->acquires.size()), job->acquires.data(), 0, nullptr);
+        }
+
+        return job->compute;
+    }
+
+    // Copies size bytes of a device buffer, as left by the job's compute commands, to hostDst. hostDst is written
+    // when the job retires and must stay valid until then. Call this after recording the dispatches. srcStage and
+    // srcAccess say how the compute commands last wrote the buffer, for buffers filled by a copy rather than a shader.
+    void readback(Job* job, const GpuBuffer* src, void* hostDst, VkDeviceSize size, VkDeviceSize srcOffset = 0,
+                  VkPipelineStageFlags srcStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                  VkAccessFlags srcAccess = VK_ACCESS_SHADER_WRITE_BIT) {
+        VkCommandBuffer compute = computeCommands(job);
+        VkDeviceSize offset = stage(readbackRing, size);
+
+        if (!job->readback) {
+            job->readback = begin(transferPool);
+            timestamp(*job, job->readback, READBACK_BATCH, false);
+        }
+
+        if (hasDedicatedQueue()) {
+            // Release from the compute queue at the end of the compute commands, acquire on the transfer queue
+            VkBufferMemoryBarrier ownership = ownershipBarrier(src->buffer, srcOffset, size, ctx.computeIndex,
+                                                               ctx.transferIndex);
+            ownership.srcAccessMask = srcAccess;
+            vkCmdPipelineBarrier(compute, srcStage, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1,
+                                 &ownership, 0, nullptr);
+
+            ownership.srcAccessMask = 0;
+            ownership.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            vkCmdPipelineBarrier(job->readback, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 0, 0, nullptr, 1, &ownership, 0, nullptr);
+        }
+
+        VkBufferCopy region{ srcOffset, offset, size };
+        vkCmdCopyBuffer(job->readback, src->buffer, readbackRing.handle(), 1, &region);
+
+        job->destinations.push_back({ offset, hostDst, size });
+    }
+
+    // Submits the job and returns its id. The job pointer must not be used afterwards.
+    uint64_t submit(Job* job) {
+        if (job != recording.get()) throw std::runtime_error("Submitting a job that isn't being recorded");
+
+        if (job->readback) {
+            // The staging data has to be visible to the host once the timeline reaches the readback
+            VkMemoryBarrier toHost{};
+            toHost.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            toHost.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+            vkCmdPipelineBarrier(job->readback, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                                 1, &toHost, 0, nullptr, 0, nullptr);
+        }
+
+        // Each batch waits for the value the batch before it in the job signals. A job with nothing in it signals
+        // nothing and retires as soon as the jobs before it have.
+        if (job->upload) {
+            job->uploadValue = uploadTimeline.next();
+            submitBatch(*job, ctx.transferQueue, job->upload, UPLOAD_BATCH, {}, uploadTimeline, job->uploadValue);
+        }
+
+        // The last job's readback goes in behind this upload, not in front of it
+        submitHeldReadback();
+
+        if (job->compute) {
+            SemaphoreWait wait{ uploadTimeline.handle(), job->uploadValue, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT };
+            job->computeValue = computeTimeline.next();
+            submitBatch(*job, ctx.queue, job->compute, COMPUTE_BATCH,
+                        job->uploadValue ? std::span(&wait, 1) : std::span<SemaphoreWait>(), computeTimeline,
+                        job->computeValue);
+        }
+
+        job->uploadEnd = uploadRing.position();
+        job->readbackEnd = readbackRing.position();
+
+        uint64_t id = job->id;
+        inFlight.push_back(std::move(recording));
+
+        if (job->readback) {
+            if (hasReadbackQueue())
+                submitReadback(*job);
+            else
+                held = job;
+        }
+        return id;
+    }
+
+    // Retires every job that has finished, without waiting. Returns the id of the newest retired job, or 0.
+    uint64_t poll() {
+        // Without a next job to push it out, a held readback goes once there's nothing left for it to wait for
+        if (held && computeTimeline.reached(held->computeValue)) submitHeldReadback();
+
+        while (!inFlight.empty() && finished(*inFlight.front())) retireFront();
+        return completed;
+    }
+
+    // Blocks until the job with the given id (and every job before it) has retired
+    void waitFor(uint64_t id) {
+        while (completed < id && !inFlight.empty()) {
+            Job& front = *inFlight.front();
+            if (held == &front) submitHeldReadback();
+
+            uploadTimeline.wait(front.uploadValue);
+            computeTimeline.wait(front.computeValue);
+            readbackTimeline.wait(front.readbackValue);
+            retireFront();
+        }
+    }
+
+    // Id of the newest job that has retired, 0 if none has
+    uint64_t completedId() const { return completed; }
+
+    // True if batches are being timed (see TransferTimings)
+    bool timed() const { return timestampPool != VK_NULL_HANDLE; }
+
+    // Timings of the retired jobs that were timed
+    TransferTimings timings() const {
+        TransferTimings result = totals;
+
+        uint64_t busyTicks = foldedTicks;
+        for (const auto& [first, last] : busy) busyTicks += last - first;
+
+        result.busyMs = static_cast<double>(busyTicks) * timestampPeriod / 1e6;
+        return result;
+    }
+
+    class Job {
+        friend class TransferEngine;
+
+        struct Destination {
+            VkDeviceSize offset;
+            void* host;
+            VkDeviceSize size;
+        };
+
+        uint64_t id = 0;
+        VkCommandBuffer upload = VK_NULL_HANDLE;
+        VkCommandBuffer compute = VK_NULL_HANDLE;
+        VkCommandBuffer readback = VK_NULL_HANDLE;
+        std::vector<VkBufferMemoryBarrier> acquires;
+        std::vector<Destination> destinations;
+        uint64_t uploadValue = 0;                   // Timeline values the job's batches signal, 0 if it has none
+        uint64_t computeValue = 0;
+        uint64_t readbackValue = 0;
+        uint64_t uploadEnd = 0;                     // Ring positions to release up to when the job retires
+        uint64_t readbackEnd = 0;
+        uint32_t timingSlot = UINT32_MAX;           // Where its timestamps go, UINT32_MAX if it isn't timed
+    };
+
+private:
+    // Batches of a job, in the order of their timestamp queries
+    static constexpr uint32_t UPLOAD_BATCH = 0;
+    static constexpr uint32_t COMPUTE_BATCH = 1;
+    static constexpr uint32_t READBACK_BATCH = 2;
+    static constexpr uint32_t QUERIES_PER_JOB = 6;
+    // Disjoint busy intervals kept apart before the oldest is folded into foldedTicks. Batches of the jobs that can
+    // be timed at once fit, so only batches that long finished get folded.
+    static constexpr size_t MAX_BUSY_INTERVALS = TIMED_JOBS * 3;
+
+    // Reserves staging space, retiring old jobs (and waiting for them if necessary) until there is room
+    VkDeviceSize stage(StagingRing& ring, VkDeviceSize size) {
+        VkDeviceSize offset;
+        while (!ring.allocate(size, copyAlignment, offset)) {
+            if (inFlight.empty())
+                throw std::runtime_error("A single job needs more staging space than the ring has");
+            waitFor(inFlight.front()->id);
+        }
+        return offset;
+    }
+
+    bool finished(const Job& job) const {
+        return &job != held && uploadTimeline.reached(job.uploadValue) &&
+               computeTimeline.reached(job.computeValue) && readbackTimeline.reached(job.readbackValue);
+    }
+
+    void submitReadback(Job& job) {
+        SemaphoreWait wait{ computeTimeline.handle(), job.computeValue, VK_PIPELINE_STAGE_TRANSFER_BIT };
+        job.readbackValue = readbackTimeline.next();
+        submitBatch(job, ctx.readbackQueue, job.readback, READBACK_BATCH, { &wait, 1 }, readbackTimeline,
+                    job.readbackValue);
+    }
+
+    void submitHeldReadback() {
+        if (!held) return;
+        submitReadback(*held);
+        held = nullptr;
+    }
+
+    void retireFront() {
+        std::unique_ptr<Job> job = std::move(inFlight.front());
+        inFlight.pop_front();
+
+        for (const auto& destination : job->destinations) {
+            readbackRing.invalidate(destination.offset, destination.size);
+            std::memcpy(destination.host, readbackRing.data(destination.offset), destination.size);
+        }
+
+        uploadRing.release(job->uploadEnd);
+        readbackRing.release(job->readbackEnd);
+
+        if (job->timingSlot != UINT32_MAX) collectTimings(*job);
+        if (job->compute) markDispatchFinished(ctx);
+
+        if (job->upload) vkFreeCommandBuffers(ctx.device, transferPool, 1, &job->upload);
+        if (job->readback) vkFreeCommandBuffers(ctx.device, transferPool, 1, &job->readback);
+        if (job->compute) vkFreeCommandBuffers(ctx.device, computePool, 1, &job->compute);
+
+        completed = job->id;
+    }
+
+    // Writes the begin or end timestamp of one of the job's batches, if the job is timed
+    void timestamp(const Job& job, VkCommandBuffer cmdBuf, uint32_t batch, bool end) {
+        if (job.timingSlot == UINT32_MAX) return;
+
+        vkCmdWriteTimestamp(cmdBuf, end ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                            timestampPool, job.timingSlot * QUERIES_PER_JOB + batch * 2 + (end ? 1 : 0));
+    }
+
+    // Adds a retired job's batch times to the totals and gives its queries back
+    void collectTimings(const Job& job) {
+        const uint32_t first = job.timingSlot * QUERIES_PER_JOB;
+        double* totalsMs[] = { &totals.uploadMs, &totals.computeMs, &totals.readbackMs };
+        const VkCommandBuffer batches[] = { job.upload, job.compute, job.readback };
+
+        for (uint32_t batch = 0; batch < 3; ++batch) {
+            if (!batches[batch]) continue;
+
+            uint64_t ticks[2];
+            VK_CHECK(vkGetQueryPoolResults(ctx.device, timestampPool, first + batch * 2, 2, sizeof(ticks), ticks,
+                                           sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+
+            uint64_t started = ticks[0] & timestampMask;
+            uint64_t ended = ticks[1] & timestampMask;
+            *totalsMs[batch] += static_cast<double>((ended - started) & timestampMask) * timestampPeriod / 1e6;
+            addBusy(started, std::max(started, ended));
+        }
+
+        ++totals.jobs;
+        vkResetQueryPool(ctx.device, timestampPool, first, QUERIES_PER_JOB);
+        freeTimingSlots.push_back(job.timingSlot);
+    }
+
+    // Merges a batch's ticks into the busy intervals. Once there are more than MAX_BUSY_INTERVALS, the oldest is added
+    // to foldedTicks and dropped, so a long run keeps a fixed number of them. A batch that started before the end of
+    // a folded interval only counts from there on.
+    void addBusy(uint64_t started, uint64_t ended) {
+        started = std::max(started, foldedEnd);
+        if (ended <= started) return;
+
+        // The first interval that doesn't end before this one starts, and the first that starts after it ends
+        auto first = std::lower_bound(busy.begin(), busy.end(), started,
+                                      [](const auto& interval, uint64_t tick) { return interval.second < tick; });
+        auto last = std::upper_bound(first, busy.end(), ended,
+                                     [](uint64_t tick, const auto& interval) { return tick < interval.first; });
+        if (first != last) {
+            started = std::min(started, first->first);
+            ended = std::max(ended, std::prev(last)->second);
+        }
+        busy.insert(busy.erase(first, last), { started, ended });
+
+        while (busy.size() > MAX_BUSY_INTERVALS) {
+            foldedTicks += busy.front().second - busy.front().first;
+            foldedEnd = busy.front().second;
+            busy.erase(busy.begin());
+        }
+    }
+
+    VkCommandBuffer begin(VkCommandPool pool) {
+        VkCommandBufferAllocateInfo cmdBufAI{};
+        cmdBufAI.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        cmdBufAI.commandPool = pool;
+        cmdBufAI.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        cmdBufAI.commandBufferCount = 1;
+
+        VkCommandBuffer cmdBuf;
+        VK_CHECK(vkAllocateCommandBuffers(ctx.device, &cmdBufAI, &cmdBuf));
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VK_CHECK(vkBeginCommandBuffer(cmdBuf, &beginInfo));
+        return cmdBuf;
+    }
+
+    void submitBatch(const Job& job, VkQueue queue, VkCommandBuffer cmdBuf, uint32_t batch,
+                     std::span<const SemaphoreWait> waits, const Timeline& timeline, uint64_t value) {
+        timestamp(job, cmdBuf, batch, true);
+        VK_CHECK(vkEndCommandBuffer(cmdBuf));
+
+        SemaphoreSignal signal{ timeline.handle(), value };
+        queueSubmit(queue, { &cmdBuf, 1 }, waits, { &signal, 1 });
+    }
+
+    static VkBufferMemoryBarrier ownershipBarrier(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+                                                  uint32_t srcFamily, uint32_t dstFamily) {
+        VkBufferMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcQueueFamilyIndex = srcFamily;
+        barrier.dstQueueFamilyIndex = dstFamily;
+        barrier.buffer = buffer;
+        barrier.offset = offset;
+        barrier.size = size;
+        return barrier;
+    }
+
+    const ComputeContext& ctx;
+    StagingRing uploadRing;
+    StagingRing readbackRing;
+    VkDeviceSize copyAlignment = 16;
+    VkCommandPool transferPool = VK_NULL_HANDLE;
+    VkCommandPool computePool = VK_NULL_HANDLE;
+    Timeline uploadTimeline;                        // Signalled by upload batches, in submission order
+    Timeline computeTimeline;                       // Signalled by compute batches
+    Timeline readbackTimeline;                      // Signalled by readback batches
+
+    std::unique_ptr<Job> recording;
+    std::deque<std::unique_ptr<Job>> inFlight;
+    Job* held = nullptr;                            // Newest job, if its readback waits for the next upload
+    uint64_t nextId = 1;
+    uint64_t completed = 0;
+
+    VkQueryPool timestampPool = VK_NULL_HANDLE;     // QUERIES_PER_JOB timestamps per timed job
+    std::vector<uint32_t> freeTimingSlots;
+    float timestampPeriod = 1.0f;                   // Nanoseconds per timestamp tick
+    uint64_t timestampMask = ~0ull;
+    TransferTimings totals;
+    std::vector<std::pair<uint64_t, uint64_t>> busy;        // Disjoint begin and end ticks, sorted, see addBusy()
+    uint64_t foldedTicks = 0;                               // Busy ticks of the intervals dropped from busy
+    uint64_t foldedEnd = 0;                                 // End of the newest of them
+};
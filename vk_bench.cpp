@@ -0,0 +1,821 @@
+#include <vulkan/vulkan.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <functional>
+#include <chrono>
+#include <ctime>
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+
+#include "compute_context.hpp"
+#include "shader_loader.hpp"
+#include "kernel.hpp"
+#include "device_select.hpp"
+#include "primitives.hpp"
+#include "frame_graph.hpp"
+#include "precision.hpp"
+
+// Benchmark suite for the compute path: context creation, time to first dispatch, shader module and pipeline creation
+// (cold and cached), submit and dispatch latency, descriptor updates, host <-> device bandwidth per memory type, image
+// kernel throughput and parallel primitive throughput. Every benchmark runs a few warmup repetitions and then
+// --repetitions timed ones, and the samples and their statistics are written to a JSON file, so runs can be compared
+// across devices and driver upgrades.
+//
+// Nothing needs a hardware GPU: --device llvmpipe (or VULKAN_DEVICE=llvmpipe) runs the suite on lavapipe. Mesa
+// drivers keep an on-disk shader cache of their own, so "cold" pipelines are only cold with
+// MESA_SHADER_CACHE_DISABLE=true.
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions {
+    uint32_t repetitions = 10;
+    uint32_t warmup = 2;                            // Untimed repetitions before the timed ones
+    std::string output = "vk_bench.json";
+    std::string device;                             // Device index, UUID or name, as for main
+    std::string filter;                             // Only run benchmarks whose name contains this
+    uint32_t imageSize = 2048;                      // Width and height of the image kernel benchmark
+    uint32_t transferMiB = 64;                      // Size of each bandwidth benchmark copy
+    uint32_t dispatches = 1000;                     // Dispatches per sample of the dispatch throughput benchmark
+    uint32_t primitiveCount = 1u << 24;             // Values per parallel primitive benchmark
+};
+
+double elapsedMs(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Swallows std::cout while it lives. Context creation logs the device it picked, which would drown the results when
+// it runs hundreds of times.
+class QuietStdout {
+public:
+    QuietStdout() : previous(std::cout.rdbuf(&sink)) {}
+    ~QuietStdout() { std::cout.rdbuf(previous); }
+
+private:
+    struct NullBuffer : std::streambuf {
+        int overflow(int c) override { return c; }
+    };
+
+    NullBuffer sink;
+    std::streambuf* previous;
+};
+
+// ===================================================== Results ======================================================
+// What a result was measured with, e.g. the memory type or image size. Written to the JSON as strings.
+using BenchParams = std::vector<std::pair<std::string, std::string>>;
+
+struct BenchResult {
+    std::string name;
+    std::string unit;
+    bool higherIsBetter = false;                    // Throughputs go up when things get better, latencies down
+    BenchParams params;
+    std::vector<double> samples;
+
+    double min() const { return *std::min_element(samples.begin(), samples.end()); }
+    double max() const { return *std::max_element(samples.begin(), samples.end()); }
+    double mean() const { return std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size(); }
+
+    double stddev() const {
+        if (samples.size() < 2) return 0.0;
+        double m = mean(), sum = 0.0;
+        for (double sample : samples) sum += (sample - m) * (sample - m);
+        return std::sqrt(sum / static_cast<double>(samples.size() - 1));
+    }
+
+    // Nearest-rank percentile, p in [0, 100]
+    double percentile(double p) const {
+        std::vector<double> sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * static_cast<double>(sorted.size())));
+        return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+    }
+};
+
+// Runs benchmarks and collects their results. A benchmark is a function that does one repetition and returns its
+// sample; it is called warmup times without recording anything first.
+class Suite {
+public:
+    explicit Suite(const BenchOptions& opts) : opts(opts) {}
+
+    bool enabled(const std::string& name) const {
+        return opts.filter.empty() || name.find(opts.filter) != std::string::npos;
+    }
+
+    void run(const std::string& name, const std::string& unit, bool higherIsBetter, BenchParams params,
+             const std::function<double()>& repetition) {
+        if (!enabled(name)) return;
+
+        BenchResult result{ name, unit, higherIsBetter, std::move(params), {} };
+
+        for (uint32_t i = 0; i < opts.warmup; ++i) repetition();
+        for (uint32_t i = 0; i < opts.repetitions; ++i) result.samples.push_back(repetition());
+
+        std::cout << "  " << result.name << ": " << result.percentile(50) << " " << result.unit << " (min "
+                  << result.min() << ", max " << result.max() << ", stddev " << result.stddev() << ")\n";
+        results.push_back(std::move(result));
+    }
+
+    const std::vector<BenchResult>& all() const { return results; }
+
+private:
+    const BenchOptions& opts;
+    std::vector<BenchResult> results;
+};
+
+std::string jsonString(const std::string& text) {
+    std::ostringstream out;
+    out << '"';
+    for (char c : text) {
+        switch (c) {
+            case '"':  out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            case '\t': out << "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) out << "\\u00" << std::hex << std::setw(2)
+                                                              << std::setfill('0') << static_cast<int>(c) << std::dec;
+                else out << c;
+        }
+    }
+    out << '"';
+    return out.str();
+}
+
+const char* deviceTypeName(VkPhysicalDeviceType type) {
+    switch (type) {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:   return "discrete";
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated";
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:    return "virtual";
+        case VK_PHYSICAL_DEVICE_TYPE_CPU:            return "cpu";
+        default:                                     return "other";
+    }
+}
+
+// Writes the device, the settings and every result with its samples and statistics
+void writeJson(const std::string& path, const ComputeContext& ctx, const BenchOptions& opts,
+               const std::vector<BenchResult>& results) {
+    VkPhysicalDeviceDriverProperties driverProps{};
+    driverProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DRIVER_PROPERTIES;
+
+    VkPhysicalDeviceIDProperties idProps{};
+    idProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+    idProps.pNext = &driverProps;
+
+    VkPhysicalDeviceProperties2 props{};
+    props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    props.pNext = &idProps;
+    vkGetPhysicalDeviceProperties2(ctx.gpu, &props);
+
+    const VkPhysicalDeviceProperties& properties = props.properties;
+    std::string apiVersion = std::to_string(VK_API_VERSION_MAJOR(properties.apiVersion)) + "." +
+                             std::to_string(VK_API_VERSION_MINOR(properties.apiVersion)) + "." +
+                             std::to_string(VK_API_VERSION_PATCH(properties.apiVersion));
+
+    char timestamp[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    std::ofstream file(path);
+    if (!file.is_open()) throw std::runtime_error("Failed to open file: " + path);
+    file.precision(9);
+
+    file << "{\n"
+         << "  \"schema\": 1,\n"
+         << "  \"timestamp\": " << jsonString(timestamp) << ",\n"
+         << "  \"device\": {\n"
+         << "    \"name\": " << jsonString(properties.deviceName) << ",\n"
+         << "    \"type\": " << jsonString(deviceTypeName(properties.deviceType)) << ",\n"
+         << "    \"uuid\": " << jsonString(uuidString(idProps.deviceUUID)) << ",\n"
+         << "    \"vendorId\": " << properties.vendorID << ",\n"
+         << "    \"deviceId\": " << properties.deviceID << ",\n"
+         << "    \"apiVersion\": " << jsonString(apiVersion) << ",\n"
+         << "    \"driverVersion\": " << properties.driverVersion << ",\n"
+         << "    \"driverName\": " << jsonString(driverProps.driverName) << ",\n"
+         << "    \"driverInfo\": " << jsonString(driverProps.driverInfo) << "\n"
+         << "  },\n"
+         << "  \"repetitions\": " << opts.repetitions << ",\n"
+         << "  \"warmup\": " << opts.warmup << ",\n"
+         << "  \"benchmarks\": [";
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& result = results[i];
+        file << (i ? ",\n" : "\n") << "    {\n"
+             << "      \"name\": " << jsonString(result.name) << ",\n"
+             << "      \"unit\": " << jsonString(result.unit) << ",\n"
+             << "      \"better\": " << jsonString(result.higherIsBetter ? "higher" : "lower") << ",\n"
+             << "      \"params\": {";
+        for (size_t p = 0; p < result.params.size(); ++p)
+            file << (p ? ", " : "") << jsonString(result.params[p].first) << ": "
+                 << jsonString(result.params[p].second);
+        file << "},\n"
+             << "      \"min\": " << result.min() << ",\n"
+             << "      \"max\": " << result.max() << ",\n"
+             << "      \"mean\": " << result.mean() << ",\n"
+             << "      \"median\": " << result.percentile(50) << ",\n"
+             << "      \"p90\": " << result.percentile(90) << ",\n"
+             << "      \"stddev\": " << result.stddev() << ",\n"
+             << "      \"samples\": [";
+        for (size_t s = 0; s < result.samples.size(); ++s) file << (s ? ", " : "") << result.samples[s];
+        file << "]\n    }";
+    }
+
+    file << "\n  ]\n}\n";
+    if (!file) throw std::runtime_error("Failed to write file: " + path);
+}
+
+// ===================================================== Helpers ======================================================
+// Kernels the creation benchmarks build, with the layouts main.cpp gives them
+struct KernelSpec {
+    const char* name;
+    VkDescriptorType binding;
+    uint32_t pushConstantSize;
+    WorkgroupSize workgroupSize;
+};
+
+constexpr KernelSpec KERNELS[] = {
+    { "squares.comp", VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2 * sizeof(uint32_t), { 64, 1, 1 } },
+    { "gradient.comp", VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 4 * sizeof(int32_t), { 16, 16, 1 } },
+    { "shader.comp", VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 4 * sizeof(int32_t), { 16, 16, 1 } },
+};
+
+ComputeKernel createBenchKernel(const ComputeContext& ctx, const KernelSpec& spec) {
+    return createKernel(ctx, loadShader(spec.name).span(), { spec.binding }, spec.pushConstantSize,
+                        spec.workgroupSize);
+}
+
+// A descriptor pool with one set of the kernel's layout
+VkDescriptorSet allocateDescriptorSet(const ComputeContext& ctx, const ComputeKernel& kernel, VkDescriptorType type,
+                                      VkDescriptorPool& pool) {
+    VkDescriptorPoolSize poolSize{ type, 1 };
+
+    VkDescriptorPoolCreateInfo poolCI{};
+    poolCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolCI.maxSets = 1;
+    poolCI.poolSizeCount = 1;
+    poolCI.pPoolSizes = &poolSize;
+    VK_CHECK(vkCreateDescriptorPool(ctx.device, &poolCI, nullptr, &pool));
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = pool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &kernel.setLayout;
+
+    VkDescriptorSet set;
+    VK_CHECK(vkAllocateDescriptorSets(ctx.device, &allocInfo, &set));
+    return set;
+}
+
+VkWriteDescriptorSet bufferWrite(VkDescriptorSet set, const VkDescriptorBufferInfo* info) {
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = set;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = info;
+    return write;
+}
+
+// A buffer placed in one particular memory type, which GpuAllocator::createBuffer can't be asked for
+struct TypedBuffer {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    GpuAllocation allocation;
+};
+
+// Returns false if the buffer can't live in that type or the type is out of memory
+bool createBufferInType(const ComputeContext& ctx, VkDeviceSize size, uint32_t type, TypedBuffer& result) {
+    VkBufferCreateInfo bufferCI{};
+    bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCI.size = size;
+    bufferCI.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VK_CHECK(vkCreateBuffer(ctx.device, &bufferCI, nullptr, &result.buffer));
+
+    VkMemoryRequirements req;
+    vkGetBufferMemoryRequirements(ctx.device, result.buffer, &req);
+    req.memoryTypeBits &= 1u << type;
+
+    AllocationCreateInfo info{};
+    info.strategy = AllocationStrategy::Dedicated;
+
+    try {
+        if (req.memoryTypeBits == 0) throw std::runtime_error("Buffers can't use this memory type");
+        result.allocation = ctx.allocator->allocate(req, info);
+    } catch (const std::exception&) {
+        vkDestroyBuffer(ctx.device, result.buffer, nullptr);
+        result.buffer = VK_NULL_HANDLE;
+        return false;
+    }
+
+    VK_CHECK(vkBindBufferMemory(ctx.device, result.buffer, result.allocation.memory, result.allocation.offset));
+    return true;
+}
+
+void destroyTypedBuffer(const ComputeContext& ctx, TypedBuffer& buffer) {
+    vkDestroyBuffer(ctx.device, buffer.buffer, nullptr);
+    ctx.allocator->free(buffer.allocation);
+}
+
+// Copies size bytes between two buffers on the compute queue and waits, returning GB/s
+double timedCopy(const ComputeContext& ctx, VkBuffer src, VkBuffer dst, VkDeviceSize size) {
+    auto start = Clock::now();
+    VkCommandBuffer cmdBuf = beginCommands(ctx);
+    VkBufferCopy region{ 0, 0, size };
+    vkCmdCopyBuffer(cmdBuf, src, dst, 1, &region);
+    submitAndWait(ctx, cmdBuf);
+    return static_cast<double>(size) / (elapsedMs(start) * 1e6);
+}
+
+// ==================================================== Benchmarks ====================================================
+// Instance, device, queues, allocator and pipeline cache: everything createContext() does, and then everything up to
+// the first dispatch
+void benchContext(Suite& suite, const BenchOptions& opts) {
+    suite.run("context_create", "ms", false, {}, [&] {
+        QuietStdout quiet;
+        auto start = Clock::now();
+        ComputeContext ctx = createContext("", opts.device);
+        double ms = elapsedMs(start);
+        destroyContext(ctx);
+        return ms;
+    });
+
+    // From nothing to the first finished dispatch: the context, a kernel from a cold process, a descriptor set and
+    // one squares.comp dispatch over zero elements. What a short-lived compute tool pays before its first result.
+    suite.run("time_to_first_dispatch", "ms", false, {}, [&] {
+        QuietStdout quiet;
+        auto start = Clock::now();
+        ComputeContext ctx = createContext("", opts.device);
+        ComputeKernel kernel = createBenchKernel(ctx, KERNELS[0]);
+
+        AllocationCreateInfo bufferAI{};
+        bufferAI.usage = MemoryUsage::GpuOnly;
+        GpuBuffer* buffer = ctx.allocator->createBuffer(4096, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, bufferAI);
+
+        VkDescriptorPool pool;
+        VkDescriptorSet set = allocateDescriptorSet(ctx, kernel, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, pool);
+        VkDescriptorBufferInfo bufInfo{ buffer->buffer, 0, VK_WHOLE_SIZE };
+        VkWriteDescriptorSet write = bufferWrite(set, &bufInfo);
+        vkUpdateDescriptorSets(ctx.device, 1, &write, 0, nullptr);
+
+        const uint32_t empty[2] = { 0, 0 };
+        VkCommandBuffer cmdBuf = beginCommands(ctx);
+        vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline);
+        vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.layout, 0, 1, &set, 0, nullptr);
+        vkCmdPushConstants(cmdBuf, kernel.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(empty), empty);
+        vkCmdDispatch(cmdBuf, 1, 1, 1);
+        submitAndWait(ctx, cmdBuf);
+        double ms = elapsedMs(start);
+
+        vkDestroyDescriptorPool(ctx.device, pool, nullptr);
+        ctx.allocator->destroyBuffer(buffer);
+        destroyKernel(ctx, kernel);
+        destroyContext(ctx);
+        return ms;
+    });
+}
+
+// Shader modules, and pipelines built with an empty pipeline cache and with one that already has them
+void benchCreation(Suite& suite, ComputeContext& ctx) {
+    for (const KernelSpec& spec : KERNELS) {
+        ShaderCode code = loadShader(spec.name);
+        BenchParams params{ { "kernel", spec.name } };
+
+        suite.run(std::string("shader_module_create/") + spec.name, "us", false, params, [&] {
+            auto start = Clock::now();
+            VkShaderModule module = createShaderModule(ctx, code.span());
+            double us = elapsedMs(start) * 1000.0;
+            vkDestroyShaderModule(ctx.device, module, nullptr);
+            return us;
+        });
+
+        ComputeKernel kernel = createBenchKernel(ctx, spec);
+
+        suite.run(std::string("pipeline_create_cold/") + spec.name, "ms", false, params, [&] {
+            ctx.pipelineCache = std::make_unique<PipelineCache>(ctx.gpu, ctx.device, "");
+            auto start = Clock::now();
+            VkPipeline pipeline = createComputePipeline(ctx, kernel.shader, kernel.layout, spec.workgroupSize);
+            double ms = elapsedMs(start);
+            vkDestroyPipeline(ctx.device, pipeline, nullptr);
+            return ms;
+        });
+
+        // The kernel's own pipeline went into the current cache, so from here on the cache has it
+        vkDestroyPipeline(ctx.device, createComputePipeline(ctx, kernel.shader, kernel.layout, spec.workgroupSize),
+                          nullptr);
+
+        suite.run(std::string("pipeline_create_cached/") + spec.name, "ms", false, params, [&] {
+            auto start = Clock::now();
+            VkPipeline pipeline = createComputePipeline(ctx, kernel.shader, kernel.layout, spec.workgroupSize);
+            double ms = elapsedMs(start);
+            vkDestroyPipeline(ctx.device, pipeline, nullptr);
+            return ms;
+        });
+
+        destroyKernel(ctx, kernel);
+    }
+
+    // The pipeline manager still holds the cache the cold runs replaced, and later benchmarks build through it
+    ctx.pipelines = std::make_unique<PipelineManager>(ctx.device, ctx.pipelineCache->handle());
+}
+
+// Round trips through the queue with nothing or almost nothing to do, the fixed cost every submission pays. The
+// kernel is squares.comp over zero elements.
+void benchDispatch(Suite& suite, const ComputeContext& ctx, const BenchOptions& opts) {
+    ComputeKernel kernel = createBenchKernel(ctx, KERNELS[0]);
+
+    AllocationCreateInfo bufferAI{};
+    bufferAI.usage = MemoryUsage::GpuOnly;
+    GpuBuffer* buffer = ctx.allocator->createBuffer(4096, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, bufferAI);
+
+    VkDescriptorPool pool;
+    VkDescriptorSet set = allocateDescriptorSet(ctx, kernel, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, pool);
+    VkDescriptorBufferInfo bufInfo{ buffer->buffer, 0, VK_WHOLE_SIZE };
+    VkWriteDescriptorSet write = bufferWrite(set, &bufInfo);
+    vkUpdateDescriptorSets(ctx.device, 1, &write, 0, nullptr);
+
+    const uint32_t empty[2] = { 0, 0 };
+    auto recordDispatch = [&](VkCommandBuffer cmdBuf) {
+        vkCmdPushConstants(cmdBuf, kernel.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(empty), empty);
+        vkCmdDispatch(cmdBuf, 1, 1, 1);
+    };
+    auto bind = [&](VkCommandBuffer cmdBuf) {
+        vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline);
+        vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.layout, 0, 1, &set, 0, nullptr);
+    };
+
+    suite.run("submit_empty", "us", false, {}, [&] {
+        auto start = Clock::now();
+        submitAndWait(ctx, beginCommands(ctx));
+        return elapsedMs(start) * 1000.0;
+    });
+
+    suite.run("dispatch_latency", "us", false, {}, [&] {
+        auto start = Clock::now();
+        VkCommandBuffer cmdBuf = beginCommands(ctx);
+        bind(cmdBuf);
+        recordDispatch(cmdBuf);
+        submitAndWait(ctx, cmdBuf);
+        return elapsedMs(start) * 1000.0;
+    });
+
+    // Recording and executing many back to back dispatches in one submission, per dispatch
+    suite.run("dispatch_throughput", "us/dispatch", false, { { "dispatches", std::to_string(opts.dispatches) } }, [&] {
+        auto start = Clock::now();
+        VkCommandBuffer cmdBuf = beginCommands(ctx);
+        bind(cmdBuf);
+        for (uint32_t i = 0; i < opts.dispatches; ++i) recordDispatch(cmdBuf);
+        submitAndWait(ctx, cmdBuf);
+        return elapsedMs(start) * 1000.0 / opts.dispatches;
+    });
+
+    // One storage buffer descriptor rewritten over and over, per update
+    constexpr uint32_t UPDATES = 10000;
+    suite.run("descriptor_update", "ns/update", false, { { "updates", std::to_string(UPDATES) } }, [&] {
+        auto start = Clock::now();
+        for (uint32_t i = 0; i < UPDATES; ++i) vkUpdateDescriptorSets(ctx.device, 1, &write, 0, nullptr);
+        return elapsedMs(start) * 1e6 / UPDATES;
+    });
+
+    vkDestroyDescriptorPool(ctx.device, pool, nullptr);
+    ctx.allocator->destroyBuffer(buffer);
+    destroyKernel(ctx, kernel);
+}
+
+// For every memory type buffers can use: how fast the host writes and reads it through a mapping, if it is host
+// visible, and how fast the GPU copies between it and device-local memory
+void benchBandwidth(Suite& suite, const ComputeContext& ctx, const BenchOptions& opts) {
+    const VkDeviceSize size = static_cast<VkDeviceSize>(opts.transferMiB) << 20;
+    const VkPhysicalDeviceMemoryProperties& memProps = ctx.allocator->memoryProperties();
+
+    AllocationCreateInfo deviceAI{};
+    deviceAI.usage = MemoryUsage::GpuOnly;
+    GpuBuffer* deviceBuffer = ctx.allocator->createBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, deviceAI);
+
+    std::vector<uint8_t> host(size, 0x5a);
+
+    for (uint32_t type = 0; type < memProps.memoryTypeCount; ++type) {
+        VkMemoryPropertyFlags flags = memProps.memoryTypes[type].propertyFlags;
+        if (flags & (VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT | VK_MEMORY_PROPERTY_PROTECTED_BIT)) continue;
+        if (memProps.memoryHeaps[memProps.memoryTypes[type].heapIndex].size < size * 4) continue;
+
+        TypedBuffer buffer;
+        if (!createBufferInType(ctx, size, type, buffer)) continue;
+
+        std::string suffix = "/type" + std::to_string(type);
+        BenchParams params{
+            { "memoryType", std::to_string(type) }, { "flags", memoryFlagsString(flags) },
+            { "heap", std::to_string(memProps.memoryTypes[type].heapIndex) }, { "bytes", std::to_string(size) } };
+
+        if (buffer.allocation.mapped) {
+            uint8_t* mapped = static_cast<uint8_t*>(buffer.allocation.mapped);
+
+            suite.run("host_write" + suffix, "GB/s", true, params, [&] {
+                auto start = Clock::now();
+                std::memcpy(mapped, host.data(), size);
+                ctx.allocator->flush(buffer.allocation);
+                return static_cast<double>(size) / (elapsedMs(start) * 1e6);
+            });
+
+            suite.run("host_read" + suffix, "GB/s", true, params, [&] {
+                auto start = Clock::now();
+                ctx.allocator->invalidate(buffer.allocation);
+                std::memcpy(host.data(), mapped, size);
+                return static_cast<double>(size) / (elapsedMs(start) * 1e6);
+            });
+        }
+
+        suite.run("copy_to_device" + suffix, "GB/s", true, params,
+                  [&] { return timedCopy(ctx, buffer.buffer, deviceBuffer->buffer, size); });
+        suite.run("copy_from_device" + suffix, "GB/s", true, params,
+                  [&] { return timedCopy(ctx, deviceBuffer->buffer, buffer.buffer, size); });
+
+        destroyTypedBuffer(ctx, buffer);
+    }
+
+    ctx.allocator->destroyBuffer(deviceBuffer);
+}
+
+// gradient.comp over an imageSize x imageSize image, dispatch to finished, in megapixels per second
+void benchImageKernel(Suite& suite, const ComputeContext& ctx, const BenchOptions& opts) {
+    const KernelSpec& spec = KERNELS[1];
+    ComputeKernel kernel = createBenchKernel(ctx, spec);
+
+    VkImageCreateInfo imageCI{};
+    imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageCI.imageType = VK_IMAGE_TYPE_2D;
+    imageCI.format = VK_FORMAT_R8G8B8A8_UNORM;
+    imageCI.extent = { opts.imageSize, opts.imageSize, 1 };
+    imageCI.mipLevels = 1;
+    imageCI.arrayLayers = 1;
+    imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageCI.usage = VK_IMAGE_USAGE_STORAGE_BIT;
+    imageCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageCI.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    AllocationCreateInfo imageAI{};
+    imageAI.usage = MemoryUsage::GpuOnly;
+    GpuImage* image = ctx.allocator->createImage(imageCI, imageAI);
+
+    VkImageViewCreateInfo viewCI{};
+    viewCI.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewCI.image = image->image;
+    viewCI.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewCI.format = imageCI.format;
+    viewCI.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+    VkImageView view;
+    VK_CHECK(vkCreateImageView(ctx.device, &viewCI, nullptr, &view));
+
+    VkDescriptorPool pool;
+    VkDescriptorSet set = allocateDescriptorSet(ctx, kernel, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, pool);
+
+    VkDescriptorImageInfo imgInfo{ VK_NULL_HANDLE, view, VK_IMAGE_LAYOUT_GENERAL };
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = set;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    write.pImageInfo = &imgInfo;
+    vkUpdateDescriptorSets(ctx.device, 1, &write, 0, nullptr);
+
+    // Undefined -> General once; every repetition overwrites the whole image
+    VkCommandBuffer cmdBuf = beginCommands(ctx);
+    imageBarrier(cmdBuf, image->image, {}, resource_use::COMPUTE_WRITE);
+    submitAndWait(ctx, cmdBuf);
+
+    const int32_t tile[4] = { 0, 0, static_cast<int32_t>(opts.imageSize), static_cast<int32_t>(opts.imageSize) };
+    const double megapixels = static_cast<double>(opts.imageSize) * opts.imageSize / 1e6;
+    BenchParams params{ { "kernel", spec.name },
+                        { "size", std::to_string(opts.imageSize) + "x" + std::to_string(opts.imageSize) } };
+
+    suite.run(std::string("image_kernel/") + spec.name, "MPix/s", true, params, [&] {
+        auto start = Clock::now();
+        VkCommandBuffer cmdBuf = beginCommands(ctx);
+        vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline);
+        vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.layout, 0, 1, &set, 0, nullptr);
+        vkCmdPushConstants(cmdBuf, kernel.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(tile), tile);
+        vkCmdDispatch(cmdBuf, groupCount(opts.imageSize, spec.workgroupSize.x),
+                      groupCount(opts.imageSize, spec.workgroupSize.y), 1);
+        submitAndWait(ctx, cmdBuf);
+        return megapixels / (elapsedMs(start) / 1000.0);
+    });
+
+    vkDestroyDescriptorPool(ctx.device, pool, nullptr);
+    vkDestroyImageView(ctx.device, view, nullptr);
+    ctx.allocator->destroyImage(image);
+    destroyKernel(ctx, kernel);
+
+    // The same kernel in fp16, writing 8-bit pixels into a buffer, where the device and the size allow it (see
+    // precision.hpp)
+    const PrecisionVariant* variant = findPrecisionVariant(ctx.precision, spec.name, opts.imageSize, opts.imageSize);
+    if (!variant) return;
+
+    const KernelSpec variantSpec{ variant->variant, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, spec.pushConstantSize,
+                                  spec.workgroupSize };
+    kernel = createBenchKernel(ctx, variantSpec);
+
+    AllocationCreateInfo bufferAI{};
+    bufferAI.usage = MemoryUsage::GpuOnly;
+    GpuBuffer* pixels = ctx.allocator->createBuffer(static_cast<VkDeviceSize>(opts.imageSize) * opts.imageSize * 4,
+                                                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, bufferAI);
+
+    set = allocateDescriptorSet(ctx, kernel, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, pool);
+    VkDescriptorBufferInfo bufInfo{ pixels->buffer, 0, VK_WHOLE_SIZE };
+    write = bufferWrite(set, &bufInfo);
+    vkUpdateDescriptorSets(ctx.device, 1, &write, 0, nullptr);
+
+    params[0].second = variant->variant;
+    suite.run(std::string("image_kernel/") + variant->variant, "MPix/s", true, params, [&] {
+        auto start = Clock::now();
+        VkCommandBuffer cmdBuf = beginCommands(ctx);
+        vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline);
+        vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.layout, 0, 1, &set, 0, nullptr);
+        vkCmdPushConstants(cmdBuf, kernel.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(tile), tile);
+        vkCmdDispatch(cmdBuf, groupCount(opts.imageSize, variantSpec.workgroupSize.x),
+                      groupCount(opts.imageSize, variantSpec.workgroupSize.y), 1);
+        submitAndWait(ctx, cmdBuf);
+        return megapixels / (elapsedMs(start) / 1000.0);
+    });
+
+    vkDestroyDescriptorPool(ctx.device, pool, nullptr);
+    ctx.allocator->destroyBuffer(pixels);
+    destroyKernel(ctx, kernel);
+}
+
+// reduce, scan, histogram, compact and sort from primitives.hpp over primitiveCount random uints in device-local
+// memory. Throughput is the size of the input over the time from submit to finished, so the primitives can be
+// compared with each other and with copy_to_device on the same device.
+void benchPrimitives(Suite& suite, const ComputeContext& ctx, const BenchOptions& opts) {
+    // Not every device has the subgroup operations the kernels need
+    std::unique_ptr<GpuPrimitives> primitives;
+    try {
+        primitives = std::make_unique<GpuPrimitives>(ctx);
+    } catch (const std::runtime_error& e) {
+        std::cout << "Skipping the primitive benchmarks: " << e.what() << "\n";
+        return;
+    }
+
+    const uint32_t count = static_cast<uint32_t>(std::min<uint64_t>(opts.primitiveCount, primitives->maxCount()));
+    const VkDeviceSize size = sizeof(uint32_t) * static_cast<VkDeviceSize>(count);
+    const VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                                     VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    AllocationCreateInfo deviceAI{};
+    deviceAI.usage = MemoryUsage::GpuOnly;
+    GpuBuffer* input = ctx.allocator->createBuffer(size, usage, deviceAI);
+    GpuBuffer* output = ctx.allocator->createBuffer(size, usage, deviceAI);
+    GpuBuffer* small = ctx.allocator->createBuffer(sizeof(uint32_t) * GpuPrimitives::MAX_HISTOGRAM_BINS, usage,
+                                                   deviceAI);
+
+    AllocationCreateInfo uploadAI{};
+    uploadAI.usage = MemoryUsage::Upload;
+    GpuBuffer* staging = ctx.allocator->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, uploadAI);
+
+    std::mt19937 rng(1234);
+    uint32_t* mapped = static_cast<uint32_t*>(staging->allocation.mapped);
+    for (uint32_t i = 0; i < count; ++i) mapped[i] = rng();
+    ctx.allocator->flush(staging->allocation);
+
+    // Puts the random values back into input, which sort overwrites
+    auto restoreInput = [&] {
+        VkCommandBuffer cmdBuf = beginCommands(ctx);
+        VkBufferCopy region{ 0, 0, size };
+        vkCmdCopyBuffer(cmdBuf, staging->buffer, input->buffer, 1, &region);
+        submitAndWait(ctx, cmdBuf);
+    };
+    restoreInput();
+
+    BenchParams params{ { "count", std::to_string(count) }, { "bytes", std::to_string(size) } };
+
+    auto run = [&](const std::string& name, const std::function<void(VkCommandBuffer)>& record) {
+        suite.run("primitive/" + name, "GB/s", true, params, [&] {
+            auto start = Clock::now();
+            VkCommandBuffer cmdBuf = beginCommands(ctx);
+            record(cmdBuf);
+            submitAndWait(ctx, cmdBuf);
+            double ms = elapsedMs(start);
+
+            primitives->recycle();
+            return static_cast<double>(size) / (ms * 1e6);
+        });
+    };
+
+    run("reduce", [&](VkCommandBuffer cmd) { primitives->reduce(cmd, input, count, small); });
+    run("scan_exclusive", [&](VkCommandBuffer cmd) {
+        primitives->scan(cmd, input, output, count, ScanKind::Exclusive);
+    });
+    run("scan_inclusive", [&](VkCommandBuffer cmd) {
+        primitives->scan(cmd, input, output, count, ScanKind::Inclusive);
+    });
+    run("histogram256", [&](VkCommandBuffer cmd) { primitives->histogram(cmd, input, count, small, 256); });
+    run("compact", [&](VkCommandBuffer cmd) {
+        primitives->compact(cmd, input, count, output, small, { CompactOp::Less, 1u << 31 });
+    });
+
+    // Every repetition sorts the same random keys; putting them back isn't timed
+    suite.run("primitive/sort", "GB/s", true, params, [&] {
+        restoreInput();
+
+        auto start = Clock::now();
+        VkCommandBuffer cmdBuf = beginCommands(ctx);
+        primitives->sort(cmdBuf, input, count);
+        submitAndWait(ctx, cmdBuf);
+        double ms = elapsedMs(start);
+
+        primitives->recycle();
+        return static_cast<double>(size) / (ms * 1e6);
+    });
+
+    for (GpuBuffer* buffer : { input, output, small, staging }) ctx.allocator->destroyBuffer(buffer);
+}
+
+// Parses the command line. Supported options:
+//   --repetitions N     Timed repetitions per benchmark (default 10)
+//   --warmup N          Untimed repetitions before those (default 2)
+//   --output PATH       JSON results file (default vk_bench.json)
+//   --device ID         Device index, UUID (prefix) or name (substring), e.g. llvmpipe for lavapipe. Defaults to
+//                       $VULKAN_DEVICE, then the best scoring device.
+//   --filter TEXT       Only run benchmarks whose name contains TEXT, e.g. pipeline_create or /type0
+//   --image-size N      Width and height of the image kernel benchmark (default 2048)
+//   --transfer-mib N    Bytes per bandwidth benchmark copy, in MiB (default 64)
+//   --dispatches N      Dispatches per sample of dispatch_throughput (default 1000)
+//   --primitive-count N Values the parallel primitive benchmarks run over (default 16777216)
+BenchOptions parseArgs(int argc, char* argv[]) {
+    BenchOptions opts;
+
+    auto positive = [](const std::string& arg, const char* value) {
+        uint32_t n = static_cast<uint32_t>(std::stoul(value));
+        if (n == 0) throw std::runtime_error(arg + " must be at least 1");
+        return n;
+    };
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        if (arg == "--repetitions" && i + 1 < argc) {
+            opts.repetitions = positive(arg, argv[++i]);
+        } else if (arg == "--warmup" && i + 1 < argc) {
+            opts.warmup = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (arg == "--output" && i + 1 < argc) {
+            opts.output = argv[++i];
+        } else if (arg == "--device" && i + 1 < argc) {
+            opts.device = argv[++i];
+        } else if (arg == "--filter" && i + 1 < argc) {
+            opts.filter = argv[++i];
+        } else if (arg == "--image-size" && i + 1 < argc) {
+            opts.imageSize = positive(arg, argv[++i]);
+        } else if (arg == "--transfer-mib" && i + 1 < argc) {
+            opts.transferMiB = positive(arg, argv[++i]);
+        } else if (arg == "--dispatches" && i + 1 < argc) {
+            opts.dispatches = positive(arg, argv[++i]);
+        } else if (arg == "--primitive-count" && i + 1 < argc) {
+            opts.primitiveCount = positive(arg, argv[++i]);
+        } else {
+            throw std::runtime_error("Unknown argument: " + arg);
+        }
+    }
+
+    return opts;
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        BenchOptions opts = parseArgs(argc, argv);
+        Suite suite(opts);
+
+        // Context creation runs first, on contexts of its own
+        benchContext(suite, opts);
+
+        ComputeContext ctx = createContext("", opts.device);
+        std::cout << "Running " << opts.repetitions << " repetitions after " << opts.warmup << " warmup\n";
+
+        benchCreation(suite, ctx);
+        benchDispatch(suite, ctx, opts);
+        benchBandwidth(suite, ctx, opts);
+        benchImageKernel(suite, ctx, opts);
+        benchPrimitives(suite, ctx, opts);
+
+        writeJson(opts.output, ctx, opts, suite.all());
+        std::cout << "Wrote " << suite.all().size() << " results to " << opts.output << "\n";
+
+        destroyContext(ctx);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
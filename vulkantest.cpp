@@ -2,14 +2,69 @@
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_vulkan.h>
 
+#include "swapchain.hpp"
+#include "profiler.hpp"
+#include "display_kernel.hpp"
+#include "queue_topology.hpp"
+#include "device_select.hpp"
+#include "frame_pacer.hpp"
+#include "pipeline_manager.hpp"
+#include "startup_trace.hpp"
+#include "autotune.hpp"
+
 #include <vector>
 #include <stdexcept>
 #include <iostream>
+#include <array>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+#include <string>
+#include <memory>
+#include <future>
+#include <optional>
+#include <filesystem>
 
 // If we want to be able to use Vulkan with SDL, we need to create a window with the appropriate flags. This macro 
 // defines the flags we need to use when creating the window.
 #define SDL_VULKAN_FLAGS (SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE | SDL_WINDOW_HIGH_PIXEL_DENSITY)
 
+// Number of frames the CPU is allowed to record ahead of the GPU. With 1 frame in flight the CPU waits for the GPU to
+// finish every frame before it records the next one; with 2 or 3 recording of frame N+1 overlaps GPU work of frame N.
+// Can be overridden on the command line with --frames-in-flight N.
+constexpr uint32_t DEFAULT_FRAMES_IN_FLIGHT = 2;
+constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 8;
+
+// Options that can be passed on the command line
+struct AppConfig {
+    uint32_t framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+    vk::PresentModeKHR presentMode = vk::PresentModeKHR::eFifo;
+    std::string shader = "gradient.comp";           // Image kernel drawn every frame
+    bool blit = false;                              // Always draw into an offscreen image and blit it to the screen
+    bool asyncCompute = true;                       // Run the kernel on a separate compute queue when there is one
+    double targetFps = 0.0;                         // Frame rate limit, 0 for none (the present mode may still cap it)
+    bool onDemand = false;                          // Only draw when something changed instead of every frame
+    std::string device;                             // Device index, UUID or name, instead of the best scoring one
+    std::string watch;                              // GLSL source of the kernel, rebuilt and swapped in on change
+    std::string startupTrace;                       // Chrome trace of the startup phases, written at exit if set
+    std::string tuningFile = "workgroups.txt";      // Workgroup sizes tuned by main's --tune, per device and kernel
+};
+
+// Everything a single frame in flight owns. Each frame has its own command pool so the whole pool can be reset at once
+// when the frame slot comes around again, instead of resetting individual command buffers.
+struct FrameData {
+    vk::raii::CommandPool commandPool{nullptr};
+    vk::raii::CommandBuffer commandBuffer{nullptr};
+
+    // Signalled by the swapchain when the acquired image is ready to be rendered to
+    vk::raii::Semaphore imageAvailableSemaphore{nullptr};
+
+    // With async compute, the kernel is recorded into a command buffer of its own for the compute queue. The graphics
+    // submission waits for it on VulkanState::computeTimeline before it blits the result.
+    vk::raii::CommandPool computePool{nullptr};
+    vk::raii::CommandBuffer computeCommandBuffer{nullptr};
+};
+
 // Struct to hold Vulkan objects so they survive past initVulkan
 struct VulkanState {
     // RAII Context for Vulkan. Essentially a safer C++ manager for Vulkan
@@ -19,29 +74,64 @@ struct VulkanState {
     vk::raii::PhysicalDevice physicalDevice{nullptr};
     vk::raii::Device device{nullptr};
     vk::raii::Queue graphicsQueue{nullptr};
+
+    // Async compute queue, only set if the kernel runs on one (see AppConfig::asyncCompute)
+    vk::raii::Queue computeQueue{nullptr};
     
-    // Swapchain and related resources
-    vk::raii::SwapchainKHR swapchain{nullptr};
-    std::vector<vk::Image> swapchainImages; // Handled by swapchain, but we need the handles
-    std::vector<vk::raii::ImageView> swapchainImageViews;
-    
-    // Synchronization
-    vk::raii::Semaphore imageAvailableSemaphore{nullptr};
-    vk::raii::Semaphore renderFinishedSemaphore{nullptr};
-    vk::raii::Fence inFlightFence{nullptr};
+    // Compiles pipelines on worker threads, so the frame loop never waits for one. Declared after the device so it is
+    // destroyed before it.
+    std::unique_ptr<PipelineManager> pipelines;
 
-    // Command pool and buffers (not used yet, but will be needed for rendering)
-    vk::raii::CommandPool commandPool{nullptr};
-    vk::raii::CommandBuffers commandBuffers{nullptr}; // Usually one per frame or one total
+    // Swapchain, its image views and per-image render finished semaphores. Rebuilt on resize and out of date.
+    Swapchain swapchain;
+
+    // The image kernel that draws each frame, along with its per-swapchain descriptor sets
+    std::unique_ptr<DisplayKernel> display;
+
+    // Ring of per-frame resources, indexed by currentFrame
+    std::vector<FrameData> frames;
+    uint32_t currentFrame = 0;
+
+    // Total number of frames submitted so far. Used to tell when retired swapchains are no longer in use.
+    int64_t frameNumber = 0;
+
+    // Timeline semaphores counting finished frames: frame N signals N + 1 on the graphics queue when it is done, and on
+    // the compute queue when its kernel is done. Waiting for a value replaces a fence per frame slot.
+    vk::raii::Semaphore frameTimeline{nullptr};
+    vk::raii::Semaphore computeTimeline{nullptr};
+
+    // GPU timings per frame, with one query slot per frame in flight. Declared after the device so it is destroyed
+    // before it.
+    std::unique_ptr<GpuProfiler> profiler;
+
+    // GPU timings of the async compute queue's submissions, if there is one
+    std::unique_ptr<GpuProfiler> computeProfiler;
 };
 
-// Opens a window
-SDL_Window* initWindow() {
-    // Initialize SDL, and draw a window with Vulkan support. Handle appropriate errors.
-    if (SDL_Init(SDL_INIT_VIDEO) < 0)
+// Initializes SDL's video subsystem and loads the Vulkan library, and returns the instance extensions SDL needs to
+// create surfaces. That is all instance creation needs from SDL, so the window can open while the instance is created.
+std::vector<const char*> initSDL() {
+    // Initialize SDL. Handle appropriate errors.
+    if (!SDL_Init(SDL_INIT_VIDEO))
         // If we can't initialize SDL, throw an error with the SDL error message
         throw std::runtime_error(SDL_GetError());
 
+    // Windows created with SDL_WINDOW_VULKAN load it too, but the extensions are needed before there is a window
+    if (!SDL_Vulkan_LoadLibrary(nullptr)) throw std::runtime_error(SDL_GetError());
+
+    // Get the list of Vulkan instance extensions required by SDL.
+    Uint32 extCount = 0;
+    const char* const* sdlExts = SDL_Vulkan_GetInstanceExtensions(&extCount);
+
+    // Handle the case where we fail to get the extensions
+    if (!sdlExts) throw std::runtime_error("Failed to get SDL extensions");
+
+    // Store the extensions in a vector for easier use with Vulkan
+    return std::vector<const char*>(sdlExts, sdlExts + extCount);
+}
+
+// Opens a window. SDL has to be initialized already (see initSDL).
+SDL_Window* initWindow() {
     // Create a Vulkan-capable window. Handle errors appropriately.
     SDL_Window* window = SDL_CreateWindow(
         "Vulkan",
@@ -57,14 +147,13 @@ SDL_Window* initWindow() {
     return window;
 }
 
-// Initializes Vulkan and creates a Vulkan surface for the given window. Handles errors appropriately.
-VulkanState initVulkan(SDL_Window* window) {
-    VulkanState state;
+// Creates the Vulkan instance and enumerates the physical devices once. Loading and initializing the drivers on the
+// first enumeration is most of the cost of getting to a device, and none of it needs the window, so this runs on a
+// worker thread while the window opens. Device selection later needs the surface and enumerates again, cheaply.
+void initInstance(VulkanState& state, const std::vector<const char*>& extensions, StartupTrace& trace) {
+    trace.nameThread("instance");
 
     // ================================================== Vulkan Setup =================================================
-    // RAII Context for Vulkan. Essentially a safer C++ manager for Vulkan
-    state.context = vk::raii::Context{};
-
     // Tell Vulkan about our application.
     vk::ApplicationInfo appInfo{};
     appInfo.setPApplicationName("Minimal App")
@@ -73,19 +162,8 @@ VulkanState initVulkan(SDL_Window* window) {
            .setEngineVersion(VK_MAKE_VERSION(1,0,0))
            .setApiVersion(VK_API_VERSION_1_3);             // Can't use 1.4 features yet, so we specify version 1.3
 
-    // ================================================ SDL Extensions =================================================
-    // Get the list of Vulkan instance extensions required by SDL.
-    Uint32 extCount = 0;
-    const char* const* sdlExts = SDL_Vulkan_GetInstanceExtensions(&extCount);  
-
-    // Handle the case where we fail to get the extensions
-    if (!sdlExts) throw std::runtime_error("Failed to get SDL extensions");
-
-    // Store the extensions in a vector for easier use with Vulkan
-    std::vector<const char*> extensions(sdlExts, sdlExts + extCount);
-
     // ================================================ Vulkan Instance ================================================
-    // Describe the Vulkan instance we want to create. This tells the Vulkan instance about the application and 
+    // Describe the Vulkan instance we want to create. This tells the Vulkan instance about the application and
     // the extensions we want to use. We will use the extensions provided by SDL to create a surface for our window.
     vk::InstanceCreateInfo instanceInfo{};
     instanceInfo.setPApplicationInfo(&appInfo)
@@ -93,7 +171,20 @@ VulkanState initVulkan(SDL_Window* window) {
                 .setPpEnabledExtensionNames(extensions.data());
 
     // Create the Vulkan instance
-    state.instance = vk::raii::Instance(state.context, instanceInfo);
+    {
+        StartupTrace::Scope phase(&trace, "instance");
+        state.instance = vk::raii::Instance(state.context, instanceInfo);
+    }
+
+    StartupTrace::Scope phase(&trace, "enumerate devices");
+    (void)state.instance.enumeratePhysicalDevices();
+}
+
+// Sets up the rest of Vulkan for the window, on top of the instance from initInstance(). Handles errors
+// appropriately. Every step is recorded as a phase in trace.
+void initVulkan(SDL_Window* window, VulkanState& state, const AppConfig& config, StartupTrace& trace) {
+    std::optional<StartupTrace::Scope> phase;
+    phase.emplace(&trace, "surface");
 
     // ==================================================== Surface ====================================================
     // Create a Vulkan surface for our window
@@ -114,241 +205,494 @@ VulkanState initVulkan(SDL_Window* window) {
     state.surface = vk::raii::SurfaceKHR(state.instance, rawSurface);
 
     // ================================================ Physical Device ================================================
-    // Enumerate through the available GPUs on the computer and pick the first one
-    auto physicalDevices = state.instance.enumeratePhysicalDevices();
+    phase.emplace(&trace, "select device");
+    // Score every GPU that can present to the window and take the best one, unless --device or VULKAN_DEVICE names
+    // another. Devices without the swapchain extension or timeline semaphores are never picked.
+    DeviceRequirements requirements;
+    requirements.surface = *state.surface;
+    requirements.extensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
 
-    // If the list of GPUs is empty, throw an error
-    if (physicalDevices.empty())
-        throw std::runtime_error("No GPUs found");
-
-    // Move the first GPU into a vk::raii::PhysicalDevice object
-    state.physicalDevice = physicalDevices.front();
+    VkPhysicalDevice gpu = selectPhysicalDevice(*state.instance, requirements, config.device, std::cout);
+    state.physicalDevice = vk::raii::PhysicalDevice(state.instance, gpu);
 
     // ================================================ Queue Selection ================================================
-    auto queueFamilies = state.physicalDevice.getQueueFamilyProperties();
-
-    // Set the graphics family index to something invalid. This is so that if we don't find a queue family that supports
-    // both graphics and presentation, we can detect it and throw an error
-    uint32_t graphicsFamily = UINT32_MAX;
-
-    // Iterate through the queue families to find one that supports both graphics and presentation
-    for (uint32_t i = 0; i < queueFamilies.size(); ++i)
-    {   
-        // Check if the queue family supports graphics and presentation.
-        bool graphics = (queueFamilies[i].queueFlags & vk::QueueFlagBits::eGraphics) != vk::QueueFlags{};
-
-        // Check if the queue family supports presentation to our surface. This is necessary for rendering to the screen.
-        bool present = state.physicalDevice.getSurfaceSupportKHR(i, *state.surface);
-        
-        // If this queue family supports both graphics and presentation, we can use it
-        if (graphics && present)
-        {   
-            // Store the index of the queue family and break out of the loop
-            graphicsFamily = i;
-            break;
-        }
-    }
-
-    // If we didn't find a suitable queue family, throw an error
-    if (graphicsFamily == UINT32_MAX) throw std::runtime_error("No suitable queue");
+    // The primary family does graphics, compute and present. Async compute goes to a compute-only family if there is
+    // one, or to a second queue of the primary family. See QueueTopology.
+    QueueTopology topology = discoverQueues(*state.physicalDevice, *state.surface);
+    uint32_t graphicsFamily = topology.primary.family;
+    bool asyncCompute = config.asyncCompute && topology.asyncCompute();
 
     // ======================================= Vulkan Device and Queue Creation ========================================
-    // Set the priority of the queue to 1.0. Vulkan expects an array of priorities, but since we only have one queue, we
-    // can just use a single float. The priority is a value between 0.0 and 1.0, where 1.0 is the highest priority.
-    float priority = 1.0f;
-
-    // Describe the queue we want to create. We want one queue from the graphics family, with the highest priority.
-    vk::DeviceQueueCreateInfo queueInfo{};
-    queueInfo.setQueueFamilyIndex(graphicsFamily)
-             .setQueueCount(1)
-             .setPQueuePriorities(&priority);
+    phase.emplace(&trace, "device");
+    // Every queue gets the highest priority, 1.0. Vulkan expects one priority per queue in a family.
+    std::vector<float> priorities(topology.maxQueueCount(), 1.0f);
+    std::vector<VkDeviceQueueCreateInfo> rawQueueInfos = topology.createInfos(priorities.data());
+    std::vector<vk::DeviceQueueCreateInfo> queueInfos(rawQueueInfos.begin(), rawQueueInfos.end());
 
     // Specify device extensions (needed for presenting)
     const char* deviceExtensions[] = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
 
+    // Pipeline statistics let the profiler count shader invocations. Only enable them if the GPU has them.
+    vk::PhysicalDeviceFeatures features{};
+    features.setPipelineStatisticsQuery(state.physicalDevice.getFeatures().pipelineStatisticsQuery);
+
+    // Frames are tracked with timeline semaphores instead of fences. Device selection made sure they're supported.
+    vk::PhysicalDeviceVulkan12Features features12{};
+    features12.setTimelineSemaphore(true);
+
+    // The display's barriers are Synchronization2's, core and always there in 1.3
+    vk::PhysicalDeviceVulkan13Features features13{};
+    features13.setSynchronization2(true);
+    features12.setPNext(&features13);
+
     // Create the logical device. RAII will handle cleanup.
     vk::DeviceCreateInfo deviceInfo{};
-    deviceInfo.setQueueCreateInfos(queueInfo)
+    deviceInfo.setPNext(&features12)
+              .setQueueCreateInfos(queueInfos)
               .setEnabledExtensionCount(1)
-              .setPpEnabledExtensionNames(deviceExtensions);
+              .setPpEnabledExtensionNames(deviceExtensions)
+              .setPEnabledFeatures(&features);
 
     state.device = vk::raii::Device(state.physicalDevice, deviceInfo);
 
-    // Get the graphics queue from the device. Since there is only one Queue in the family, we can just get the first 
-    // one (index 0).
-    state.graphicsQueue = state.device.getQueue(graphicsFamily, 0);
+    // Get the graphics queue, and the async compute queue if the kernel runs on one
+    state.graphicsQueue = state.device.getQueue(graphicsFamily, topology.primary.index);
+    if (asyncCompute) state.computeQueue = state.device.getQueue(topology.compute.family, topology.compute.index);
+
+    // ================================================= Display Kernel ================================================
+    // Runs on the async compute queue if there is one. Otherwise it writes straight into the swapchain images if they
+    // were created as storage images, and blits otherwise.
+    // Its shader is loaded and its pipeline compiled on the pipeline manager's workers while the swapchain and the
+    // rest of Vulkan are set up; frames are cleared until it's done.
+    // It runs with the workgroup size main's --tune found for this device, like the headless path does.
+    phase.emplace(&trace, "request pipeline");
+    const std::string kernelName = std::filesystem::path(config.shader).filename().string();
+    WorkgroupSize workgroupSize =
+        WorkgroupTuner::lookup(static_cast<VkPhysicalDevice>(*state.physicalDevice), config.tuningFile, kernelName)
+            .value_or(IMAGE_WORKGROUP_SIZE);
+
+    state.pipelines = std::make_unique<PipelineManager>(*state.device, VK_NULL_HANDLE);
+    state.pipelines->reportBuildTimes(true);                // Just the one pipeline, and its rebuilds with --watch
+    state.display = std::make_unique<DisplayKernel>(state.device, *state.pipelines, config.shader, config.watch,
+                                                    config.framesInFlight, graphicsFamily, topology.compute.family,
+                                                    asyncCompute, workgroupSize);
+    if (!config.watch.empty()) state.pipelines->watch();
 
     // ==================================================== Swapchain ==================================================
-    // 1. Define the Swapchain settings
-    vk::SwapchainCreateInfoKHR swapchainInfo{};
-    swapchainInfo.setSurface(*state.surface)
-                 .setMinImageCount(3) // Triple buffering
-                 .setImageFormat(vk::Format::eB8G8R8A8Unorm) // Common color format
-                 .setImageColorSpace(vk::ColorSpaceKHR::eSrgbNonlinear)
-                 .setImageExtent({800, 600})
-                 .setImageArrayLayers(1)
-                 .setImageUsage(vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferDst) 
-                 .setPreTransform(vk::SurfaceTransformFlagBitsKHR::eIdentity)
-                 .setCompositeAlpha(vk::CompositeAlphaFlagBitsKHR::eOpaque)
-                 .setPresentMode(vk::PresentModeKHR::eFifo) // VSync
-                 .setClipped(true);
-
-    state.swapchain = vk::raii::SwapchainKHR(state.device, swapchainInfo);
-
-    // ================================================= Synchronization ===============================================
-    vk::SemaphoreCreateInfo semInfo{};
-    vk::FenceCreateInfo fenceInfo{ vk::FenceCreateFlagBits::eSignaled };
+    phase.emplace(&trace, "swapchain");
+    // The swapchain manager queries the surface for its capabilities, formats and present modes and builds the
+    // swapchain, image views and render finished semaphores from them.
+    state.swapchain.config.presentMode = config.presentMode;
+    state.swapchain.config.preferStorage = !config.blit && !asyncCompute;     // Async compute always blits
 
-    state.imageAvailableSemaphore = vk::raii::Semaphore(state.device, semInfo);
-    state.renderFinishedSemaphore = vk::raii::Semaphore(state.device, semInfo);
-    state.inFlightFence = vk::raii::Fence(state.device, fenceInfo);
+    int width = 0, height = 0;
+    SDL_GetWindowSizeInPixels(window, &width, &height);
 
-    // ================================================= Image Views ==================================================
-    // 1. Get the image handles from the swapchain
-    state.swapchainImages = state.swapchain.getImages();
+    state.swapchain.recreate(state.physicalDevice, state.device, state.surface,
+                             { static_cast<uint32_t>(width), static_cast<uint32_t>(height) }, state.frameNumber);
 
-    // 2. Create a View for each Image
-    for (const auto& image : state.swapchainImages) {
-        vk::ImageViewCreateInfo viewInfo{};
-        viewInfo.setImage(image)
-                .setViewType(vk::ImageViewType::e2D)
-                .setFormat(vk::Format::eB8G8R8A8Unorm) // Must match swapchain format
-                .setSubresourceRange({ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 });
+    // The descriptor sets and offscreen images that go with the swapchain
+    phase.emplace(&trace, "display targets");
+    state.display->resize(state.physicalDevice, state.device, state.swapchain, state.frameNumber);
 
-        state.swapchainImageViews.push_back(vk::raii::ImageView(state.device, viewInfo));
+    switch (state.display->path()) {
+        case DisplayPath::Direct:
+            std::cout << "Drawing " << config.shader << " directly into the swapchain images" << std::endl;
+            break;
+        case DisplayPath::Blit:
+            std::cout << "Drawing " << config.shader << " through an offscreen image" << std::endl;
+            break;
+        case DisplayPath::Async:
+            std::cout << "Drawing " << config.shader << " on the async compute queue (family "
+                      << topology.compute.family << ", queue " << topology.compute.index << ")" << std::endl;
+            break;
     }
 
-    // ================================================= Command Pool =================================================
-    vk::CommandPoolCreateInfo poolInfo{};
-    poolInfo.setQueueFamilyIndex(graphicsFamily)
-            .setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer); // Allows us to reuse the list every frame
+    // ================================================ Frames in Flight ===============================================
+    phase.emplace(&trace, "frames in flight");
+    // Each frame in flight gets its own command pool, command buffer and image available semaphore. Both timelines
+    // start at 0, so waiting for "frame -1 is done" returns immediately.
+    vk::SemaphoreCreateInfo semInfo{};
+
+    vk::SemaphoreTypeCreateInfo timelineType(vk::SemaphoreType::eTimeline, 0);
+    vk::SemaphoreCreateInfo timelineInfo{};
+    timelineInfo.setPNext(&timelineType);
+
+    state.frameTimeline = vk::raii::Semaphore(state.device, timelineInfo);
+    if (asyncCompute) state.computeTimeline = vk::raii::Semaphore(state.device, timelineInfo);
+
+    for (uint32_t i = 0; i < config.framesInFlight; ++i) {
+        FrameData frame;
+
+        // The pool is reset as a whole every time the frame slot is reused, and its buffers are short lived
+        vk::CommandPoolCreateInfo poolInfo{};
+        poolInfo.setQueueFamilyIndex(graphicsFamily)
+                .setFlags(vk::CommandPoolCreateFlagBits::eTransient);
+
+        frame.commandPool = vk::raii::CommandPool(state.device, poolInfo);
+
+        // Allocate the frame's command buffer
+        vk::CommandBufferAllocateInfo allocInfo{};
+        allocInfo.setCommandPool(*frame.commandPool)
+                 .setLevel(vk::CommandBufferLevel::ePrimary)
+                 .setCommandBufferCount(1);
+
+        frame.commandBuffer = std::move(vk::raii::CommandBuffers(state.device, allocInfo).front());
+
+        frame.imageAvailableSemaphore = vk::raii::Semaphore(state.device, semInfo);
 
-    state.commandPool = vk::raii::CommandPool(state.device, poolInfo);
+        // The same again for the compute queue. Its submissions are covered by frameTimeline, since the graphics
+        // submission of the same frame waits for them.
+        if (asyncCompute) {
+            poolInfo.setQueueFamilyIndex(topology.compute.family);
+            frame.computePool = vk::raii::CommandPool(state.device, poolInfo);
 
-    // Allocate a command buffer
-    vk::CommandBufferAllocateInfo allocInfo{};
-    allocInfo.setCommandPool(*state.commandPool)
-             .setLevel(vk::CommandBufferLevel::ePrimary)
-             .setCommandBufferCount(1);
+            allocInfo.setCommandPool(*frame.computePool);
+            frame.computeCommandBuffer = std::move(vk::raii::CommandBuffers(state.device, allocInfo).front());
+        }
+
+        state.frames.push_back(std::move(frame));
+    }
 
-    state.commandBuffers = vk::raii::CommandBuffers(state.device, allocInfo);
+    // ================================================== GPU Profiler =================================================
+    phase.emplace(&trace, "profiler");
+    state.profiler = std::make_unique<GpuProfiler>(*state.physicalDevice, *state.device, graphicsFamily,
+                                                   config.framesInFlight, features.pipelineStatisticsQuery);
 
-    return state;
+    if (asyncCompute)
+        state.computeProfiler = std::make_unique<GpuProfiler>(*state.physicalDevice, *state.device,
+                                                              topology.compute.family, config.framesInFlight,
+                                                              features.pipelineStatisticsQuery);
 }
 
 // Main loop of the application. This is where we render frames and handle events
-void mainLoop(VulkanState& state) {
+void mainLoop(SDL_Window* window, VulkanState& state, const AppConfig& config, StartupTrace& trace) {
     // =================================================== Main Loop ===================================================
 
     // Populate a boolean variable which controls if we are running or not. When we quit, this will be set to false.
     bool running = true;
 
+    // True while there is nothing to draw: the window is minimized or hidden, or, in on-demand mode, the last frame is
+    // still up to date. The loop then blocks in SDL_WaitEvent instead of spinning.
+    bool idle = false;
+
     // SDL_Event object to hold event data. We will use this to poll for events in the main loop.
     SDL_Event e;
 
-    // While the status of the application is running, poll for events. If we get a quit event, set running to false. 
-    while (running)
-    {   
-        // Poll for events. SDL_PollEvent() is a boolean function that returns 1 if there is an event in the queue, and
-        // 0 if there are no events. It also fills the SDL_Event structure with the event data. 
-        while (SDL_PollEvent(&e))
-        {   
+    // Limits the frame rate if asked to, and measures CPU frame time and jitter from the start of one frame to the
+    // start of the next
+    FramePacer pacer(config.targetFps);
+
+    // Handles a single event. Resizes mark the swapchain for rebuilding, and F/M/I switch between the FIFO, mailbox and
+    // immediate present modes at runtime. Anything that changes what is on screen ends idle mode.
+    auto handleEvent = [&](const SDL_Event& event) {
+        switch (event.type) {
             // If we get a quit event, set running to false (Like if the user clicks the X button on the window)
-            if (e.type == SDL_EVENT_QUIT)
+            case SDL_EVENT_QUIT:
                 running = false;
+                break;
+            case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED:
+                state.swapchain.dirty = true;
+                idle = false;
+                break;
+            case SDL_EVENT_WINDOW_MINIMIZED:
+            case SDL_EVENT_WINDOW_HIDDEN:
+            case SDL_EVENT_WINDOW_OCCLUDED:
+                idle = true;
+                break;
+            case SDL_EVENT_WINDOW_RESTORED:
+            case SDL_EVENT_WINDOW_SHOWN:
+            case SDL_EVENT_WINDOW_EXPOSED:
+                idle = false;
+                break;
+            case SDL_EVENT_KEY_DOWN:
+                if (event.key.key == SDLK_F) state.swapchain.setPresentMode(vk::PresentModeKHR::eFifo);
+                if (event.key.key == SDLK_M) state.swapchain.setPresentMode(vk::PresentModeKHR::eMailbox);
+                if (event.key.key == SDLK_I) state.swapchain.setPresentMode(vk::PresentModeKHR::eImmediate);
+                if (state.swapchain.dirty) idle = false;
+                break;
+            default:
+                break;
+        }
+    };
+
+    while (running) {
+        // Nothing to draw, so sleep until the next event. The time spent here isn't frame time.
+        if (idle) {
+            if (SDL_WaitEvent(&e)) handleEvent(e);
+            pacer.resume();
+            continue;
         }
 
-        // Frame rendering loop
-        while (running) {
-            // If we detect a quit event, stop the loop
-            while (SDL_PollEvent(&e)) {
-                if (e.type == SDL_EVENT_QUIT) running = false;
+        // Handle everything that came in since the last frame without blocking
+        while (SDL_PollEvent(&e))
+            handleEvent(e);
+
+        if (!running || idle) continue;
+
+        // Wait until the frame is due if there is a frame rate limit
+        pacer.beginFrame();
+
+        FrameData& frame = state.frames[state.currentFrame];
+        uint32_t framesInFlight = static_cast<uint32_t>(state.frames.size());
+
+        // Wait until the GPU is done with the last frame that used this slot, frame frameNumber - framesInFlight.
+        // With more than one frame in flight this usually returns immediately, since the slot was submitted several
+        // frames ago.
+        const uint64_t slotRetired = static_cast<uint64_t>(std::max<int64_t>(
+            state.frameNumber - static_cast<int64_t>(framesInFlight) + 1, 0));
+
+        vk::SemaphoreWaitInfo slotWait{};
+        slotWait.setSemaphores(*state.frameTimeline)
+                .setValues(slotRetired);
+        (void)state.device.waitSemaphores(slotWait, UINT64_MAX);
+
+        // Submissions on a queue complete in order, so every frame up to the one that last used this slot is done.
+        // Swapchains retired before then can be destroyed now.
+        state.swapchain.collectGarbage(state.frameNumber - framesInFlight);
+        state.display->collectGarbage(state.frameNumber - framesInFlight);
+        state.pipelines->update(state.frameNumber, state.frameNumber - framesInFlight);
+
+        // Rebuild the swapchain if the window was resized, the surface went out of date or the present mode
+        // changed. The old swapchain stays alive until the frames using it retire, so this doesn't have to idle
+        // the device.
+        if (state.swapchain.dirty) {
+            int width = 0, height = 0;
+            SDL_GetWindowSizeInPixels(window, &width, &height);
+
+            // A minimized window can't have a swapchain. Go idle until the window comes back and try again.
+            if (!state.swapchain.recreate(state.physicalDevice, state.device, state.surface,
+                                          { static_cast<uint32_t>(width), static_cast<uint32_t>(height) },
+                                          state.frameNumber)) {
+                idle = true;
+                continue;
             }
 
-            // Wait for the previous frame to finish on the GPU
-            (void)state.device.waitForFences(*state.inFlightFence, true, UINT64_MAX);
-            state.device.resetFences(*state.inFlightFence);
-
-            // Get the next image from the swapchain. result.first is the image index
-            auto [result, imageIndex] = state.swapchain.acquireNextImage(UINT64_MAX, *state.imageAvailableSemaphore);
-
-            // Record the "Clear Screen" command
-            auto& cmd = state.commandBuffers[0];
-            cmd.reset();
-            cmd.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
-
-            // Transition the image so we can clear it (Layout: Undefined -> Transfer Destination)
-            vk::ImageMemoryBarrier barrier{};
-            barrier.setOldLayout(vk::ImageLayout::eUndefined)
-                   .setNewLayout(vk::ImageLayout::eTransferDstOptimal)
-                   .setImage(state.swapchainImages[imageIndex])
-                   .setSubresourceRange({ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 });
-
-            cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, 
-                                {}, nullptr, nullptr, barrier);
-
-            // Paint the image to a color of our choosing. 
-            vk::ClearColorValue clearColor(std::array<float, 4>{ 0.39f, 0.58f, 0.93f, 1.0f }); // Cornflower blue, hehe
-            vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
-
-            cmd.clearColorImage(state.swapchainImages[imageIndex], 
-                                vk::ImageLayout::eTransferDstOptimal, 
-                                clearColor, 
-                                range);
-
-            // Transition the image so it's ready to be shown (Layout: Transfer Destination -> Present Source)
-            barrier.setOldLayout(vk::ImageLayout::eTransferDstOptimal)
-                   .setNewLayout(vk::ImageLayout::ePresentSrcKHR);
-            
-            cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, 
-                                vk::PipelineStageFlagBits::eBottomOfPipe, 
-                                {}, 
-                                nullptr, 
-                                nullptr, 
-                                barrier);
-            
-            cmd.end();
-
-            // Submit the command buffer to the GPU
-            vk::PipelineStageFlags waitStages[] = { vk::PipelineStageFlagBits::eColorAttachmentOutput };
-            vk::SubmitInfo submitInfo(*state.imageAvailableSemaphore, 
-                                      waitStages, 
-                                      *cmd, 
-                                      *state.renderFinishedSemaphore);
-            
-            state.graphicsQueue.submit(submitInfo, *state.inFlightFence);
-
-            // Present the image back to the swapchain
-            vk::PresentInfoKHR presentInfo(*state.renderFinishedSemaphore, 
-                                           *state.swapchain, 
-                                           imageIndex);
-
-            (void)state.graphicsQueue.presentKHR(presentInfo);
+            state.display->resize(state.physicalDevice, state.device, state.swapchain, state.frameNumber);
+        }
+
+        // Get the next image from the swapchain. If it is out of date, rebuild it on the next iteration.
+        uint32_t imageIndex = 0;
+        if (!state.swapchain.acquire(frame.imageAvailableSemaphore, imageIndex)) continue;
+
+        // Value both timelines reach when this frame is done
+        const uint64_t frameValue = static_cast<uint64_t>(state.frameNumber) + 1;
+
+        // The GPU is no longer using anything allocated from this frame's pool, so reset all of it in one go
+        frame.commandPool.reset();
+
+        // With async compute the kernel goes to the compute queue first. It waits for nothing, so it runs while
+        // the graphics queue is still blitting and presenting the previous frame.
+        bool async = state.display->path() == DisplayPath::Async;
+        if (async) {
+            frame.computePool.reset();
+
+            auto& computeCmd = frame.computeCommandBuffer;
+            computeCmd.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+
+            state.computeProfiler->beginFrame(*computeCmd, state.currentFrame);
+            state.computeProfiler->begin(*computeCmd, "compute");
+            state.display->recordCompute(computeCmd, *state.computeProfiler, state.currentFrame);
+            state.computeProfiler->end(*computeCmd);
+
+            computeCmd.end();
+
+            vk::TimelineSemaphoreSubmitInfo computeValues{};
+            computeValues.setSignalSemaphoreValues(frameValue);
+
+            vk::SubmitInfo computeSubmit{};
+            computeSubmit.setPNext(&computeValues)
+                         .setCommandBuffers(*computeCmd)
+                         .setSignalSemaphores(*state.computeTimeline);
+            state.computeQueue.submit(computeSubmit);
+        }
+
+        vk::Image image = state.swapchain.images[imageIndex];
+
+        // Record the image kernel
+        auto& cmd = frame.commandBuffer;
+        cmd.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+
+        // This slot's last frame was waited on above, so the timings it recorded last time can be read back now
+        state.profiler->beginFrame(*cmd, state.currentFrame);
+        state.profiler->begin(*cmd, "frame");
+
+        bool kernelFrame = state.display->ready();
+        state.display->record(cmd, *state.profiler, state.currentFrame, imageIndex, image);
+
+        state.profiler->end(*cmd);
+        cmd.end();
+
+        // The render finished semaphore belongs to the image, not the frame, since present waits on it per image
+        vk::raii::Semaphore& renderFinished = state.swapchain.renderFinishedSemaphores[imageIndex];
+
+        // Submit the command buffer to the GPU. It waits for the image, and for the kernel on the async path, at
+        // the first stage that touches the image. It signals the binary render finished semaphore for present and
+        // the frame timeline for the CPU. Values are ignored for the binary semaphores.
+        std::vector<vk::Semaphore> waitSemaphores{ *frame.imageAvailableSemaphore };
+        std::vector<uint64_t> waitValues{ 0 };
+        if (async) {
+            waitSemaphores.push_back(*state.computeTimeline);
+            waitValues.push_back(frameValue);
         }
+
+        std::array<vk::Semaphore, 2> signalSemaphores{ *renderFinished, *state.frameTimeline };
+        std::array<uint64_t, 2> signalValues{ 0, frameValue };
+
+        vk::TimelineSemaphoreSubmitInfo timelineValues{};
+        timelineValues.setWaitSemaphoreValues(waitValues)
+                      .setSignalSemaphoreValues(signalValues);
+
+        std::vector<vk::PipelineStageFlags> waitStages(waitSemaphores.size(), state.display->waitStage());
+        vk::SubmitInfo submitInfo{};
+        submitInfo.setPNext(&timelineValues)
+                  .setWaitSemaphores(waitSemaphores)
+                  .setWaitDstStageMask(waitStages)
+                  .setCommandBuffers(*cmd)
+                  .setSignalSemaphores(signalSemaphores);
+
+        state.graphicsQueue.submit(submitInfo);
+
+        // Present the image back to the swapchain. Out of date or suboptimal marks it for rebuilding.
+        state.swapchain.present(state.graphicsQueue, imageIndex);
+
+        // Until the kernel's pipeline is ready, frames are only cleared. Both firsts are startup metrics.
+        trace.milestone("first frame");
+        if (kernelFrame) trace.milestone("first kernel frame");
+
+        // Move on to the next frame slot in the ring
+        state.currentFrame = (state.currentFrame + 1) % framesInFlight;
+        ++state.frameNumber;
+
+        // In on-demand mode the image stays up until something changes, unless present already asked for a rebuild
+        // or the kernel is still compiling and this frame was only cleared. Pipelines rebuilt by --watch show up
+        // with the next frame drawn.
+        if (config.onDemand && !state.swapchain.dirty && state.display->ready()) idle = true;
     }
+
+    // Frames may still be executing on the GPU. Wait for them before the RAII destructors start freeing resources.
+    state.device.waitIdle();
+
+    if (pacer.stats().frameCount > 0) {
+        std::cout << "Frames in flight: " << state.frames.size() << " | ";
+        pacer.stats().print(std::cout);
+    }
+
+    state.profiler->collectAll();
+    state.profiler->report(std::cout);
+
+    if (state.computeProfiler) {
+        state.computeProfiler->collectAll();
+        state.computeProfiler->report(std::cout);
+    }
+
+    std::cout << "Time to first frame: " << trace.milestoneMs("first frame") << " ms, to first kernel frame: "
+              << trace.milestoneMs("first kernel frame") << " ms" << std::endl;
+}
+
+// Parses the command line. Supported options:
+//   --frames-in-flight N   Number of frames the CPU may record ahead of the GPU (1 to MAX_FRAMES_IN_FLIGHT)
+//   --present-mode MODE    fifo (vsync, default), mailbox, immediate or relaxed. Can be changed at runtime with F/M/I.
+//   --shader NAME          Image kernel to draw: gradient.comp (default), shader.comp or a path to a .spv file
+//   --blit                 Draw into an offscreen image and blit it, even if the swapchain supports storage images
+//   --no-async-compute     Run the kernel on the graphics queue even if there is a separate compute queue
+//   --fps N                Limit the frame rate to N frames per second (default 0, no limit beyond the present mode)
+//   --on-demand            Only draw when the window changes, and sleep until the next event in between
+//   --device ID            Use the device with this index, UUID (prefix) or name (substring) instead of the best
+//                          scoring one. Defaults to $VULKAN_DEVICE if set.
+//   --watch PATH           GLSL source of --shader. Whenever it changes it is recompiled in the background and the new
+//                          kernel is swapped in without waiting for frames in flight.
+//   --startup-trace PATH   Write the CPU time of each startup phase, and when the first frames were presented, to PATH
+//                          as a Chrome trace (chrome://tracing, ui.perfetto.dev)
+//   --tuning-file PATH     Workgroup sizes tuned with main's --tune (default workgroups.txt, "none" for the defaults)
+AppConfig parseArgs(int argc, char* argv[]) {
+    AppConfig config;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        if (arg == "--frames-in-flight" && i + 1 < argc) {
+            int n = std::stoi(argv[++i]);
+
+            if (n < 1 || n > static_cast<int>(MAX_FRAMES_IN_FLIGHT))
+                throw std::runtime_error("--frames-in-flight must be between 1 and " +
+                                         std::to_string(MAX_FRAMES_IN_FLIGHT));
+
+            config.framesInFlight = static_cast<uint32_t>(n);
+        } else if (arg == "--present-mode" && i + 1 < argc) {
+            config.presentMode = parsePresentMode(argv[++i]);
+        } else if (arg == "--shader" && i + 1 < argc) {
+            config.shader = argv[++i];
+        } else if (arg == "--blit") {
+            config.blit = true;
+        } else if (arg == "--no-async-compute") {
+            config.asyncCompute = false;
+        } else if (arg == "--fps" && i + 1 < argc) {
+            config.targetFps = std::stod(argv[++i]);
+            if (config.targetFps < 0.0) throw std::runtime_error("--fps can't be negative");
+        } else if (arg == "--on-demand") {
+            config.onDemand = true;
+        } else if (arg == "--device" && i + 1 < argc) {
+            config.device = argv[++i];
+        } else if (arg == "--watch" && i + 1 < argc) {
+            config.watch = argv[++i];
+        } else if (arg == "--startup-trace" && i + 1 < argc) {
+            config.startupTrace = argv[++i];
+        } else if (arg == "--tuning-file" && i + 1 < argc) {
+            config.tuningFile = argv[++i];
+            if (config.tuningFile == "none") config.tuningFile.clear();
+        } else {
+            throw std::runtime_error("Unknown argument: " + arg);
+        }
+    }
+
+    return config;
 }
 
 // The RAII Vulkan wrapper automatically handles Vulkan cleanup, so we only need to destroy SDL resources here.
 void cleanup(SDL_Window* window) {
-    // RAII handles Vulkan automatically, so we just need to clean up SDL resources. Destroy the window and quit SDL.
+    // RAII handles Vulkan automatically, so we just need to clean up SDL resources. Destroy the window, drop the
+    // Vulkan library loaded by initSDL() and quit SDL.
     SDL_DestroyWindow(window);
+    SDL_Vulkan_UnloadLibrary();
     SDL_Quit();
 }
 
-// This function dictates the flow of the program.
-void run() {
-    SDL_Window* window = initWindow();
-    VulkanState vkState = initVulkan(window);
-    mainLoop(vkState);
-    cleanup(window);
+// This function dictates the flow of the program. The instance is created and the drivers are loaded on a worker
+// thread while the window opens on this one; SDL wants its windows created on the main thread.
+void run(const AppConfig& config, StartupTrace& trace) {
+    std::vector<const char*> extensions;
+    {
+        StartupTrace::Scope phase(&trace, "SDL init");
+        extensions = initSDL();
+    }
 
+    VulkanState vkState;
+    std::future<void> instanceReady = std::async(std::launch::async, [&] {
+        initInstance(vkState, extensions, trace);
+    });
+
+    SDL_Window* window = nullptr;
+    {
+        StartupTrace::Scope phase(&trace, "window");
+        window = initWindow();
+    }
+    instanceReady.get();
+
+    initVulkan(window, vkState, config, trace);
+    mainLoop(window, vkState, config, trace);
+    if (!config.startupTrace.empty()) trace.write(config.startupTrace);
+    cleanup(window);
 }
 
-int main()
+int main(int argc, char* argv[])
 {   
+    // Startup is timed from here to the first frame (see StartupTrace)
+    StartupTrace trace;
+
     // Try to run it
     try {
-        run();
+        run(parseArgs(argc, argv), trace);
     } catch (const std::exception& e) {
         // If we can't run the application, print the error message and exit with a failure code
         std::cerr << "Error: " << e.what() << std::endl;